@@ -1,6 +1,8 @@
 #include <asm/prctl.h>
 #include <benchmark/benchmark.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/prctl.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
@@ -13,6 +15,27 @@ static void init_shadow_stack() {
   asm volatile("mov %0, %%gs:0;" : : "a"(addr) :);
 }
 
+// Maps the mirror of the current thread stack used by the parallel layout, at
+// the same offset as the runtime does.
+static void init_parallel_shadow_stack() {
+  static bool mapped = false;
+  if (mapped) return;
+
+  pthread_attr_t attr;
+  void* stack;
+  size_t size;
+  if (pthread_getattr_np(pthread_self(), &attr) != 0) abort();
+  pthread_attr_getstack(&attr, &stack, &size);
+  pthread_attr_destroy(&attr);
+
+  void* mirror = (char*)stack - 0x40000000L;
+  if (mmap(mirror, size, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1,
+           0) != mirror)
+    abort();
+  mapped = true;
+}
+
 static void BM_ShadowStackPush(benchmark::State& state) {
   init_shadow_stack();
   for (auto _ : state) {
@@ -106,3 +129,98 @@ static void BM_ShadowStackPop(benchmark::State& state) {
   }
 }
 BENCHMARK(BM_ShadowStackPop);
+
+// A push and a pop of the compact layout as emitted, including the shadow
+// stack pointer updates.
+static void BM_ShadowStackPushPop(benchmark::State& state) {
+  init_shadow_stack();
+  for (auto _ : state) {
+    asm volatile(
+        "mov 16(%%rsp), %%rcx\n\t"
+        "mov %%gs:0, %%rax\n\t"
+        "mov %%rcx, (%%rax)\n\t"
+        "lea 8(%%rax), %%rax\n\t"
+        "mov %%rax, %%gs:0\n\t"
+        "mov %%gs:0, %%rax\n\t"
+        "lea -8(%%rax), %%rax\n\t"
+        "mov %%rax, %%gs:0\n\t"
+        "mov (%%rax), %%rcx\n\t"
+        "cmp 16(%%rsp), %%rcx\n\t"
+        :
+        :
+        : "rax", "rcx", "memory", "cc");
+  }
+}
+BENCHMARK(BM_ShadowStackPushPop);
+
+static void BM_ParallelShadowStackPush(benchmark::State& state) {
+  init_parallel_shadow_stack();
+  for (auto _ : state) {
+    asm volatile(
+        "push %%rcx\n\t"
+        "mov 8(%%rsp), %%rcx\n\t"
+        "mov %%rcx, -0x40000000+8(%%rsp)\n\t"
+        "pop %%rcx\n\t"
+        :
+        :
+        : "memory");
+  }
+}
+BENCHMARK(BM_ParallelShadowStackPush);
+
+static void BM_ParallelShadowStackPushNoCtxSave(benchmark::State& state) {
+  init_parallel_shadow_stack();
+  for (auto _ : state) {
+    asm volatile(
+        "mov 16(%%rsp), %%rcx\n\t"
+        "mov %%rcx, -0x40000000+16(%%rsp)\n\t"
+        :
+        :
+        : "rcx", "memory");
+  }
+}
+BENCHMARK(BM_ParallelShadowStackPushNoCtxSave);
+
+static void BM_ParallelShadowStackPop(benchmark::State& state) {
+  init_parallel_shadow_stack();
+  for (auto _ : state) {
+    asm volatile(
+        "push %%rcx\n\t"
+        "mov 8(%%rsp), %%rcx\n\t"
+        "cmp -0x40000000+8(%%rsp), %%rcx\n\t"
+        "pop %%rcx\n\t"
+        :
+        :
+        : "memory", "cc");
+  }
+}
+BENCHMARK(BM_ParallelShadowStackPop);
+
+static void BM_ParallelShadowStackPopNoCtxSave(benchmark::State& state) {
+  init_parallel_shadow_stack();
+  for (auto _ : state) {
+    asm volatile(
+        "mov 16(%%rsp), %%rcx\n\t"
+        "cmp -0x40000000+16(%%rsp), %%rcx\n\t"
+        :
+        :
+        : "rcx", "memory", "cc");
+  }
+}
+BENCHMARK(BM_ParallelShadowStackPopNoCtxSave);
+
+// The parallel counterpart of BM_ShadowStackPushPop.
+static void BM_ParallelShadowStackPushPop(benchmark::State& state) {
+  init_parallel_shadow_stack();
+  for (auto _ : state) {
+    asm volatile(
+        "mov 16(%%rsp), %%rcx\n\t"
+        "mov %%rcx, -0x40000000+16(%%rsp)\n\t"
+        "mov 16(%%rsp), %%rcx\n\t"
+        "cmp -0x40000000+16(%%rsp), %%rcx\n\t"
+        :
+        :
+        : "rcx", "memory", "cc");
+  }
+}
+BENCHMARK(BM_ParallelShadowStackPushPop);
@@ -0,0 +1,162 @@
+#ifndef LITECFI_ANALYSIS_BUDGET_H_
+#define LITECFI_ANALYSIS_BUDGET_H_
+
+#include <atomic>
+#include <chrono>
+
+#include "gflags/gflags.h"
+
+DECLARE_int32(analysis_max_instructions);
+DECLARE_int32(analysis_max_iterations);
+DECLARE_int32(analysis_deadline_ms);
+
+// Work budget for the analyses of a single function.
+//
+// Budget aware analyses charge the instructions they visit and the dataflow
+// iterations they run to the function being analysed, and bail out once its
+// budget is exhausted. Only then does the pass manager fall back to assuming
+// the function unsafe, so large functions which are cheap to analyse still get
+// analysed.
+//
+// The deadline applies to the wall clock time spent in local analyses of the
+// function, summed up over all the passes. It is off by default, since it
+// makes the results depend on the machine and its load. A limit of 0 disables
+// the respective check.
+class AnalysisBudget {
+ public:
+  enum Limit : int { kNoLimit, kInstructions, kIterations, kDeadline };
+
+  // Times a local analysis of a function by the given pass. Charges made on
+  // the same thread while the timer is alive check the deadline against the
+  // time spent in earlier analyses of the function plus the time since the
+  // timer started, and blame the pass if they exhaust the budget.
+  class Timer {
+   public:
+    Timer(AnalysisBudget* budget, const char* pass)
+        : budget_(budget),
+          pass_(pass),
+          start_(Clock::now()),
+          prev_(Current()) {
+      Current() = this;
+    }
+
+    ~Timer() {
+      budget_->elapsed_us_ += ElapsedMicros();
+      Current() = prev_;
+    }
+
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+   private:
+    friend class AnalysisBudget;
+
+    static const Timer*& Current() {
+      static thread_local const Timer* current = nullptr;
+      return current;
+    }
+
+    long ElapsedMicros() const {
+      return std::chrono::duration_cast<std::chrono::microseconds>(
+                 Clock::now() - start_)
+          .count();
+    }
+
+    AnalysisBudget* budget_;
+    const char* pass_;
+    std::chrono::steady_clock::time_point start_;
+    const Timer* prev_;
+  };
+
+  AnalysisBudget()
+      : instructions_(0),
+        iterations_(0),
+        elapsed_us_(0),
+        exceeded_(kNoLimit),
+        exhausted_by_(nullptr) {}
+
+  // Charges n visited instructions. Returns false if the budget is exhausted,
+  // in which case the caller should stop analysing the function.
+  bool ChargeInstructions(long n) {
+    long total = instructions_ += n;
+    if (FLAGS_analysis_max_instructions > 0 &&
+        total > FLAGS_analysis_max_instructions)
+      Exceed(kInstructions);
+    return CheckDeadline();
+  }
+
+  // Charges n dataflow iterations. Returns false if the budget is exhausted.
+  bool ChargeIterations(long n) {
+    long total = iterations_ += n;
+    if (FLAGS_analysis_max_iterations > 0 &&
+        total > FLAGS_analysis_max_iterations)
+      Exceed(kIterations);
+    return CheckDeadline();
+  }
+
+  bool Exhausted() const { return exceeded_ != kNoLimit; }
+
+  // The limit which exhausted the budget first.
+  Limit exceeded() const { return static_cast<Limit>(exceeded_.load()); }
+
+  // The pass whose analysis exhausted the budget. Since earlier passes use up
+  // the budget as well, this need not be the most expensive one. Null if the
+  // budget is not exhausted or was exhausted outside of a timed analysis.
+  const char* exhausted_by() const { return exhausted_by_; }
+
+  long instructions() const { return instructions_; }
+
+  long iterations() const { return iterations_; }
+
+  double elapsed_ms() const { return elapsed_us_ / 1000.0; }
+
+  static const char* LimitName(Limit limit) {
+    switch (limit) {
+      case kInstructions:
+        return "instructions";
+      case kIterations:
+        return "iterations";
+      case kDeadline:
+        return "deadline";
+      default:
+        return "none";
+    }
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  bool CheckDeadline() {
+    if (Exhausted())
+      return false;
+    if (FLAGS_analysis_deadline_ms <= 0)
+      return true;
+
+    long us = elapsed_us_;
+    const Timer* timer = Timer::Current();
+    if (timer != nullptr && timer->budget_ == this)
+      us += timer->ElapsedMicros();
+    if (us > FLAGS_analysis_deadline_ms * 1000L) {
+      Exceed(kDeadline);
+      return false;
+    }
+    return true;
+  }
+
+  void Exceed(Limit limit) {
+    int expected = kNoLimit;
+    if (!exceeded_.compare_exchange_strong(expected, limit))
+      return;
+    const Timer* timer = Timer::Current();
+    if (timer != nullptr && timer->budget_ == this)
+      exhausted_by_ = timer->pass_;
+  }
+
+  std::atomic<long> instructions_;
+  std::atomic<long> iterations_;
+  std::atomic<long> elapsed_us_;
+  std::atomic<int> exceeded_;
+  std::atomic<const char*> exhausted_by_;
+};
+
+#endif  // LITECFI_ANALYSIS_BUDGET_H_
@@ -0,0 +1,150 @@
+#ifndef LITECFI_ARENA_H_
+#define LITECFI_ARENA_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Bump pointer arena owning analysis objects.
+//
+// Objects are carved out of large chunks and are never freed individually.
+// Release() runs the destructors of all the objects allocated so far and frees
+// the chunks in one go.
+//
+// New() may be called concurrently from multiple threads. Each thread gets its
+// own shard of chunks so allocation does not need any locking apart from when
+// a thread first touches the arena. Release() must not race with New().
+class Arena {
+ public:
+  explicit Arena(size_t chunk_size = kDefaultChunkSize)
+      : id_(NextId()), chunk_size_(chunk_size) {}
+
+  ~Arena() { Release(); }
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  template <typename T, typename... Args>
+  T* New(Args&&... args) {
+    Shard* shard = GetShard();
+    void* mem = Allocate(shard, sizeof(T), alignof(T));
+    T* obj = new (mem) T(std::forward<Args>(args)...);
+    if (!std::is_trivially_destructible<T>::value) {
+      shard->cleanups.push_back(std::make_pair(obj, &Destroy<T>));
+    }
+    return obj;
+  }
+
+  // Destroys all the objects allocated from the arena and frees its memory.
+  void Release() {
+    std::lock_guard<std::mutex> lock(mu_);
+    for (auto shard : shards_) {
+      for (auto it = shard->cleanups.rbegin(); it != shard->cleanups.rend();
+           ++it) {
+        it->second(it->first);
+      }
+      for (auto chunk : shard->chunks) {
+        free(chunk);
+      }
+      delete shard;
+    }
+    shards_.clear();
+    thread_shards_.clear();
+    bytes_allocated_ = 0;
+
+    // Invalidate the shards cached by threads.
+    id_ = NextId();
+  }
+
+  // Total size of the chunks currently held by the arena.
+  size_t BytesAllocated() const { return bytes_allocated_; }
+
+  static constexpr size_t kDefaultChunkSize = 1 << 20;
+
+ private:
+  struct Shard {
+    char* cur = nullptr;
+    char* end = nullptr;
+    std::vector<char*> chunks;
+    std::vector<std::pair<void*, void (*)(void*)>> cleanups;
+  };
+
+  // Single entry per thread cache of the shard last used by the thread.
+  struct ThreadCache {
+    uint64_t arena_id = 0;
+    Shard* shard = nullptr;
+  };
+
+  template <typename T>
+  static void Destroy(void* obj) {
+    static_cast<T*>(obj)->~T();
+  }
+
+  static uint64_t NextId() {
+    static std::atomic<uint64_t> next_id(1);
+    return next_id++;
+  }
+
+  static ThreadCache& GetThreadCache() {
+    static thread_local ThreadCache cache;
+    return cache;
+  }
+
+  Shard* GetShard() {
+    ThreadCache& cache = GetThreadCache();
+    if (cache.arena_id == id_)
+      return cache.shard;
+
+    std::lock_guard<std::mutex> lock(mu_);
+    Shard*& shard = thread_shards_[std::this_thread::get_id()];
+    if (shard == nullptr) {
+      shard = new Shard;
+      shards_.push_back(shard);
+    }
+
+    cache.arena_id = id_;
+    cache.shard = shard;
+    return shard;
+  }
+
+  void* Allocate(Shard* shard, size_t size, size_t align) {
+    uintptr_t cur = reinterpret_cast<uintptr_t>(shard->cur);
+    uintptr_t aligned = (cur + align - 1) & ~(uintptr_t)(align - 1);
+    if (shard->cur == nullptr ||
+        aligned + size > reinterpret_cast<uintptr_t>(shard->end)) {
+      // Oversized objects get a chunk of their own.
+      size_t chunk_size = std::max(chunk_size_, size + align);
+      char* chunk = static_cast<char*>(malloc(chunk_size));
+      if (chunk == nullptr)
+        throw std::bad_alloc();
+      shard->chunks.push_back(chunk);
+      shard->cur = chunk;
+      shard->end = chunk + chunk_size;
+      bytes_allocated_ += chunk_size;
+
+      cur = reinterpret_cast<uintptr_t>(shard->cur);
+      aligned = (cur + align - 1) & ~(uintptr_t)(align - 1);
+    }
+
+    shard->cur = reinterpret_cast<char*>(aligned + size);
+    return reinterpret_cast<void*>(aligned);
+  }
+
+  std::atomic<uint64_t> id_;
+  size_t chunk_size_;
+  std::atomic<size_t> bytes_allocated_{0};
+
+  std::mutex mu_;
+  std::vector<Shard*> shards_;
+  std::map<std::thread::id, Shard*> thread_shards_;
+};
+
+#endif  // LITECFI_ARENA_H_
@@ -13,19 +13,30 @@ class PrintErrorHandler : public asmjit::ErrorHandler {
   }
 };
 
-AssemblerHolder::AssemblerHolder() {
-  rt_ = new asmjit::JitRuntime();
+AssemblerHolder::AssemblerHolder(bool log) : logger_(nullptr) {
+  // The runtime only provides the target description, so one is enough.
+  static asmjit::JitRuntime rt;
 
   code_ = new asmjit::CodeHolder;
-  code_->init(rt_->codeInfo());
-  code_->setErrorHandler(new PrintErrorHandler());
+  code_->init(rt.codeInfo());
+  error_handler_ = new PrintErrorHandler();
+  code_->setErrorHandler(error_handler_);
 
-  logger_ = new asmjit::StringLogger();
-  code_->setLogger(logger_);
+  if (log) {
+    logger_ = new asmjit::StringLogger();
+    code_->setLogger(logger_);
+  }
 
   assembler_ = new asmjit::x86::Assembler(code_);
 }
 
+AssemblerHolder::~AssemblerHolder() {
+  delete assembler_;
+  delete code_;
+  delete logger_;
+  delete error_handler_;
+}
+
 asmjit::x86::Assembler* AssemblerHolder::GetAssembler() { return assembler_; }
 
 asmjit::StringLogger* AssemblerHolder::GetStringLogger() { return logger_; }
@@ -1,4 +1,3 @@
-
 #ifndef LITECFI_ASSEMBLER_H_
 #define LITECFI_ASSEMBLER_H_
 
@@ -6,17 +5,24 @@
 
 class AssemblerHolder {
  public:
-  AssemblerHolder();
+  // Attaches a logger recording the assembly if log is set.
+  explicit AssemblerHolder(bool log = false);
+
+  ~AssemblerHolder();
+
+  AssemblerHolder(const AssemblerHolder&) = delete;
+  AssemblerHolder& operator=(const AssemblerHolder&) = delete;
 
   asmjit::x86::Assembler* GetAssembler();
 
+  // Null unless logging.
   asmjit::StringLogger* GetStringLogger();
 
   asmjit::CodeHolder* GetCode();
 
  private:
-  asmjit::JitRuntime* rt_;
   asmjit::CodeHolder* code_;
+  asmjit::ErrorHandler* error_handler_;
   asmjit::x86::Assembler* assembler_;
   asmjit::StringLogger* logger_;
 };
@@ -0,0 +1,230 @@
+#ifndef LITECFI_CALL_GRAPH_H_
+#define LITECFI_CALL_GRAPH_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "CodeObject.h"
+#include "gflags/gflags.h"
+#include "scc.h"
+#include "thread_pool.h"
+
+using Dyninst::Address;
+using Dyninst::ParseAPI::Function;
+
+DECLARE_int32(analysis_threads);
+
+// Immutable call graph of a code object in compressed sparse row form.
+//
+// Functions are identified by dense ids in [0, Size()). The outgoing edges of
+// all the functions live in one array, sliced per function by an offsets array,
+// and similarly for the callers. Interprocedural passes thus walk flat arrays
+// instead of chasing pointers through per function sets.
+//
+// The graph also holds its strongly connected components. Component ids follow
+// reverse topological order, so the components called by a component always
+// have smaller ids. The level of a component is one more than the highest
+// level among the components it calls. Leaf components are at level 0.
+class CallGraph {
+ public:
+  enum EdgeKind : uint8_t {
+    // Direct call to a function within the object.
+    kCall,
+    // Jump to the entry of another function within the object.
+    kTailCall,
+    // Call through the PLT. The callee is outside of the object.
+    kPltCall,
+    // Indirect call or jump out of the function. The callee is unknown.
+    kIndirect,
+  };
+
+  struct Edge {
+    // Address of the call (or jump) instruction.
+    Address site;
+    // Callee id. -1 for PLT and indirect edges.
+    int callee;
+    EdgeKind kind;
+  };
+
+  template <typename T>
+  class Range {
+   public:
+    Range(const T* begin, const T* end) : begin_(begin), end_(end) {}
+
+    const T* begin() const { return begin_; }
+    const T* end() const { return end_; }
+    size_t size() const { return end_ - begin_; }
+    bool empty() const { return begin_ == end_; }
+
+   private:
+    const T* begin_;
+    const T* end_;
+  };
+
+  // Builds the graph. edges[i] holds the outgoing edges of funcs[i], with
+  // callee ids indexing into funcs.
+  void Build(const std::vector<Function*>& funcs,
+             const std::vector<std::vector<Edge>>& edges) {
+    funcs_ = funcs;
+    ids_.clear();
+    for (size_t i = 0; i < funcs_.size(); i++) {
+      ids_[funcs_[i]] = i;
+    }
+
+    int n = funcs_.size();
+    edge_offsets_.assign(1, 0);
+    edges_.clear();
+    std::vector<std::vector<int>> callers(n);
+    for (int i = 0; i < n; i++) {
+      for (auto& e : edges[i]) {
+        edges_.push_back(e);
+        if (e.callee >= 0)
+          callers[e.callee].push_back(i);
+      }
+      edge_offsets_.push_back(edges_.size());
+    }
+
+    caller_offsets_.assign(1, 0);
+    callers_.clear();
+    for (auto& c : callers) {
+      std::sort(c.begin(), c.end());
+      c.erase(std::unique(c.begin(), c.end()), c.end());
+      callers_.insert(callers_.end(), c.begin(), c.end());
+      caller_offsets_.push_back(callers_.size());
+    }
+
+    ComputeComponents();
+  }
+
+  int Size() const { return funcs_.size(); }
+
+  Function* GetFunction(int id) const { return funcs_[id]; }
+
+  // Returns the id of the function or -1 if it is not part of the graph.
+  int GetId(Function* f) const {
+    auto it = ids_.find(f);
+    if (it == ids_.end())
+      return -1;
+    return it->second;
+  }
+
+  // All outgoing edges of the function in the order they were added.
+  Range<Edge> Edges(int id) const {
+    return Range<Edge>(edges_.data() + edge_offsets_[id],
+                       edges_.data() + edge_offsets_[id + 1]);
+  }
+
+  // Ids of the functions calling (or tail calling) the function, sorted.
+  Range<int> Callers(int id) const {
+    return Range<int>(callers_.data() + caller_offsets_[id],
+                      callers_.data() + caller_offsets_[id + 1]);
+  }
+
+  int SCCId(int id) const { return scc_ids_[id]; }
+
+  int SCCLevel(int id) const { return scc_levels_[scc_ids_[id]]; }
+
+  // Returns the components grouped by level, i.e. each group only holds
+  // components whose callees live in earlier groups. Components within a group
+  // are ordered by component id and their members by function id.
+  std::vector<std::vector<std::vector<int>>> Waves() const {
+    std::vector<std::vector<std::vector<int>>> waves;
+    std::vector<int> slot(scc_levels_.size());
+    for (size_t c = 0; c < scc_levels_.size(); c++) {
+      int level = scc_levels_[c];
+      if (level >= static_cast<int>(waves.size()))
+        waves.resize(level + 1);
+      slot[c] = waves[level].size();
+      waves[level].emplace_back();
+    }
+
+    for (int i = 0; i < Size(); i++) {
+      int c = scc_ids_[i];
+      waves[scc_levels_[c]][slot[c]].push_back(i);
+    }
+    return waves;
+  }
+
+ private:
+  void ComputeComponents() {
+    std::vector<int> nodes(Size());
+    for (int i = 0; i < Size(); i++) {
+      nodes[i] = i;
+    }
+
+    auto callees = [this](int id) {
+      std::vector<int> succs;
+      for (auto& e : Edges(id)) {
+        if (e.callee >= 0)
+          succs.push_back(e.callee);
+      }
+      return succs;
+    };
+
+    scc_ids_.assign(Size(), 0);
+    scc_levels_.clear();
+    for (auto& scc : ComputeSCCs(nodes, callees)) {
+      int c = scc_levels_.size();
+      for (auto id : scc) {
+        scc_ids_[id] = c;
+      }
+
+      int level = 0;
+      for (auto id : scc) {
+        for (auto& e : Edges(id)) {
+          if (e.callee >= 0 && scc_ids_[e.callee] != c)
+            level = std::max(level, scc_levels_[scc_ids_[e.callee]] + 1);
+        }
+      }
+      scc_levels_.push_back(level);
+    }
+  }
+
+  std::vector<Function*> funcs_;
+  std::unordered_map<Function*, int> ids_;
+
+  std::vector<int> edge_offsets_;
+  std::vector<Edge> edges_;
+  std::vector<int> caller_offsets_;
+  std::vector<int> callers_;
+
+  // Component id of each function and level of each component.
+  std::vector<int> scc_ids_;
+  std::vector<int> scc_levels_;
+};
+
+// Runs solve(scc) on every call graph component, where scc holds the ids of
+// the component's members. Callees are solved before their callers.
+//
+// Components of a wave are solved concurrently with --analysis_threads > 1.
+// solve may hence only update the summaries of the given component, reading
+// the (final) summaries of the callees outside of it.
+template <typename Solve>
+void SolveBottomUp(const CallGraph& cg, Solve solve) {
+  std::vector<std::vector<std::vector<int>>> waves = cg.Waves();
+
+  if (FLAGS_analysis_threads <= 1) {
+    for (auto& wave : waves) {
+      for (auto& scc : wave) {
+        solve(scc);
+      }
+    }
+    return;
+  }
+
+  WorkStealingPool pool(FLAGS_analysis_threads);
+  for (auto& wave : waves) {
+    // Deep call chains produce long runs of single component waves which are
+    // not worth handing off to the workers.
+    if (wave.size() == 1) {
+      solve(wave[0]);
+      continue;
+    }
+    pool.ParallelFor(wave.size(),
+                     [&](int worker, size_t i) { solve(wave[i]); });
+  }
+}
+
+#endif  // LITECFI_CALL_GRAPH_H_
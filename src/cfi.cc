@@ -16,6 +16,11 @@ DEFINE_bool(validate_frame, false,
             "Validate stack frame in addition to the "
             "return address");
 
+DEFINE_bool(compact_entries, false,
+            "\n Store 32 bit shadow stack entries holding the low 32 bits of "
+            "the return and frame addresses instead of full addresses. Ignored "
+            "with the parallel shadow stack layout.\n");
+
 DEFINE_bool(disable_lowering, false, "Disable instrumentation lowering");
 DEFINE_bool(disable_reg_frame, false, "Disable register frame");
 DEFINE_bool(disable_reg_save_opt, false, "Disable register save optimization");
@@ -24,6 +29,45 @@ DEFINE_bool(disable_sfe, false, "Disable safe function elision");
 
 DEFINE_bool(libs, false, "Protect shared libraries as well.");
 
+DEFINE_int32(analysis_threads, 1,
+             "\n Number of threads used for running per function local "
+             "analyses. A value of 1 runs the analyses serially.\n");
+
+DEFINE_bool(parallel_passes, false,
+            "\n Run analysis passes which do not depend on each other's "
+            "results concurrently. Passes run one at a time in pipeline order "
+            "otherwise.\n");
+
+DEFINE_int32(slowest_functions, 10,
+             "\n Number of costliest functions to report per analysis pass in "
+             "the JSON analysis profile written next to the stats file.\n");
+
+DEFINE_int32(analysis_max_instructions, 5000000,
+             "\n Maximum number of instructions the analyses may visit per "
+             "function before giving up and assuming the function unsafe. A "
+             "value of 0 disables the limit.\n");
+
+DEFINE_int32(analysis_max_iterations, 1000000,
+             "\n Maximum number of dataflow iterations the analyses may run "
+             "per function before giving up and assuming the function unsafe. "
+             "A value of 0 disables the limit.\n");
+
+DEFINE_int32(analysis_deadline_ms, 0,
+             "\n Maximum wall clock time in milliseconds the analyses may "
+             "spend per function before giving up and assuming the function "
+             "unsafe. Whether a function makes it in time depends on the "
+             "machine and its load, so setting this makes the analysis results "
+             "and the instrumentation non-deterministic. A value of 0, the "
+             "default, disables the limit, leaving the instruction and "
+             "iteration limits.\n");
+
+DEFINE_int32(symbolic_deadline_ms, 0,
+             "\n Maximum wall clock time in milliseconds spent per function "
+             "on resolving unknown memory writes symbolically. Writes not "
+             "resolved by then stay unknown. Like --analysis_deadline_ms this "
+             "makes the analysis results non-deterministic. A value of 0, the "
+             "default, disables the limit.\n");
+
 DEFINE_string(
     shadow_stack, "light",
     "\n Shadow stack implementation mechanism for backward-edge protection.\n"
@@ -32,11 +76,28 @@ DEFINE_string(
     "             deemed safe\n"
     "   * full :  Add run-time checks at every function\n");
 
+DEFINE_string(
+    shadow_stack_layout, "compact",
+    "\n Memory layout of the shadow stack.\n"
+    "\n Valid values are\n"
+    "   * compact :  Return addresses are pushed to a per thread stack "
+    "addressed through %gs:0x0\n"
+    "   * parallel : Each return address is mirrored at a fixed offset from "
+    "its stack slot, in a region the runtime maps next to every thread "
+    "stack. Implies frame validation and disables register frames. "
+    "Rewritten objects must be loaded at start up, and stacks allocated by "
+    "the program itself, e.g. for makecontext, must be registered with "
+    "__shadow_guard_map_parallel_stack from the runtime. Since the region "
+    "lies 1 GiB below its stack, the stacks of all threads must fit into "
+    "1 GiB, e.g. less than 128 threads with 8 MiB stacks. The runtime aborts "
+    "once a region would collide with another mapping\n");
+
 DEFINE_string(output, "", "\n Output binary.\n");
 
 DEFINE_string(stats, "",
               "\n File to log statistics related static analyses. Only used "
-              "with 'light' shadow stack option\n");
+              "with 'light' shadow stack option. A per pass analysis profile "
+              "is additionally written to <stats>.json\n");
 
 DEFINE_string(
     threat_model, "trust_system",
@@ -47,6 +108,23 @@ DEFINE_string(
     " So, only instrument system code for context switch, no CFI checks\n"
     "   * trust_none : Instrument all code for CFI checks\n");
 
+DEFINE_string(
+    summary_cache, "",
+    "\n Directory holding the persistent function summary cache. Summaries of "
+    "functions whose code and callees are unchanged since the last run are "
+    "restored from the cache instead of being re-analysed.\n");
+
+DEFINE_string(
+    library_summaries, "",
+    "\n Comma separated list of library summary files, as written by "
+    "--export_summaries. Calls into shared libraries are resolved against "
+    "these summaries instead of being assumed unsafe.\n");
+
+DEFINE_string(
+    export_summaries, "",
+    "\n Analyse the given shared library and write the summaries of its "
+    "functions to this file instead of instrumenting it.\n");
+
 DEFINE_string(
     skip_list, "", "\nA list of function entry addresses to skip instrumentation.\n");
 
@@ -70,6 +148,13 @@ static bool ValidateShadowStackFlag(const char* flagname,
 
 DEFINE_validator(shadow_stack, &ValidateShadowStackFlag);
 
+static bool ValidateShadowStackLayoutFlag(const char* flagname,
+                                          const std::string& value) {
+  return value == "compact" || value == "parallel";
+}
+
+DEFINE_validator(shadow_stack_layout, &ValidateShadowStackLayoutFlag);
+
 int main(int argc, char* argv[]) {
   std::string usage("Usage : ./cfi <flags> binary");
   gflags::SetUsageMessage(usage);
@@ -81,6 +166,11 @@ int main(int argc, char* argv[]) {
   litecfi::Parser* parser =
       InitParser(binary, /* libs */ true, /* sanitize */ false);
 
+  if (!FLAGS_export_summaries.empty()) {
+    ExportLibrarySummaries(binary, const_cast<litecfi::Parser&>(*parser));
+    return 0;
+  }
+
   Instrument(binary, const_cast<litecfi::Parser&>(*parser));
 
   return 0;
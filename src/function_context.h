@@ -0,0 +1,90 @@
+#ifndef LITECFI_FUNCTION_CONTEXT_H_
+#define LITECFI_FUNCTION_CONTEXT_H_
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "CFG.h"
+#include "Instruction.h"
+#include "analysis_budget.h"
+#include "stackanalysis.h"
+
+using Dyninst::Address;
+using Dyninst::Offset;
+using Dyninst::StackAnalysis;
+using Dyninst::InstructionAPI::Instruction;
+using Dyninst::ParseAPI::Block;
+using Dyninst::ParseAPI::Function;
+
+// Decoded instructions of a basic block in address order.
+using InsnVec = std::vector<std::pair<Offset, Instruction>>;
+
+// Per function analysis state shared across passes.
+//
+// Decoding instructions and running the stack analysis dataflow are among the
+// most expensive steps of the local analyses. The context computes each of
+// these lazily on first use and hands out the cached result to later passes.
+//
+// Passes running concurrently may query the context of the same function, so
+// all accesses are serialized on a per context lock.
+class FunctionContext {
+ public:
+  explicit FunctionContext(Function* f) : func_(f) {}
+
+  FunctionContext(const FunctionContext&) = delete;
+  FunctionContext& operator=(const FunctionContext&) = delete;
+
+  // Returns the decoded instructions of the block.
+  const InsnVec& Instructions(Block* b) {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = insns_.find(b);
+    if (it != insns_.end())
+      return it->second;
+
+    Block::Insns decoded;
+    b->getInsns(decoded);
+
+    InsnVec& insns = insns_[b];
+    insns.reserve(decoded.size());
+    for (auto& ins : decoded) {
+      insns.push_back(ins);
+    }
+    return insns;
+  }
+
+  // Returns the stack pointer height before the instruction at addr within the
+  // block. Also valid for b->end() to get the height at the block exit.
+  StackAnalysis::Height SPHeight(Block* b, Address addr) {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto& heights = heights_[b];
+    auto it = heights.find(addr);
+    if (it != heights.end())
+      return it->second;
+
+    StackAnalysis::Height h = GetStackAnalysis()->findSP(b, addr);
+    heights.emplace(addr, h);
+    return h;
+  }
+
+  // Work budget shared by the analyses of the function.
+  AnalysisBudget* budget() { return &budget_; }
+
+ private:
+  StackAnalysis* GetStackAnalysis() {
+    if (sa_ == nullptr)
+      sa_.reset(new StackAnalysis(func_));
+    return sa_.get();
+  }
+
+  Function* func_;
+  std::mutex mu_;
+  std::unique_ptr<StackAnalysis> sa_;
+  std::map<Block*, InsnVec> insns_;
+  std::map<Block*, std::map<Address, StackAnalysis::Height>> heights_;
+  AnalysisBudget budget_;
+};
+
+#endif  // LITECFI_FUNCTION_CONTEXT_H_
@@ -1,9 +1,14 @@
 #ifndef LITECFI_HEAP_H_
 #define LITECFI_HEAP_H_
 
-#include <map>
+#include <algorithm>
+#include <climits>
+#include <memory>
 #include <set>
-#include <stack>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "CFG.h"
 #include "Instruction.h"
@@ -11,6 +16,7 @@
 #include "dyn_regs.h"
 #include "glog/logging.h"
 #include "pass_manager.h"
+#include "register_utils.h"
 
 namespace heap {
 
@@ -26,32 +32,35 @@ using Dyninst::InstructionAPI::Visitor;
 using Dyninst::ParseAPI::Block;
 using Dyninst::ParseAPI::Function;
 
-enum class Location { HEAP, STACK, ARG, HEAP_OR_ARG, TOP, BOTTOM };
+enum class Location : uint8_t {
+  HEAP,
+  STACK,
+  ARG,
+  HEAP_OR_ARG,
+  GLOBAL,
+  TOP,
+  BOTTOM
+};
 
-char buf[128];
+// Registers holding the (pointer) arguments at function entry.
+const Gpr kArgRegisters[] = {kRdi, kRsi, kRdx, kRcx, kR8, kR9};
 
+// Abstract value held by a register or a stack slot.
+//
+// BOTTOM denotes that nothing is known yet and TOP that the value may point
+// anywhere. This is a plain value type so that contexts can be copied, met and
+// compared without chasing pointers.
 struct AbstractLocation {
-  AbstractLocation()
-      : type(Location::BOTTOM), stack_height(INT_MAX), points_to(nullptr) {}
-
-  AbstractLocation(const AbstractLocation& l)
-      : type(l.type), stack_height(l.stack_height) {
-    if (l.points_to == nullptr) {
-      points_to = nullptr;
-    } else {
-      points_to = new AbstractLocation;
-      *points_to = *l.points_to;
-    }
-  }
-
-  ~AbstractLocation() {
-    if (points_to != nullptr) delete points_to;
-    points_to = nullptr;
-  }
-
   Location type;
+  // Stack height of STACK locations relative to the canonical frame address,
+  // i.e. the return address is at -8. INT_MAX otherwise.
   int stack_height;
-  AbstractLocation* points_to;
+  // Argument registers at function entry an ARG or HEAP_OR_ARG location may
+  // have been derived from.
+  RegisterSet args;
+  // Constant offset of an ARG or HEAP_OR_ARG location from the argument
+  // registers. 0 otherwise.
+  int offset;
 
   std::string format() const {
     std::string ret = "AbsLoc: ";
@@ -60,16 +69,16 @@ struct AbstractLocation {
         ret += "HEAP";
         break;
       case Location::STACK:
-        ret += "STACK(";
-        snprintf(buf, 128, "%d", stack_height);
-        ret += buf;
-        ret += ")";
+        ret += "STACK(" + std::to_string(stack_height) + ")";
         break;
       case Location::ARG:
-        ret += "ARG";
+        ret += "ARG(" + std::to_string(offset) + ")";
         break;
       case Location::HEAP_OR_ARG:
-        ret += "HEAP_OR_ARG";
+        ret += "HEAP_OR_ARG(" + std::to_string(offset) + ")";
+        break;
+      case Location::GLOBAL:
+        ret += "GLOBAL";
         break;
       case Location::TOP:
         ret += "TOP";
@@ -80,363 +89,383 @@ struct AbstractLocation {
       default:
         ret += "ERROR TYPE";
     }
-    if (points_to != nullptr) {
-      ret += ", point to [";
-      ret += points_to->format();
-      ret += "]";
-    }
     return ret;
   }
 
-  AbstractLocation pointToLocation() const {
-    if (points_to == nullptr)
-      return GetTop();
-    else
-      return *points_to;
-  }
-
-  void setPointToLocation(const AbstractLocation& l) {
-    if (points_to != nullptr) delete points_to;
-    if (l == GetTop()) {
-      points_to = nullptr;
-    } else {
-      points_to = new AbstractLocation;
-      *points_to = l;
-    }
-  }
-
   bool operator==(const AbstractLocation& l) const {
-    if (type != l.type)
-      return false;
-
-    if (type == Location::STACK) {
-      if (stack_height != l.stack_height)
-        return false;
-
-      if ((points_to == nullptr && l.points_to != nullptr) ||
-          (points_to != nullptr && l.points_to == nullptr))
-        return false;
-
-      if (points_to != nullptr && l.points_to != nullptr)
-        return *points_to == *(l.points_to);
-    }
-
-    return true;
+    return type == l.type && stack_height == l.stack_height &&
+           args == l.args && offset == l.offset;
   }
 
   bool operator!=(const AbstractLocation& l) const { return !(*this == l); }
 
-  AbstractLocation& operator=(const AbstractLocation& l) {
-    type = l.type;
-    stack_height = l.stack_height;
-    if (l.points_to == nullptr) {
-      points_to = nullptr;
-    } else {
-      points_to = new AbstractLocation;
-      assert(l.points_to->points_to == nullptr);
-      points_to->type = l.points_to->type;
-      points_to->stack_height = l.points_to->stack_height;
-      points_to->points_to = nullptr;
-    }
-    return *this;
-  }
-
   void Meet(const AbstractLocation& other) {
-    if (type == Location::TOP || other.type == Location::TOP) {
-      Reset();
-      type = Location::TOP;
+    if (*this == other || other.type == Location::BOTTOM)
       return;
-    }
 
     if (type == Location::BOTTOM) {
       *this = other;
       return;
     }
 
-    if (other.type == Location::BOTTOM)
+    // Pointers to the same argument at differing offsets, as when walking an
+    // argument buffer in a loop, may end up anywhere within it.
+    bool has_args = !args.Empty() && !other.args.Empty();
+    if (has_args && offset != other.offset) {
+      *this = GetTop();
       return;
+    }
 
-    if (other.type == type) {
-      if (type == Location::STACK) {
-        if (stack_height != other.stack_height) {
-          Reset();
-          type = Location::TOP;
-          return;
-        }
-
-        if (points_to != nullptr) {
-          points_to->Meet(other.pointToLocation());
-        }
-      }
+    if (type == Location::ARG && other.type == Location::ARG) {
+      args = args | other.args;
       return;
     }
 
-    if ((type == Location::ARG && other.type == Location::HEAP) ||
-        (type == Location::HEAP && other.type == Location::ARG) ||
-        (type == Location::HEAP_OR_ARG && other.type == Location::HEAP) ||
-        (type == Location::HEAP_OR_ARG && other.type == Location::ARG) ||
-        (type == Location::HEAP && other.type == Location::HEAP_OR_ARG) ||
-        (type == Location::ARG && other.type == Location::HEAP_OR_ARG)) {
-      Reset();
-      type = Location::HEAP_OR_ARG;
+    if (IsHeapOrArg(type) && IsHeapOrArg(other.type)) {
+      int met_offset = args.Empty() ? other.offset : offset;
+      *this = GetHeapOrArgLocation(args | other.args, met_offset);
       return;
     }
-    DCHECK(false);
-  }
 
-  void Reset() {
-    type = Location::BOTTOM;
-    stack_height = INT_MAX;
-    if (points_to != nullptr) delete points_to;
-    points_to = nullptr;
+    // Differing stack heights or otherwise incompatible locations.
+    *this = GetTop();
   }
 
   static AbstractLocation GetStackLocation(int height) {
-    AbstractLocation loc;
-    loc.type = Location::STACK;
-    loc.stack_height = height;
-    return loc;
+    return {Location::STACK, height, RegisterSet(), 0};
   }
 
-  static AbstractLocation GetArgLocation() {
-    AbstractLocation loc;
-    loc.type = Location::ARG;
-    return loc;
+  static AbstractLocation GetArgLocation(Gpr reg) {
+    return {Location::ARG, INT_MAX, RegisterSet({reg}), 0};
   }
 
   static AbstractLocation GetHeapLocation() {
-    AbstractLocation loc;
-    loc.type = Location::HEAP;
-    return loc;
+    return {Location::HEAP, INT_MAX, RegisterSet(), 0};
   }
 
-  static AbstractLocation GetHeapOrArgLocation() {
-    AbstractLocation loc;
-    loc.type = Location::HEAP_OR_ARG;
-    return loc;
+  static AbstractLocation GetHeapOrArgLocation(RegisterSet args,
+                                               int offset) {
+    return {Location::HEAP_OR_ARG, INT_MAX, args, offset};
+  }
+
+  static AbstractLocation GetGlobalLocation() {
+    return {Location::GLOBAL, INT_MAX, RegisterSet(), 0};
   }
 
   static AbstractLocation GetTop() {
-    AbstractLocation loc;
-    loc.type = Location::TOP;
-    return loc;
+    return {Location::TOP, INT_MAX, RegisterSet(), 0};
   }
 
   static AbstractLocation GetBottom() {
-    AbstractLocation loc;
-    loc.type = Location::BOTTOM;
-    return loc;
+    return {Location::BOTTOM, INT_MAX, RegisterSet(), 0};
+  }
+
+ private:
+  static bool IsHeapOrArg(Location l) {
+    return l == Location::HEAP || l == Location::ARG ||
+           l == Location::HEAP_OR_ARG;
   }
 };
 
+// Contents of the stack slots written within the function sorted by stack
+// height. Slots missing from the map hold TOP.
+using StackSlots = std::vector<std::pair<int, AbstractLocation>>;
+
+// Data flow fact at a basic block boundary.
+//
+// Registers live in a fixed size array indexed by register number. The stack
+// slots are shared between contexts and only copied once a context writes to
+// them. Most blocks never touch the stack slots, so propagating a fact across
+// such a block or meeting facts derived from the same one is cheap.
 struct HeapContext {
-  Address addr;
-  Block* block;
-  Instruction ins;
-
-  std::map<MachRegister, AbstractLocation> regs;
-  std::map<int, AbstractLocation> stack;
-
-  HeapContext* successor;
-
-  HeapContext() : successor(nullptr) {
-    regs[Dyninst::x86_64::rax] = AbstractLocation::GetBottom();
-    regs[Dyninst::x86_64::rbx] = AbstractLocation::GetBottom();
-    regs[Dyninst::x86_64::rcx] = AbstractLocation::GetBottom();
-    regs[Dyninst::x86_64::rdx] = AbstractLocation::GetBottom();
-    regs[Dyninst::x86_64::rsp] = AbstractLocation::GetBottom();
-    regs[Dyninst::x86_64::rbp] = AbstractLocation::GetBottom();
-    regs[Dyninst::x86_64::rsi] = AbstractLocation::GetBottom();
-    regs[Dyninst::x86_64::rdi] = AbstractLocation::GetBottom();
-    regs[Dyninst::x86_64::r8] = AbstractLocation::GetBottom();
-    regs[Dyninst::x86_64::r9] = AbstractLocation::GetBottom();
-    regs[Dyninst::x86_64::r10] = AbstractLocation::GetBottom();
-    regs[Dyninst::x86_64::r11] = AbstractLocation::GetBottom();
-    regs[Dyninst::x86_64::r12] = AbstractLocation::GetBottom();
-    regs[Dyninst::x86_64::r13] = AbstractLocation::GetBottom();
-    regs[Dyninst::x86_64::r14] = AbstractLocation::GetBottom();
-    regs[Dyninst::x86_64::r15] = AbstractLocation::GetBottom();
-  }
-
-  // This copy constructor is used to compare whether
-  // data flow fact has changed. The successor field is
-  // not part of the data flow fact.
-  HeapContext(const HeapContext& c) {
-    regs = c.regs;
-    stack = c.stack;
-    successor = nullptr;
-  }
-
-  ~HeapContext() {
-    regs.clear();
-    stack.clear();
-  }
-
-  void Meet(HeapContext* other) {
-    if (this == other) return;
-    PointWiseMeet<MachRegister>(regs, other->regs);
-    PointWiseMeet<int>(stack, other->stack);
-  }
-
-  template <class T>
-  void PointWiseMeet(std::map<T, AbstractLocation>& m1,
-                     std::map<T, AbstractLocation>& m2) {
-    for (auto& it1 : m1) {
-      auto it2 = m2.find(it1.first);
-      if (it2 != m2.end()) {
-        it1.second.Meet(it2->second);
-      }
+  HeapContext() : reached(false) {
+    for (int r = 0; r < kNumGprs; r++) {
+      regs[r] = AbstractLocation::GetBottom();
     }
+  }
 
-    for (auto& it2 : m2) {
-      auto it1 = m1.find(it2.first);
-      if (it1 == m1.end()) {
-        m1.insert(std::make_pair(it2.first, it2.second));
+  AbstractLocation regs[kNumGprs];
+  // Null if no stack slot has been written to.
+  std::shared_ptr<StackSlots> stack;
+  // Denotes whether any path from the function entry has reached this fact.
+  bool reached;
+
+  AbstractLocation StackSlot(int height) const {
+    if (stack == nullptr)
+      return AbstractLocation::GetTop();
+    auto it = Find(*stack, height);
+    if (it == stack->end() || it->first != height)
+      return AbstractLocation::GetTop();
+    return it->second;
+  }
+
+  void SetStackSlot(int height, const AbstractLocation& l) {
+    if (l.type == Location::TOP && StackSlot(height).type == Location::TOP)
+      return;
+
+    if (stack == nullptr) {
+      stack = std::make_shared<StackSlots>();
+    } else if (stack.use_count() > 1) {
+      stack = std::make_shared<StackSlots>(*stack);
+    }
+
+    auto it = Find(*stack, height);
+    bool found = it != stack->end() && it->first == height;
+    if (l.type == Location::TOP) {
+      stack->erase(it);
+    } else if (found) {
+      it->second = l;
+    } else {
+      stack->insert(it, std::make_pair(height, l));
+    }
+  }
+
+  void Meet(const HeapContext& other) {
+    if (this == &other || !other.reached)
+      return;
+
+    if (!reached) {
+      *this = other;
+      return;
+    }
+
+    for (int r = 0; r < kNumGprs; r++) {
+      regs[r].Meet(other.regs[r]);
+    }
+
+    if (stack == other.stack)
+      return;
+
+    // A slot only written to along one of the paths holds TOP.
+    if (stack == nullptr || other.stack == nullptr) {
+      stack.reset();
+      return;
+    }
+
+    StackSlots met;
+    auto it1 = stack->begin();
+    auto it2 = other.stack->begin();
+    while (it1 != stack->end() && it2 != other.stack->end()) {
+      if (it1->first < it2->first) {
+        ++it1;
+      } else if (it2->first < it1->first) {
+        ++it2;
+      } else {
+        AbstractLocation l = it1->second;
+        l.Meet(it2->second);
+        if (l.type != Location::TOP)
+          met.push_back(std::make_pair(it1->first, l));
+        ++it1;
+        ++it2;
       }
     }
+
+    if (met != *stack)
+      stack = std::make_shared<StackSlots>(std::move(met));
   }
 
   bool operator==(const HeapContext& c) const {
-    return (regs == c.regs) && (stack == c.stack);
+    if (reached != c.reached)
+      return false;
+    for (int r = 0; r < kNumGprs; r++) {
+      if (regs[r] != c.regs[r])
+        return false;
+    }
+    if (stack == c.stack)
+      return true;
+    size_t size = stack == nullptr ? 0 : stack->size();
+    size_t c_size = c.stack == nullptr ? 0 : c.stack->size();
+    if (size == 0 || c_size == 0)
+      return size == c_size;
+    return *stack == *c.stack;
+  }
+
+  bool operator!=(const HeapContext& c) const { return !(*this == c); }
+
+ private:
+  static StackSlots::iterator Find(StackSlots& slots, int height) {
+    return std::lower_bound(
+        slots.begin(), slots.end(), height,
+        [](const std::pair<int, AbstractLocation>& slot, int h) {
+          return slot.first < h;
+        });
   }
 
-  bool operator!=(const HeapContext& c) const {
-    return !(*this == c);
+  static StackSlots::const_iterator Find(const StackSlots& slots, int height) {
+    return std::lower_bound(
+        slots.begin(), slots.end(), height,
+        [](const std::pair<int, AbstractLocation>& slot, int h) {
+          return slot.first < h;
+        });
   }
 };
 
+// Classifies the unknown memory writes of a function as heap, global, argument
+// or heap or argument writes by tracking where the registers and the stack
+// slots may point to. Also records where the pointer arguments passed at each
+// direct call site may point to.
+//
+// Facts are only kept at basic block boundaries. Blocks are processed in
+// reverse post order with a worklist until the facts at block entries
+// stabilize, and the facts at each unknown write and call site are recomputed
+// from the fact at its block entry afterwards.
+//
+// Each block visit is charged to the function's analysis budget. If the budget
+// runs out before the facts stabilize the summary is left untouched, and the
+// pass manager falls back to assuming the function unsafe.
 class HeapAnalysis {
  public:
   HeapAnalysis(FuncSummary* s) : s_(s) {
-    InitFlowInfo();
-    Analyse();
-    UpdateFunctionSummary();
-    Cleanup();
+    InitBlocks();
+    if (Analyse())
+      UpdateFunctionSummary();
   }
 
  private:
-  using FlowInfo = std::map<Address, std::map<Address, HeapContext*>>;
-  using WorkList = std::deque<std::pair<HeapContext*, std::set<HeapContext*>>>;
-
-  void InitFlowInfo() {
+  // Orders the blocks reachable from the function entry in reverse post order
+  // and records their intra-procedural predecessors.
+  void InitBlocks() {
     Function* f = s_->func;
-    auto blocks = f->blocks();
-
-    for (auto b : blocks) {
-      std::map<Offset, Instruction> insns;
-      b->getInsns(insns);
-
-      Address start = b->start();
-      auto& ctxs = info_[start];
-      HeapContext* prev = nullptr;
-      for (auto const& ins : insns) {
-        Address addr = ins.first;
-        auto it = ctxs.find(addr);
-        HeapContext* ctx;
-        if (it == ctxs.end()) {
-          ctx = new HeapContext;
-          ctx->addr = addr;
-          ctx->block = b;
-          ctx->ins = ins.second;
-        } else {
-          ctx = it->second;
-          ctx->ins = ins.second;
-        }
-
-        ctxs[ctx->addr] = ctx;
-
-        if (prev != nullptr) {
-          prev->successor = ctx;
-        }
-        prev = ctx;
+    for (auto b : f->blocks()) {
+      index_[b] = -1;
+    }
+
+    // Iterative depth first search, the blocks of large functions may nest
+    // deeper than the call stack allows.
+    std::vector<Block*> post_order;
+    std::vector<std::pair<Block*, std::vector<Block*>>> stack;
+    std::set<Block*> visited;
+    visited.insert(f->entry());
+    stack.push_back(std::make_pair(f->entry(), Successors(f->entry())));
+    while (!stack.empty()) {
+      auto& top = stack.back();
+      if (top.second.empty()) {
+        post_order.push_back(top.first);
+        stack.pop_back();
+        continue;
       }
+
+      Block* next = top.second.back();
+      top.second.pop_back();
+      if (visited.insert(next).second)
+        stack.push_back(std::make_pair(next, Successors(next)));
     }
-  }
 
-  void Analyse() {
-    std::stack<SCComponent*> rpo;
-    std::set<SCComponent*> visited;
-    PostOrderTraverse(s_->cfg, rpo, visited);
+    blocks_.assign(post_order.rbegin(), post_order.rend());
+    for (size_t i = 0; i < blocks_.size(); i++) {
+      index_[blocks_[i]] = i;
+    }
 
-    while (!rpo.empty()) {
-      AnalyseBlocks(rpo.top()->blocks, s_->func->entry());
-      rpo.pop();
+    succs_.resize(blocks_.size());
+    preds_.resize(blocks_.size());
+    for (size_t i = 0; i < blocks_.size(); i++) {
+      for (auto succ : Successors(blocks_[i])) {
+        succs_[i].push_back(index_[succ]);
+        preds_[index_[succ]].push_back(i);
+      }
     }
   }
 
-  void PostOrderTraverse(SCComponent* sc, std::stack<SCComponent*>& rpo, std::set<SCComponent*> &visited) {
-    if (visited.find(sc) != visited.end()) return;
-    visited.insert(sc);
-    for (auto child : sc->children) {
-      PostOrderTraverse(child, rpo, visited);
+  // Intra-procedural successors of the block within the function.
+  std::vector<Block*> Successors(Block* b) {
+    std::vector<Block*> succs;
+    for (auto e : b->targets()) {
+      if (e->sinkEdge() || e->interproc() ||
+          e->type() == Dyninst::ParseAPI::CATCH)
+        continue;
+      // A block can be shared by multiple functions, hence only follow edges
+      // into blocks of this function.
+      if (index_.find(e->trg()) != index_.end())
+        succs.push_back(e->trg());
     }
-    rpo.push(sc);
+    return succs;
   }
 
-  void AnalyseBlocks(std::set<Block*>& blocks, Block* func_entry) {
-    WorkList worklist;
-    Block* b = *(blocks.begin());
-    UpdateWorkList(worklist, b, func_entry);
+  // Returns false if the analysis ran out of budget.
+  bool Analyse() {
+    AnalysisBudget* budget = s_->context->budget();
+    int n = blocks_.size();
+    in_.assign(n, HeapContext());
+    out_.assign(n, HeapContext());
 
-    while (!worklist.empty()) {
-      auto work = worklist.front();
-      HeapContext* ctx = work.first;
-      std::set<HeapContext*>& predecessors = work.second;
+    // Argument registers may point to the heap or to the caller's frame. Any
+    // other register may point anywhere at function entry.
+    HeapContext entry;
+    entry.reached = true;
+    for (int r = 0; r < kNumGprs; r++) {
+      entry.regs[r] = AbstractLocation::GetTop();
+    }
+    for (auto r : kArgRegisters) {
+      entry.regs[r] = AbstractLocation::GetArgLocation(r);
+    }
 
-      HeapContext old_fact(*ctx);
+    // Lower indices come first in reverse post order.
+    std::set<int> worklist;
+    worklist.insert(0);
+    while (!worklist.empty()) {
+      int i = *worklist.begin();
+      worklist.erase(worklist.begin());
 
-      for (auto pred : predecessors) {
-        assert(pred);
-        ctx->Meet(pred);
+      HeapContext in = i == 0 ? entry : HeapContext();
+      for (auto p : preds_[i]) {
+        in.Meet(out_[p]);
       }
-      TransferFunction(ctx);
-      if (old_fact != *ctx) {
-        if (ctx->successor != nullptr) {
-          std::set<HeapContext*> predecessors;
-          predecessors.insert(ctx);
-          worklist.push_back(std::make_pair(ctx->successor, predecessors));
-        } else {
-          for (auto& e : ctx->block->targets()) {
-            Block* target = e->trg();
-            // We only process intra component targets. Inter component edges
-            // will be processed subsequently in reverse post order.
-            if (blocks.find(target) != blocks.end()) {
-              UpdateWorkList(worklist, target, func_entry);
-            }
-          }
-        }
+      if (!in.reached)
+        continue;
+
+      if (!budget->ChargeIterations(1) ||
+          !budget->ChargeInstructions(
+              s_->context->Instructions(blocks_[i]).size()))
+        return false;
+
+      HeapContext out = in;
+      TransferBlock(&out, blocks_[i], false);
+      in_[i] = std::move(in);
+
+      if (out != out_[i]) {
+        out_[i] = std::move(out);
+        worklist.insert(succs_[i].begin(), succs_[i].end());
       }
-      worklist.pop_front();
     }
+    return true;
   }
 
-  void UpdateWorkList(WorkList& worklist, Block* b, Block* func_entry) {
-    auto& ctxs = info_[b->start()];
-    HeapContext* ctx = ctxs[b->start()];
-    DCHECK(ctx != nullptr);
+  // Applies the transfer functions of the block's instructions to ctx. With
+  // replay set, the unknown writes of the block are classified and the
+  // arguments of its direct call site, if any, recorded using the fact right
+  // before the respective instruction.
+  void TransferBlock(HeapContext* ctx, Block* b, bool replay) {
+    std::set<Address>* writes = nullptr;
+    Address call_site = 0;
+    if (replay) {
+      auto it = s_->unknown_writes.find(b);
+      if (it != s_->unknown_writes.end())
+        writes = &it->second;
+      if (HasDirectCallee(b))
+        call_site = b->last();
+    }
 
-    std::set<HeapContext*> predecessors;
-    if (b->start() == func_entry->start()) {
-      ctx->regs[Dyninst::x86_64::rdi].type = Location::ARG;
-      ctx->regs[Dyninst::x86_64::rsi].type = Location::ARG;
-      ctx->regs[Dyninst::x86_64::rdx].type = Location::ARG;
-      ctx->regs[Dyninst::x86_64::rcx].type = Location::ARG;
-      ctx->regs[Dyninst::x86_64::r8].type = Location::ARG;
-      ctx->regs[Dyninst::x86_64::r9].type = Location::ARG;
-    } else {
-      for (auto& e : b->sources()) {
-        if (e->interproc()) continue;
-        if (e->type() == Dyninst::ParseAPI::CATCH) continue;
-        Block* src = e->src();
-        Address start = src->start();
-        // A block can be shared by multiple functions.
-        // An intra-procedural source edge can come from other functions
-        if (info_.find(start) == info_.end()) continue;
-        auto& src_ctxs = info_[start];
-        predecessors.insert(src_ctxs[src->last()]);
-      }
+    for (auto const& ins : s_->context->Instructions(b)) {
+      if (writes != nullptr && writes->count(ins.first) > 0)
+        ClassifyWrite(*ctx, b, ins.first, ins.second, writes);
+      if (ins.first == call_site)
+        RecordCallArgs(*ctx, b, ins.first, ins.second);
+      TransferFunction(ctx, b, ins.first, ins.second);
     }
-    worklist.push_back(std::make_pair(ctx, predecessors));
+  }
+
+  // Denotes whether the block calls or tail calls a function within the
+  // object.
+  static bool HasDirectCallee(Block* b) {
+    for (auto e : b->targets()) {
+      if (e->sinkEdge() || !e->interproc())
+        continue;
+      if (e->type() == Dyninst::ParseAPI::CALL ||
+          e->type() == Dyninst::ParseAPI::DIRECT ||
+          e->type() == Dyninst::ParseAPI::COND_TAKEN)
+        return true;
+    }
+    return false;
   }
 
   // Pattern match any memory operand to get the base register.
@@ -444,22 +473,34 @@ class HeapAnalysis {
   //   (%rbx) -> %rbx
   //   4(%rax, %rcx, 2) -> %rax
   //   (,%rdx, 2) -> %rdx
+  //
+  // Also collects the constant displacement of operands with a single
+  // register and no scaling.
   class RegisterVisitor : public Visitor {
    public:
-    RegisterVisitor() : add_found_(false), complex_operand_(false) {}
+    RegisterVisitor()
+        : add_found_(false), complex_operand_(false), multiply_found_(false),
+          num_regs_(0), disp_(0), num_imms_(0) {}
 
     void visit(BinaryFunction* f) override {
       complex_operand_ = true;
       if (f->isAdd()) {
         add_found_ = true;
       }
+      if (f->isMultiply()) {
+        multiply_found_ = true;
+      }
     }
 
-    void visit(Immediate* i) override {}
+    void visit(Immediate* i) override {
+      disp_ += i->eval().convert<int64_t>();
+      num_imms_++;
+    }
 
     void visit(Dereference* d) override {}
 
     void visit(RegisterAST* r) override {
+      num_regs_++;
       if (complex_operand_ && !add_found_)
         return;
 
@@ -467,250 +508,375 @@ class HeapAnalysis {
         base_ = r->getID().getBaseRegister();
     }
 
-    void reset() { base_ = MachRegister(); }
-
     bool add_found_;
     bool complex_operand_;
+    bool multiply_found_;
+    int num_regs_;
+    int64_t disp_;
+    int num_imms_;
     MachRegister base_;
   };
 
-  void ParseOperand(Expression::Ptr expr, RegisterVisitor* v,
-                    MachRegister* reg) {
-    if (expr != nullptr) {
-      expr->apply(v);
+  struct Operand {
+    // Base general purpose register. kNoGpr if there is none.
+    Gpr base;
+    // Denotes an instruction pointer relative operand.
+    bool rip_relative;
+    // Denotes an operand with no registers at all, i.e. an immediate or an
+    // absolute address.
+    bool constant;
+    // Denotes whether disp is the exact offset from the base register.
+    bool exact;
+    int64_t disp;
+  };
+
+  Operand ParseOperand(const Instruction& ins, unsigned index) {
+    Operand op = {kNoGpr, false, false, false, 0};
+    Expression::Ptr expr = ins.getOperand(index).getValue();
+    if (expr == nullptr)
+      return op;
 
-      if (v->base_.isValid()) {
-        *reg = v->base_;
-      }
+    RegisterVisitor v;
+    expr->apply(&v);
+    op.constant = v.num_regs_ == 0 && v.num_imms_ > 0;
+    op.exact = v.num_regs_ == 1 && !v.multiply_found_;
+    op.disp = v.disp_;
+    if (v.base_.isValid()) {
+      op.base = ToGpr(v.base_);
+      op.rip_relative = v.base_ == Dyninst::x86_64::rip;
     }
+    return op;
+  }
+
+  // Value of the register before the instruction at addr. The stack pointer
+  // is resolved from the stack analysis.
+  AbstractLocation RegValue(const HeapContext& ctx, Block* b, Address addr,
+                            Gpr r) {
+    if (r != kRsp)
+      return ctx.regs[r];
+
+    StackAnalysis::Height h = s_->context->SPHeight(b, addr);
+    if (h.isTop() || h.isBottom())
+      return AbstractLocation::GetTop();
+    return AbstractLocation::GetStackLocation(h.height());
   }
 
-  void TransferFunction(HeapContext* ctx) {
-    Instruction& ins = ctx->ins;
+  void TransferFunction(HeapContext* ctx, Block* b, Address addr,
+                        const Instruction& ins) {
     entryID id = ins.getOperation().getID();
     switch (id) {
     case e_mov:
-      HandleMov(ctx);
+      HandleMov(ctx, b, addr, ins);
       return;
     case e_call:
-      HandleCall(ctx);
+      HandleCall(ctx, b);
       return;
     case e_lea:
-      HandleLea(ctx);
+      HandleLea(ctx, b, addr, ins);
       return;
     default:
       break;
     }
-    HandleUnknown(ctx);
+    HandleUnknown(ctx, addr, ins);
   }
 
-  void HandleUnknown(HeapContext *ctx) {
-    std::set<Dyninst::InstructionAPI::RegisterAST::Ptr> written;
-    ctx->ins.getWriteSet(written);
+  void HandleUnknown(HeapContext* ctx, Address addr, const Instruction& ins) {
+    std::set<RegisterAST::Ptr> written;
+    ins.getWriteSet(written);
     for (auto const& w : written) {
-      Dyninst::MachRegister reg = w->getID().getBaseRegister();
-      if (reg.regClass() == Dyninst::x86_64::GPR) {
+      Gpr reg = ToGpr(w->getID());
+      if (reg != kNoGpr) {
         ctx->regs[reg] = AbstractLocation::GetTop();
       }
     }
-  }
-
-  void HandleLea(HeapContext* ctx) {
-    MachRegister src_reg;
-    MachRegister dest_reg;
-    RegisterVisitor v = RegisterVisitor();
-
-    Instruction ins = ctx->ins;
-    Expression::Ptr expr = ins.getOperand(0).getValue();
-    ParseOperand(expr, &v, &dest_reg);
 
-    v.reset();
-    expr = ins.getOperand(1).getValue();
-    ParseOperand(expr, &v, &src_reg);
-    if (src_reg.regClass() == Dyninst::x86_64::GPR && dest_reg.regClass() == Dyninst::x86_64::GPR) {
-      ctx->regs[dest_reg] = ctx->regs[src_reg]; 
+    // Whatever was in a stack slot this instruction writes to is gone. Indexed
+    // stack writes may hit any of the slots.
+    auto it = s_->all_writes.find(addr);
+    if (it != s_->all_writes.end() && it->second->stack) {
+      auto hit = s_->stack_heights.find(addr);
+      if (hit != s_->stack_heights.end())
+        ctx->SetStackSlot(hit->second.dest, AbstractLocation::GetTop());
+      else
+        ctx->stack.reset();
+    }
+  }
+
+  // Value of the address computed by a lea source operand.
+  AbstractLocation EffectiveAddress(const HeapContext& ctx, Block* b,
+                                    Address addr, const Operand& op) {
+    if (op.rip_relative || op.constant)
+      return AbstractLocation::GetGlobalLocation();
+    if (op.base == kNoGpr)
+      return AbstractLocation::GetTop();
+
+    AbstractLocation base = RegValue(ctx, b, addr, op.base);
+    bool has_args =
+        base.type == Location::ARG || base.type == Location::HEAP_OR_ARG;
+    if (base.type != Location::STACK && !has_args)
+      return base;
+    if (!op.exact)
+      return AbstractLocation::GetTop();
+    if (base.type == Location::STACK)
+      return AbstractLocation::GetStackLocation(base.stack_height + op.disp);
+
+    // Callers check the written range against the pointers they pass, so
+    // only constant offsets from the arguments are tracked.
+    int64_t offset = base.offset + op.disp;
+    if (offset < INT_MIN || offset > INT_MAX)
+      return AbstractLocation::GetTop();
+    base.offset = offset;
+    return base;
+  }
+
+  void HandleLea(HeapContext* ctx, Block* b, Address addr,
+                 const Instruction& ins) {
+    Gpr dest_reg = ParseOperand(ins, 0).base;
+    if (dest_reg == kNoGpr)
       return;
-    }
-    HandleUnknown(ctx);
+    ctx->regs[dest_reg] = EffectiveAddress(*ctx, b, addr, ParseOperand(ins, 1));
   }
 
-  void HandleCall(HeapContext* ctx) {
+  void HandleCall(HeapContext* ctx, Block* b) {
     // Pattern match the call to determine if the call is heap
     // allocation function or not. If so ctx->regs[rax] == HEAP.
     // Otherwise ctx->regs[rax] == TOP.
     //
     // Other caller saved registers are set to TOP
-
-    ctx->regs[Dyninst::x86_64::rcx] = AbstractLocation::GetTop();
-    ctx->regs[Dyninst::x86_64::rdx] = AbstractLocation::GetTop();
-    ctx->regs[Dyninst::x86_64::rsi] = AbstractLocation::GetTop();
-    ctx->regs[Dyninst::x86_64::rdi] = AbstractLocation::GetTop();
-    ctx->regs[Dyninst::x86_64::r8] = AbstractLocation::GetTop();
-    ctx->regs[Dyninst::x86_64::r9] = AbstractLocation::GetTop();
-    ctx->regs[Dyninst::x86_64::r10] = AbstractLocation::GetTop();
-    ctx->regs[Dyninst::x86_64::r11] = AbstractLocation::GetTop();
+    for (auto r : {kRcx, kRdx, kRsi, kRdi, kR8, kR9, kR10, kR11}) {
+      ctx->regs[r] = AbstractLocation::GetTop();
+    }
 
     // Start to handle rax depending on the callee
-    Block* b = ctx->block;
     Address target = 0;
     for (auto e : b->targets())
       if (e->type() == Dyninst::ParseAPI::CALL && !e->sinkEdge()) {
         target = e->trg()->start();
       }
     bool setToHeap = false;
-    if (target != 0 && b->obj()->cs()->linkage().find(target) != b->obj()->cs()->linkage().end()) {
-      std::string name = b->obj()->cs()->linkage()[target];
+    auto& linkage = b->obj()->cs()->linkage();
+    auto it = linkage.find(target);
+    if (target != 0 && it != linkage.end()) {
+      const std::string& name = it->second;
       if (name == "malloc" || name.find("_Zna") == 0) {
         setToHeap = true;
       }
     }
     if (!setToHeap) {
-      ctx->regs[Dyninst::x86_64::rax] = AbstractLocation::GetTop();
+      ctx->regs[kRax] = AbstractLocation::GetTop();
     } else {
-      ctx->regs[Dyninst::x86_64::rax] = AbstractLocation::GetHeapLocation();
+      ctx->regs[kRax] = AbstractLocation::GetHeapLocation();
     }
   }
 
-  void HandleMov(HeapContext* ctx) {
-    MachRegister src_reg;
-    MachRegister dest_reg;
-    RegisterVisitor v = RegisterVisitor();
-
-    Instruction ins = ctx->ins;
-    Expression::Ptr expr = ins.getOperand(0).getValue();
-    ParseOperand(expr, &v, &dest_reg);
-
-    if (!dest_reg.isValid()) {
-      fprintf(stderr, " Handle move, unknown dest reg, %s at %lx\n", ins.format().c_str(), ctx->addr);
-      return;
-    }
-
-    v.reset();
-    expr = ins.getOperand(1).getValue();
-    ParseOperand(expr, &v, &src_reg);
+  void HandleMov(HeapContext* ctx, Block* b, Address addr,
+                 const Instruction& ins) {
+    Operand dest = ParseOperand(ins, 0);
+    Operand src = ParseOperand(ins, 1);
 
     if (ins.readsMemory()) {
-      auto it = s_->stack_heights.find(ctx->addr);
+      if (dest.base == kNoGpr)
+        return;
+
+      auto it = s_->stack_heights.find(addr);
       if (it != s_->stack_heights.end()) {
         // Stack read.
-        int height = it->second.src;
-        auto sit = ctx->stack.find(height);
-        if (sit == ctx->stack.end()) {
-          ctx->stack[height] = AbstractLocation::GetStackLocation(height);
-        }
-        ctx->regs[dest_reg] = ctx->stack[height].pointToLocation();
+        ctx->regs[dest.base] = ctx->StackSlot(it->second.src);
         return;
       }
 
       // Non stack read.
-      ctx->regs[dest_reg] = AbstractLocation::GetTop();
+      ctx->regs[dest.base] = AbstractLocation::GetTop();
       return;
     }
 
+    // Immediates may only serve as pointers to globals.
+    AbstractLocation value = AbstractLocation::GetTop();
+    if (src.base != kNoGpr) {
+      value = RegValue(*ctx, b, addr, src.base);
+    } else if (src.constant) {
+      value = AbstractLocation::GetGlobalLocation();
+    }
+
     if (ins.writesMemory()) {
-      auto it = s_->stack_heights.find(ctx->addr);
+      auto it = s_->stack_heights.find(addr);
       if (it != s_->stack_heights.end()) {
         // Stack write.
-        int height = it->second.dest;
-        auto sit = ctx->stack.find(height);
-        if (sit == ctx->stack.end()) {
-          ctx->stack[height] = AbstractLocation::GetStackLocation(height);
-        }
-        ctx->stack[height].setPointToLocation(ctx->regs[src_reg]);
+        ctx->SetStackSlot(it->second.dest, value);
+        return;
+      }
+
+      auto wit = s_->all_writes.find(addr);
+      if (wit != s_->all_writes.end() && wit->second->stack) {
+        // Indexed stack write to any of the slots.
+        ctx->stack.reset();
       }
-      return ;
+      return;
     }
 
-    if (src_reg.isValid() && dest_reg.isValid()) {
-      ctx->regs[dest_reg] = ctx->regs[src_reg];
+    if (dest.base == kNoGpr) {
+      StdOut(Color::YELLOW, FLAGS_vv)
+          << "  Heap analysis : unknown mov destination " << ins.format()
+          << " at " << std::hex << addr << std::dec << Endl;
       return;
     }
 
-    ctx->regs[dest_reg] = AbstractLocation::GetTop();
-    return;
+    ctx->regs[dest.base] = value;
   }
 
-  void UpdateFunctionSummary() {
-    std::set<Block*> to_remove_blocks;
-    for (auto it : s_->unknown_writes) {
-      Address block = it.first->start();
-      std::set<Address>& addrs = it.second;
-
-      auto& ctxs = info_[block];
-      std::set<Address> to_remove;
-      for (auto addr : addrs) {
-        auto cit = ctxs.find(addr);
-        if (cit != ctxs.end()) {
-          HeapContext* ctx = cit->second;
-          MachRegister dest_reg;
-          RegisterVisitor v = RegisterVisitor();
-
-          Instruction ins = ctx->ins;
-          Expression::Ptr expr = ins.getOperand(0).getValue();
-          ParseOperand(expr, &v, &dest_reg);
-
-          // Push instructions that do have a known stack height
-          // can lead to unvalid dest register
-          if (!dest_reg.isValid()) {
-              fprintf(stderr, " UpdateFunctionSummary, unknown dest reg, %s at %lx\n", ins.format().c_str(), ctx->addr);
-              continue;
-          }
-
-          AbstractLocation& loc = ctx->regs[dest_reg];
-          switch (loc.type) {
-          case Location::HEAP:
-            s_->heap_writes[block].insert(addr);
-            assert(s_->all_writes.find(addr) != s_->all_writes.end());
-            s_->all_writes[addr]->heap = true;
-            to_remove.insert(addr);
-            break;
-          case Location::ARG:
-            s_->arg_writes[block].insert(addr);
-            assert(s_->all_writes.find(addr) != s_->all_writes.end());
-            s_->all_writes[addr]->arg = true;
-            //to_remove.insert(addr);
-            break;
-          case Location::HEAP_OR_ARG:
-            s_->heap_or_arg_writes[block].insert(addr);
-            assert(s_->all_writes.find(addr) != s_->all_writes.end());
-            s_->all_writes[addr]->heap_or_arg = true;
-            //to_remove.insert(addr);
-            break;
-          default:
-            break;
-          }
-        }
-      }
+  // Records the write at addr if its destination resolves to a heap, a global
+  // or an argument location. Writes through arguments are left to the callers
+  // to check, by recording the arguments in written_args along with the end of
+  // the written range. Those are only classified for a constant displacement
+  // from the argument, indexed writes stay unknown. Writes resolved to any of
+  // these locations are erased from writes.
+  void ClassifyWrite(const HeapContext& ctx, Block* b, Address addr,
+                     const Instruction& ins, std::set<Address>* writes) {
+    // Push instructions that do have a known stack height can lead to an
+    // invalid dest register.
+    Operand dest = ParseOperand(ins, 0);
+    Gpr dest_reg = dest.base;
+    if (dest_reg == kNoGpr)
+      return;
 
-      for (auto addr : to_remove) {
-        addrs.erase(addr);
-      }
+    auto wit = s_->all_writes.find(addr);
+    DCHECK(wit != s_->all_writes.end());
+    if (wit == s_->all_writes.end())
+      return;
 
-      if (addrs.empty()) {
-        to_remove_blocks.insert(it.first);
-      }
+    MemoryWrite* w = wit->second;
+    const AbstractLocation& loc = ctx.regs[dest_reg];
+    switch (loc.type) {
+    case Location::HEAP:
+      s_->heap_writes[b->start()].insert(addr);
+      w->heap = true;
+      writes->erase(addr);
+      break;
+    case Location::GLOBAL:
+      w->global = true;
+      writes->erase(addr);
+      break;
+    case Location::ARG:
+      if (!RecordArgWrite(loc, dest, ins))
+        break;
+      s_->arg_writes[b->start()].insert(addr);
+      w->arg = true;
+      writes->erase(addr);
+      break;
+    case Location::HEAP_OR_ARG:
+      if (!RecordArgWrite(loc, dest, ins))
+        break;
+      s_->heap_or_arg_writes[b->start()].insert(addr);
+      w->heap_or_arg = true;
+      writes->erase(addr);
+      break;
+    default:
+      break;
     }
+  }
 
-    for (auto b : to_remove_blocks) {
-      s_->unknown_writes.erase(b);
-      s_->unsafe_blocks.erase(b);
+  // Adds the arguments of loc to written_args and widens their extents to
+  // cover the write. Returns false for writes with no constant displacement.
+  bool RecordArgWrite(const AbstractLocation& loc, const Operand& dest,
+                      const Instruction& ins) {
+    if (!dest.exact)
+      return false;
+    int64_t extent = loc.offset + dest.disp + WriteSize(ins);
+    if (extent > INT_MAX)
+      return false;
+
+    for (auto r : loc.args) {
+      s_->arg_extents[r] = std::max<int64_t>(s_->arg_extents[r], extent);
     }
+    s_->written_args = s_->written_args | loc.args;
+    return true;
   }
 
-  void Cleanup() {
-    for (auto it : info_) {
-      auto& ctxs = it.second;
-
-      for (auto& cit : ctxs) {
-        delete cit.second;
+  // Size of the memory write of the instruction in bytes. Errs on the large
+  // side if it cannot be determined.
+  static unsigned WriteSize(const Instruction& ins) {
+    std::vector<Dyninst::InstructionAPI::Operand> operands;
+    ins.getOperands(operands);
+    unsigned size = 0;
+    for (auto& op : operands) {
+      if (op.writesMemory() && op.getValue() != nullptr)
+        size = std::max(size, op.getValue()->size());
+    }
+    return size == 0 ? 64 : size;
+  }
+
+  // Records where the pointer arguments passed at the call site may point to.
+  // The frame is gone by the time a tail called function runs, so pointers
+  // into it are only fine for proper calls. Whether the callee's writes stay
+  // below the return address is checked once its extents are known.
+  void RecordCallArgs(const HeapContext& ctx, Block* b, Address addr,
+                      const Instruction& ins) {
+    bool tail_call =
+        ins.getCategory() != Dyninst::InstructionAPI::c_CallInsn;
+    CallSiteArgs& args = s_->call_args[addr];
+    for (auto r : kArgRegisters) {
+      AbstractLocation v = RegValue(ctx, b, addr, r);
+      switch (v.type) {
+      case Location::HEAP:
+      case Location::GLOBAL:
+        args.safe.Insert(r);
+        break;
+      case Location::STACK:
+        if (!tail_call)
+          args.stack_height[r] = v.stack_height;
+        break;
+      case Location::ARG:
+      case Location::HEAP_OR_ARG:
+        args.forwarded[r] = v.args;
+        args.offset[r] = v.offset;
+        break;
+      default:
+        break;
       }
     }
   }
 
+  void UpdateFunctionSummary() {
+    std::vector<Block*> resolved;
+    for (size_t i = 0; i < blocks_.size(); i++) {
+      Block* b = blocks_[i];
+      if (!in_[i].reached)
+        continue;
+
+      auto it = s_->unknown_writes.find(b);
+      bool has_writes = it != s_->unknown_writes.end();
+      if (!has_writes && !HasDirectCallee(b))
+        continue;
+
+      HeapContext ctx = in_[i];
+      TransferBlock(&ctx, b, true);
+
+      if (has_writes && it->second.empty())
+        resolved.push_back(b);
+    }
+
+    for (auto b : resolved) {
+      s_->unknown_writes.erase(b);
+      if (!s_->HasUnsafeStackWrite(b))
+        s_->unsafe_blocks.erase(b);
+    }
+  }
+
   FuncSummary* s_;
-  FlowInfo info_;
+
+  // Blocks reachable from the function entry in reverse post order.
+  std::vector<Block*> blocks_;
+  // Index of each block of the function within blocks_. -1 for unreachable
+  // blocks.
+  std::unordered_map<Block*, int> index_;
+  std::vector<std::vector<int>> succs_;
+  std::vector<std::vector<int>> preds_;
+
+  // Facts at the entry and the exit of each block, indexed like blocks_.
+  std::vector<HeapContext> in_;
+  std::vector<HeapContext> out_;
 };
 
 }  // namespace heap
 
-#endif  // LITECFI_HEAP_H
+#endif  // LITECFI_HEAP_H_
@@ -23,13 +23,17 @@
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 #include "jit.h"
+#include "library_summaries.h"
 #include "parse.h"
 #include "pass_manager.h"
 #include "passes.h"
+#include "placement.h"
+#include "summary_cache.h"
 #include "utils.h"
 
 #include "Module.h"
 #include "Symbol.h"
+#include "Symtab.h"
 
 using namespace Dyninst;
 using namespace Dyninst::PatchAPI;
@@ -39,9 +43,13 @@ DECLARE_bool(vv);
 
 DECLARE_string(output);
 DECLARE_string(shadow_stack);
+DECLARE_string(shadow_stack_layout);
 DECLARE_string(threat_model);
 DECLARE_string(stats);
 DECLARE_string(skip_list);
+DECLARE_string(summary_cache);
+DECLARE_string(library_summaries);
+DECLARE_string(export_summaries);
 
 DECLARE_bool(disable_lowering);
 DECLARE_bool(disable_reg_frame);
@@ -56,11 +64,24 @@ static constexpr char kShadowStackInitFn[] = "litecfi_init_mem_region";
 // Init function which needs to be instrumented with a call the thread local
 // shadow stack initialzation function above.
 static constexpr char kInitFn[] = "_start";
+// Dynamic symbol marking objects rewritten for the parallel shadow stack
+// layout, upon which the runtime maps the mirrors of the thread stacks. Must
+// match __parallel_layout_symbol in runtime.c.
+static constexpr char kParallelLayoutSymbol[] =
+    "__shadow_guard_parallel_layout";
 
 // Trampoline specifications.
 static InstSpec is_init;
 static InstSpec is_empty;
 static std::set<Address> skip_addrs;
+// Arenas holding the analysis summaries of instrumented code objects. The
+// summaries are referenced by the instrumentation snippets, so these must only
+// be released after the binary has been written out.
+static std::vector<Arena*> analysis_arenas;
+
+// Summaries of the shared library functions called through the PLT.
+static LibrarySummaries library_summaries;
+
 static CFGMaker* cfgMaker;
 static int total_func = 0;
 static int func_with_indirect_or_plt_call = 0;
@@ -77,11 +98,23 @@ static int no_dead_reg_site = 0;
 static int lowering_dead_reg_site = 0;
 static int lowering_no_dead_reg_entry_site = 0;
 static int lowering_no_dead_reg_exit_site = 0;
+static int lowering_jump_table_fns = 0;
+static int lowering_hoisted_pushes = 0;
+static long summary_cache_hits = 0;
+static long summary_cache_misses = 0;
+
+// Code added by cloning blocks of a lowered function.
+struct CodeGrowth {
+  std::string name;
+  long cloned_bytes;
+  long function_bytes;
+};
 
 struct InstrumentationResult {
   std::vector<std::string> safe_fns;
   std::vector<std::string> lowered_fns;
   std::vector<std::string> reg_stack_fns;
+  std::vector<CodeGrowth> lowering_growth;
 };
 
 class StackOpSnippet : public Dyninst::PatchAPI::Snippet {
@@ -91,25 +124,17 @@ class StackOpSnippet : public Dyninst::PatchAPI::Snippet {
         useOriginalCodeFixed(u2) {}
 
   bool generate(Dyninst::PatchAPI::Point* pt, Dyninst::Buffer& buf) override {
-    AssemblerHolder ah;
-    jit_fn_(pt, summary_, ah, useOriginalCode, height, useOriginalCodeFixed);
-
-    size_t size = ah.GetCode()->codeSize();
-    char* temp_buf = (char*)malloc(size);
-
-    ah.GetCode()->relocateToBase((uint64_t)temp_buf);
-
-    size = ah.GetCode()->codeSize();
-    ah.GetCode()->copyFlattenedData(temp_buf, size,
-                                    asmjit::CodeHolder::kCopyWithPadding);
-
-    buf.copy(temp_buf, size);
+    SnippetKey key = key_fn_(pt, summary_, useOriginalCode, height,
+                             useOriginalCodeFixed);
+    const std::vector<char>& code = SnippetCode(key);
+    if (!code.empty())
+      buf.copy(const_cast<char*>(code.data()), code.size());
     return true;
   }
 
  protected:
-  std::string (*jit_fn_)(Dyninst::PatchAPI::Point* pt, FuncSummary* summary,
-                         AssemblerHolder&, bool, int, bool);
+  SnippetKey (*key_fn_)(Dyninst::PatchAPI::Point* pt, FuncSummary* summary,
+                        bool, int, bool);
 
  private:
   FuncSummary* summary_;
@@ -123,15 +148,15 @@ class StackPushSnippet : public StackOpSnippet {
   explicit StackPushSnippet(FuncSummary* summary, bool u, int h = 0,
                             bool u2 = false)
       : StackOpSnippet(summary, u, h, u2) {
-    jit_fn_ = JitStackPush;
+    key_fn_ = StackPushKey;
   }
 };
 
 class StackPopSnippet : public StackOpSnippet {
  public:
-  explicit StackPopSnippet(FuncSummary* summary, bool u)
-      : StackOpSnippet(summary, u, 0, false) {
-    jit_fn_ = JitStackPop;
+  explicit StackPopSnippet(FuncSummary* summary, bool u, int h = 0)
+      : StackOpSnippet(summary, u, h, false) {
+    key_fn_ = StackPopKey;
   }
 };
 
@@ -139,7 +164,7 @@ class RegisterPushSnippet : public StackOpSnippet {
  public:
   explicit RegisterPushSnippet(FuncSummary* summary, int height = 0)
       : StackOpSnippet(summary, false, height, false) {
-    jit_fn_ = JitRegisterPush;
+    key_fn_ = RegisterPushKey;
   }
 };
 
@@ -147,7 +172,7 @@ class RegisterPopSnippet : public StackOpSnippet {
  public:
   explicit RegisterPopSnippet(FuncSummary* summary)
       : StackOpSnippet(summary, false, 0, false) {
-    jit_fn_ = JitRegisterPop;
+    key_fn_ = RegisterPopKey;
   }
 };
 
@@ -182,112 +207,21 @@ void InsertSnippet(BPatch_function* function, Point::Type location,
   }
 }
 
-bool CheckFastPathFunction(BPatch_basicBlock*& entry,
-                           vector<BPatch_basicBlock*>& exits,
-                           BPatch_function* f) {
+bool CheckFastPathFunction(BPatch_function* function, FuncSummary* summary,
+                           placement::FastPaths* fast_paths) {
   if (FLAGS_disable_lowering) return false;
-  BPatch_flowGraph* cfg = f->getCFG();
-
-  // Should have only one function entry block.
-  std::vector<BPatch_basicBlock*> eb;
-  cfg->getEntryBasicBlock(eb);
-  if (eb.size() != 1)
-    return false;
-  BPatch_basicBlock* func_entry = eb[0];
-
-  // The function entry block should not contain memory writes.
-  std::vector<Dyninst::InstructionAPI::Instruction> insns;
-  func_entry->getInstructions(insns);
-  for (auto i : insns) {
-    // Here we should reuse stack analysis to allow writes to known stack
-    // location. But it is going to be a future optimization.
-    if (i.writesMemory())
-      return false;
-  }
-
-  eb.clear();
-  cfg->getExitBasicBlock(eb);
-  // The function entry block should have two edges,
-  // one cond-taken, one cond-not-taken.
-  //
-  // One of the edge should point to an exit block
-  // as the fast path exit block.
-  std::vector<BPatch_edge*> edges;
-  func_entry->getOutgoingEdges(edges);
-  if (edges.size() != 2)
-    return false;
-  bool condTaken = false;
-  bool condNotTaken = false;
-  BPatch_basicBlock* fastExitBlock = NULL;
-  for (auto e : edges) {
-    if (e->getType() == CondJumpTaken)
-      condTaken = true;
-    if (e->getType() == CondJumpNottaken)
-      condNotTaken = true;
-    BPatch_basicBlock* b = e->getTarget();
-    if (std::find(eb.begin(), eb.end(), b) != eb.end()) {
-      fastExitBlock = b;
-    } else {
-      entry = b;
-    }
-  }
-  if (!condTaken || !condNotTaken || fastExitBlock == NULL || entry == NULL)
-    return false;
-
-  // Function entry block cannot have intra-procedural incoming edges.
-  edges.clear();
-  func_entry->getIncomingEdges(edges);
-  if (edges.size() > 0)
-    return false;
-
-  // The slow path entry should only have entry block as source.
-  // Otherwise, the stack push instrumentation will be executed multiple times.
-  edges.clear();
-  entry->getIncomingEdges(edges);
-  if (edges.size() != 1)
-    return false;
-
-  // The fast path exit block should contain one return instruction.
-  // This condition makes sure that our shadow stack instrumentation can
-  // find the correct location for return address.
-  // TODO: relax this condition later.
-  insns.clear();
-  fastExitBlock->getInstructions(insns);
-  if (insns.size() != 1)
-    return false;
-  if (insns[0].getCategory() != InstructionAPI::c_ReturnInsn)
-    return false;
-
-  // Excluding the function entry block,
-  // each block that is a source block of the fast exit block
-  // should be instrumented with shadow stack pop.
-  edges.clear();
-  fastExitBlock->getIncomingEdges(edges);
-  for (auto e : edges) {
-    if (e->getSource() != func_entry) {
-      BPatch_basicBlock* slowPathExit = e->getSource();
-      // If the slow path exit has more than one outgoing edges,
-      // we cannot instrument at its exit, because stack pop operation
-      // can potentially be performed mulitple times.
-      std::vector<BPatch_edge*> out_edges;
-      slowPathExit->getOutgoingEdges(out_edges);
-      if (out_edges.size() != 1)
-        return false;
-      exits.push_back(e->getSource());
-    }
-  }
-
-  // In addition, we need to instrument all non-fast-exit exit blocks.
-  for (auto b : eb)
-    if (b != fastExitBlock)
-      exits.push_back(b);
-  return true;
+  if (summary == nullptr) return false;
+  return placement::FindFastPaths(PatchAPI::convert(function), summary,
+                                  fast_paths);
 }
 
 bool DoStackOpsUsingRegisters(BPatch_function* function, FuncSummary* summary,
                               const litecfi::Parser& parser,
                               PatchMgr::Ptr patcher) {
   if (FLAGS_disable_reg_frame) return false;
+  // A parallel stack push is as cheap as saving to a register, so register
+  // frames, with their unwinding on the compact stack, do not pay off.
+  if (FLAGS_shadow_stack_layout == "parallel") return false;
   if (summary != nullptr && summary->shouldUseRegisterFrame()) {
     fprintf(stdout, "[Register Stack] Function : %s\n",
             Dyninst::PatchAPI::convert(function)->name().c_str());
@@ -317,18 +251,17 @@ bool DoStackOpsUsingRegisters(BPatch_function* function, FuncSummary* summary,
 }
 
 bool skipPatchEdges(PatchEdge* e) {
-  if (e->sinkEdge() || e->interproc())
-    return true;
-  if (e->type() == ParseAPI::CATCH)
-    return true;
-  return false;
+  return !placement::IsFollowed(e);
 }
 
-void CloneFunctionCFG(PatchFunction* f, PatchMgr::Ptr patcher,
+// Clones the blocks of the region. Edges from the clones to blocks outside of
+// the region keep going to the original blocks.
+void CloneFunctionCFG(PatchFunction* f, const std::set<PatchBlock*>& region,
+                      PatchMgr::Ptr patcher,
                       std::map<PatchBlock*, PatchBlock*>& cloneBlockMap) {
-  // Clone all blocks
+  // Clone the region blocks
   std::vector<PatchBlock*> newBlocks;
-  for (auto b : f->blocks()) {
+  for (auto b : region) {
     PatchBlock* cloneB = cfgMaker->cloneBlock(b, b->object());
     cloneBlockMap[b] = cloneB;
     newBlocks.push_back(cloneB);
@@ -338,44 +271,30 @@ void CloneFunctionCFG(PatchFunction* f, PatchMgr::Ptr patcher,
   }
 
   // The edges of the cloned blocks are still from/to original blocks
-  // Now we redirect all edges
+  // Now we redirect all edges. This includes the resolved jump table edges of
+  // cloned switch blocks, so that the relocated jump table of a clone
+  // dispatches to the cloned cases.
   for (auto b : newBlocks) {
     for (auto e : b->targets()) {
       if (skipPatchEdges(e))
         continue;
+      if (cloneBlockMap.find(e->trg()) == cloneBlockMap.end())
+        continue;
       PatchBlock* newTarget = cloneBlockMap[e->trg()];
       assert(PatchModifier::redirect(e, newTarget));
     }
   }
 }
 
-void RedirectTransitionEdges(PatchBlock* cur, FuncSummary* summary,
-                             std::set<PatchEdge*>& redirect,
-                             std::set<PatchEdge*>& visited) {
-  for (auto e : cur->targets()) {
-    if (skipPatchEdges(e))
-      continue;
-    if (visited.find(e) != visited.end())
-      continue;
-    visited.insert(e);
-    PatchBlock* target = e->trg();
-    bool targetHasIndJump = false;
-    for (auto te : target->targets()) {
-      if (skipPatchEdges(te))
-        continue;
-      if (te->type() == ParseAPI::INDIRECT) {
-        targetHasIndJump = true;
-        break;
-      }
-    }
-    if (summary->unsafe_blocks.find(target->block()) !=
-        summary->unsafe_blocks.end() ||
-        targetHasIndJump) {
-      redirect.insert(e);
-    } else {
-      RedirectTransitionEdges(target, summary, redirect, visited);
-    }
-  }
+// Whether the function has an intra-procedural indirect jump whose targets
+// were not resolved. Such a jump in a clone would leave the cloned CFG for
+// the original code, which does not pop the shadow stack.
+bool HasUnresolvedIndirectJump(PatchFunction* f) {
+  for (auto b : f->blocks())
+    for (auto e : b->targets())
+      if (e->sinkEdge() && e->type() == ParseAPI::INDIRECT && !e->interproc())
+        return true;
+  return false;
 }
 
 void GetReachableBlocks(PatchBlock* b, std::set<PatchBlock*>& visited) {
@@ -428,39 +347,57 @@ void CoalesceEdgeInstrumentation(PatchFunction* f,
 
 bool DoInstrumentationLowering(BPatch_function* function, FuncSummary* summary,
                                const litecfi::Parser& parser,
-                               PatchMgr::Ptr patcher) {
+                               PatchMgr::Ptr patcher, CodeGrowth* growth) {
   if (FLAGS_disable_lowering) return false;
   if (!summary || !summary->lowerInstrumentation()) {
     return false;
   }
-  if (summary->has_indirect_cf) return false;
   PatchFunction* f = PatchAPI::convert(function);
-  std::set<PatchEdge*> visited;
-  std::set<PatchEdge*> redirect;
-  RedirectTransitionEdges(f->entry(), summary, redirect, visited);
+  if (HasUnresolvedIndirectJump(f))
+    return false;
+
+  bool useRegisterFrame = summary->shouldUseRegisterFrame();
+  if (FLAGS_disable_reg_frame) useRegisterFrame = false;
 
-  for (auto e : redirect)
+  // Pushes need the stack height at the edge and, for functions accessing the
+  // red zone, somewhere to save the scratch registers.
+  auto pushable = [&](PatchEdge* e) {
     if (summary->blockEndSPHeight.find(e->src()->start()) ==
         summary->blockEndSPHeight.end())
       return false;
-
-  bool useRegisterFrame = summary->shouldUseRegisterFrame();
-  if (FLAGS_disable_reg_frame) useRegisterFrame = false;
-  if (!useRegisterFrame && summary->redZoneAccess.size() > 0) {
-    for (auto e : redirect) {
+    if (!useRegisterFrame && summary->redZoneAccess.size() > 0) {
       MoveInstData* mid =
           summary->getMoveInstDataFixedAtEntry(e->trg()->start());
-      if (mid == nullptr)
-        return false;
-      if (mid->saveCount < 2)
+      if (mid == nullptr || mid->saveCount < 2)
         return false;
     }
-  }
+    return true;
+  };
+
+  placement::PushPlacement placement(f, summary);
+  if (!placement.Compute(pushable))
+    return false;
+  std::set<PatchEdge*> redirect = placement.push_edges();
+  lowering_hoisted_pushes += placement.hoisted();
+
+  // Exit blocks of the region, before the clones get added to the function.
+  std::vector<PatchBlock*> exitBlocks;
+  for (auto b : f->exitBlocks())
+    if (placement.region().find(b) != placement.region().end())
+      exitBlocks.push_back(b);
+
+  growth->name = f->name();
+  growth->cloned_bytes = 0;
+  growth->function_bytes = 0;
+  for (auto b : f->blocks())
+    growth->function_bytes += b->end() - b->start();
+  for (auto b : placement.region())
+    growth->cloned_bytes += b->end() - b->start();
 
   assert(parser.parser->markPatchFunctionEntryInstrumented(f));
 
   std::map<PatchBlock*, PatchBlock*> cloneBlockMap;
-  CloneFunctionCFG(f, patcher, cloneBlockMap);
+  CloneFunctionCFG(f, placement.region(), patcher, cloneBlockMap);
   for (auto e : redirect) {
     assert(PatchModifier::redirect(e, cloneBlockMap[e->trg()]));
   }
@@ -530,7 +467,7 @@ bool DoInstrumentationLowering(BPatch_function* function, FuncSummary* summary,
   }
 
   // Insert stack pop operations
-  for (auto b : f->exitBlocks()) {
+  for (auto b : exitBlocks) {
     PatchBlock* cloneB = cloneBlockMap[b];
     Point* p = patcher->findPoint(PatchAPI::Location::BlockInstance(f, cloneB),
                                   Point::BlockExit);
@@ -560,6 +497,8 @@ bool DoInstrumentationLowering(BPatch_function* function, FuncSummary* summary,
     assert(parser.parser->markPatchBlockInstrumented(cloneB));
   }
 
+  if (summary->has_indirect_cf)
+    lowering_jump_table_fns += 1;
   f->setContainsClonedBlocks(true);
   return true;
 }
@@ -739,8 +678,11 @@ void InstrumentFunction(BPatch_function* function,
 
     // If possible check and lower the instrumentation to within non frequently
     // executed unsafe control flow paths.
-    if (DoInstrumentationLowering(function, summary, parser, patcher)) {
+    CodeGrowth growth;
+    if (DoInstrumentationLowering(function, summary, parser, patcher,
+                                  &growth)) {
       res->lowered_fns.push_back(fn_name);
+      res->lowering_growth.push_back(growth);
       StdOut(Color::RED, FLAGS_vv)
           << "      Optimized instrumentation lowering for function at 0x"
           << std::hex << (uint64_t)function->getBaseAddr() << Endl;
@@ -756,35 +698,42 @@ void InstrumentFunction(BPatch_function* function,
     }
 
     // Apply fast path optimization if applicable.
-    BPatch_basicBlock* condNotTakenEntry = NULL;
-    vector<BPatch_basicBlock*> condNotTakenExits;
-    if (summary != nullptr && CheckFastPathFunction(condNotTakenEntry, condNotTakenExits, function)) {
+    placement::FastPaths fast_paths;
+    if (CheckFastPathFunction(function, summary, &fast_paths)) {
       res->lowered_fns.push_back(fn_name);
       StdOut(Color::RED, FLAGS_vv)
           << "      Optimized fast path instrumentation for function at 0x"
           << std::hex << (uint64_t)function->getBaseAddr() << Endl;
       /* If the function has the following shape:
        * entry:
-       *    code that does not writes memory
+       *    code that does not write memory unsafely
        *    jz A   (or other conditional jump)
        *    some complicated code
        * A: ret
        *
        * Then we do not need to instrument the fast path: entry -> ret.
        * We can instrument the entry and exit of the "some complicated code",
-       * which is the slow path.
+       * which is the slow path. Any number of guards and early returns
+       * works the same way.
        */
+      std::map<Address, BPatch_basicBlock*> blocks;
+      std::set<BPatch_basicBlock*> all_blocks;
+      function->getCFG()->getAllBasicBlocks(all_blocks);
+      for (auto b : all_blocks)
+        blocks[b->getStartAddress()] = b;
 
-      // Instrument slow paths entry with stack push operation
+      // Instrument slow paths entries with stack push operations
       // and nop snippet, which enables instrumentation frame spec.
       //
       // Also attempt to move instrumentation to utilize existing push & pop
-      BPatch_point* push_point = condNotTakenEntry->findEntryPoint();
-      bool moveInst = MoveInstrumentation(push_point, summary);
-      Snippet::Ptr stack_push =
-          StackPushSnippet::create(new StackPushSnippet(summary, moveInst));
-      PatchAPI::convert(push_point, BPatch_callBefore)->pushBack(stack_push);
-      points.push_back(push_point);
+      for (auto& push : fast_paths.pushes) {
+        BPatch_point* push_point = blocks[push.first->start()]->findEntryPoint();
+        bool moveInst = MoveInstrumentation(push_point, summary);
+        Snippet::Ptr stack_push = StackPushSnippet::create(
+            new StackPushSnippet(summary, moveInst, push.second));
+        PatchAPI::convert(push_point, BPatch_callBefore)->pushBack(stack_push);
+        points.push_back(push_point);
+      }
       binary_edit->insertSnippet(nopSnippet, points, BPatch_callBefore,
                                  BPatch_lastSnippet, &is_empty);
 
@@ -792,11 +741,15 @@ void InstrumentFunction(BPatch_function* function,
       // and nop snippet, which enables instrumentation frame spec.
       points.clear();
       std::vector<BPatch_point*> insnPoints;
-      for (auto b : condNotTakenExits) {
-        BPatch_point* pop_point = b->findExitPoint();
-        bool moveInst = MoveInstrumentation(pop_point, summary);
-        Snippet::Ptr stack_pop =
-            StackPopSnippet::create(new StackPopSnippet(summary, moveInst));
+      for (auto& pop : fast_paths.pops) {
+        BPatch_point* pop_point = blocks[pop.first->start()]->findExitPoint();
+        if (IsNonreturningCall(PatchAPI::convert(pop_point, BPatch_callAfter)))
+          continue;
+        // Moved pops expect the return address at the top of the stack.
+        bool moveInst =
+            pop.second == 0 && MoveInstrumentation(pop_point, summary);
+        Snippet::Ptr stack_pop = StackPopSnippet::create(
+            new StackPopSnippet(summary, moveInst, pop.second));
         if (pop_point->getPointType() == BPatch_locInstruction) {
           PatchAPI::convert(pop_point, BPatch_callBefore)->pushBack(stack_pop);
           insnPoints.push_back(pop_point);
@@ -912,6 +865,33 @@ static void GetIFUNCs(BPatch_module* module,
   }
 }
 
+// Adds kParallelLayoutSymbol to the dynamic symbols of the object. Only its
+// presence matters, so it is placed on the first function symbol.
+static void MarkParallelLayout(BPatch_object* object) {
+  std::vector<BPatch_module*> modules;
+  object->modules(modules);
+  if (modules.empty())
+    return;
+
+  SymtabAPI::Module* sym_mod = SymtabAPI::convert(modules[0]);
+  SymtabAPI::Symtab* symtab = sym_mod->exec();
+  std::vector<SymtabAPI::Symbol*> functions;
+  symtab->getAllSymbolsByType(functions, SymtabAPI::Symbol::ST_FUNCTION);
+  DCHECK(!functions.empty())
+      << "No function to place the parallel layout marker at in "
+      << object->pathName();
+  if (functions.empty())
+    return;
+
+  SymtabAPI::Symbol* at = functions[0];
+  SymtabAPI::Symbol* marker = new SymtabAPI::Symbol(
+      kParallelLayoutSymbol, SymtabAPI::Symbol::ST_OBJECT,
+      SymtabAPI::Symbol::SL_GLOBAL, SymtabAPI::Symbol::SV_DEFAULT,
+      at->getOffset(), at->getModule(), at->getRegion(), 0 /* size */,
+      true /* dynamic */);
+  symtab->addSymbol(marker);
+}
+
 void InstrumentModule(BPatch_module* module, const litecfi::Parser& parser,
                       PatchMgr::Ptr patcher,
                       const std::map<uint64_t, FuncSummary*>& analyses,
@@ -941,6 +921,57 @@ void InstrumentModule(BPatch_module* module, const litecfi::Parser& parser,
   }
 }
 
+// Runs the analysis pipeline over the code object, followed by last_pass if
+// given, and returns the resulting function summaries.
+std::set<FuncSummary*> AnalyseCodeObject(BPatch_object* object,
+                                         Pass* last_pass = nullptr) {
+  CodeObject* co = Dyninst::ParseAPI::convert(object);
+  co->parse();
+  co->adjustJumpTableRange();
+
+  SummaryCache* cache = nullptr;
+  if (FLAGS_summary_cache != "") {
+    cache = new SummaryCache(FLAGS_summary_cache, object->pathName());
+    cache->Load();
+  }
+
+  Arena* arena = new Arena;
+  analysis_arenas.push_back(arena);
+
+  PassManager* pm = new PassManager(arena);
+  pm->AddPass(new CallGraphAnalysis(&library_summaries));
+  if (cache != nullptr) {
+    // Summaries are keyed on the call graph, hence the lookup has to happen
+    // after call graph generation.
+    pm->AddPass(new SummaryCacheLookup(cache));
+  }
+  pm->AddPass(new StackHeightAnalysis())
+      ->AddPass(new CFGAnalysis())
+      ->AddPass(new IndexedStackWriteAnalysis())
+      ->AddPass(new HeapWriteAnalysis())
+      ->AddPass(new SymbolicWriteResolution())
+      ->AddPass(new ArgumentWriteAnalysis())
+      ->AddPass(new InterProceduralMemoryAnalysis())
+      ->AddPass(new FunctionExceptionAnalysis())
+      ->AddPass(new UnsafeCallBlockAnalysis())
+      ->AddPass(new SafePathsCounting())
+      ->AddPass(new DeadRegisterAnalysis())
+      ->AddPass(new UnusedRegisterAnalysis())
+      ->AddPass(new BlockDeadRegisterAnalysis());
+  if (last_pass != nullptr) {
+    pm->AddPass(last_pass);
+  }
+  std::set<FuncSummary*> summaries = pm->Run(co);
+
+  if (cache != nullptr) {
+    cache->Save(summaries);
+    summary_cache_hits += cache->hits();
+    summary_cache_misses += cache->misses();
+    delete cache;
+  }
+  return summaries;
+}
+
 void InstrumentCodeObject(BPatch_object* object, const litecfi::Parser& parser,
                           PatchMgr::Ptr patcher, InstrumentationResult* res) {
   if (!IsSharedLibrary(object)) {
@@ -961,26 +992,7 @@ void InstrumentCodeObject(BPatch_object* object, const litecfi::Parser& parser,
   std::map<uint64_t, FuncSummary*> analyses;
   // Do the static analysis on this code and obtain skippable functions.
   if (FLAGS_shadow_stack == "light") {
-    CodeObject* co = Dyninst::ParseAPI::convert(object);
-    co->parse();
-    co->adjustJumpTableRange();
-
-    PassManager* pm = new PassManager;
-    pm->AddPass(new CallGraphAnalysis())
-        ->AddPass(new LargeFunctionFilter())
-        ->AddPass(new StackHeightAnalysis())
-        ->AddPass(new CFGAnalysis())
-//        ->AddPass(new HeapWriteAnalysis())
-        ->AddPass(new InterProceduralMemoryAnalysis())
-        ->AddPass(new FunctionExceptionAnalysis())
-        ->AddPass(new UnsafeCallBlockAnalysis())
-        ->AddPass(new SafePathsCounting())
-        ->AddPass(new DeadRegisterAnalysis())
-        ->AddPass(new UnusedRegisterAnalysis())
-        ->AddPass(new BlockDeadRegisterAnalysis());
-    std::set<FuncSummary*> summaries = pm->Run(co);
-
-    for (auto f : summaries) {
+    for (auto f : AnalyseCodeObject(object)) {
       analyses[f->func->addr()] = f;
     }
   }
@@ -992,6 +1004,9 @@ void InstrumentCodeObject(BPatch_object* object, const litecfi::Parser& parser,
 
     InstrumentModule(module, parser, patcher, analyses, res);
   }
+
+  if (FLAGS_shadow_stack_layout == "parallel")
+    MarkParallelLayout(object);
 }
 
 void SetupInstrumentationSpec() {
@@ -1014,6 +1029,8 @@ void Instrument(std::string binary, const litecfi::Parser& parser) {
 
   StdOut(Color::BLUE) << "+ Instrumenting the binary..." << Endl;
 
+  library_summaries.LoadAll(FLAGS_library_summaries);
+
   if (FLAGS_skip_list != "") {
     std::ifstream infile(FLAGS_skip_list, std::fstream::in);
     Address addr;
@@ -1048,6 +1065,11 @@ void Instrument(std::string binary, const litecfi::Parser& parser) {
     binary_edit->writeFile(FLAGS_output.c_str());
   }
 
+  for (auto arena : analysis_arenas) {
+    delete arena;
+  }
+  analysis_arenas.clear();
+
   StdOut(Color::RED) << "Safe functions : " << std::dec << res->safe_fns.size() << "(" << res->safe_fns.size() * 100.0 / total_func << "%)"
                      << "\n  ";
   /*
@@ -1073,6 +1095,31 @@ void Instrument(std::string binary, const litecfi::Parser& parser) {
   }
   */
   StdOut(Color::BLUE) << Endl;
+  StdOut(Color::RED) << "Lowering stack functions with jump tables : "
+                     << lowering_jump_table_fns << Endl;
+  StdOut(Color::RED) << "Lowering pushes hoisted to dominators : "
+                     << lowering_hoisted_pushes << Endl;
+
+  long cloned_bytes = 0;
+  long lowered_bytes = 0;
+  for (auto& g : res->lowering_growth) {
+    cloned_bytes += g.cloned_bytes;
+    lowered_bytes += g.function_bytes;
+  }
+  StdOut(Color::RED) << "Lowering code growth : " << cloned_bytes
+                     << " bytes cloned of " << lowered_bytes << "("
+                     << (lowered_bytes ? cloned_bytes * 100.0 / lowered_bytes
+                                       : 0)
+                     << "%)" << Endl;
+  for (auto& g : res->lowering_growth) {
+    StdOut(Color::BLUE, FLAGS_vv)
+        << "  " << g.name << " : " << g.cloned_bytes << " / "
+        << g.function_bytes << " bytes" << Endl;
+  }
+
+  SnippetCacheStats snippets = GetSnippetCacheStats();
+  StdOut(Color::RED) << "Snippet templates : " << snippets.templates
+                     << " (reused " << snippets.hits << " times)" << Endl;
   StdOut(Color::RED) << "Functions with indirect call or plt calls : "
                      << func_with_indirect_or_plt_call
                      << Endl;
@@ -1099,5 +1146,42 @@ void Instrument(std::string binary, const litecfi::Parser& parser) {
   StdOut(Color::RED) << "\tUnknown writes : " << unknown << "(" << unknown * 100.0 / memory_writes << "%)" <<  Endl;
   StdOut(Color::RED) << "Dead register optimization : " << no_dead_reg_site << "/" << total_dead_reg_site << Endl;
   StdOut(Color::RED) << "Lowering dead register optimization : " << lowering_no_dead_reg_entry_site << "/" << lowering_no_dead_reg_exit_site << "/" << lowering_dead_reg_site << Endl;
+  if (FLAGS_summary_cache != "") {
+    StdOut(Color::RED) << "Summary cache hits / misses : " << summary_cache_hits
+                       << "/" << summary_cache_misses << Endl;
+  }
+
+}
 
+void ExportLibrarySummaries(std::string binary,
+                            const litecfi::Parser& parser) {
+  StdOut(Color::BLUE) << "+ Exporting library summaries to "
+                      << FLAGS_export_summaries << Endl;
+
+  library_summaries.LoadAll(FLAGS_library_summaries);
+
+  std::vector<BPatch_object*> objects;
+  parser.image->getObjects(objects);
+
+  // Only the given binary is summarised. Its dependencies are expected to
+  // come with summary files of their own.
+  bool found = false;
+  for (auto object : objects) {
+    if (GetFileNameFromPath(object->pathName()) != GetFileNameFromPath(binary))
+      continue;
+    AnalyseCodeObject(object, new LibrarySummaryExport(FLAGS_export_summaries,
+                                                       &library_summaries));
+    found = true;
+    break;
+  }
+
+  if (!found) {
+    StdOut(Color::RED) << "Unable to find " << binary << " among the parsed "
+                       << "objects" << Endl;
+  }
+
+  for (auto arena : analysis_arenas) {
+    delete arena;
+  }
+  analysis_arenas.clear();
 }
@@ -8,4 +8,8 @@
 
 void Instrument(std::string binary, const litecfi::Parser& parser);
 
+// Analyses the given shared library and writes the summaries of its functions
+// out to the --export_summaries file instead of instrumenting it.
+void ExportLibrarySummaries(std::string binary, const litecfi::Parser& parser);
+
 #endif  // LITECFI_INSTRUMENT_H_
@@ -1,6 +1,10 @@
+#include <map>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include "asmjit/asmjit.h"
+#include "assembler.h"
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 #include "jit.h"
@@ -11,53 +15,41 @@
 using namespace asmjit::x86;
 
 DECLARE_bool(optimize_regs);
+DECLARE_bool(vv);
 DECLARE_bool(validate_frame);
+DECLARE_bool(compact_entries);
 DECLARE_string(shadow_stack);
+DECLARE_string(shadow_stack_layout);
 DECLARE_string(dry_run);
 
-static std::map<std::string, Gp> kRegisterMap = {
-    {"x86_64::rax", rax}, {"x86_64::rbx", rbx}, {"x86_64::rcx", rcx},
-    {"x86_64::rdx", rdx}, /*{"x86_64::rsp", rsp},*/ {"x86_64::rbp", rbp},
-    {"x86_64::rsi", rsi}, {"x86_64::rdi", rdi}, {"x86_64::r8", r8},
-    {"x86_64::r9", r9},   {"x86_64::r10", r10}, {"x86_64::r11", r11},
-    {"x86_64::r12", r12}, {"x86_64::r13", r13}, {"x86_64::r14", r14},
-    {"x86_64::r15", r15}};
+// asmjit registers indexed by general purpose register number.
+static const Gp kRegisterMap[kNumGprs] = {rax, rcx, rdx, rbx, rsp, rbp,
+                                          rsi, rdi, r8,  r9,  r10, r11,
+                                          r12, r13, r14, r15};
+
+// Registers usable as temporaries in the order of preference.
+static const Gpr kTempRegisterOrder[] = {kR10, kR11, kR12, kR13, kR14,
+                                        kR15, kR8,  kR9,  kRax, kRbp,
+                                        kRbx, kRcx, kRdi, kRdx, kRsi};
 
 struct TempRegisters {
   Gp tmp1;
   Gp tmp2;
-  Gp tmp3;
   bool tmp1_saved;
   bool tmp2_saved;
-  bool tmp3_saved;
   int sp_offset;
 
-  TempRegisters(std::set<std::string> exclude = {}, int height = 0)
-      : tmp1_saved(true), tmp2_saved(true), tmp3_saved(true),
-        sp_offset(height /* flag saving always takes 8 bytes */) {
-    int count = 0;
-    for (auto it : kRegisterMap) {
-      auto rit = exclude.find(it.first);
-      if (rit == exclude.end()) {
-        switch (count) {
-        case 0:
-          tmp1 = it.second;
-          break;
-        case 1:
-          tmp2 = it.second;
-          break;
-        case 2:
-          tmp3 = it.second;
-          break;
-        }
-        count++;
-      }
-
-      if (count == 2)
-        break;
-    }
-
-    DCHECK(count == 2);
+  // Picks two temporaries not in exclude, preferring dead registers since
+  // those need not be saved.
+  TempRegisters(RegisterSet dead = {}, RegisterSet exclude = {},
+                int height = 0)
+      : sp_offset(height) {
+    Gpr r1 = PickTemporary(dead, exclude, &tmp1_saved);
+    exclude.Insert(r1);
+    Gpr r2 = PickTemporary(dead, exclude, &tmp2_saved);
+
+    tmp1 = kRegisterMap[r1];
+    tmp2 = kRegisterMap[r2];
   }
 
   TempRegisters(MoveInstData * mid, int height) {
@@ -68,77 +60,69 @@ struct TempRegisters {
       tmp2_saved = false;
       tmp2 = kRegisterMap[mid->reg2];
     } else {
-      tmp2_saved = true;
-      auto it = kRegisterMap.begin();
-      if (it->first == mid->reg1) ++it;
-      tmp2 = it->second;
+      tmp2 = kRegisterMap[PickTemporary({}, {mid->reg1}, &tmp2_saved)];
     }
-    tmp3_saved = true;
   }
-};
 
-void SaveOrSkip(Assembler* a, TempRegisters* t, std::string reg_str, Gp* reg,
-                bool* saved) {
-  auto it = kRegisterMap.find(reg_str);
-  if (it != kRegisterMap.end()) {
-    *reg = it->second;
-    *saved = false;
-  } else {
-    a->push(*reg);
-    t->sp_offset += 8;
+  static Gpr PickTemporary(RegisterSet dead, RegisterSet exclude,
+                           bool* saved) {
+    for (auto r : kTempRegisterOrder) {
+      if (dead.Contains(r) && !exclude.Contains(r)) {
+        *saved = false;
+        return r;
+      }
+    }
+
+    for (auto r : kTempRegisterOrder) {
+      if (!exclude.Contains(r)) {
+        *saved = true;
+        return r;
+      }
+    }
+
+    DCHECK(false);
+    return kNoGpr;
   }
-}
+};
 
 inline void Save(Assembler* a, TempRegisters* t, Gp* reg) {
   a->push(*reg);
   t->sp_offset += 8;
 }
 
-TempRegisters UseSpecifiedRegisters(Assembler *a, MoveInstData* mid, int height = 0) {
-    TempRegisters t(mid, height);
-    if (t.tmp1_saved) Save(a, &t, &t.tmp1);
-    if (t.tmp2_saved) Save(a, &t, &t.tmp2);
-    return t;
+// Picks the temporaries without emitting any code.
+TempRegisters PlanTempRegisters(RegisterSet dead_registers,
+                                RegisterSet exclude = {}, int height = 0) {
+  if (!FLAGS_optimize_regs) {
+    dead_registers = RegisterSet();
+  }
+  return TempRegisters(dead_registers, exclude, height);
 }
 
-TempRegisters SaveTempRegisters(Assembler* a,
-                                std::set<std::string>& dead_registers,
-                                std::set<std::string> exclude = {},
-                                int height = 0) {
-  TempRegisters t(exclude, height);
-  if ((FLAGS_optimize_regs && dead_registers.empty()) || !FLAGS_optimize_regs) {
-    Save(a, &t, &t.tmp1);
-    Save(a, &t, &t.tmp2);
-    // Save(a, &t, &t.tmp3);
-  } else {
-    auto reg = dead_registers.begin();
-    if (reg++ != dead_registers.end()) {
-      SaveOrSkip(a, &t, *reg, &t.tmp1, &t.tmp1_saved);
-    } else {
-      Save(a, &t, &t.tmp1);
-    }
-
-    if (reg++ != dead_registers.end()) {
-      SaveOrSkip(a, &t, *reg, &t.tmp2, &t.tmp2_saved);
-    } else {
-      Save(a, &t, &t.tmp2);
-    }
+void SaveTemporaries(Assembler* a, TempRegisters* t) {
+  if (t->tmp1_saved) Save(a, t, &t->tmp1);
+  if (t->tmp2_saved) Save(a, t, &t->tmp2);
+}
 
-    if (reg++ != dead_registers.end()) {
-      SaveOrSkip(a, &t, *reg, &t.tmp3, &t.tmp3_saved);
-    } else {
-      Save(a, &t, &t.tmp3);
-    }
-  }
+TempRegisters SaveTempRegisters(Assembler* a, RegisterSet dead_registers,
+                                RegisterSet exclude = {}, int height = 0) {
+  TempRegisters t = PlanTempRegisters(dead_registers, exclude, height);
+  SaveTemporaries(a, &t);
+  return t;
+}
 
+// Temporaries recorded in a snippet key.
+TempRegisters KeyTemporaries(const SnippetKey& key) {
+  TempRegisters t;
+  t.tmp1 = kRegisterMap[key.tmp1];
+  t.tmp2 = kRegisterMap[key.tmp2];
+  t.tmp1_saved = key.tmp1_saved;
+  t.tmp2_saved = key.tmp2_saved;
+  t.sp_offset = key.sp_offset;
   return t;
 }
 
 void RestoreTempRegisters(Assembler* a, TempRegisters t) {
-  if (t.tmp3_saved) {
-    // a->pop(t.tmp3);
-  }
-
   if (t.tmp2_saved) {
     a->pop(t.tmp2);
   }
@@ -148,67 +132,84 @@ void RestoreTempRegisters(Assembler* a, TempRegisters t) {
   }
 }
 
+// Compact entries keep the low 32 bits of the return address and frame
+// address. Pushes and pops of a frame agree on the text base and thread stack
+// base, so these compare the same as 32 bit offsets from the bases do, without
+// having to find the bases.
+inline Gp EntryRegister(const Gp& reg, bool compact) {
+  return compact ? reg.r32() : reg;
+}
+
+inline asmjit::x86::Mem EntryPtr(const Gp& base, int offset, bool compact) {
+  return compact ? dword_ptr(base, offset) : qword_ptr(base, offset);
+}
+
 void SaveRa(const asmjit::x86::Mem& shadow_ptr, const Gp& sp_reg,
-            const Gp& ra_reg, const TempRegisters& t, Assembler* a) {
+            const Gp& ra_reg, const TempRegisters& t, Assembler* a,
+            bool compact) {
+  // Leaves the flags alone.
+  //
   // Assembly:
   //
-  //   pushfq
-  //   mov 0x16(%rsp),%rcx
+  //   mov 0x10(%rsp),%rcx
   //   mov %gs:0x0, %rax
-  //   addq $0x8, %gs:0x0
-  //   mov %rcx, (%rax)
-  //   popfq
-  a->mov(ra_reg, ptr(rsp, t.sp_offset));
+  //   mov %rcx, (%rax)             | mov %ecx, (%rax)
+  //   leaq 0x8(%rax), %rax         | leaq 0x4(%rax), %rax
+  //   mov %rax, %gs:0x0
+  int entry_size = compact ? 4 : 8;
+  Gp ra = EntryRegister(ra_reg, compact);
+  a->mov(ra, EntryPtr(rsp, t.sp_offset, compact));
   a->mov(sp_reg, shadow_ptr);
-  a->mov(ptr(sp_reg), ra_reg);
-  a->lea(sp_reg, ptr(sp_reg, 8));
+  a->mov(EntryPtr(sp_reg, 0, compact), ra);
+  a->lea(sp_reg, ptr(sp_reg, entry_size));
   a->mov(shadow_ptr, sp_reg);
 }
 
+// Distance of the parallel shadow stack from the thread stack it mirrors. Must
+// match the offset the runtime maps it at (see runtime.c).
+static constexpr int kParallelShadowOffset = -0x40000000;
+
+void SaveRaParallel(const Gp& ra_reg, const TempRegisters& t, Assembler* a) {
+  // The slot is tied to the address of the return address, so the frame is
+  // validated implicitly and there is no stack pointer to maintain.
+  //
+  // Assembly:
+  //
+  //   mov 0x10(%rsp),%rcx
+  //   mov %rcx, -0x40000000+0x10(%rsp)
+  a->mov(ra_reg, ptr(rsp, t.sp_offset));
+  a->mov(ptr(rsp, kParallelShadowOffset + t.sp_offset), ra_reg);
+}
+
 void SaveRaAndFrame(const asmjit::x86::Mem& shadow_ptr, const Gp& sp_reg,
-                    const Gp& ra_reg, const TempRegisters& t, Assembler* a) {
+                    const Gp& ra_reg, const TempRegisters& t, Assembler* a,
+                    bool compact) {
+  // Only uses instructions which leave the flags alone, so they need not be
+  // saved. The frame is the address of the return address.
+  //
   // Assembly:
   //
-  //   pushfq
-  //   mov 0x16(%rsp),%rcx
+  //   mov 0x10(%rsp),%rcx
   //   mov %gs:0x0, %rax
-  //   addq $0x16, %gs:0x0
-  //   mov %rcx, (%rax)
-  //   leaq rcx, 0x10(%rsp)
-  //   mov %rcx, 0x8(%rax)
-  //   popfq
-  a->pushfq();
-  a->mov(ra_reg, ptr(rsp, t.sp_offset));
+  //   mov %rcx, (%rax)             | mov %ecx, (%rax)
+  //   leaq 0x10(%rsp), %rcx
+  //   mov %rcx, 0x8(%rax)          | mov %ecx, 0x4(%rax)
+  //   leaq 0x10(%rax), %rax        | leaq 0x8(%rax), %rax
+  //   mov %rax, %gs:0x0
+  int entry_size = compact ? 4 : 8;
+  Gp ra = EntryRegister(ra_reg, compact);
+  a->mov(ra, EntryPtr(rsp, t.sp_offset, compact));
   a->mov(sp_reg, shadow_ptr);
-  a->add(shadow_ptr, asmjit::imm(16));
-  a->mov(ptr(sp_reg), ra_reg);
-  a->lea(ra_reg, ptr(rsp, 24));
-  a->mov(ptr(sp_reg, 8), ra_reg);
-  a->popfq();
+  a->mov(EntryPtr(sp_reg, 0, compact), ra);
+  a->lea(ra_reg, ptr(rsp, t.sp_offset));
+  a->mov(EntryPtr(sp_reg, entry_size, compact), ra);
+  a->lea(sp_reg, ptr(sp_reg, 2 * entry_size));
+  a->mov(shadow_ptr, sp_reg);
 }
 
-std::string JitStackPush(Dyninst::PatchAPI::Point* pt, FuncSummary* s,
-                         AssemblerHolder& ah, bool useOriginalCode, int height, bool useOriginalCodeFixed) {
-  if (FLAGS_dry_run == "empty") return "";
-  Assembler* a = ah.GetAssembler();
-  TempRegisters t;
-  MoveInstData* mid = nullptr;
-  if (useOriginalCode) {
-      Address blockEntry = pt->block()->start();
-      mid = s->getMoveInstDataAtEntry(blockEntry);
-  } else if (useOriginalCodeFixed) {
-      Address blockEntry = pt->edge()->trg()->start();
-      mid = s->getMoveInstDataFixedAtEntry(blockEntry);
-  }
-  
-  if (mid != nullptr) {
-      t = UseSpecifiedRegisters(a, mid, height);
-  } else if (s != nullptr) {
-    t = SaveTempRegisters(a, s->dead_at_entry, {}, height);
-  } else {
-    std::set<std::string> dead;
-    t = SaveTempRegisters(a, dead);
-  }
+void EmitStackPush(const SnippetKey& key, Assembler* a) {
+  TempRegisters t = KeyTemporaries(key);
+  SaveTemporaries(a, &t);
 
   Gp sp_reg = t.tmp1;
   Gp ra_reg = t.tmp2;
@@ -217,150 +218,169 @@ std::string JitStackPush(Dyninst::PatchAPI::Point* pt, FuncSummary* s,
   shadow_ptr.setSize(8);
   shadow_ptr.setSegment(gs);
   shadow_ptr = shadow_ptr.cloneAdjusted(0);
-  if (FLAGS_dry_run != "only-save") {
-    if (FLAGS_validate_frame) {
-      SaveRaAndFrame(shadow_ptr, sp_reg, ra_reg, t, a);
+  if (key.dry_run != "only-save") {
+    if (key.parallel) {
+      SaveRaParallel(ra_reg, t, a);
+    } else if (key.validate_frame) {
+      SaveRaAndFrame(shadow_ptr, sp_reg, ra_reg, t, a, key.compact_entries);
     } else {
-      SaveRa(shadow_ptr, sp_reg, ra_reg, t, a);
+      SaveRa(shadow_ptr, sp_reg, ra_reg, t, a, key.compact_entries);
     }
   }
 
   RestoreTempRegisters(a, t);
+}
 
-  return "";
+// Slots at the base of the shadow stack segment holding the addresses of the
+// unwind stubs of the runtime (see runtime.c). The stubs are shared by all
+// pops, so that only the compare of the common case is inlined.
+//
+// Stubs take the return address, or its address when validating frames, as a
+// stack argument, preserve all registers but the flags and pop the argument.
+// Compact entries have stubs of their own at kCompactStubSlots past the
+// others.
+static constexpr int kUnwindStubSlot = 0x10;
+static constexpr int kUnwindFrameStubSlot = 0x18;
+static constexpr int kUnwindRegisterStubSlot = 0x20;
+static constexpr int kCompactStubSlots = 0x18;
+
+inline int StubSlot(int slot, bool compact) {
+  return compact ? slot + kCompactStubSlots : slot;
+}
+
+asmjit::x86::Mem SegmentSlot(int offset) {
+  asmjit::x86::Mem slot;
+  slot.setSize(8);
+  slot.setSegment(gs);
+  return slot.cloneAdjusted(offset);
 }
 
 void ValidateRa(const asmjit::x86::Mem& shadow_ptr, const Gp& sp_reg,
                 const Gp& ra_reg, const TempRegisters& t, Assembler* a,
-                bool save_flags = true) {
-  asmjit::Label error = a->newLabel();
+                bool save_flags, bool compact) {
   asmjit::Label done = a->newLabel();
-  asmjit::Label loop = a->newLabel();
+  int ra_offset = t.sp_offset + (save_flags ? 8 : 0);
+  int entry_size = compact ? 4 : 8;
+  Gp ra = EntryRegister(ra_reg, compact);
 
+  // On a mismatch the stub unwinds the rest of the shadow stack, starting
+  // from the entry popped here.
+  //
   // Assembly:
   //
   //   [pushfq]
   //   mov %gs:0x0,%rax
-  // loop:
-  //   mov -0x8(%rax), %rcx
-  //   subq $0x8, %gs:0x0
-  //   cmp 0x16(%rsp), %rcx
+  //   lea -0x8(%rax), %rax         | lea -0x4(%rax), %rax
+  //   mov %rax, %gs:0x0
+  //   mov (%rax), %rcx             | mov (%rax), %ecx
+  //   cmp 0x16(%rsp), %rcx         | cmp 0x16(%rsp), %ecx
   //   je done
-  //   sub $0x8, %rax
-  //   cmpl $0x0, (%rax)
-  //   je error
-  //   jmp loop
-  // error:
-  //   int3 | sigill
+  //   push 0x16(%rsp)
+  //   call *%gs:0x10               | call *%gs:0x28
   // done:
   //   [popfq]
 
+  if (save_flags)
+    a->pushfq();
   a->mov(sp_reg, shadow_ptr);
-
-  a->bind(loop);
-  a->lea(sp_reg, ptr(sp_reg, -8));
-  a->mov(ra_reg, ptr(sp_reg));
+  a->lea(sp_reg, ptr(sp_reg, -entry_size));
   a->mov(shadow_ptr, sp_reg);
-  a->cmp(ra_reg, ptr(rsp, t.sp_offset));
+  a->mov(ra, EntryPtr(sp_reg, 0, compact));
+  a->cmp(ra, EntryPtr(rsp, ra_offset, compact));
   a->je(done);
 
-  a->cmp(dword_ptr(sp_reg), 0);
-  a->je(error);
-
-  a->jmp(loop);
-
-  a->bind(error);
-  // Cause a SIGILL instead of SIGTRAP to ease debuggability with GDB.
-  const char sigill = 0x62;
-  a->embed(&sigill, sizeof(char));
+  a->push(qword_ptr(rsp, ra_offset));
+  a->call(SegmentSlot(StubSlot(kUnwindStubSlot, compact)));
 
   a->bind(done);
+  if (save_flags)
+    a->popfq();
 }
 
 void ValidateRaAndFrame(const asmjit::x86::Mem& shadow_ptr, const Gp& sp_reg,
-                        const Gp& ra_reg, const TempRegisters& t,
-                        Assembler* a) {
-  asmjit::Label error = a->newLabel();
+                        const Gp& ra_reg, const TempRegisters& t, Assembler* a,
+                        bool save_flags, bool compact) {
   asmjit::Label done = a->newLabel();
-  asmjit::Label loop = a->newLabel();
   asmjit::Label unwind = a->newLabel();
+  int ra_offset = t.sp_offset + (save_flags ? 8 : 0);
+  int entry_size = compact ? 4 : 8;
+  Gp ra = EntryRegister(ra_reg, compact);
 
   // Assembly:
   //
-  //   pushfq
+  //   [pushfq]
   //   mov %gs:0x0,%rax
-  // loop:
-  //   mov -0x10(%rax), %rcx
-  //   subq $0x10, %gs:0x0
-  //   cmp 0x16(%rsp), %rcx
+  //   lea -0x10(%rax), %rax        | lea -0x8(%rax), %rax
+  //   mov %rax, %gs:0x0
+  //   mov (%rax), %rcx             | mov (%rax), %ecx
+  //   cmp 0x16(%rsp), %rcx         | cmp 0x16(%rsp), %ecx
   //   jne unwind
   //   leaq 0x16(%rsp), %rcx
-  //   cmp -0x8(%rax), %rcx
-  //   je success
+  //   cmp 0x8(%rax), %rcx          | cmp 0x4(%rax), %ecx
+  //   je done
   // unwind:
-  //   sub $0x10, %rax
-  //   cmpl $0x0, (%rax)
-  //   je error
-  //   jmp loop
-  // error:
-  //   int3 | sigill
+  //   leaq 0x16(%rsp), %rax
+  //   push %rax
+  //   call *%gs:0x18               | call *%gs:0x30
   // done:
-  //   popfq
-  //   pop ...
-  //   retq
-  a->pushfq();
+  //   [popfq]
+  if (save_flags)
+    a->pushfq();
   a->mov(sp_reg, shadow_ptr);
-
-  a->bind(loop);
-  a->mov(ra_reg, ptr(sp_reg, -16));
-  a->sub(shadow_ptr, asmjit::imm(16));
-  a->cmp(ra_reg, ptr(rsp, t.sp_offset));
+  a->lea(sp_reg, ptr(sp_reg, -2 * entry_size));
+  a->mov(shadow_ptr, sp_reg);
+  a->mov(ra, EntryPtr(sp_reg, 0, compact));
+  a->cmp(ra, EntryPtr(rsp, ra_offset, compact));
   a->jne(unwind);
-  a->lea(ra_reg, ptr(rsp, t.sp_offset));
-  a->cmp(ra_reg, ptr(sp_reg, -8));
+  a->lea(ra_reg, ptr(rsp, ra_offset));
+  a->cmp(ra, EntryPtr(sp_reg, entry_size, compact));
   a->je(done);
 
   a->bind(unwind);
-  a->sub(sp_reg, asmjit::imm(16));
-  a->cmp(dword_ptr(sp_reg), 0);
-  a->je(error);
-  a->jmp(loop);
+  a->lea(sp_reg, ptr(rsp, ra_offset));
+  a->push(sp_reg);
+  a->call(SegmentSlot(StubSlot(kUnwindFrameStubSlot, compact)));
+
+  a->bind(done);
+  if (save_flags)
+    a->popfq();
+}
+
+void ValidateRaParallel(const Gp& ra_reg, const TempRegisters& t,
+                        Assembler* a, bool save_flags) {
+  asmjit::Label done = a->newLabel();
+  int ra_offset = t.sp_offset + (save_flags ? 8 : 0);
+
+  // Frames skipped by a longjmp or an exception leave nothing behind to
+  // unwind, so a mismatch is always a violation.
+  //
+  // Assembly:
+  //
+  //   [pushfq]
+  //   mov 0x10(%rsp), %rcx
+  //   cmp -0x40000000+0x10(%rsp), %rcx
+  //   je done
+  //   sigill
+  // done:
+  //   [popfq]
+  if (save_flags)
+    a->pushfq();
+  a->mov(ra_reg, ptr(rsp, ra_offset));
+  a->cmp(ra_reg, ptr(rsp, kParallelShadowOffset + ra_offset));
+  a->je(done);
 
-  a->bind(error);
   // Cause a SIGILL instead of SIGTRAP to ease debuggability with GDB.
   const char sigill = 0x62;
   a->embed(&sigill, sizeof(char));
 
   a->bind(done);
-  a->popfq();
+  if (save_flags)
+    a->popfq();
 }
 
-std::string JitStackPop(Dyninst::PatchAPI::Point* pt, FuncSummary* s,
-                        AssemblerHolder& ah, bool useOriginalCode, int, bool) {
-  if (FLAGS_dry_run == "empty") return "";
-  Assembler* a = ah.GetAssembler();
-
-  TempRegisters t;
-  MoveInstData* mid = nullptr;
-  if (useOriginalCode) {
-      Address blockEntry = pt->block()->start();
-      mid = s->getMoveInstDataAtExit(blockEntry);
-  }
-  
-  if (mid != nullptr) {
-      t = UseSpecifiedRegisters(a, mid);
-  } else if (s != nullptr) {
-    auto it = s->dead_at_exit.find(pt->addr());
-    if (it != s->dead_at_exit.end()) {
-      t = SaveTempRegisters(a, it->second);
-    } else {
-      std::set<std::string> dead;
-      t = SaveTempRegisters(a, dead);
-    }
-  } else {
-    std::set<std::string> dead;
-    t = SaveTempRegisters(a, dead);
-  }
+void EmitStackPop(const SnippetKey& key, Assembler* a) {
+  TempRegisters t = KeyTemporaries(key);
+  SaveTemporaries(a, &t);
 
   Gp sp_reg = t.tmp1;
   Gp ra_reg = t.tmp2;
@@ -369,34 +389,29 @@ std::string JitStackPop(Dyninst::PatchAPI::Point* pt, FuncSummary* s,
   shadow_ptr.setSize(8);
   shadow_ptr.setSegment(gs);
   shadow_ptr = shadow_ptr.cloneAdjusted(0);
-  if (FLAGS_dry_run != "only-save") {
-    if (FLAGS_validate_frame) {
-      ValidateRaAndFrame(shadow_ptr, sp_reg, ra_reg, t, a);
+  if (key.dry_run != "only-save") {
+    if (key.parallel) {
+      ValidateRaParallel(ra_reg, t, a, key.save_flags);
+    } else if (key.validate_frame) {
+      ValidateRaAndFrame(shadow_ptr, sp_reg, ra_reg, t, a, key.save_flags,
+                         key.compact_entries);
     } else {
-      ValidateRa(shadow_ptr, sp_reg, ra_reg, t, a);
+      ValidateRa(shadow_ptr, sp_reg, ra_reg, t, a, key.save_flags,
+                 key.compact_entries);
     }
   }
 
   RestoreTempRegisters(a, t);
-
-  return "";
 }
 
-std::pair<std::string, Gp> GetUnusedRegister(FuncSummary* s) {
-  DCHECK(s->unused_regs.size() > 0);
-  auto it = s->unused_regs.cbegin();
-
-  auto rit = kRegisterMap.find(*it);
-  DCHECK(rit != kRegisterMap.end());
-
-  return std::make_pair(*it, rit->second);
+std::pair<Gpr, Gp> GetUnusedRegister(FuncSummary* s) {
+  DCHECK(!s->unused_regs.Empty());
+  Gpr reg = s->unused_regs.First();
+  return std::make_pair(reg, kRegisterMap[reg]);
 }
 
-std::string JitRegisterPush(Dyninst::PatchAPI::Point* pt, FuncSummary* s,
-                            AssemblerHolder& ah, bool, int height, bool) {
-  if (FLAGS_dry_run == "empty") return "";
-  auto pair = GetUnusedRegister(s);
-  Gp reg = pair.second;
+void EmitRegisterPush(const SnippetKey& key, Assembler* a) {
+  Gp reg = kRegisterMap[key.tmp1];
 
   // Assembly:
   //
@@ -404,7 +419,6 @@ std::string JitRegisterPush(Dyninst::PatchAPI::Point* pt, FuncSummary* s,
   //   pushfq
   //   mov 0x10(%rsp),%<unused_reg>
   //   popfq
-  Assembler* a = ah.GetAssembler();
   //a->push(reg);
   //a->pushfq();
   asmjit::x86::Mem scratch;
@@ -413,75 +427,211 @@ std::string JitRegisterPush(Dyninst::PatchAPI::Point* pt, FuncSummary* s,
   scratch = scratch.cloneAdjusted(8);
 
   a->mov(scratch, reg);
-  if (FLAGS_dry_run != "only-save")
-    a->mov(reg, ptr(rsp, height));
+  if (key.dry_run != "only-save")
+    a->mov(reg, ptr(rsp, key.sp_offset));
   //a->popfq();
-
-  return "";
 }
 
-std::string JitRegisterPop(Dyninst::PatchAPI::Point* pt, FuncSummary* s,
-                           AssemblerHolder& ah, bool, int, bool) {
-  if (FLAGS_dry_run == "empty") return "";
-  // Here we rely on the fact that stl::set iteration order is deterministic
-  // across multiple invocations (i.e: we will get the same register that we got
-  // during stack push using the iterator).
-  auto pair = GetUnusedRegister(s);
-  std::string reg_str = pair.first;
-  Gp reg = pair.second;
+void EmitRegisterPop(const SnippetKey& key, Assembler* a) {
+  Gpr unused = static_cast<Gpr>(key.tmp1);
+  Gp reg = kRegisterMap[unused];
 
+  // The register frame only misses when frames have been skipped, e.g. by a
+  // longjmp. The stub then unwinds the shadow stack of the enclosing
+  // functions.
+  //
   // Assembly:
   //
-  //   pushfq
-  //   cmp %<unused_reg>, 0x10(%rsp)
+  //   [pushfq]
+  //   cmp %<unused_reg>, 0x8(%rsp)
   //   je success
-  //   push %rcx                        ; begin stack unwinding
-  //   push %rax
-  //   mov %gs:0x0,%rax
-  // loop:
-  //   mov -0x8(%rax), %rcx
-  //   subq $0x8, %gs:0x0
-  //   cmp 0x20(%rsp), %rcx
-  //   je done
-  //   sub $0x8, %rax
-  //   cmpl $0x0, (%rax)
-  //   je error
-  //   jmp loop
-  // error:
-  //   int3 | sigill
-  // done:
-  //   pop %rax
-  //   pop %rcx                         ; end stack unwinding
+  //   push 0x8(%rsp)
+  //   call *%gs:0x20               | call *%gs:0x38
   // success:
-  //   popfq
-  //   pop %<unused_reg>
-  Assembler* a = ah.GetAssembler();
-  if (FLAGS_dry_run != "only-save") {
+  //   [popfq]
+  //   mov %gs:0x8, %<unused_reg>
+  if (key.dry_run != "only-save") {
     asmjit::Label success = a->newLabel();
+    int ra_offset = 0;
 
-    a->cmp(reg, ptr(rsp));
+    if (key.save_flags) {
+      a->pushfq();
+      ra_offset = 8;
+    }
+    a->cmp(reg, ptr(rsp, ra_offset));
     a->je(success);
 
-    // Fall through for stack unwind scenario.
-    std::set<std::string> dead;
-    TempRegisters t = SaveTempRegisters(a, dead, {reg_str});
-
-    Gp sp_reg = t.tmp1;
-    Gp ra_reg = t.tmp2;
-
-    asmjit::x86::Mem shadow_ptr;
-    shadow_ptr.setSize(8);
-    shadow_ptr.setSegment(gs);
-    shadow_ptr = shadow_ptr.cloneAdjusted(0);
-    ValidateRa(shadow_ptr, sp_reg, ra_reg, t, a, false /* save_flags */);
-    RestoreTempRegisters(a, t);
+    a->push(qword_ptr(rsp, ra_offset));
+    a->call(SegmentSlot(
+        StubSlot(kUnwindRegisterStubSlot, key.compact_entries)));
 
     a->bind(success);
+    if (key.save_flags)
+      a->popfq();
   }
   asmjit::x86::Mem scratch;
   scratch.setSize(8);
   scratch.setSegment(gs);
   scratch = scratch.cloneAdjusted(8);
   a->mov(reg, scratch);
-  return "";
+}
+
+// Fills in the settings common to all snippets.
+static SnippetKey NewKey(SnippetOp op) {
+  SnippetKey key;
+  key.op = op;
+  key.tmp1 = 0;
+  key.tmp2 = 0;
+  key.tmp1_saved = false;
+  key.tmp2_saved = false;
+  key.sp_offset = 0;
+  key.save_flags = false;
+  key.parallel = FLAGS_shadow_stack_layout == "parallel";
+  key.validate_frame = FLAGS_validate_frame && !key.parallel;
+  key.compact_entries = FLAGS_compact_entries && !key.parallel;
+  key.dry_run = FLAGS_dry_run;
+  return key;
+}
+
+static void SetTemporaries(const TempRegisters& t, SnippetKey* key) {
+  key->tmp1 = t.tmp1.id();
+  key->tmp2 = t.tmp2.id();
+  key->tmp1_saved = t.tmp1_saved;
+  key->tmp2_saved = t.tmp2_saved;
+  key->sp_offset = t.sp_offset;
+
+  // The parallel layout gets by with a single temporary.
+  if (key->parallel) {
+    key->tmp2 = key->tmp1;
+    key->tmp2_saved = false;
+  }
+}
+
+SnippetKey StackPushKey(Dyninst::PatchAPI::Point* pt, FuncSummary* s,
+                        bool useOriginalCode, int height,
+                        bool useOriginalCodeFixed) {
+  SnippetKey key = NewKey(SnippetOp::kStackPush);
+  MoveInstData* mid = nullptr;
+  if (useOriginalCode) {
+      Address blockEntry = pt->block()->start();
+      mid = s->getMoveInstDataAtEntry(blockEntry);
+  } else if (useOriginalCodeFixed) {
+      Address blockEntry = pt->edge()->trg()->start();
+      mid = s->getMoveInstDataFixedAtEntry(blockEntry);
+  }
+
+  if (mid != nullptr) {
+    SetTemporaries(TempRegisters(mid, height), &key);
+  } else if (s != nullptr) {
+    SetTemporaries(PlanTempRegisters(s->dead_at_entry, {}, height), &key);
+  } else {
+    SetTemporaries(PlanTempRegisters(RegisterSet()), &key);
+  }
+  return key;
+}
+
+static bool FlagsLiveAtPop(Dyninst::PatchAPI::Point* pt, FuncSummary* s) {
+  if (pt->block() == nullptr)
+    return true;
+  return FlagsLiveAtPop(pt->block()->end(), s);
+}
+
+SnippetKey StackPopKey(Dyninst::PatchAPI::Point* pt, FuncSummary* s,
+                       bool useOriginalCode, int height, bool) {
+  SnippetKey key = NewKey(SnippetOp::kStackPop);
+  key.save_flags = FlagsLiveAtPop(pt, s);
+  MoveInstData* mid = nullptr;
+  if (useOriginalCode) {
+      Address blockEntry = pt->block()->start();
+      mid = s->getMoveInstDataAtExit(blockEntry);
+  }
+
+  if (mid != nullptr) {
+    SetTemporaries(TempRegisters(mid, height), &key);
+  } else if (s != nullptr) {
+    auto it = s->dead_at_exit.find(pt->addr());
+    if (it != s->dead_at_exit.end()) {
+      SetTemporaries(PlanTempRegisters(it->second, {}, height), &key);
+    } else {
+      SetTemporaries(PlanTempRegisters(RegisterSet(), {}, height), &key);
+    }
+  } else {
+    SetTemporaries(PlanTempRegisters(RegisterSet(), {}, height), &key);
+  }
+  return key;
+}
+
+SnippetKey RegisterPushKey(Dyninst::PatchAPI::Point* pt, FuncSummary* s, bool,
+                           int height, bool) {
+  SnippetKey key = NewKey(SnippetOp::kRegisterPush);
+  key.tmp1 = GetUnusedRegister(s).first;
+  key.sp_offset = height;
+  return key;
+}
+
+SnippetKey RegisterPopKey(Dyninst::PatchAPI::Point* pt, FuncSummary* s, bool,
+                          int, bool) {
+  // Here we rely on GetUnusedRegister always picking the lowest numbered unused
+  // register (i.e: we will get the same register that we got during stack
+  // push).
+  SnippetKey key = NewKey(SnippetOp::kRegisterPop);
+  key.tmp1 = GetUnusedRegister(s).first;
+  key.save_flags = FlagsLiveAtPop(pt, s);
+  return key;
+}
+
+static void EmitSnippet(const SnippetKey& key, Assembler* a) {
+  if (key.dry_run == "empty")
+    return;
+  switch (key.op) {
+    case SnippetOp::kStackPush:
+      EmitStackPush(key, a);
+      break;
+    case SnippetOp::kStackPop:
+      EmitStackPop(key, a);
+      break;
+    case SnippetOp::kRegisterPush:
+      EmitRegisterPush(key, a);
+      break;
+    case SnippetOp::kRegisterPop:
+      EmitRegisterPop(key, a);
+      break;
+  }
+}
+
+static std::mutex snippet_mu;
+static std::map<SnippetKey, std::vector<char>> snippet_cache;
+static long snippet_hits = 0;
+
+const std::vector<char>& SnippetCode(const SnippetKey& key) {
+  std::lock_guard<std::mutex> lock(snippet_mu);
+  auto it = snippet_cache.find(key);
+  if (it != snippet_cache.end()) {
+    snippet_hits++;
+    return it->second;
+  }
+
+  // The snippets only address memory relative to the stack pointer and the
+  // shadow stack segment, so the code does not depend on where it goes.
+  AssemblerHolder ah(FLAGS_vv);
+  EmitSnippet(key, ah.GetAssembler());
+
+  asmjit::CodeHolder* code = ah.GetCode();
+  std::vector<char> bytes(code->codeSize());
+  code->relocateToBase(reinterpret_cast<uint64_t>(bytes.data()));
+  bytes.resize(code->codeSize());
+  code->copyFlattenedData(bytes.data(), bytes.size(),
+                          asmjit::CodeHolder::kCopyWithPadding);
+
+  if (ah.GetStringLogger() != nullptr) {
+    StdOut(Color::BLUE, FLAGS_vv) << "      Snippet template "
+                                  << snippet_cache.size() << " :\n"
+                                  << ah.GetStringLogger()->data() << Endl;
+  }
+  return snippet_cache.emplace(key, std::move(bytes)).first->second;
+}
+
+SnippetCacheStats GetSnippetCacheStats() {
+  std::lock_guard<std::mutex> lock(snippet_mu);
+  return {static_cast<long>(snippet_cache.size()), snippet_hits};
 }
@@ -2,23 +2,90 @@
 #ifndef LITECFI_JIT_H_
 #define LITECFI_JIT_H_
 
+#include <cstdint>
 #include <string>
+#include <tuple>
+#include <vector>
 
 #include "Point.h"
-#include "asmjit/asmjit.h"
-#include "assembler.h"
 #include "pass_manager.h"
 
-std::string JitStackPush(Dyninst::PatchAPI::Point* pt, FuncSummary* s,
-                         AssemblerHolder& ah, bool, int, bool);
+// Kinds of shadow stack snippets.
+enum class SnippetOp { kStackPush, kStackPop, kRegisterPush, kRegisterPop };
 
-std::string JitStackPop(Dyninst::PatchAPI::Point* pt, FuncSummary* s,
-                        AssemblerHolder& ah, bool, int, bool);
+// Everything the code of a snippet depends on. Instrumentation points with
+// equal keys get identical code, which is only assembled once.
+struct SnippetKey {
+  SnippetOp op;
+  // Temporary registers, or the unused register for register frames.
+  uint32_t tmp1;
+  uint32_t tmp2;
+  bool tmp1_saved;
+  bool tmp2_saved;
+  // Offset of the return address from the stack pointer before saving the
+  // temporaries.
+  int sp_offset;
+  // Whether the flags are live across the snippet.
+  bool save_flags;
+  bool validate_frame;
+  // Whether shadow stack entries are 32 bits wide.
+  bool compact_entries;
+  // Whether return addresses are mirrored at a fixed offset from the stack
+  // instead of being pushed to the compact shadow stack.
+  bool parallel;
+  std::string dry_run;
 
-std::string JitRegisterPush(Dyninst::PatchAPI::Point* pt, FuncSummary* s,
-                            AssemblerHolder& ah, bool, int, bool);
+  bool operator==(const SnippetKey& other) const {
+    return std::tie(op, tmp1, tmp2, tmp1_saved, tmp2_saved, sp_offset,
+                    save_flags, validate_frame, compact_entries, parallel,
+                    dry_run) ==
+           std::tie(other.op, other.tmp1, other.tmp2, other.tmp1_saved,
+                    other.tmp2_saved, other.sp_offset, other.save_flags,
+                    other.validate_frame, other.compact_entries,
+                    other.parallel, other.dry_run);
+  }
 
-std::string JitRegisterPop(Dyninst::PatchAPI::Point* pt, FuncSummary* s,
-                           AssemblerHolder& ah, bool, int, bool);
+  bool operator<(const SnippetKey& other) const {
+    return std::tie(op, tmp1, tmp2, tmp1_saved, tmp2_saved, sp_offset,
+                    save_flags, validate_frame, compact_entries, parallel,
+                    dry_run) <
+           std::tie(other.op, other.tmp1, other.tmp2, other.tmp1_saved,
+                    other.tmp2_saved, other.sp_offset, other.save_flags,
+                    other.validate_frame, other.compact_entries,
+                    other.parallel, other.dry_run);
+  }
+};
+
+// Number of distinct snippets assembled and of points reusing one of them.
+struct SnippetCacheStats {
+  long templates;
+  long hits;
+};
+
+// Pops compare and so change the flags. Skip saving them only where the dead
+// register analysis found them dead at the pop ending the block at block_end.
+// Functions it skipped, such as those assumed unsafe, save them anyway.
+inline bool FlagsLiveAtPop(Address block_end, const FuncSummary* s) {
+  if (s == nullptr || !s->flags_analyzed)
+    return true;
+  return s->flags_live_at_end.find(block_end) != s->flags_live_at_end.end();
+}
+
+SnippetKey StackPushKey(Dyninst::PatchAPI::Point* pt, FuncSummary* s, bool,
+                        int, bool);
+
+SnippetKey StackPopKey(Dyninst::PatchAPI::Point* pt, FuncSummary* s, bool, int,
+                       bool);
+
+SnippetKey RegisterPushKey(Dyninst::PatchAPI::Point* pt, FuncSummary* s, bool,
+                           int, bool);
+
+SnippetKey RegisterPopKey(Dyninst::PatchAPI::Point* pt, FuncSummary* s, bool,
+                          int, bool);
+
+// Returns the code of the snippet, assembling it on first use.
+const std::vector<char>& SnippetCode(const SnippetKey& key);
+
+SnippetCacheStats GetSnippetCacheStats();
 
 #endif  // LITECFI_JIT_H_
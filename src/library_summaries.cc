@@ -0,0 +1,101 @@
+#include "library_summaries.h"
+
+#include <fstream>
+#include <sstream>
+
+#include "utils.h"
+
+namespace {
+
+// PLT callees known not to write to the stack of their caller. Only consulted
+// for symbols without an imported summary.
+bool IsKnownSafeSymbol(const std::string& name) {
+  if (name == "malloc")
+    return true;
+
+  // C++ new operators
+  if (name.find("_Zna") == 0)
+    return true;
+
+  if (name == "strlen")
+    return true;
+  if (name == "strcmp")
+    return true;
+  return false;
+}
+
+// Strips the symbol version, if any, from a symbol name (e.g. memcpy@GLIBC_2.14
+// to memcpy).
+std::string StripVersion(const std::string& name) {
+  size_t pos = name.find('@');
+  if (pos == std::string::npos || pos == 0)
+    return name;
+  return name.substr(0, pos);
+}
+
+}  // namespace
+
+bool LibrarySummaries::Load(const std::string& path) {
+  std::ifstream in(path);
+  if (!in)
+    return false;
+
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+
+    std::istringstream fields(line);
+    std::string name;
+    int writes, exception_safe, invokes_callbacks;
+    if (!(fields >> name >> writes >> exception_safe >> invokes_callbacks))
+      continue;
+
+    Symbol& sym = symbols_[name];
+    sym.writes = writes;
+    sym.exception_safe = exception_safe;
+    sym.invokes_callbacks = invokes_callbacks;
+  }
+  return true;
+}
+
+void LibrarySummaries::LoadAll(const std::string& paths) {
+  for (auto& path : Split(paths, ',')) {
+    if (path.empty())
+      continue;
+    if (!Load(path)) {
+      StdOut(Color::RED) << "Unable to read library summaries from " << path
+                         << Endl;
+    }
+  }
+}
+
+bool LibrarySummaries::Save(const std::string& path,
+                            const std::map<std::string, Symbol>& symbols) {
+  std::ofstream out(path);
+  if (!out)
+    return false;
+
+  out << "# <symbol> <writes> <exception_safe> <invokes_callbacks>\n";
+  for (auto& it : symbols) {
+    out << it.first << " " << it.second.writes << " "
+        << it.second.exception_safe << " " << it.second.invokes_callbacks
+        << "\n";
+  }
+  return static_cast<bool>(out);
+}
+
+LibrarySummaries::Symbol LibrarySummaries::Lookup(
+    const std::string& name) const {
+  auto it = symbols_.find(name);
+  if (it == symbols_.end())
+    it = symbols_.find(StripVersion(name));
+  if (it != symbols_.end())
+    return it->second;
+
+  Symbol sym;
+  sym.writes = !IsKnownSafeSymbol(StripVersion(name));
+  sym.exception_safe = false;
+  sym.invokes_callbacks = sym.writes;
+  return sym;
+}
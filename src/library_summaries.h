@@ -0,0 +1,64 @@
+#ifndef LITECFI_LIBRARY_SUMMARIES_H_
+#define LITECFI_LIBRARY_SUMMARIES_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Analysis summaries of the functions exported by shared libraries.
+//
+// Calls through the PLT leave the analysed object, so the passes cannot tell
+// what the callee does. Instead of assuming the worst for every such call, a
+// shared library can be analysed once with the regular pass pipeline and the
+// summaries of its exported functions written out to a summary file. Summary
+// files are then imported when analysing the objects linking against the
+// library and PLT calls are resolved against them by callee name.
+//
+// Summary file format is line based text, one symbol per line:
+//
+//   <symbol> <writes> <exception_safe> <invokes_callbacks>
+//
+// where the flags are 0 or 1. Empty lines and lines starting with '#' are
+// ignored.
+class LibrarySummaries {
+ public:
+  struct Symbol {
+    // Symbol may write to the stack above its frame.
+    bool writes;
+    // Symbol never throws or propagates an exception.
+    bool exception_safe;
+    // Symbol may call back into code outside of the library, e.g. through a
+    // function pointer argument.
+    bool invokes_callbacks;
+  };
+
+  // Reads in the summaries of a summary file. Summaries of symbols which are
+  // already known are overwritten. Returns false if the file cannot be read.
+  bool Load(const std::string& path);
+
+  // Reads in the summaries of a comma separated list of summary files.
+  void LoadAll(const std::string& paths);
+
+  // Writes the given summaries out to a summary file.
+  static bool Save(const std::string& path,
+                   const std::map<std::string, Symbol>& symbols);
+
+  // Returns the summary of the named PLT callee. Symbols without an imported
+  // summary fall back to a small set of known safe libc functions and are
+  // otherwise assumed to write, throw and invoke callbacks.
+  Symbol Lookup(const std::string& name) const;
+
+  // Denotes whether a call to the named PLT callee is known not to write to the
+  // stack above the caller's frame.
+  bool IsSafeCall(const std::string& name) const {
+    Symbol sym = Lookup(name);
+    return !sym.writes && !sym.invokes_callbacks;
+  }
+
+  size_t size() const { return symbols_.size(); }
+
+ private:
+  std::map<std::string, Symbol> symbols_;
+};
+
+#endif  // LITECFI_LIBRARY_SUMMARIES_H_
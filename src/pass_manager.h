@@ -1,16 +1,25 @@
 #ifndef LITECFI_PASS_MANAGER_H_
 #define LITECFI_PASS_MANAGER_H_
 
+#include <algorithm>
 #include <chrono>
+#include <climits>
 #include <fstream>
 #include <map>
 #include <set>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "CodeObject.h"
 #include "DynAST.h"
+#include "analysis_budget.h"
+#include "arena.h"
+#include "call_graph.h"
+#include "function_context.h"
 #include "gflags/gflags.h"
+#include "register_utils.h"
+#include "thread_pool.h"
 #include "utils.h"
 
 using Dyninst::Address;
@@ -24,6 +33,9 @@ using Dyninst::ParseAPI::Function;
 using Dyninst::ParseAPI::RET;
 
 DECLARE_bool(vv);
+DECLARE_int32(analysis_threads);
+DECLARE_bool(parallel_passes);
+DECLARE_int32(slowest_functions);
 DECLARE_string(stats);
 
 extern std::set<Address> exception_free_func;
@@ -34,8 +46,8 @@ struct MoveInstData {
   int raOffset;
 
   int saveCount;
-  std::string reg1;
-  std::string reg2;
+  Gpr reg1;
+  Gpr reg2;
 };
 
 struct MemoryWrite {
@@ -48,7 +60,8 @@ struct MemoryWrite {
     global(false),
     heap(false),
     arg(false),
-    heap_or_arg(false) {}
+    heap_or_arg(false),
+    indexed(false) {}
 
   // Memory write coordinate information.
   Instruction ins;
@@ -76,6 +89,9 @@ struct MemoryWrite {
   bool arg;
   // Denotes if it is heap or arg-specified memory location
   bool heap_or_arg;
+  // Denotes if this is a stack write at a variable offset, bounded to stay
+  // below the return address.
+  bool indexed;
 
 };
 
@@ -143,6 +159,30 @@ struct StackAccess {
   int dest;
 };
 
+// Where the pointer arguments passed at a call site may point to, as seen by
+// the caller.
+struct CallSiteArgs {
+  CallSiteArgs() {
+    for (int r = 0; r < kNumGprs; r++) {
+      stack_height[r] = INT_MAX;
+      offset[r] = 0;
+    }
+  }
+
+  // Argument registers pointing to the heap or to globals.
+  RegisterSet safe;
+  // Stack height of each argument register pointing into the caller's frame,
+  // relative to the canonical frame address. INT_MAX for the others and at
+  // tail call sites, where the frame is gone by the time the callee runs.
+  int stack_height[kNumGprs];
+  // For each argument register not in safe, the caller's own argument
+  // registers (at its entry) it may have been derived from. Empty if it may
+  // point anywhere.
+  RegisterSet forwarded[kNumGprs];
+  // Constant offset of each forwarded pointer from the caller's arguments.
+  int offset[kNumGprs];
+};
+
 struct FuncSummary {
   Function* func;
 
@@ -165,8 +205,9 @@ struct FuncSummary {
   // irrespective of if it writes to memory or not.
   //
   // Currently we have following exceptional conditions:
-  //   - Function is too large: We skip static analyses (to keep static analyses
-  //       times tractable) and simply assume it is unsafe.
+  //   - Function exceeded its analysis budget: An analysis gave up on the
+  //       function before finishing (to keep static analyses times tractable)
+  //       so we simply assume it is unsafe.
   //   - Function has PLT calls or unknown control flow : Stack mutation effects
   //       due to callees/ indirect control flows cannot be statically
   //       determined so we consider current function to be unsafe as well.
@@ -175,6 +216,13 @@ struct FuncSummary {
   //  rest of the analyses in the pipeline can choose to simply skip analysing
   //  the function.
   bool assume_unsafe;
+  // Denotes whether the function was assumed unsafe because it exceeded its
+  // analysis budget.
+  bool over_budget;
+  // Denotes whether an analysis was cut short by a time limit, so that the
+  // summary depends on the machine and its load and must not be cached. Only
+  // read once the pipeline is done, hence not part of any field group.
+  bool uncacheable;
 
   // Denotes whether this function itself unsafely writes to memory.
   bool self_unsafe_writes;
@@ -195,6 +243,11 @@ struct FuncSummary {
   // PLT call map. Keyed by the address of the call
   // and the value is the callee's name.
   std::map<Address, std::string> plt_calls;
+  // Denotes whether any of the PLT calls may write to the stack above this
+  // function's frame, as resolved against the library summaries.
+  bool unsafe_plt_calls;
+  // Denotes whether any of the PLT calls may throw an exception.
+  bool plt_may_throw;
   // Denotes whether this function has unknown control flows.
   bool has_unknown_cf;
   // Denotes whether this function has indirect control flows;.
@@ -204,17 +257,22 @@ struct FuncSummary {
   bool moveDownSP;
   std::set<int> redZoneAccess;
 
-  // Callees of this function.
-  std::set<Function*> callees;
-  // Callers of this function.
-  std::set<Function*> callers;
+  // Denotes whether this function calls or tail calls other functions within
+  // the object. The call graph itself is kept in CallGraph.
+  bool has_callees;
 
   // Set of registers dead at function entry.
-  std::set<std::string> dead_at_entry;
+  RegisterSet dead_at_entry;
   // Set of registers dead at each of the function exits.
-  std::map<Address, std::set<std::string>> dead_at_exit;
+  std::map<Address, RegisterSet> dead_at_exit;
+  // Ends of the blocks where the status flags may be live at a pop, i.e.
+  // before the last instruction or after the block.
+  std::set<Address> flags_live_at_end;
+  // Denotes whether flags_live_at_end has been computed. Pops save the flags
+  // everywhere otherwise.
+  bool flags_analyzed;
   // Unused registers. Currently only set for leaf functions.
-  std::set<std::string> unused_regs;
+  RegisterSet unused_regs;
 
   std::map<Address, MoveInstData*> entryData;
   std::map<Address, MoveInstData*> exitData;
@@ -238,21 +296,44 @@ struct FuncSummary {
   // block startaddresses.
   std::map<Address, std::set<Address>> heap_or_arg_writes;
 
+  // Argument registers (at function entry) through which this function or its
+  // callees may write. Such writes cannot reach this function's own return
+  // address, so they are not counted as unsafe writes here. Instead each
+  // caller checks what it passes in these registers.
+  RegisterSet written_args;
+  // For each register in written_args, the end of the written range in bytes
+  // past the argument pointer, i.e. the largest displacement plus access size.
+  int arg_extents[kNumGprs];
+  // Denotes whether this function passes pointers which may point anywhere to
+  // callees writing through them.
+  bool unsafe_arg_passing;
+  // Pointer arguments at the direct call and tail call sites of the function.
+  // Keyed by the address of the call (or jump) instruction.
+  std::map<Address, CallSiteArgs> call_args;
+
   int safe_paths;
 
   bool func_exception_safe;
 
+  // Denotes whether this summary was restored from the summary cache. Local
+  // analyses are skipped for cached summaries.
+  bool cached;
+
+  // Analysis state of the function shared across passes. Only available
+  // while the pass manager is running.
+  FunctionContext* context;
+
   void Print() {
     printf("Writes to memory = %d ", writes);
     printf("Has PLT calls = %lu ", plt_calls.size());
     printf("Has unknown control flow = %d ", has_unknown_cf);
-    printf("Number of callees = %lu\n", callees.size());
+    printf("Has callees = %d\n", has_callees);
   }
 
   bool shouldUseRegisterFrame() {
-    if (callees.size() > 0)
+    if (has_callees)
       return false;
-    if (unused_regs.size() == 0)
+    if (unused_regs.Empty())
       return false;
     if (has_unknown_cf || !plt_calls.empty())
       return false;
@@ -279,7 +360,23 @@ struct FuncSummary {
     return it->second;
   }
 
+  // Denotes whether the block holds a stack write into the caller's frame,
+  // which keeps it unsafe regardless of its unknown writes.
+  bool HasUnsafeStackWrite(Block* b) {
+    for (auto const& ins : context->Instructions(b)) {
+      auto it = all_writes.find(ins.first);
+      if (it == all_writes.end() || !it->second->stack)
+        continue;
+      auto hit = stack_heights.find(ins.first);
+      if (hit != stack_heights.end() && hit->second.dest >= -8)
+        return true;
+    }
+    return false;
+  }
+
   bool lowerInstrumentation() {
+    if (assume_unsafe)
+      return false;
     if (unsafe_blocks.find(func->entry()) != unsafe_blocks.end())
       return false;
     if (blockEndSPHeight.empty())
@@ -288,43 +385,202 @@ struct FuncSummary {
       return false;
     return true;
   }
+};
 
-  bool unsafePLTCalls() {
-    for (auto it : plt_calls ) {
-      if (IsSafePLTCall(it.second)) continue;
-      return true;
-    }
-    return false;
+// Analysis cost of a single function within a pass.
+struct FunctionCost {
+  Address addr;
+  std::string name;
+  double wall_ms;
+
+  // Orders costlier functions first. Ties are broken by address so that the
+  // reported functions do not depend on the scheduling order.
+  bool operator<(const FunctionCost& other) const {
+    if (wall_ms != other.wall_ms)
+      return wall_ms > other.wall_ms;
+    return addr < other.addr;
   }
-  
-  static bool IsSafePLTCall(std::string name) {
-    if (name == "malloc") return true;
+};
 
-    // C++ new operators
-    if (name.find("_Zna") == 0) return true;
+struct PassResult {
+  std::string name;
+  std::map<std::string, std::string> data;
+  // Numeric statistics accumulated during local analysis. Unlike data these
+  // are summed up when merging per worker results so the merged values do not
+  // depend on how functions got scheduled across workers.
+  std::map<std::string, long> counters;
 
-    if (name == "strlen") return true;
-    if (name == "strcmp") return true;
-    return false;
+  // Pass profile.
+  //
+  // Wall clock time of the whole pass in milliseconds.
+  double wall_ms = 0.0;
+  // Wall clock time of the local analysis phase in milliseconds.
+  double local_wall_ms = 0.0;
+  // CPU time consumed during the pass across all threads in milliseconds.
+  double cpu_ms = 0.0;
+  // Growth of the process peak resident set size during the pass in
+  // kilobytes.
+  long peak_rss_delta_kb = 0;
+  // Whether cpu_ms and peak_rss_delta_kb got measured for the whole wave of
+  // passes run concurrently with --parallel_passes, since resource usage is
+  // only available for the process as a whole.
+  bool wave_usage = false;
+  // Number of functions the local analysis got invoked on.
+  long functions = 0;
+  // Costliest functions of the local analysis, costliest first. Holds at most
+  // --slowest_functions entries.
+  std::vector<FunctionCost> slowest;
+
+  void RecordFunctionCost(Function* f, double wall_ms) {
+    functions++;
+    if (FLAGS_slowest_functions <= 0)
+      return;
+
+    FunctionCost cost;
+    cost.addr = f->addr();
+    cost.name = f->name();
+    cost.wall_ms = wall_ms;
+    AddSlowest(cost);
   }
 
+  void Merge(const PassResult& other) {
+    for (auto& it : other.counters) {
+      counters[it.first] += it.second;
+    }
 
-};
+    functions += other.functions;
+    for (auto& cost : other.slowest) {
+      AddSlowest(cost);
+    }
+  }
 
-struct PassResult {
-  std::string name;
-  std::map<std::string, std::string> data;
+  void LogJson(std::ostream& out) const {
+    out << "    {\n";
+    out << "      \"name\": \"" << JsonEscape(name) << "\",\n";
+    out << "      \"wall_ms\": " << wall_ms << ",\n";
+    out << "      \"local_wall_ms\": " << local_wall_ms << ",\n";
+    out << "      \"cpu_ms\": " << cpu_ms << ",\n";
+    out << "      \"peak_rss_delta_kb\": " << peak_rss_delta_kb << ",\n";
+    out << "      \"usage_scope\": \"" << (wave_usage ? "wave" : "pass")
+        << "\",\n";
+    out << "      \"functions\": " << functions << ",\n";
+
+    out << "      \"counters\": {";
+    const char* sep = "";
+    for (auto& it : counters) {
+      out << sep << "\n        \"" << JsonEscape(it.first)
+          << "\": " << it.second;
+      sep = ",";
+    }
+    out << (counters.empty() ? "" : "\n      ") << "},\n";
+
+    out << "      \"data\": {";
+    sep = "";
+    for (auto& it : data) {
+      out << sep << "\n        \"" << JsonEscape(it.first) << "\": \""
+          << JsonEscape(it.second) << "\"";
+      sep = ",";
+    }
+    out << (data.empty() ? "" : "\n      ") << "},\n";
+
+    out << "      \"slowest_functions\": [";
+    sep = "";
+    for (auto& cost : slowest) {
+      out << sep << "\n        {\"name\": \"" << JsonEscape(cost.name)
+          << "\", \"addr\": " << cost.addr
+          << ", \"wall_ms\": " << cost.wall_ms << "}";
+      sep = ",";
+    }
+    out << (slowest.empty() ? "" : "\n      ") << "]\n";
+    out << "    }";
+  }
+
+ private:
+  void AddSlowest(const FunctionCost& cost) {
+    slowest.push_back(cost);
+    std::sort(slowest.begin(), slowest.end());
+    if (slowest.size() > static_cast<size_t>(FLAGS_slowest_functions)) {
+      slowest.pop_back();
+    }
+  }
 };
 
+// Returns the summaries indexed by call graph function id.
+inline std::vector<FuncSummary*> SummariesById(
+    const CallGraph& cg, std::map<Function*, FuncSummary*>& summaries) {
+  std::vector<FuncSummary*> by_id(cg.Size());
+  for (int i = 0; i < cg.Size(); i++) {
+    by_id[i] = summaries[cg.GetFunction(i)];
+  }
+  return by_id;
+}
+
 struct AnalysisResult {
   std::vector<PassResult*> pass_results;
 };
 
+// Groups of FuncSummary fields. Passes declare the groups they read and write
+// so that the pass manager can work out which passes depend on each other.
+enum SummaryFields : uint32_t {
+  kNoFields = 0,
+  // has_callees, plt_calls, unsafe_plt_calls, plt_may_throw, has_unknown_cf,
+  // has_indirect_cf and the CallGraph
+  kCallGraph = 1 << 0,
+  // assume_unsafe, over_budget
+  kAssumeUnsafe = 1 << 1,
+  // cfg
+  kCFG = 1 << 2,
+  // stack_heights, stack_writes, all_writes, blockEntrySPHeight,
+  // blockEndSPHeight
+  kStackAccesses = 1 << 3,
+  // self_unsafe_writes, unknown_writes
+  kSelfWrites = 1 << 4,
+  // heap_writes, arg_writes, heap_or_arg_writes
+  kHeapWrites = 1 << 5,
+  // child_writes, writes
+  kWrites = 1 << 6,
+  // unsafe_blocks
+  kUnsafeBlocks = 1 << 7,
+  // safe_paths
+  kSafePaths = 1 << 8,
+  // func_exception_safe
+  kExceptionSafety = 1 << 9,
+  // dead_at_entry, dead_at_exit, flags_live_at_end, flags_analyzed
+  kDeadRegisters = 1 << 10,
+  // unused_regs, moveDownSP, redZoneAccess
+  kUnusedRegisters = 1 << 11,
+  // entryData, exitData, entryFixedData
+  kMoveInstData = 1 << 12,
+  // cached
+  kCached = 1 << 13,
+  // written_args, arg_extents, unsafe_arg_passing, call_args
+  kArgWrites = 1 << 14,
+  kAllFields = (1 << 15) - 1,
+};
+
 class Pass {
  public:
   Pass(std::string name, std::string description)
-      : pass_name_(name), description_(description) {}
+      : pass_name_(name), description_(description), arena_(nullptr),
+        call_graph_(nullptr), reads_(kNoFields), writes_(kNoFields), declared_(false) {}
+
+  std::string name() const { return pass_name_; }
+
+  // Summary fields read and written by this pass. A pass which does not
+  // declare any is assumed to read and write all of them.
+  uint32_t reads() const { return declared_ ? reads_ : kAllFields; }
 
+  uint32_t writes() const { return declared_ ? writes_ : kAllFields; }
+
+  // Sets the arena owning the analysis objects allocated by this pass.
+  void SetArena(Arena* arena) { arena_ = arena; }
+
+  // Sets the call graph of the code object being analysed.
+  void SetCallGraph(CallGraph* cg) { call_graph_ = cg; }
+
+  // Analyses a single function. With --analysis_threads > 1 this gets invoked
+  // concurrently for different functions, so implementations may only mutate
+  // the given summary and result.
   virtual void RunLocalAnalysis(CodeObject* co, Function* f, FuncSummary* s,
                                 PassResult* result) {
     // NOOP
@@ -338,22 +594,26 @@ class Pass {
 
   virtual bool IsSafeFunction(FuncSummary* s) { return !s->writes; }
 
-  void RunPass(CodeObject* co, std::map<Function*, FuncSummary*>& summaries,
-               AnalysisResult& result) {
+  // Summary fields read by IsSafeFunction.
+  virtual uint32_t IsSafeFunctionReads() const { return kWrites; }
+
+  PassResult* RunPass(CodeObject* co,
+                      std::map<Function*, FuncSummary*>& summaries) {
     if (FLAGS_vv) {
       StdOut(Color::YELLOW) << "------------------------------------" << Endl;
       StdOut(Color::YELLOW) << "Running pass > " << pass_name_ << Endl;
       StdOut(Color::YELLOW) << "  Description : " << description_ << Endl;
     }
 
-    PassResult* pr = new PassResult;
+    PassResult* pr = arena_->New<PassResult>();
     pr->name = pass_name_;
 
-    result.pass_results.push_back(pr);
+    using ClockType = std::chrono::steady_clock;
+    auto start = ClockType::now();
+    ResourceUsage usage = GetResourceUsage();
 
-    for (auto f : co->funcs()) {
-      RunLocalAnalysis(co, f, summaries[f], pr);
-    }
+    RunLocalAnalyses(co, summaries, pr);
+    pr->local_wall_ms = ElapsedMillis(start);
 
     RunGlobalAnalysis(co, summaries, pr);
 
@@ -365,20 +625,120 @@ class Pass {
       }
     }
 
-    pr->data["Safe Functions"] = count;
+    ResourceUsage end_usage = GetResourceUsage();
+    pr->wall_ms = ElapsedMillis(start);
+    pr->cpu_ms = end_usage.cpu_ms - usage.cpu_ms;
+    pr->peak_rss_delta_kb = end_usage.peak_rss_kb - usage.peak_rss_kb;
+    pr->counters["Safe Functions"] = count;
 
     StdOut(Color::YELLOW, FLAGS_vv)
         << "  Safe Functions Found (cumulative) : " << count << Endl;
+    return pr;
   }
 
  protected:
+  // Declares summary fields (a union of SummaryFields) read by the pass.
+  void Reads(uint32_t fields) {
+    reads_ |= fields;
+    declared_ = true;
+  }
+
+  // Declares summary fields (a union of SummaryFields) written by the pass.
+  void Writes(uint32_t fields) {
+    writes_ |= fields;
+    declared_ = true;
+  }
+
   std::string pass_name_;
   std::string description_;
+  // Analysis objects referenced from summaries must be allocated from this
+  // arena. It is safe to allocate from within concurrent local analyses.
+  Arena* arena_;
+  // Built by the call graph pass. Read only for all the later passes.
+  CallGraph* call_graph_;
+
+ private:
+  uint32_t reads_;
+  uint32_t writes_;
+  bool declared_;
+
+  static double ElapsedMillis(std::chrono::steady_clock::time_point start) {
+    std::chrono::duration<double, std::milli> diff =
+        std::chrono::steady_clock::now() - start;
+    return diff.count();
+  }
+
+  void RunTimedLocalAnalysis(CodeObject* co, Function* f, FuncSummary* s,
+                             PassResult* pr) {
+    auto start = std::chrono::steady_clock::now();
+    AnalysisBudget* budget = s->context->budget();
+    {
+      AnalysisBudget::Timer timer(budget, pass_name_.c_str());
+      RunLocalAnalysis(co, f, s, pr);
+    }
+    pr->RecordFunctionCost(f, ElapsedMillis(start));
+
+    // Only passes owning assume_unsafe may fall back to it. Budget aware
+    // analyses of the other passes simply leave their results incomplete.
+    if (budget->Exhausted() && !s->over_budget && (writes() & kAssumeUnsafe)) {
+      s->assume_unsafe = true;
+      s->over_budget = true;
+      pr->counters["Over Budget"]++;
+    }
+  }
+
+  void RunLocalAnalyses(CodeObject* co,
+                        std::map<Function*, FuncSummary*>& summaries,
+                        PassResult* pr) {
+    // Look up the summaries upfront since map lookups with operator[] may
+    // insert and are not safe to do from the workers.
+    std::vector<Function*> funcs;
+    std::vector<FuncSummary*> func_summaries;
+    for (auto f : co->funcs()) {
+      FuncSummary* s = summaries[f];
+      if (s->cached)
+        continue;
+      funcs.push_back(f);
+      func_summaries.push_back(s);
+    }
+
+    if (FLAGS_analysis_threads <= 1 || funcs.size() <= 1) {
+      for (size_t i = 0; i < funcs.size(); i++) {
+        RunTimedLocalAnalysis(co, funcs[i], func_summaries[i], pr);
+      }
+      return;
+    }
+
+    WorkStealingPool pool(FLAGS_analysis_threads);
+    std::vector<PassResult> worker_results(pool.Size());
+    pool.ParallelFor(funcs.size(), [&](int worker, size_t i) {
+      RunTimedLocalAnalysis(co, funcs[i], func_summaries[i],
+                            &worker_results[worker]);
+    });
+
+    for (auto& wr : worker_results) {
+      pr->Merge(wr);
+    }
+  }
 };
 
 class PassManager {
  public:
+  // Creates a pass manager owning its own analysis arena.
+  PassManager() : arena_(new Arena), owns_arena_(true) {}
+
+  // Creates a pass manager allocating summaries and other analysis objects
+  // from the given arena. Summaries stay valid until the arena is released.
+  explicit PassManager(Arena* arena) : arena_(arena), owns_arena_(false) {}
+
+  ~PassManager() {
+    if (owns_arena_)
+      delete arena_;
+  }
+
   PassManager* AddPass(Pass* pass) {
+    pass->SetArena(arena_);
+    pass->SetCallGraph(&call_graph_);
     passes_.push_back(pass);
     return this;
   }
@@ -387,22 +747,40 @@ class PassManager {
     for (auto f : co->funcs()) {
       FuncSummary* s = summaries_[f];
       if (s == nullptr) {
-        s = new FuncSummary();
+        s = arena_->New<FuncSummary>();
         s->func = f;
         summaries_[f] = s;
       }
+      s->context = new FunctionContext(f);
     }
+    budget_ = BudgetUsage();
 
-    using ClockType = std::chrono::system_clock;
+    using ClockType = std::chrono::steady_clock;
     auto start = ClockType::now();
+    ResourceUsage usage = GetResourceUsage();
+
+    if (FLAGS_parallel_passes) {
+      RunPassesConcurrently(co);
+    } else {
+      for (Pass* p : passes_) {
+        result_.pass_results.push_back(p->RunPass(co, summaries_));
+      }
+    }
 
-    for (Pass* p : passes_) {
-      p->RunPass(co, summaries_, result_);
+    // Decoded instructions and stack analyses are not needed past analysis.
+    for (auto& it : summaries_) {
+      RecordBudgetUsage(it.second);
+      delete it.second->context;
+      it.second->context = nullptr;
     }
 
-    auto diff = ClockType::now() - start;
-    auto duration = std::chrono::duration_cast<std::chrono::seconds>(diff);
-    auto elapsed = duration.count();
+    std::chrono::duration<double> diff = ClockType::now() - start;
+    double elapsed = diff.count();
+
+    ResourceUsage end_usage = GetResourceUsage();
+    wall_ms_ = elapsed * 1000.0;
+    cpu_ms_ = end_usage.cpu_ms - usage.cpu_ms;
+    peak_rss_kb_ = end_usage.peak_rss_kb;
 
     std::set<FuncSummary*> s;
     Pass* last = passes_.back();
@@ -418,6 +796,8 @@ class PassManager {
 
     long safe_fn_count = safe_fns.size();
     long unsafe_fn_count = co->funcs().size() - safe_fn_count;
+    safe_fn_count_ = safe_fn_count;
+    unsafe_fn_count_ = unsafe_fn_count;
 
     if (FLAGS_stats != "") {
       // Stats file format:
@@ -429,6 +809,10 @@ class PassManager {
       // safe_fn_n
       //
       // elapsed (seconds) : <elapsed_time>
+      //
+      // over budget functions : <over_budget_count>
+      // over_budget_fn_1 : <limit> (<exhausting_pass>)
+      // ..
       std::ofstream stats;
       stats.open(FLAGS_stats);
       stats << safe_fn_count << "," << unsafe_fn_count << "\n\n";
@@ -437,7 +821,19 @@ class PassManager {
       }
 
       stats << "\nelapsed (seconds) : " << elapsed;
+
+      stats << "\n\nover budget functions : " << budget_.over_budget.size();
+      for (auto& it : budget_.over_budget) {
+        stats << "\n" << it.first << " : " << it.second.first << " ("
+              << it.second.second << ")";
+      }
       stats.close();
+
+      // Per pass analysis profile. See LogResult for the format.
+      std::ofstream profile;
+      profile.open(FLAGS_stats + ".json");
+      LogResult(profile);
+      profile.close();
     }
 
     if (FLAGS_vv) {
@@ -447,16 +843,207 @@ class PassManager {
                           << Endl;
       StdOut(Color::BLUE) << "  Non Safe Functions : " << unsafe_fn_count
                           << Endl;
+      StdOut(Color::BLUE) << "  Over Budget Functions : "
+                          << budget_.over_budget.size() << Endl;
     }
     return s;
   }
 
-  void LogResult(std::ostream& out) {}
+  // Logs the analysis profile as JSON.
+  //
+  // {
+  //   "wall_ms": <total_wall_time>,
+  //   "cpu_ms": <total_cpu_time>,
+  //   "peak_rss_kb": <process_peak_rss>,
+  //   "arena_kb": <analysis_arena_size>,
+  //   "analysis_threads": <n_threads>,
+  //   "safe_functions": <safe_fn_count>,
+  //   "unsafe_functions": <unsafe_fn_count>,
+  //   "budget": {
+  //     "max_instructions": .., "max_iterations": .., "deadline_ms": ..,
+  //     "instructions": <total_charged>, "iterations": <total_charged>,
+  //     "max_function_ms": <largest_per_function_time>,
+  //     "over_budget": { "instructions": .., "iterations": ..,
+  //                      "deadline": .. },
+  //     "over_budget_by_pass": { <exhausting_pass>: <count>, .. }
+  //   },
+  //   "passes": [
+  //     {
+  //       "name": <pass_name>,
+  //       "wall_ms": .., "local_wall_ms": .., "cpu_ms": ..,
+  //       "peak_rss_delta_kb": .., "usage_scope": "pass" | "wave",
+  //       "functions": ..,
+  //       "counters": { <name>: <value>, .. },
+  //       "data": { <name>: <value>, .. },
+  //       "slowest_functions": [ {"name": .., "addr": .., "wall_ms": ..}, .. ]
+  //     },
+  //     ..
+  //   ]
+  // }
+  void LogResult(std::ostream& out) {
+    out << "{\n";
+    out << "  \"wall_ms\": " << wall_ms_ << ",\n";
+    out << "  \"cpu_ms\": " << cpu_ms_ << ",\n";
+    out << "  \"peak_rss_kb\": " << peak_rss_kb_ << ",\n";
+    out << "  \"arena_kb\": " << arena_->BytesAllocated() / 1024 << ",\n";
+    out << "  \"analysis_threads\": " << std::max(FLAGS_analysis_threads, 1)
+        << ",\n";
+    out << "  \"safe_functions\": " << safe_fn_count_ << ",\n";
+    out << "  \"unsafe_functions\": " << unsafe_fn_count_ << ",\n";
+    out << "  \"budget\": {\n";
+    out << "    \"max_instructions\": " << FLAGS_analysis_max_instructions
+        << ", \"max_iterations\": " << FLAGS_analysis_max_iterations
+        << ", \"deadline_ms\": " << FLAGS_analysis_deadline_ms << ",\n";
+    out << "    \"instructions\": " << budget_.instructions
+        << ", \"iterations\": " << budget_.iterations << ",\n";
+    out << "    \"max_function_ms\": " << budget_.max_function_ms << ",\n";
+    out << "    \"over_budget\": { \"instructions\": "
+        << budget_.by_limit[AnalysisBudget::kInstructions]
+        << ", \"iterations\": " << budget_.by_limit[AnalysisBudget::kIterations]
+        << ", \"deadline\": " << budget_.by_limit[AnalysisBudget::kDeadline]
+        << " },\n";
+    out << "    \"over_budget_by_pass\": {";
+    const char* pass_sep = " ";
+    for (auto& it : budget_.by_pass) {
+      out << pass_sep << "\"" << JsonEscape(it.first) << "\": " << it.second;
+      pass_sep = ", ";
+    }
+    out << " }\n";
+    out << "  },\n";
+    out << "  \"passes\": [";
+    const char* sep = "\n";
+    for (auto pr : result_.pass_results) {
+      out << sep;
+      pr->LogJson(out);
+      sep = ",\n";
+    }
+    out << "\n  ]\n";
+    out << "}\n";
+  }
+
+  // Returns the summary fields accessed by the pass. Local analyses are
+  // skipped for cached summaries and a safe function count is taken after
+  // every pass, hence those reads are implied.
+  static uint32_t AllReads(Pass* p) {
+    return p->reads() | p->IsSafeFunctionReads() | kCached;
+  }
+
+  // Returns whether the later pass must run after the earlier one, i.e. one
+  // of them writes summary fields that the other accesses.
+  static bool DependsOn(Pass* later, Pass* earlier) {
+    return (earlier->writes() & (AllReads(later) | later->writes())) ||
+           (AllReads(earlier) & later->writes());
+  }
+
+  // Groups the passes into waves of mutually independent passes. A pass is
+  // placed in the wave following the latest wave holding a pass it depends
+  // on. Dependent passes thus keep their relative pipeline order.
+  std::vector<std::vector<size_t>> SchedulePasses() {
+    std::vector<size_t> wave(passes_.size(), 0);
+    std::vector<std::vector<size_t>> waves;
+    for (size_t i = 0; i < passes_.size(); i++) {
+      for (size_t j = 0; j < i; j++) {
+        if (DependsOn(passes_[i], passes_[j]))
+          wave[i] = std::max(wave[i], wave[j] + 1);
+      }
+
+      if (wave[i] >= waves.size())
+        waves.resize(wave[i] + 1);
+      waves[wave[i]].push_back(i);
+    }
+    return waves;
+  }
 
  private:
+  // Aggregate analysis budget usage over all the functions.
+  struct BudgetUsage {
+    long instructions = 0;
+    long iterations = 0;
+    double max_function_ms = 0.0;
+    long by_limit[AnalysisBudget::kDeadline + 1] = {};
+    // Over budget functions by the pass which exhausted their budget.
+    std::map<std::string, long> by_pass;
+    // Limit exceeded by each over budget function and the pass exceeding it,
+    // keyed by function name.
+    std::map<std::string, std::pair<std::string, std::string>> over_budget;
+  };
+
+  void RecordBudgetUsage(FuncSummary* s) {
+    AnalysisBudget* budget = s->context->budget();
+    budget_.instructions += budget->instructions();
+    budget_.iterations += budget->iterations();
+    budget_.max_function_ms =
+        std::max(budget_.max_function_ms, budget->elapsed_ms());
+    if (s->over_budget) {
+      const char* pass =
+          budget->exhausted_by() ? budget->exhausted_by() : "unknown";
+      budget_.by_limit[budget->exceeded()]++;
+      budget_.by_pass[pass]++;
+      budget_.over_budget[s->func->name()] = std::make_pair(
+          std::string(AnalysisBudget::LimitName(budget->exceeded())), pass);
+    }
+  }
+
+  void RunPassesConcurrently(CodeObject* co) {
+    std::vector<std::vector<size_t>> waves = SchedulePasses();
+
+    if (FLAGS_vv) {
+      StdOut(Color::YELLOW) << "Pass schedule :" << Endl;
+      for (size_t w = 0; w < waves.size(); w++) {
+        StdOut(Color::YELLOW) << "  Wave " << w << " :";
+        for (auto i : waves[w]) {
+          StdOut(Color::YELLOW) << " [" << passes_[i]->name() << "]";
+        }
+        StdOut(Color::YELLOW) << Endl;
+      }
+    }
+
+    std::vector<PassResult*> results(passes_.size());
+    for (auto& wave : waves) {
+      if (wave.size() == 1) {
+        results[wave[0]] = passes_[wave[0]]->RunPass(co, summaries_);
+        continue;
+      }
+
+      // Summaries already exist for all the functions. So the passes only
+      // ever look up the summaries map and do not modify it.
+      ResourceUsage usage = GetResourceUsage();
+      WorkStealingPool pool(wave.size());
+      pool.ParallelFor(wave.size(), [&](int worker, size_t i) {
+        results[wave[i]] = passes_[wave[i]]->RunPass(co, summaries_);
+      });
+      ResourceUsage end_usage = GetResourceUsage();
+
+      // The per pass measurements include the other passes of the wave, so
+      // report the usage of the wave instead.
+      for (auto i : wave) {
+        results[i]->cpu_ms = end_usage.cpu_ms - usage.cpu_ms;
+        results[i]->peak_rss_delta_kb =
+            end_usage.peak_rss_kb - usage.peak_rss_kb;
+        results[i]->wave_usage = true;
+      }
+    }
+
+    // Report in pipeline order irrespective of the schedule.
+    for (auto pr : results) {
+      result_.pass_results.push_back(pr);
+    }
+  }
+
+  Arena* arena_;
+  bool owns_arena_;
+
+  CallGraph call_graph_;
   std::map<Function*, FuncSummary*> summaries_;
   std::vector<Pass*> passes_;
   AnalysisResult result_;
+
+  double wall_ms_ = 0.0;
+  double cpu_ms_ = 0.0;
+  long peak_rss_kb_ = 0;
+  long safe_fn_count_ = 0;
+  long unsafe_fn_count_ = 0;
+  BudgetUsage budget_;
 };
 
 #endif  // LITECFI_PASS_MANAGER_H
@@ -3,6 +3,7 @@
 
 #include <algorithm>
 #include <cstdlib>
+#include <limits>
 
 #include "Absloc.h"
 #include "AbslocInterface.h"
@@ -16,13 +17,17 @@
 #include "Register.h"
 #include "Visitor.h"
 #include "bitArray.h"
+#include "call_graph.h"
 #include "glog/logging.h"
 #include "heap.h"
+#include "library_summaries.h"
 #include "liveness.h"
 #include "pass_manager.h"
 #include "register_utils.h"
 #include "stackanalysis.h"
+#include "symbolic.h"
 #include "utils.h"
+#include "value_set.h"
 
 using Dyninst::Absloc;
 using Dyninst::AbsRegion;
@@ -33,35 +38,78 @@ using Dyninst::InstructionAPI::RegisterAST;
 using Dyninst::InstructionAPI::Visitor;
 using Dyninst::ParseAPI::Block;
 using Dyninst::ParseAPI::Function;
+using Dyninst::ParseAPI::InsnLoc;
 using Dyninst::ParseAPI::Location;
 using Dyninst::ParseAPI::Loop;
 
 class CallGraphAnalysis : public Pass {
  public:
-  CallGraphAnalysis()
-      : Pass("Call Graph Generation", "Generates the application call graph.") {
+  // PLT calls are resolved against the given library summaries, if any.
+  explicit CallGraphAnalysis(const LibrarySummaries* libraries = nullptr)
+      : Pass("Call Graph Generation", "Generates the application call graph."),
+        libraries_(libraries != nullptr ? libraries : &no_libraries_) {
+    Writes(kCallGraph);
   }
 
   void RunGlobalAnalysis(CodeObject* co,
                          std::map<Function*, FuncSummary*>& summaries,
                          PassResult* result) override {
-    std::set<Function*> visited;
+    // Function ids follow address order so that the graph does not depend on
+    // the parse order.
+    std::vector<Function*> funcs;
     for (auto f : co->funcs()) {
-      auto it = visited.find(f);
-      if (it == visited.end()) {
-        VisitFunction(co, summaries[f], summaries, visited);
-      }
+      funcs.push_back(f);
+    }
+    std::sort(funcs.begin(), funcs.end(), [](Function* a, Function* b) {
+      return a->addr() < b->addr();
+    });
+
+    std::map<Function*, int> ids;
+    for (size_t i = 0; i < funcs.size(); i++) {
+      ids[funcs[i]] = i;
+    }
+
+    std::vector<std::vector<CallGraph::Edge>> edges(funcs.size());
+    for (size_t i = 0; i < funcs.size(); i++) {
+      FuncSummary* s = summaries[funcs[i]];
+      UpdateCallees(co, funcs[i], s, ids, &edges[i]);
+      ResolvePLTCalls(co, funcs[i], s);
+      if (!s->plt_calls.empty())
+        result->counters["Functions With PLT Calls"]++;
+      if (s->unsafe_plt_calls)
+        result->counters["Functions With Unsafe PLT Calls"]++;
     }
+
+    call_graph_->Build(funcs, edges);
   }
 
  private:
-  void UpdateCallees(CodeObject* co, Function* f, FuncSummary* s) {
+  // Returns the function entered at the target of the edge, if any.
+  Function* GetTargetFunction(ParseAPI::Edge* e) {
+    std::vector<Function*> funcs;
+    e->trg()->getFuncs(funcs);
+    for (auto f : funcs) {
+      if (f->entry() == e->trg()) {
+        return f;
+      }
+    }
+    return nullptr;
+  }
+
+  void UpdateCallees(CodeObject* co, Function* f, FuncSummary* s,
+                     const std::map<Function*, int>& ids,
+                     std::vector<CallGraph::Edge>* edges) {
     for (auto b : f->blocks()) {
       for (auto e : b->targets()) {
-        if (e->sinkEdge() && e->type() == ParseAPI::INDIRECT && e->interproc())
+        if (e->sinkEdge() && e->type() == ParseAPI::INDIRECT &&
+            e->interproc()) {
+          edges->push_back({b->last(), -1, CallGraph::kIndirect});
           continue;
+        }
         if (e->sinkEdge() && e->type() != ParseAPI::RET) {
           s->has_unknown_cf = true;
+          if (e->type() == ParseAPI::CALL)
+            edges->push_back({b->last(), -1, CallGraph::kIndirect});
           continue;
         }
         if (e->type() == ParseAPI::INDIRECT) {
@@ -69,79 +117,63 @@ class CallGraphAnalysis : public Pass {
           continue;
         }
 
-        if (e->type() != ParseAPI::CALL)
+        if (e->type() != ParseAPI::CALL) {
+          // Direct jumps into another function are tail calls.
+          if (!e->interproc() || e->type() == ParseAPI::RET ||
+              e->type() == ParseAPI::CALL_FT)
+            continue;
+
+          Function* callee = GetTargetFunction(e);
+          if (callee == nullptr || callee == f)
+            continue;
+          auto it = ids.find(callee);
+          if (it != ids.end()) {
+            edges->push_back({b->last(), it->second, CallGraph::kTailCall});
+            s->has_callees = true;
+          }
           continue;
+        }
+
         if (co->cs()->linkage().find(e->trg()->start()) !=
             co->cs()->linkage().end()) {
           s->plt_calls[b->last()] = co->cs()->linkage()[e->trg()->start()];
+          edges->push_back({b->last(), -1, CallGraph::kPltCall});
           continue;
         }
-        std::vector<Function*> funcs;
-        e->trg()->getFuncs(funcs);
-        Function* callee = nullptr;
-        for (auto call_trg : funcs) {
-          if (call_trg->entry() == e->trg()) {
-            callee = call_trg;
-            break;
-          }
-        }
-        if (callee)
-          s->callees.insert(callee);
-      }
-    }
-  }
 
-  void VisitFunction(CodeObject* co, FuncSummary* s,
-                     std::map<Function*, FuncSummary*>& summaries,
-                     std::set<Function*>& visited) {
-    visited.insert(s->func);
-    UpdateCallees(co, s->func, s);
-    for (auto f : s->callees) {
-      summaries[f]->callers.insert(s->func);
-      auto it = visited.find(f);
-      if (it == visited.end()) {
-        VisitFunction(co, summaries[f], summaries, visited);
+        Function* callee = GetTargetFunction(e);
+        if (callee == nullptr)
+          continue;
+        auto it = ids.find(callee);
+        if (it != ids.end()) {
+          edges->push_back({b->last(), it->second, CallGraph::kCall});
+          s->has_callees = true;
+        }
       }
     }
   }
-};
-
-class LargeFunctionFilter : public Pass {
- public:
-  LargeFunctionFilter()
-      : Pass("Large Function Filter",
-             "Filters out large functions from static anlaysis.") {}
-
-  void RunLocalAnalysis(CodeObject* co, Function* f, FuncSummary* s,
-                        PassResult* result) override {
-    if (s->assume_unsafe)
-      return;
-
-    Address start = f->addr();
-    Address end = 0;
-    for (auto b : f->exitBlocks()) {
-      end = std::max(end, b->end());
-    }
-
-    for (auto b : f->returnBlocks()) {
-      end = std::max(end, b->end());
-    }
 
-    if (end < start) {
-      return;
+  // Resolves the PLT calls of the function against the library summaries. A
+  // PLT stub is itself resolved as a call to the symbol it is bound to, so
+  // that calls reaching the stub directly get the same treatment.
+  void ResolvePLTCalls(CodeObject* co, Function* f, FuncSummary* s) {
+    std::vector<std::string> callees;
+    auto it = co->cs()->linkage().find(f->addr());
+    if (it != co->cs()->linkage().end())
+      callees.push_back(it->second);
+    for (auto& call : s->plt_calls) {
+      callees.push_back(call.second);
     }
 
-    if (end - start > kCutoffSize_) {
-      StdOut(Color::RED, FLAGS_vv)
-          << "    Skipping large function " << f->name()
-          << " with size : " << end - start << Endl;
-
-      // Bail out and conservatively assume the function is unsafe.
-      s->assume_unsafe = true;
+    for (auto& name : callees) {
+      LibrarySummaries::Symbol sym = libraries_->Lookup(name);
+      s->unsafe_plt_calls |= sym.writes || sym.invokes_callbacks;
+      s->plt_may_throw |= !sym.exception_safe;
     }
   }
 
-  static constexpr unsigned int kCutoffSize_ = 20000;
+  LibrarySummaries no_libraries_;
+  const LibrarySummaries* libraries_;
 };
 
 class CFGAnalysis : public Pass {
@@ -149,7 +181,10 @@ class CFGAnalysis : public Pass {
   CFGAnalysis()
       : Pass("CFG Analysis",
              "Analyses the CFG for unsafe basic blocks and generates a flow "
-             "graph with strongly connected components.") {}
+             "graph with strongly connected components.") {
+    Reads(kAssumeUnsafe | kCallGraph);
+    Writes(kCFG);
+  }
 
   void RunLocalAnalysis(CodeObject* co, Function* f, FuncSummary* s,
                         PassResult* result) override {
@@ -167,7 +202,7 @@ class CFGAnalysis : public Pass {
       std::vector<Block*> blocks;
       l->getLoopBasicBlocks(blocks);
 
-      SCComponent* sc = new SCComponent;
+      SCComponent* sc = arena_->New<SCComponent>();
       for (auto b : blocks) {
         sc->blocks.insert(b);
         block_to_sc[b] = sc;
@@ -179,7 +214,7 @@ class CFGAnalysis : public Pass {
     if (it != block_to_sc.end()) {
       s->cfg = it->second;
     } else {
-      s->cfg = new SCComponent;
+      s->cfg = arena_->New<SCComponent>();
     }
     VisitBlock(f->entry(), s->cfg, s, visited, block_to_sc);
   }
@@ -209,7 +244,7 @@ class CFGAnalysis : public Pass {
       auto it = block_to_sc.find(target);
       SCComponent* new_sc = nullptr;
       if (it == block_to_sc.end()) {
-        new_sc = new SCComponent;
+        new_sc = arena_->New<SCComponent>();
       } else {
         new_sc = it->second;
       }
@@ -235,7 +270,11 @@ class StackHeightAnalysis : public Pass {
   StackHeightAnalysis()
       : Pass("Stack height analysis", "Analyzes the stack memory accesses "
                                       "within a function. Also detects stack"
-                                      " pointer overwrites.") {}
+                                      " pointer overwrites.") {
+    Reads(kAssumeUnsafe);
+    // Falls back to assume_unsafe when over the analysis budget.
+    Writes(kStackAccesses | kSelfWrites | kUnsafeBlocks | kAssumeUnsafe);
+  }
 
   void RunLocalAnalysis(CodeObject* co, Function* f, FuncSummary* s,
                         PassResult* result) override {
@@ -243,24 +282,28 @@ class StackHeightAnalysis : public Pass {
     if (s->assume_unsafe)
       return;
 
-    StackAnalysis sa(f);
+    FunctionContext* ctx = s->context;
+    AnalysisBudget* budget = ctx->budget();
 
     AssignmentConverter converter(true /* cache results*/,
                                   true /* use stack analysis*/);
 
-    std::map<Offset, Instruction> insns;
     for (auto b : f->blocks()) {
-      StackAnalysis::Height h = sa.findSP(b, b->end());
+      StackAnalysis::Height h = ctx->SPHeight(b, b->end());
       if (!h.isTop() && !h.isBottom()) {
         s->blockEndSPHeight[b->start()] = -8 - h.height();
       }
-      h = sa.findSP(b, b->start());
+      h = ctx->SPHeight(b, b->start());
       if (!h.isTop() && !h.isBottom()) {
         s->blockEntrySPHeight[b->start()] = -8 - h.height();
       }
 
-      insns.clear();
-      b->getInsns(insns);
+      const InsnVec& insns = ctx->Instructions(b);
+      if (!budget->ChargeInstructions(insns.size())) {
+        StdOut(Color::RED, FLAGS_vv)
+            << "    Analysis budget exhausted for " << f->name() << Endl;
+        return;
+      }
 
       for (auto const& ins : insns) {
         // Ignore writes due to frame switching instructions such as call/ ret.
@@ -277,7 +320,7 @@ class StackHeightAnalysis : public Pass {
         if (ins.second.writesMemory()) {
           converter.convert(ins.second, ins.first, f, b, assigns);
 
-          MemoryWrite* write = new MemoryWrite;
+          MemoryWrite* write = arena_->New<MemoryWrite>();
           write->function = f;
           write->block = b;
           write->ins = ins.second;
@@ -348,7 +391,11 @@ class StackHeightAnalysis : public Pass {
   }
 
   bool IsSafeFunction(FuncSummary* s) override {
-    return !s->self_unsafe_writes && !s->assume_unsafe && s->callees.empty() && !s->unknown_writes.empty();
+    return !s->self_unsafe_writes && !s->assume_unsafe && !s->has_callees && !s->unknown_writes.empty();
+  }
+
+  uint32_t IsSafeFunctionReads() const override {
+    return kSelfWrites | kAssumeUnsafe | kCallGraph;
   }
 
  private:
@@ -362,60 +409,297 @@ class StackHeightAnalysis : public Pass {
   }
 };
 
+class IndexedStackWriteAnalysis : public Pass {
+ public:
+  IndexedStackWriteAnalysis()
+      : Pass("Indexed Stack Write Analysis",
+             "Bounds unknown memory writes with a value set analysis over "
+             "stack pointer relative addresses.") {
+    Reads(kAssumeUnsafe | kStackAccesses | kSelfWrites);
+    Writes(kStackAccesses | kSelfWrites | kUnsafeBlocks);
+  }
+
+  void RunLocalAnalysis(CodeObject* co, Function* f, FuncSummary* s,
+                        PassResult* result) override {
+    if (s->assume_unsafe || s->unknown_writes.empty())
+      return;
+
+    value_set::StackIntervalAnalysis vsa(s);
+    if (vsa.resolved() > 0) {
+      result->counters["Resolved Indexed Writes"] += vsa.resolved();
+      result->counters["Functions With Indexed Writes"]++;
+    }
+  }
+};
+
 class HeapWriteAnalysis : public Pass {
  public:
   HeapWriteAnalysis()
-      : Pass("Heap Write Analysis", "Analyses heap memory writes.") {}
+      : Pass("Heap Write Analysis", "Analyses heap memory writes.") {
+    Reads(kCallGraph | kAssumeUnsafe | kStackAccesses | kSelfWrites);
+    // Falls back to assume_unsafe when over the analysis budget.
+    Writes(kHeapWrites | kStackAccesses | kSelfWrites | kUnsafeBlocks |
+           kArgWrites | kAssumeUnsafe);
+  }
 
   void RunLocalAnalysis(CodeObject* co, Function* f, FuncSummary* s,
                         PassResult* result) override {
-    if (s->assume_unsafe || s->cfg == nullptr) {
+    // Only unknown writes are up for classification, and call arguments are
+    // only of interest for direct calls.
+    if (s->assume_unsafe || (s->unknown_writes.empty() && !s->has_callees)) {
       return;
     }
     heap::HeapAnalysis ha(s);
   }
 };
 
+class SymbolicWriteResolution : public Pass {
+ public:
+  SymbolicWriteResolution()
+      : Pass("Symbolic Write Resolution",
+             "Resolves the targets of unknown memory writes by backward "
+             "slicing and symbolic evaluation.") {
+    Reads(kAssumeUnsafe | kStackAccesses | kSelfWrites);
+    Writes(kStackAccesses | kSelfWrites | kUnsafeBlocks);
+  }
+
+  void RunLocalAnalysis(CodeObject* co, Function* f, FuncSummary* s,
+                        PassResult* result) override {
+    if (s->assume_unsafe || s->unknown_writes.empty())
+      return;
+
+    symbolic::WriteResolver resolver(s, &cache_);
+    std::vector<Block*> resolved;
+    for (auto& it : s->unknown_writes) {
+      std::set<Address>& writes = it.second;
+      for (auto wit = writes.begin(); wit != writes.end();) {
+        auto mit = s->all_writes.find(*wit);
+        if (mit == s->all_writes.end()) {
+          ++wit;
+          continue;
+        }
+
+        MemoryWrite* w = mit->second;
+        int height = 0;
+        switch (resolver.Resolve(w, &height)) {
+        case symbolic::Target::kGlobal:
+          w->global = true;
+          result->counters["Resolved Global Writes"]++;
+          wit = writes.erase(wit);
+          break;
+        case symbolic::Target::kFrame:
+          w->stack = true;
+          s->stack_writes[height] = w;
+          s->stack_heights.emplace(w->addr, StackAccess{INT_MAX, INT_MAX})
+              .first->second.dest = height;
+          result->counters["Resolved Frame Writes"]++;
+          wit = writes.erase(wit);
+          break;
+        default:
+          ++wit;
+          break;
+        }
+      }
+
+      if (writes.empty())
+        resolved.push_back(it.first);
+    }
+
+    if (resolver.Expired()) {
+      StdOut(Color::RED, FLAGS_vv)
+          << "    Symbolic write resolution timed out for " << f->name()
+          << Endl;
+      s->uncacheable = true;
+      result->counters["Timed Out Functions"]++;
+    }
+
+    for (auto b : resolved) {
+      s->unknown_writes.erase(b);
+      if (!s->HasUnsafeStackWrite(b))
+        s->unsafe_blocks.erase(b);
+    }
+  }
+
+  void RunGlobalAnalysis(CodeObject* co,
+                         std::map<Function*, FuncSummary*>& summaries,
+                         PassResult* result) override {
+    result->counters["Slice Cache Hits"] = cache_.hits();
+  }
+
+ private:
+  symbolic::SliceCache cache_;
+};
+
+// Checks the pointer arguments passed to functions writing through their
+// arguments.
+//
+// A write through an argument cannot reach the return address of the writing
+// function, so the heap write analysis leaves such writes to the callers. At
+// each call site the caller checks the arguments the callee writes through.
+// Arguments pointing to the heap or to globals are fine, as are pointers into
+// the caller's frame as long as the callee's extent ends below the return
+// address. Arguments derived from the caller's own arguments are in turn left
+// to its callers, with the extent grown by the offset passed. Anything else
+// renders the call block unsafe and the caller an unsafe writer.
+class ArgumentWriteAnalysis : public Pass {
+ public:
+  ArgumentWriteAnalysis()
+      : Pass("Argument Write Analysis",
+             "Checks the pointers passed to functions writing through their "
+             "arguments.") {
+    Reads(kCallGraph | kArgWrites | kCached | kAssumeUnsafe);
+    Writes(kArgWrites | kUnsafeBlocks);
+  }
+
+  void RunGlobalAnalysis(CodeObject* co,
+                         std::map<Function*, FuncSummary*>& summaries,
+                         PassResult* result) override {
+    const CallGraph& cg = *call_graph_;
+    std::vector<FuncSummary*> by_id = SummariesById(cg, summaries);
+    SolveBottomUp(cg, [&cg, &by_id](const std::vector<int>& scc) {
+      SolveSCC(scc, cg, by_id);
+    });
+
+    for (auto s : by_id) {
+      if (!s->written_args.Empty())
+        result->counters["Functions Writing Through Arguments"]++;
+      if (s->unsafe_arg_passing)
+        result->counters["Functions Passing Unsafe Arguments"]++;
+    }
+  }
+
+ private:
+  // written_args and the extents only grow, so iterating the component until
+  // no member changes terminates. Extents growing around a recursive cycle
+  // are capped, past which any pointer into a frame is unsafe anyway.
+  static void SolveSCC(const std::vector<int>& scc, const CallGraph& cg,
+                       const std::vector<FuncSummary*>& by_id) {
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (auto id : scc) {
+        FuncSummary* s = by_id[id];
+        // Cached summaries already hold the final results.
+        if (s->cached || s->assume_unsafe)
+          continue;
+
+        for (auto& e : cg.Edges(id)) {
+          if (e.callee < 0)
+            continue;
+          FuncSummary* callee = by_id[e.callee];
+          RegisterSet written = callee->written_args;
+          if (written.Empty())
+            continue;
+
+          bool unsafe = false;
+          auto it = s->call_args.find(e.site);
+          if (it == s->call_args.end()) {
+            unsafe = true;
+          } else {
+            const CallSiteArgs& args = it->second;
+            for (auto r : written - args.safe) {
+              int64_t extent = callee->arg_extents[r];
+              if (args.stack_height[r] != INT_MAX) {
+                if (args.stack_height[r] + extent > -8)
+                  unsafe = true;
+                continue;
+              }
+              if (args.forwarded[r].Empty()) {
+                unsafe = true;
+                continue;
+              }
+              int64_t grown = args.offset[r] + extent;
+              int forwarded_extent =
+                  grown < 0 ? 0 : grown > kMaxArgExtent ? kMaxArgExtent : grown;
+              for (auto a : args.forwarded[r]) {
+                if (!s->written_args.Contains(a) ||
+                    s->arg_extents[a] < forwarded_extent) {
+                  s->written_args.Insert(a);
+                  s->arg_extents[a] =
+                      std::max(s->arg_extents[a], forwarded_extent);
+                  changed = true;
+                }
+              }
+            }
+          }
+
+          if (unsafe)
+            MarkUnsafeCallSite(s, e.site);
+        }
+      }
+    }
+  }
+
+  // Cap of the extents grown by forwarding, well past any frame size.
+  static constexpr int kMaxArgExtent = 1 << 24;
+
+  static void MarkUnsafeCallSite(FuncSummary* s, Address site) {
+    s->unsafe_arg_passing = true;
+    for (auto b : s->func->blocks()) {
+      if (b->last() == site)
+        s->unsafe_blocks.insert(b);
+    }
+  }
+};
+
 class InterProceduralMemoryAnalysis : public Pass {
  public:
   InterProceduralMemoryAnalysis()
       : Pass("Inter-procedural Memory Write Analysis",
-             "Analyses memory writes across functions.") {}
+             "Analyses memory writes across functions.") {
+    Reads(kCallGraph | kSelfWrites | kAssumeUnsafe | kWrites | kArgWrites);
+    Writes(kWrites);
+  }
 
   void RunGlobalAnalysis(CodeObject* co,
                          std::map<Function*, FuncSummary*>& summaries,
                          PassResult* result) override {
-    std::set<Function*> visited;
-    for (auto f : co->funcs()) {
-      auto it = visited.find(f);
-      if (it == visited.end()) {
-        VisitFunction(co, summaries[f], summaries, visited);
-      }
-    }
+    const CallGraph& cg = *call_graph_;
+    std::vector<FuncSummary*> by_id = SummariesById(cg, summaries);
+    SolveBottomUp(cg, [&cg, &by_id](const std::vector<int>& scc) {
+      SolveSCC(scc, cg, by_id);
+    });
   }
 
  private:
-  bool VisitFunction(CodeObject* co, FuncSummary* s,
-                     std::map<Function*, FuncSummary*>& summaries,
-                     std::set<Function*>& visited) {
-    visited.insert(s->func);
+  // Propagates writes through a call graph component until none of its
+  // members change. All the flags only ever go from false to true, so this
+  // converges after at most a couple of sweeps per member.
+  //
+  // Functions assumed unsafe write as far as their callers are concerned, but
+  // the callers themselves are still analysed normally. In particular a
+  // function over its analysis budget does not stop the analysis of its
+  // callers.
+  static void SolveSCC(const std::vector<int>& scc, const CallGraph& cg,
+                       const std::vector<FuncSummary*>& by_id) {
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (auto id : scc) {
+        FuncSummary* s = by_id[id];
+        bool child_writes = s->child_writes;
+        for (auto& e : cg.Edges(id)) {
+          if (e.callee < 0)
+            continue;
+          FuncSummary* callee = by_id[e.callee];
+          child_writes |= callee->writes;
+        }
 
-    for (auto f : s->callees) {
-      auto it = visited.find(f);
-      if (it == visited.end()) {
-        VisitFunction(co, summaries[f], summaries, visited);
+        bool writes = s->self_unsafe_writes ||
+            child_writes ||
+            s->assume_unsafe ||
+            s->has_unknown_cf ||
+            !s->unknown_writes.empty() ||
+            s->unsafe_plt_calls ||
+            s->unsafe_arg_passing;
+
+        if (child_writes != s->child_writes || writes != s->writes) {
+          changed = true;
+        }
+        s->child_writes = child_writes;
+        s->writes = writes;
       }
-      s->child_writes |= summaries[f]->writes;
-      s->assume_unsafe |= summaries[f]->assume_unsafe;
     }
-
-    s->writes = s->self_unsafe_writes || 
-        s->child_writes || 
-        s->assume_unsafe || 
-        s->has_unknown_cf ||
-        !s->unknown_writes.empty() ||
-        s->unsafePLTCalls();
-    return s->writes;
   }
 };
 
@@ -456,6 +740,8 @@ class UnusedRegisterAnalysis : public Pass {
   UnusedRegisterAnalysis()
       : Pass("Unused Register Analysis", "Analyses register unused "
                                          "saved registers of leaf functions.") {
+    Reads(kAssumeUnsafe | kCallGraph);
+    Writes(kUnusedRegisters);
   }
 
   void RunLocalAnalysis(CodeObject* co, Function* f, FuncSummary* s,
@@ -464,24 +750,17 @@ class UnusedRegisterAnalysis : public Pass {
       return;
     }
 
-    if (s->callees.size() > 0) {
+    if (s->has_callees) {
       return;
     }
 
-    std::set<std::string> all = {
-        "x86_64::rax", "x86_64::rbx", "x86_64::rcx", "x86_64::rdx",
-        "x86_64::rsi", "x86_64::rdi", "x86_64::r8",  "x86_64::r9",
-        "x86_64::r10", "x86_64::r11", "x86_64::r12", "x86_64::r13",
-        "x86_64::r14", "x86_64::r15",
-    };
+    RegisterSet all = RegisterSet::AllButSp() - RegisterSet({kRbp});
 
-    StackAnalysis sa(f);
-    std::set<std::string> used;
+    FunctionContext* ctx = s->context;
+    RegisterSet used;
     for (auto b : f->blocks()) {
-      ParseAPI::Block::Insns insns;
-      b->getInsns(insns);
-      for (auto const& ins : insns) {
-        StackAnalysis::Height h = sa.findSP(b, ins.first);
+      for (auto const& ins : ctx->Instructions(b)) {
+        StackAnalysis::Height h = ctx->SPHeight(b, ins.first);
         if (!h.isTop() && !h.isBottom()) {
           int height = -8 - h.height();
           if (height >= 128)
@@ -495,11 +774,11 @@ class UnusedRegisterAnalysis : public Pass {
         ins.second.getWriteSet(written);
 
         for (auto const& r : read) {
-          used.insert(NormalizeRegisterName(r->getID().name()));
+          used.Insert(ToGpr(r->getID()));
         }
 
         for (auto const& w : written) {
-          used.insert(NormalizeRegisterName(w->getID().name()));
+          used.Insert(ToGpr(w->getID()));
         }
 
         // See if this instruction accesses to red zone
@@ -519,12 +798,7 @@ class UnusedRegisterAnalysis : public Pass {
       }
     }
 
-    for (auto r : all) {
-      auto it = used.find(r);
-      if (it == used.end()) {
-        s->unused_regs.insert(r);
-      }
-    }
+    s->unused_regs = all - used;
   }
 };
 
@@ -532,17 +806,18 @@ class DeadRegisterAnalysis : public Pass {
  public:
   DeadRegisterAnalysis()
       : Pass("Dead Register Analysis",
-             "Analyses dead registers at function entry and exit.") {}
+             "Analyses dead registers at function entry and exit and the "
+             "liveness of the status flags at block ends.") {
+    Reads(kAssumeUnsafe);
+    Writes(kDeadRegisters);
+  }
 
-  std::set<std::string> GetDeadRegisters(Function* f, Block* b,
-                                         LivenessAnalyzer::Type type) {
-    // Construct a liveness analyzer based on the address width of the
-    // mutatee. 32bit code and 64bit code have different ABI.
-    LivenessAnalyzer la(f->obj()->cs()->getAddressWidth());
+  RegisterSet GetDeadRegisters(LivenessAnalyzer& la, Function* f, Block* b,
+                               LivenessAnalyzer::Type type) {
     // Construct a liveness query location.
     Location loc(f, b);
 
-    std::set<std::string> dead;
+    RegisterSet dead;
 
     // Query live registers.
     bitArray live;
@@ -551,37 +826,80 @@ class DeadRegisterAnalysis : public Pass {
     }
 
     // Check all dead caller-saved registers.
-    std::vector<MachRegister> regs;
-    regs.push_back(x86_64::rsi);
-    regs.push_back(x86_64::rdi);
-    regs.push_back(x86_64::rdx);
-    regs.push_back(x86_64::rcx);
-    regs.push_back(x86_64::r8);
-    regs.push_back(x86_64::r9);
-    regs.push_back(x86_64::r10);
-    regs.push_back(x86_64::r11);
+    RegisterSet regs = {kRsi, kRdi, kRdx, kRcx, kR8, kR9, kR10, kR11};
 
     for (auto reg : regs) {
-      if (!live.test(la.getIndex(reg))) {
-        dead.insert(reg.name());
+      if (!live.test(la.getIndex(ToMachRegister(reg)))) {
+        dead.Insert(reg);
       }
     }
     return dead;
   }
 
+  // Whether any of the status flags may be live at loc. The shadow stack
+  // snippets never change the direction flag.
+  bool FlagsLive(LivenessAnalyzer& la, const Location& loc,
+                 LivenessAnalyzer::Type type) {
+    bitArray live;
+    if (!la.query(loc, type, live)) {
+      return true;
+    }
+
+    for (auto flag : {x86_64::cf, x86_64::pf, x86_64::af, x86_64::zf,
+                      x86_64::sf, x86_64::of}) {
+      int index = la.getIndex(flag);
+      if (index < 0 || live.test(index))
+        return true;
+    }
+    return false;
+  }
+
+  // Whether the flags may be live at a pop placed at the end of the block.
+  // Pops go before a final control flow instruction, which may itself read
+  // the flags, as a conditional tail call does. Otherwise they go after the
+  // block.
+  bool FlagsLiveAtPop(LivenessAnalyzer& la, FuncSummary* s, Block* b) {
+    Function* f = s->func;
+    if (FlagsLive(la, Location(f, b), LivenessAnalyzer::After))
+      return true;
+
+    const auto& insns = s->context->Instructions(b);
+    if (insns.empty())
+      return true;
+    const auto& last = insns.back();
+    return FlagsLive(la, Location(f, InsnLoc(b, last.first, last.second)),
+                     LivenessAnalyzer::Before);
+  }
+
   void RunLocalAnalysis(CodeObject* co, Function* f, FuncSummary* s,
                         PassResult* result) override {
     if (s->assume_unsafe) {
       return;
     }
 
+    // Construct a liveness analyzer based on the address width of the
+    // mutatee. 32bit code and 64bit code have different ABI. It caches the
+    // liveness of the function across queries.
+    LivenessAnalyzer la(f->obj()->cs()->getAddressWidth());
+
     s->dead_at_entry =
-        GetDeadRegisters(f, f->entry(), LivenessAnalyzer::Before);
+        GetDeadRegisters(la, f, f->entry(), LivenessAnalyzer::Before);
 
     for (auto b : f->exitBlocks()) {
       s->dead_at_exit[b->end()] =
-          GetDeadRegisters(f, b, LivenessAnalyzer::After);
+          GetDeadRegisters(la, f, b, LivenessAnalyzer::After);
+    }
+
+    // Shadow stack pops may go to the end of any block. The ABI leaves the
+    // flags dead at returns, so this mostly comes down to blocks followed by
+    // a shared epilogue and to conditional tail calls.
+    for (auto b : f->blocks()) {
+      if (FlagsLiveAtPop(la, s, b))
+        s->flags_live_at_end.insert(b->end());
     }
+    s->flags_analyzed = true;
+    if (!s->flags_live_at_end.empty())
+      result->counters["Functions With Live Flags At Pops"]++;
   }
 };
 
@@ -589,14 +907,16 @@ class BlockDeadRegisterAnalysis : public Pass {
  public:
   BlockDeadRegisterAnalysis()
       : Pass("Dead Register Analysis in a basic block",
-             "Looking for concrete envidence that registers are dead") {}
+             "Looking for concrete envidence that registers are dead") {
+    Writes(kMoveInstData);
+  }
 
-  void CalculateBlockLevelLiveness(std::map<Offset, Instruction>& insns,
-                                   std::map<Offset, std::set<std::string>>& d) {
-    std::set<std::string> cur;
+  void CalculateBlockLevelLiveness(const InsnVec& insns,
+                                   std::map<Offset, RegisterSet>& d) {
+    RegisterSet cur;
     for (auto it = insns.rbegin(); it != insns.rend(); ++it) {
       auto& o = it->first;
-      Instruction& i = it->second;
+      const Instruction& i = it->second;
       std::set<Dyninst::InstructionAPI::RegisterAST::Ptr> read;
       i.getReadSet(read);
 
@@ -611,23 +931,19 @@ class BlockDeadRegisterAnalysis : public Pass {
         if (actualReg.size() != 4 && actualReg.size() != 8) {
           continue;
         }
-        MachRegister baseReg = actualReg.getBaseRegister();
-        if (baseReg == x86_64::rsp)
-          continue;
-        if (baseReg.regClass() != x86_64::GPR)
+        Gpr reg = ToGpr(actualReg);
+        if (reg == kRsp || reg == kNoGpr)
           continue;
-        std::string name = NormalizeRegisterName(baseReg.name());
-        cur.insert(name);
+        cur.Insert(reg);
       }
       for (auto const& r : read) {
-        MachRegister baseReg = r->getID().getBaseRegister();
-        cur.erase(NormalizeRegisterName(baseReg.name()));
+        cur.Erase(ToGpr(r->getID()));
       }
       d[o] = cur;
     }
   }
 
-  bool MoveSP(Instruction& i) {
+  bool MoveSP(const Instruction& i) {
     std::set<Dyninst::InstructionAPI::RegisterAST::Ptr> written;
     i.getWriteSet(written);
     for (auto const& w : written) {
@@ -637,7 +953,7 @@ class BlockDeadRegisterAnalysis : public Pass {
     return false;
   }
 
-  bool ReadFlags(Instruction& i) {
+  bool ReadFlags(const Instruction& i) {
     std::set<Dyninst::InstructionAPI::RegisterAST::Ptr> read;
     i.getReadSet(read);
     for (auto const& r : read) {
@@ -647,8 +963,8 @@ class BlockDeadRegisterAnalysis : public Pass {
     return false;
   }
 
-  void CalculateEntryInstPoint(std::map<Offset, Instruction>& insns,
-                               std::map<Offset, std::set<std::string>>& d,
+  void CalculateEntryInstPoint(const InsnVec& insns,
+                               std::map<Offset, RegisterSet>& d,
                                FuncSummary* s, Address blockEntry) {
     Address newAddr = 0;
     int saveCount = 0;
@@ -656,8 +972,8 @@ class BlockDeadRegisterAnalysis : public Pass {
     int curHeight = 0;
     for (auto it = insns.begin(); it != insns.end(); ++it) {
       auto& deadRegs = d[it->first];
-      if ((int)deadRegs.size() > saveCount) {
-        saveCount = deadRegs.size();
+      if (deadRegs.Size() > saveCount) {
+        saveCount = deadRegs.Size();
         if (saveCount > 2)
           saveCount = 2;
         raOffset = curHeight;
@@ -665,14 +981,14 @@ class BlockDeadRegisterAnalysis : public Pass {
       }
 
       if (saveCount > 0 && it == insns.begin()) {
-        MoveInstData* mid = new MoveInstData;
+        MoveInstData* mid = arena_->New<MoveInstData>();
         mid->newInstAddress = it->first;
         mid->raOffset = raOffset;
         mid->saveCount = saveCount;
 
         auto& deadRegs = d[it->first];
-        if (deadRegs.size() == 1) {
-          mid->reg1 = *(deadRegs.begin());
+        if (deadRegs.Size() == 1) {
+          mid->reg1 = deadRegs.First();
         } else {
           auto it = deadRegs.begin();
           mid->reg1 = *it;
@@ -695,14 +1011,14 @@ class BlockDeadRegisterAnalysis : public Pass {
     }
 
     if (saveCount > 0 && newAddr > 0) {
-      MoveInstData* mid = new MoveInstData;
+      MoveInstData* mid = arena_->New<MoveInstData>();
       mid->newInstAddress = newAddr;
       mid->raOffset = raOffset;
       mid->saveCount = saveCount;
 
       auto& deadRegs = d[newAddr];
-      if (deadRegs.size() == 1) {
-        mid->reg1 = *(deadRegs.begin());
+      if (deadRegs.Size() == 1) {
+        mid->reg1 = deadRegs.First();
       } else {
         auto it = deadRegs.begin();
         mid->reg1 = *it;
@@ -713,8 +1029,8 @@ class BlockDeadRegisterAnalysis : public Pass {
     }
   }
 
-  void CalculateExitInstPoint(std::map<Offset, Instruction>& insns,
-                              std::map<Offset, std::set<std::string>>& d,
+  void CalculateExitInstPoint(const InsnVec& insns,
+                              std::map<Offset, RegisterSet>& d,
                               FuncSummary* s, Address blockEntry) {
     Address newAddr = 0;
     int saveCount = 0;
@@ -738,8 +1054,8 @@ class BlockDeadRegisterAnalysis : public Pass {
       }
 
       auto& deadRegs = d[it->first];
-      if ((int)deadRegs.size() > saveCount) {
-        saveCount = deadRegs.size();
+      if (deadRegs.Size() > saveCount) {
+        saveCount = deadRegs.Size();
         if (saveCount > 2)
           saveCount = 2;
         raOffset = curHeight;
@@ -750,14 +1066,14 @@ class BlockDeadRegisterAnalysis : public Pass {
     }
 
     if (saveCount > 0 && newAddr > 0) {
-      MoveInstData* mid = new MoveInstData;
+      MoveInstData* mid = arena_->New<MoveInstData>();
       mid->newInstAddress = newAddr;
       mid->raOffset = raOffset;
       mid->saveCount = saveCount;
 
       auto& deadRegs = d[newAddr];
-      if (deadRegs.size() == 1) {
-        mid->reg1 = *(deadRegs.begin());
+      if (deadRegs.Size() == 1) {
+        mid->reg1 = deadRegs.First();
       } else {
         auto it = deadRegs.begin();
         mid->reg1 = *it;
@@ -772,9 +1088,8 @@ class BlockDeadRegisterAnalysis : public Pass {
                         PassResult* result) override {
 
     for (auto b : f->blocks()) {
-      std::map<Offset, Instruction> insns;
-      b->getInsns(insns);
-      std::map<Offset, std::set<std::string>> deadReg;
+      const InsnVec& insns = s->context->Instructions(b);
+      std::map<Offset, RegisterSet> deadReg;
 
       CalculateBlockLevelLiveness(insns, deadReg);
       CalculateEntryInstPoint(insns, deadReg, s, b->start());
@@ -788,40 +1103,141 @@ class SafePathsCounting : public Pass {
   SafePathsCounting()
       : Pass(
             "Count the maximal number of safe control flow paths in a function",
-            "Do not collapse SCC to get as many safe CF paths as possible") {}
+            "Counts entry to exit paths avoiding unsafe blocks over the "
+            "condensed control flow graph") {
+    Reads(kUnsafeBlocks | kCFG);
+    Writes(kSafePaths);
+  }
 
-  int countPaths(Block* cur, FuncSummary* s, std::set<ParseAPI::Edge*>& visited,
-                 std::set<Block*>& exitBlocks) {
-    if (s->unsafe_blocks.find(cur) != s->unsafe_blocks.end()) {
-      return 0;
+  void RunLocalAnalysis(CodeObject* co, Function* f, FuncSummary* s,
+                        PassResult* result) override {
+    std::vector<std::vector<Block*>> components;
+    if (s->cfg != nullptr) {
+      components = CFGComponents(s->cfg);
+    } else {
+      // No flow graph for functions with unknown control flow. Condense the
+      // block graph directly instead.
+      std::vector<Block*> blocks;
+      for (auto b : f->blocks()) {
+        blocks.push_back(b);
+      }
+      components = ComputeSCCs(blocks, [](Block* b) {
+        std::vector<Block*> succs;
+        for (auto e : b->targets()) {
+          if (IsFollowed(e))
+            succs.push_back(e->trg());
+        }
+        return succs;
+      });
     }
-    if (exitBlocks.find(cur) != exitBlocks.end()) {
-      return 1;
+
+    s->safe_paths = CountPaths(f, s, components);
+  }
+
+ private:
+  static constexpr int kMaxPaths = std::numeric_limits<int>::max();
+
+  static int SaturatingAdd(int a, int b) {
+    return a > kMaxPaths - b ? kMaxPaths : a + b;
+  }
+
+  // Edges followed when counting paths.
+  static bool IsFollowed(ParseAPI::Edge* e) {
+    return !e->sinkEdge() && !e->interproc() &&
+           e->type() != ParseAPI::CATCH;
+  }
+
+  // Returns the blocks of the components of the flow graph, successors first.
+  // The flow graph collapses loops so it is normally acyclic already. Running
+  // it through Tarjan guards against any cycle it did not collapse.
+  std::vector<std::vector<Block*>> CFGComponents(SCComponent* cfg) {
+    std::vector<SCComponent*> nodes;
+    std::set<SCComponent*> seen = {cfg};
+    std::vector<SCComponent*> stack = {cfg};
+    while (!stack.empty()) {
+      SCComponent* sc = stack.back();
+      stack.pop_back();
+      nodes.push_back(sc);
+      for (auto child : sc->children) {
+        if (seen.insert(child).second)
+          stack.push_back(child);
+      }
     }
-    int c = 0;
-    for (auto e : cur->targets()) {
-      if (e->sinkEdge())
-        continue;
-      if (e->interproc())
-        continue;
-      if (e->type() == ParseAPI::CATCH)
+
+    std::vector<std::vector<Block*>> components;
+    auto children = [](SCComponent* sc) -> std::set<SCComponent*>& {
+      return sc->children;
+    };
+    for (auto& scc : ComputeSCCs(nodes, children)) {
+      components.emplace_back();
+      for (auto sc : scc) {
+        components.back().insert(components.back().end(), sc->blocks.begin(),
+                                 sc->blocks.end());
+      }
+    }
+    return components;
+  }
+
+  // Counts the entry to exit paths not passing through unsafe blocks with a
+  // single sweep over the condensed graph. Components are given successors
+  // first so the counts of all the successors of a component are final by the
+  // time it is visited. A component is treated as a single node: it yields no
+  // safe paths if any of its blocks is unsafe and ends the path if any of its
+  // blocks exits the function.
+  int CountPaths(Function* f, FuncSummary* s,
+                 const std::vector<std::vector<Block*>>& components) {
+    std::set<Block*> exit_blocks;
+    for (auto b : f->exitBlocks()) {
+      exit_blocks.insert(b);
+    }
+
+    std::map<Block*, int> component_of;
+    for (size_t i = 0; i < components.size(); i++) {
+      for (auto b : components[i]) {
+        component_of[b] = i;
+      }
+    }
+
+    std::vector<int> paths(components.size(), 0);
+    for (size_t i = 0; i < components.size(); i++) {
+      bool unsafe = false;
+      bool exits = false;
+      for (auto b : components[i]) {
+        unsafe |= s->unsafe_blocks.find(b) != s->unsafe_blocks.end();
+        exits |= exit_blocks.find(b) != exit_blocks.end();
+      }
+
+      if (unsafe) {
+        paths[i] = 0;
         continue;
-      if (visited.find(e) != visited.end())
+      }
+
+      if (exits) {
+        paths[i] = 1;
         continue;
-      if (e->type() == ParseAPI::INDIRECT) return 0;
-      visited.insert(e);
-      c += countPaths(e->trg(), s, visited, exitBlocks);
+      }
+
+      // Resolved jump table edges are counted like any other. Lowering clones
+      // and redirects them along with the rest of the function.
+      int count = 0;
+      for (auto b : components[i]) {
+        for (auto e : b->targets()) {
+          if (!IsFollowed(e))
+            continue;
+
+          auto it = component_of.find(e->trg());
+          if (it == component_of.end() || it->second == static_cast<int>(i))
+            continue;
+          count = SaturatingAdd(count, paths[it->second]);
+        }
+      }
+      paths[i] = count;
     }
-    return c;
-  }
 
-  void RunLocalAnalysis(CodeObject* co, Function* f, FuncSummary* s,
-                        PassResult* result) override {
-    std::set<ParseAPI::Edge*> visited;
-    std::set<Block*> exitBlocks;
-    for (auto b : f->exitBlocks())
-      exitBlocks.insert(b);
-    s->safe_paths = countPaths(f->entry(), s, visited, exitBlocks);
+    auto it = component_of.find(f->entry());
+    if (it == component_of.end())
+      return 0;
+    return paths[it->second];
   }
 };
 
@@ -829,16 +1245,17 @@ class UnsafeCallBlockAnalysis : public Pass {
  public:
   UnsafeCallBlockAnalysis()
       : Pass("Identify unsafe call blocks",
-             "A call block to safe function is safe") {}
+             "A call block to safe function is safe") {
+    Reads(kWrites);
+    Writes(kUnsafeBlocks);
+  }
   void RunGlobalAnalysis(CodeObject* co,
                          std::map<Function*, FuncSummary*>& summaries,
                          PassResult* result) override {
+    // PLT stubs are only safe if the library summary of their symbol says so,
+    // which the inter-procedural memory analysis folds into writes.
     std::set<Address> safe_func;
     for (auto f : co->funcs()) {
-      auto it = f->obj()->cs()->linkage().find(f->addr());
-      if (it != f->obj()->cs()->linkage().end()) {
-        if (!FuncSummary::IsSafePLTCall(it->second)) continue;
-      }
       if (!summaries[f]->writes) {
         safe_func.insert(f->addr());
       }
@@ -867,50 +1284,159 @@ class FunctionExceptionAnalysis : public Pass {
  public:
   FunctionExceptionAnalysis()
       : Pass("Inter-procedural Exception Analysis",
-             "Assume a plt call may throw an exception.") {}
+             "Assume a plt call may throw an exception unless its library "
+             "summary says otherwise.") {
+    Reads(kCallGraph);
+    Writes(kExceptionSafety);
+  }
 
   void RunGlobalAnalysis(CodeObject* co,
                          std::map<Function*, FuncSummary*>& summaries,
                          PassResult* result) override {
-    std::set<Function*> visited;
-    for (auto f : co->funcs()) {
-      auto it = visited.find(f);
-      if (it == visited.end()) {
-        VisitFunction(co, summaries[f], summaries, visited);
-      }
-    }
+    const CallGraph& cg = *call_graph_;
+    std::vector<FuncSummary*> by_id = SummariesById(cg, summaries);
+    SolveBottomUp(cg, [&cg, &by_id](const std::vector<int>& scc) {
+      SolveSCC(scc, cg, by_id);
+    });
+
     for (auto f : co->funcs())
       if (summaries[f]->func_exception_safe)
         exception_free_func.insert(f->addr());
   }
 
  private:
-  bool VisitFunction(CodeObject* co, FuncSummary* s,
-                     std::map<Function*, FuncSummary*>& summaries,
-                     std::set<Function*>& visited) {
-    visited.insert(s->func);
-    if (!s->plt_calls.empty()) {
-      s->func_exception_safe = false;
-      return false;
-    }
-    if (s->has_unknown_cf) {
-      s->func_exception_safe = false;
-      return false;
-    }
-
-    bool ret = true;
-    for (auto f : s->callees) {
-      auto it = visited.find(f);
-      if (it == visited.end()) {
-        ret &= VisitFunction(co, summaries[f], summaries, visited);
-      } else {
-        ret &= summaries[f]->writes;
+  // A function is exception safe if neither it nor anything it may call makes
+  // PLT calls which may throw or has unknown control flow. Within a call graph component we
+  // start out assuming every member is safe and clear the flag until no more
+  // members change, which terminates since flags only go from true to false.
+  static void SolveSCC(const std::vector<int>& scc, const CallGraph& cg,
+                       const std::vector<FuncSummary*>& by_id) {
+    for (auto id : scc) {
+      FuncSummary* s = by_id[id];
+      s->func_exception_safe = !s->plt_may_throw && !s->has_unknown_cf;
+    }
+
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (auto id : scc) {
+        FuncSummary* s = by_id[id];
+        if (!s->func_exception_safe)
+          continue;
+
+        for (auto& e : cg.Edges(id)) {
+          if (e.callee >= 0 && !by_id[e.callee]->func_exception_safe) {
+            s->func_exception_safe = false;
+            changed = true;
+            break;
+          }
+        }
       }
     }
+  }
+};
+
+// Exports the summaries of the object's functions to a library summary file,
+// to be imported when analysing the objects which link against it.
+class LibrarySummaryExport : public Pass {
+ public:
+  // PLT calls of the object are resolved against the given library summaries,
+  // if any, to tell whether they invoke callbacks.
+  LibrarySummaryExport(const std::string& path,
+                       const LibrarySummaries* libraries = nullptr)
+      : Pass("Library Summary Export",
+             "Exports function summaries for analysing dependent objects."),
+        path_(path),
+        libraries_(libraries != nullptr ? libraries : &no_libraries_) {
+    Reads(kCallGraph | kWrites | kExceptionSafety | kArgWrites);
+  }
+
+  void RunGlobalAnalysis(CodeObject* co,
+                         std::map<Function*, FuncSummary*>& summaries,
+                         PassResult* result) override {
+    const CallGraph& cg = *call_graph_;
+    std::vector<FuncSummary*> by_id = SummariesById(cg, summaries);
+
+    std::vector<char> callbacks(cg.Size(), 0);
+    SolveBottomUp(cg, [&](const std::vector<int>& scc) {
+      SolveSCC(scc, cg, by_id, &callbacks);
+    });
+
+    // Functions of the same name (e.g. local functions of different
+    // compilation units) are merged conservatively.
+    std::map<std::string, LibrarySummaries::Symbol> symbols;
+    for (int id = 0; id < cg.Size(); id++) {
+      Function* f = cg.GetFunction(id);
+      if (f->name().empty() ||
+          co->cs()->linkage().find(f->addr()) != co->cs()->linkage().end())
+        continue;
+
+      // Importers do not check the pointers they pass, hence writes through
+      // arguments count as writes.
+      FuncSummary* s = by_id[id];
+      bool writes = s->writes || !s->written_args.Empty();
+      auto it = symbols.find(f->name());
+      if (it == symbols.end()) {
+        symbols[f->name()] = {writes, s->func_exception_safe,
+                              callbacks[id] != 0};
+        continue;
+      }
+      it->second.writes |= writes;
+      it->second.exception_safe &= s->func_exception_safe;
+      it->second.invokes_callbacks |= callbacks[id] != 0;
+    }
+
+    if (!LibrarySummaries::Save(path_, symbols)) {
+      StdOut(Color::RED) << "Unable to write library summaries to " << path_
+                         << Endl;
+      return;
+    }
+    result->counters["Exported Symbols"] = symbols.size();
+    StdOut(Color::YELLOW, FLAGS_vv) << "  Exported " << symbols.size()
+                                    << " symbol summaries to " << path_
+                                    << Endl;
+  }
+
+ private:
+  // A function invokes callbacks if it, or anything it may call, makes
+  // indirect calls or calls into another library invoking callbacks. Flags
+  // only go from false to true, hence iterate the component to a fixpoint.
+  void SolveSCC(const std::vector<int>& scc, const CallGraph& cg,
+                const std::vector<FuncSummary*>& by_id,
+                std::vector<char>* callbacks) const {
+    for (auto id : scc) {
+      FuncSummary* s = by_id[id];
+      bool invokes = s->has_unknown_cf;
+      for (auto& e : cg.Edges(id)) {
+        if (e.kind == CallGraph::kIndirect)
+          invokes = true;
+      }
+      for (auto& call : s->plt_calls) {
+        invokes |= libraries_->Lookup(call.second).invokes_callbacks;
+      }
+      (*callbacks)[id] = invokes;
+    }
 
-    s->func_exception_safe = ret;
-    return ret;
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (auto id : scc) {
+        if ((*callbacks)[id])
+          continue;
+        for (auto& e : cg.Edges(id)) {
+          if (e.callee >= 0 && (*callbacks)[e.callee]) {
+            (*callbacks)[id] = 1;
+            changed = true;
+            break;
+          }
+        }
+      }
+    }
   }
+
+  std::string path_;
+  LibrarySummaries no_libraries_;
+  const LibrarySummaries* libraries_;
 };
 
 #endif  // LITECFI_PASSES_H
@@ -0,0 +1,552 @@
+#ifndef LITECFI_PLACEMENT_H_
+#define LITECFI_PLACEMENT_H_
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "CFG.h"
+#include "PatchCFG.h"
+#include "pass_manager.h"
+#include "scc.h"
+
+namespace placement {
+
+using Dyninst::PatchAPI::PatchBlock;
+using Dyninst::PatchAPI::PatchEdge;
+using Dyninst::PatchAPI::PatchFunction;
+
+// Computes immediate dominators with the iterative algorithm of Cooper, Harvey
+// and Kennedy over a graph of nodes numbered from 0 to n - 1.
+//
+// succs(v) and preds(v) return the successors and predecessors of v. Running
+// it over the reversed graph yields the immediate post-dominators. The result
+// holds -1 for nodes not reachable from root and root for root itself.
+template <typename Succs, typename Preds>
+std::vector<int> ComputeIdoms(int n, int root, Succs succs, Preds preds) {
+  // Reverse post order by an iterative depth first search.
+  std::vector<int> rpo;
+  std::vector<int> order(n, -1);
+  std::vector<bool> seen(n, false);
+  std::vector<std::pair<int, size_t>> stack = {{root, 0}};
+  std::vector<std::vector<int>> children(n);
+  seen[root] = true;
+  children[root] = succs(root);
+  while (!stack.empty()) {
+    auto& top = stack.back();
+    if (top.second < children[top.first].size()) {
+      int w = children[top.first][top.second++];
+      if (!seen[w]) {
+        seen[w] = true;
+        children[w] = succs(w);
+        stack.push_back({w, 0});
+      }
+      continue;
+    }
+    rpo.push_back(top.first);
+    stack.pop_back();
+  }
+  std::reverse(rpo.begin(), rpo.end());
+  for (size_t i = 0; i < rpo.size(); i++)
+    order[rpo[i]] = i;
+
+  std::vector<int> idom(n, -1);
+  idom[root] = root;
+  auto intersect = [&](int a, int b) {
+    while (a != b) {
+      while (order[a] > order[b])
+        a = idom[a];
+      while (order[b] > order[a])
+        b = idom[b];
+    }
+    return a;
+  };
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto v : rpo) {
+      if (v == root)
+        continue;
+      int new_idom = -1;
+      for (auto p : preds(v)) {
+        if (order[p] < 0 || idom[p] < 0)
+          continue;
+        new_idom = new_idom < 0 ? p : intersect(p, new_idom);
+      }
+      if (new_idom != idom[v]) {
+        idom[v] = new_idom;
+        changed = true;
+      }
+    }
+  }
+  return idom;
+}
+
+// Edges of the function's own control flow. Shared with the CFG cloning in
+// instrument.cc.
+inline bool IsFollowed(PatchEdge* e) {
+  return !e->sinkEdge() && !e->interproc() &&
+         e->type() != Dyninst::ParseAPI::CATCH;
+}
+
+// Chooses the edges at which a lowered function pushes to the shadow stack.
+//
+// Blocks reachable from the function entry without passing an unsafe block
+// run on the original code. Every edge from them into an unsafe block is
+// redirected into the instrumented clone with a push on it. Jump table edges
+// cannot carry a push, so a switch block with a jump table target needing
+// one needs it itself.
+//
+// The pushes are then hoisted up the dominator tree. A push on all the
+// incoming edges of a block d replaces the pushes on the edges dominated by d
+// as long as
+//
+//   - d is post-dominated by the unsafe edges. Every path through d pushes
+//     anyway, so no path gets an extra push.
+//   - d is not part of a loop. The clone of a loop block has incoming edges
+//     from within the clone, so the push could not be put at its entry.
+//   - all incoming edges of d are ordinary edges which can carry a push.
+//   - it reduces the number of push sites.
+//
+// The highest such block of each dominator subtree is chosen.
+//
+// Only the targets of the redirected edges and the blocks between them and a
+// return are cloned. Blocks which cannot return, such as error paths ending
+// in a call to abort, are shared with the original code since they never
+// reach a pop anyway.
+class PushPlacement {
+ public:
+  PushPlacement(PatchFunction* f, FuncSummary* s) : f_(f), s_(s) {}
+
+  // Computes the placement. pushable tells if the push can be put on an
+  // edge. Returns false if the function cannot be lowered.
+  bool Compute(const std::function<bool(PatchEdge*)>& pushable) {
+    if (NeedsPushBefore(f_->entry()))
+      return false;
+
+    CollectSafeBlocks();
+    Hoist(pushable);
+
+    for (auto e : push_edges_) {
+      if (!pushable(e))
+        return false;
+    }
+    CollectRegion();
+    return true;
+  }
+
+  // Original edges to redirect into the clone and push on.
+  const std::set<PatchEdge*>& push_edges() const { return push_edges_; }
+
+  // Original blocks which need an instrumented clone.
+  const std::set<PatchBlock*>& region() const { return region_; }
+
+  // Number of blocks the pushes were hoisted to.
+  int hoisted() const { return hoisted_; }
+
+ private:
+  // Whether the shadow stack push has to happen before entering the block.
+  bool NeedsPushBefore(PatchBlock* b) {
+    auto it = needs_push_.find(b);
+    if (it != needs_push_.end())
+      return it->second;
+
+    // Jump table cycles are broken by assuming the block does not need one.
+    needs_push_[b] = false;
+    bool needs = s_->unsafe_blocks.find(b->block()) != s_->unsafe_blocks.end();
+    for (auto e : b->targets()) {
+      if (needs)
+        break;
+      if (!IsFollowed(e) || e->type() != Dyninst::ParseAPI::INDIRECT)
+        continue;
+      needs = NeedsPushBefore(e->trg());
+    }
+    needs_push_[b] = needs;
+    return needs;
+  }
+
+  // Numbers the blocks reachable from the entry without a push and collects
+  // the edges leaving them for blocks needing one.
+  void CollectSafeBlocks() {
+    std::vector<PatchBlock*> stack = {f_->entry()};
+    index_[f_->entry()] = 0;
+    safe_.push_back(f_->entry());
+    while (!stack.empty()) {
+      PatchBlock* b = stack.back();
+      stack.pop_back();
+      for (auto e : b->targets()) {
+        if (!IsFollowed(e))
+          continue;
+        if (NeedsPushBefore(e->trg())) {
+          // The source of a jump table edge would have needed the push.
+          assert(e->type() != Dyninst::ParseAPI::INDIRECT);
+          push_edges_.insert(e);
+          continue;
+        }
+        if (index_.emplace(e->trg(), safe_.size()).second) {
+          safe_.push_back(e->trg());
+          stack.push_back(e->trg());
+        }
+      }
+    }
+  }
+
+  // Whether leaving the block may return from the function or otherwise leave
+  // its control flow graph. Calls return to their fall through.
+  bool Leaves(PatchBlock* b) {
+    if (f_->exitBlocks().find(b) != f_->exitBlocks().end())
+      return true;
+    for (auto e : b->targets()) {
+      if (!IsFollowed(e) && e->type() != Dyninst::ParseAPI::CALL)
+        return true;
+    }
+    return false;
+  }
+
+  void Hoist(const std::function<bool(PatchEdge*)>& pushable) {
+    int n = safe_.size();
+    if (push_edges_.empty() || n < 2)
+      return;
+
+    // Successors of the safe blocks. Unsafe edges lead to the node kUnsafe and
+    // leaving the function to kExit. kUnsafe continues to kExit.
+    const int kUnsafe = n;
+    const int kExit = n + 1;
+    std::vector<std::vector<int>> succs(n + 2);
+    std::vector<std::vector<int>> preds(n + 2);
+    auto add_edge = [&](int from, int to) {
+      succs[from].push_back(to);
+      preds[to].push_back(from);
+    };
+    for (int i = 0; i < n; i++) {
+      PatchBlock* b = safe_[i];
+      for (auto e : b->targets()) {
+        if (!IsFollowed(e))
+          continue;
+        if (push_edges_.find(e) != push_edges_.end()) {
+          add_edge(i, kUnsafe);
+        } else {
+          add_edge(i, index_[e->trg()]);
+        }
+      }
+      if (Leaves(b))
+        add_edge(i, kExit);
+    }
+    add_edge(kUnsafe, kExit);
+
+    std::vector<int> idom = ComputeIdoms(
+        n + 2, 0, [&](int v) { return succs[v]; },
+        [&](int v) { return preds[v]; });
+    std::vector<int> ipdom = ComputeIdoms(
+        n + 2, kExit, [&](int v) { return preds[v]; },
+        [&](int v) { return succs[v]; });
+
+    auto post_dominated_by_unsafe = [&](int v) {
+      if (ipdom[v] < 0)
+        return false;
+      while (v != kExit && v != kUnsafe)
+        v = ipdom[v];
+      return v == kUnsafe;
+    };
+
+    // Blocks on a cycle anywhere in the function, clones included.
+    std::vector<PatchBlock*> blocks(f_->blocks().begin(), f_->blocks().end());
+    std::set<PatchBlock*> cyclic;
+    auto components = ComputeSCCs(blocks, [](PatchBlock* b) {
+      std::vector<PatchBlock*> succs;
+      for (auto e : b->targets()) {
+        if (IsFollowed(e))
+          succs.push_back(e->trg());
+      }
+      return succs;
+    });
+    for (auto& c : components) {
+      if (c.size() > 1)
+        cyclic.insert(c.begin(), c.end());
+    }
+    for (auto b : blocks) {
+      for (auto e : b->targets()) {
+        if (IsFollowed(e) && e->trg() == b)
+          cyclic.insert(b);
+      }
+    }
+
+    // Push edges dominated by each block, counting those of its subtree.
+    std::vector<std::vector<int>> children(n);
+    for (int i = 1; i < n; i++) {
+      if (idom[i] >= 0 && idom[i] < n)
+        children[idom[i]].push_back(i);
+    }
+    std::vector<int> dominated(n, 0);
+    for (auto e : push_edges_)
+      dominated[index_[e->src()]]++;
+    std::vector<int> preorder;
+    std::vector<int> stack = {0};
+    while (!stack.empty()) {
+      int v = stack.back();
+      stack.pop_back();
+      preorder.push_back(v);
+      for (auto c : children[v])
+        stack.push_back(c);
+    }
+    for (auto it = preorder.rbegin(); it != preorder.rend(); ++it) {
+      if (*it != 0)
+        dominated[idom[*it]] += dominated[*it];
+    }
+
+    auto dominates = [&](int d, int v) {
+      while (v != d && v != 0)
+        v = idom[v];
+      return v == d;
+    };
+
+    // Top down so that the highest block of each subtree is taken.
+    std::vector<bool> covered(n, false);
+    for (auto v : preorder) {
+      if (v != 0 && covered[idom[v]]) {
+        covered[v] = true;
+        continue;
+      }
+      if (v == 0 || dominated[v] < 2)
+        continue;
+
+      PatchBlock* d = safe_[v];
+      if (cyclic.find(d) != cyclic.end() || !post_dominated_by_unsafe(v))
+        continue;
+
+      std::vector<PatchEdge*> incoming;
+      bool ok = true;
+      for (auto e : d->sources()) {
+        if (!IsFollowed(e) || e->type() == Dyninst::ParseAPI::INDIRECT ||
+            index_.find(e->src()) == index_.end() || !pushable(e)) {
+          ok = false;
+          break;
+        }
+        incoming.push_back(e);
+      }
+      // Fewer push sites even if the pushes on the incoming edges do not get
+      // coalesced into one at the block entry.
+      if (!ok || incoming.empty() ||
+          static_cast<int>(incoming.size()) >= dominated[v])
+        continue;
+
+      for (auto it = push_edges_.begin(); it != push_edges_.end();) {
+        if (dominates(v, index_[(*it)->src()])) {
+          it = push_edges_.erase(it);
+        } else {
+          ++it;
+        }
+      }
+      push_edges_.insert(incoming.begin(), incoming.end());
+      covered[v] = true;
+      hoisted_++;
+    }
+  }
+
+  // Whether the block may return from the function. Calls to functions which
+  // do not return do not count.
+  bool Returns(PatchBlock* b) {
+    bool call = false;
+    bool call_ft = false;
+    for (auto e : b->targets()) {
+      if (e->type() == Dyninst::ParseAPI::CALL) {
+        call = true;
+      } else if (e->type() == Dyninst::ParseAPI::CALL_FT) {
+        call_ft = true;
+      } else if (!IsFollowed(e)) {
+        return true;
+      }
+    }
+    if (f_->exitBlocks().find(b) == f_->exitBlocks().end())
+      return false;
+    return !call || call_ft;
+  }
+
+  // Blocks reachable from the pushes which can return, and the push targets.
+  void CollectRegion() {
+    std::set<PatchBlock*> reachable;
+    std::vector<PatchBlock*> stack;
+    for (auto e : push_edges_) {
+      region_.insert(e->trg());
+      if (reachable.insert(e->trg()).second)
+        stack.push_back(e->trg());
+    }
+    while (!stack.empty()) {
+      PatchBlock* b = stack.back();
+      stack.pop_back();
+      for (auto e : b->targets()) {
+        if (IsFollowed(e) && reachable.insert(e->trg()).second)
+          stack.push_back(e->trg());
+      }
+    }
+
+    std::set<PatchBlock*> returning;
+    for (auto b : reachable) {
+      if (Returns(b) && returning.insert(b).second)
+        stack.push_back(b);
+    }
+    while (!stack.empty()) {
+      PatchBlock* b = stack.back();
+      stack.pop_back();
+      for (auto e : b->sources()) {
+        if (!IsFollowed(e) || reachable.find(e->src()) == reachable.end())
+          continue;
+        if (returning.insert(e->src()).second)
+          stack.push_back(e->src());
+      }
+    }
+    region_.insert(returning.begin(), returning.end());
+  }
+
+  PatchFunction* f_;
+  FuncSummary* s_;
+  std::map<PatchBlock*, bool> needs_push_;
+  std::vector<PatchBlock*> safe_;
+  std::map<PatchBlock*, int> index_;
+  std::set<PatchEdge*> push_edges_;
+  std::set<PatchBlock*> region_;
+  int hoisted_ = 0;
+};
+
+// Shadow stack operations of a function whose fast paths run uninstrumented.
+// Each block comes with the offset of the return address from the stack
+// pointer at the instrumentation point.
+struct FastPaths {
+  // Slow path entries, pushing at their entry.
+  std::vector<std::pair<PatchBlock*, int>> pushes;
+  // Slow path blocks popping at their exit. Either exits of the function or
+  // blocks falling into an epilogue shared with the fast paths.
+  std::vector<std::pair<PatchBlock*, int>> pops;
+};
+
+// Finds the fast paths of a function. Those are the paths from the entry
+// through blocks without unsafe writes, calls or unknown control flow, which
+// return without ever passing an unsafe block. Early returns after null
+// checks and guard clauses fall into this.
+//
+// The remaining blocks reachable from the fast paths are the slow paths. They
+// push at their entries and pop at their exits. This requires that
+//
+//   - the function entry is on the fast paths and is not a loop header.
+//   - the slow paths do not lead back to a fast path, except into an
+//     epilogue which only leads to returns. Slow paths pop right before
+//     falling into such an epilogue, at the stack height there.
+//   - slow path entries are entered only from the fast paths, so that the
+//     push runs once.
+//
+// Returns false if the function has no such fast paths.
+inline bool FindFastPaths(PatchFunction* f, FuncSummary* s, FastPaths* fp) {
+  using Dyninst::ParseAPI::CALL;
+  using Dyninst::ParseAPI::RET;
+
+  auto fast = [&](PatchBlock* b) {
+    if (s->unsafe_blocks.find(b->block()) != s->unsafe_blocks.end())
+      return false;
+    for (auto e : b->targets()) {
+      if (e->type() == CALL || (e->sinkEdge() && e->type() != RET))
+        return false;
+    }
+    return true;
+  };
+
+  auto closure = [](const std::vector<PatchBlock*>& roots,
+                    const std::function<bool(PatchBlock*)>& include) {
+    std::set<PatchBlock*> blocks;
+    std::vector<PatchBlock*> stack;
+    for (auto b : roots) {
+      if (include(b) && blocks.insert(b).second)
+        stack.push_back(b);
+    }
+    while (!stack.empty()) {
+      PatchBlock* b = stack.back();
+      stack.pop_back();
+      for (auto e : b->targets()) {
+        if (IsFollowed(e) && include(e->trg()) &&
+            blocks.insert(e->trg()).second)
+          stack.push_back(e->trg());
+      }
+    }
+    return blocks;
+  };
+
+  PatchBlock* entry = f->entry();
+  if (!fast(entry))
+    return false;
+  for (auto e : entry->sources()) {
+    if (IsFollowed(e))
+      return false;
+  }
+
+  std::set<PatchBlock*> fast_blocks = closure({entry}, fast);
+  std::set<PatchBlock*> slow_entries;
+  for (auto b : fast_blocks) {
+    for (auto e : b->targets()) {
+      if (IsFollowed(e) && fast_blocks.find(e->trg()) == fast_blocks.end())
+        slow_entries.insert(e->trg());
+    }
+  }
+  if (slow_entries.empty())
+    return false;
+
+  std::set<PatchBlock*> slow_blocks =
+      closure(std::vector<PatchBlock*>(slow_entries.begin(), slow_entries.end()),
+              [](PatchBlock*) { return true; });
+
+  // Fast blocks reachable from the slow paths must form an epilogue.
+  std::set<PatchBlock*> epilogue;
+  for (auto b : slow_blocks) {
+    if (fast_blocks.find(b) != fast_blocks.end())
+      epilogue.insert(b);
+  }
+  for (auto b : epilogue) {
+    for (auto e : b->targets()) {
+      if (IsFollowed(e) && epilogue.find(e->trg()) == epilogue.end())
+        return false;
+    }
+  }
+
+  for (auto b : slow_entries) {
+    auto it = s->blockEntrySPHeight.find(b->start());
+    if (it == s->blockEntrySPHeight.end())
+      return false;
+    for (auto e : b->sources()) {
+      if (!IsFollowed(e) || fast_blocks.find(e->src()) == fast_blocks.end() ||
+          epilogue.find(e->src()) != epilogue.end())
+        return false;
+    }
+    fp->pushes.push_back({b, it->second});
+  }
+
+  for (auto b : slow_blocks) {
+    if (epilogue.find(b) != epilogue.end())
+      continue;
+    if (f->exitBlocks().find(b) != f->exitBlocks().end()) {
+      fp->pops.push_back({b, 0});
+      continue;
+    }
+
+    bool into_epilogue = false;
+    for (auto e : b->targets()) {
+      if (IsFollowed(e) && epilogue.find(e->trg()) != epilogue.end())
+        into_epilogue = true;
+    }
+    if (!into_epilogue)
+      continue;
+
+    // The pop would otherwise run on the other edges too.
+    auto it = s->blockEndSPHeight.find(b->start());
+    if (b->targets().size() != 1 || it == s->blockEndSPHeight.end())
+      return false;
+    fp->pops.push_back({b, it->second});
+  }
+  return true;
+}
+
+}  // namespace placement
+
+#endif  // LITECFI_PLACEMENT_H_
@@ -1,44 +1,148 @@
-
 #ifndef LITECFI_REGISTER_UTILS_H_
 #define LITECFI_REGISTER_UTILS_H_
 
-#include <string>
+#include <cstdint>
+#include <initializer_list>
+#include <map>
 
-inline std::string NormalizeRegisterName(std::string reg_with_arch) {
-  std::string arch = "x86_64::";
+#include "dyn_regs.h"
 
-  // Remove architecture prefix (x86_64::)
-  std::string reg = reg_with_arch.substr(arch.length(), std::string::npos);
-  if (!reg.compare(0, 1, "e")) {
-    return arch + "r" + reg.substr(1);
-  }
+using Dyninst::MachRegister;
+
+// General purpose register numbers. These follow the x86-64 register encoding.
+enum Gpr : int {
+  kRax = 0,
+  kRcx,
+  kRdx,
+  kRbx,
+  kRsp,
+  kRbp,
+  kRsi,
+  kRdi,
+  kR8,
+  kR9,
+  kR10,
+  kR11,
+  kR12,
+  kR13,
+  kR14,
+  kR15,
+  kNumGprs,
+  kNoGpr = -1
+};
+
+// Set of general purpose registers packed into a 16 bit mask.
+//
+// Iteration visits registers in increasing register number.
+class RegisterSet {
+ public:
+  class Iterator {
+   public:
+    explicit Iterator(uint16_t mask) : mask_(mask) {}
+
+    Gpr operator*() const { return static_cast<Gpr>(__builtin_ctz(mask_)); }
+
+    Iterator& operator++() {
+      mask_ &= mask_ - 1;
+      return *this;
+    }
+
+    bool operator!=(const Iterator& o) const { return mask_ != o.mask_; }
+
+   private:
+    uint16_t mask_;
+  };
 
-  if (!(reg.compare("ax") && reg.compare("ah") && reg.compare("al"))) {
-    return arch + "rax";
-  } else if (!(reg.compare("bx") && reg.compare("bh") && reg.compare("bl"))) {
-    return arch + "rbx";
-  } else if (!(reg.compare("cx") && reg.compare("ch") && reg.compare("cl"))) {
-    return arch + "rcx";
-  } else if (!(reg.compare("dx") && reg.compare("dh") && reg.compare("dl"))) {
-    return arch + "rdx";
-  } else if (!reg.compare("si")) {
-    return arch + "rsi";
-  } else if (!reg.compare("di")) {
-    return arch + "rdi";
-  } else if (!reg.compare("bp")) {
-    return arch + "rbp";
-  } else if (!reg.compare("sp")) {
-    return arch + "rsp";
-  } else if (!reg.compare(0, 1, "r") && isdigit(reg.substr(1, 1).at(0)) &&
-             (std::isalpha(reg.substr(reg.size() - 1).at(0)))) {
-    if (std::isdigit(reg.substr(2, 1).at(0))) {
-      return arch + "r" + reg.substr(1, 2);
+  RegisterSet() : mask_(0) {}
+
+  explicit RegisterSet(uint16_t mask) : mask_(mask) {}
+
+  RegisterSet(std::initializer_list<Gpr> regs) : mask_(0) {
+    for (auto r : regs) {
+      Insert(r);
     }
+  }
 
-    return arch + "r" + reg.substr(1, 1);
+  // All general purpose registers apart from the stack pointer.
+  static RegisterSet AllButSp() {
+    return RegisterSet(static_cast<uint16_t>(0xffff & ~(1 << kRsp)));
   }
 
-  return reg_with_arch;
+  void Insert(Gpr r) { mask_ |= Bit(r); }
+
+  void Erase(Gpr r) { mask_ &= ~Bit(r); }
+
+  bool Contains(Gpr r) const { return (mask_ & Bit(r)) != 0; }
+
+  bool Empty() const { return mask_ == 0; }
+
+  int Size() const { return __builtin_popcount(mask_); }
+
+  // Lowest numbered register in the set. The set must not be empty.
+  Gpr First() const { return *begin(); }
+
+  uint16_t mask() const { return mask_; }
+
+  RegisterSet operator|(RegisterSet o) const {
+    return RegisterSet(mask_ | o.mask_);
+  }
+
+  RegisterSet operator&(RegisterSet o) const {
+    return RegisterSet(mask_ & o.mask_);
+  }
+
+  RegisterSet operator-(RegisterSet o) const {
+    return RegisterSet(mask_ & ~o.mask_);
+  }
+
+  bool operator==(RegisterSet o) const { return mask_ == o.mask_; }
+
+  bool operator!=(RegisterSet o) const { return mask_ != o.mask_; }
+
+  Iterator begin() const { return Iterator(mask_); }
+
+  Iterator end() const { return Iterator(0); }
+
+ private:
+  static uint16_t Bit(Gpr r) {
+    return r == kNoGpr ? 0 : static_cast<uint16_t>(1 << r);
+  }
+
+  uint16_t mask_;
+};
+
+// Maps a Dyninst register to the general purpose register it is part of.
+// Sub registers (eax, ax, al, ah etc.) map to their full width register.
+// Returns kNoGpr for any other register.
+inline Gpr ToGpr(MachRegister reg) {
+  // Built once. Read only afterwards, hence safe to use from concurrent
+  // analyses.
+  static const std::map<MachRegister, Gpr> kGprs = {
+      {Dyninst::x86_64::rax, kRax}, {Dyninst::x86_64::rcx, kRcx},
+      {Dyninst::x86_64::rdx, kRdx}, {Dyninst::x86_64::rbx, kRbx},
+      {Dyninst::x86_64::rsp, kRsp}, {Dyninst::x86_64::rbp, kRbp},
+      {Dyninst::x86_64::rsi, kRsi}, {Dyninst::x86_64::rdi, kRdi},
+      {Dyninst::x86_64::r8, kR8},   {Dyninst::x86_64::r9, kR9},
+      {Dyninst::x86_64::r10, kR10}, {Dyninst::x86_64::r11, kR11},
+      {Dyninst::x86_64::r12, kR12}, {Dyninst::x86_64::r13, kR13},
+      {Dyninst::x86_64::r14, kR14}, {Dyninst::x86_64::r15, kR15}};
+
+  auto it = kGprs.find(reg.getBaseRegister());
+  if (it == kGprs.end())
+    return kNoGpr;
+  return it->second;
+}
+
+// Returns the Dyninst register corresponding to a general purpose register.
+inline MachRegister ToMachRegister(Gpr r) {
+  static const MachRegister kRegs[kNumGprs] = {
+      Dyninst::x86_64::rax, Dyninst::x86_64::rcx, Dyninst::x86_64::rdx,
+      Dyninst::x86_64::rbx, Dyninst::x86_64::rsp, Dyninst::x86_64::rbp,
+      Dyninst::x86_64::rsi, Dyninst::x86_64::rdi, Dyninst::x86_64::r8,
+      Dyninst::x86_64::r9,  Dyninst::x86_64::r10, Dyninst::x86_64::r11,
+      Dyninst::x86_64::r12, Dyninst::x86_64::r13, Dyninst::x86_64::r14,
+      Dyninst::x86_64::r15};
+  return kRegs[r];
 }
 
 #endif  // LITECFI_REGISTER_UTILS_H_
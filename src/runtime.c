@@ -2,9 +2,12 @@
 #include <asm/prctl.h>
 #include <bits/pthreadtypes.h>
 #include <dlfcn.h>
+#include <errno.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/prctl.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
@@ -20,34 +23,320 @@ extern "C" {
 
 static const long long __stack_sz = 8 * 1024 * 1024;  // 8 MB
 
+// Distance of the parallel shadow stack from the thread stack it mirrors. Must
+// match kParallelShadowOffset in jit.cc.
+static const long __parallel_offset = -0x40000000L;
+
+// Dynamic symbol the rewriter adds to objects rewritten with
+// --shadow_stack_layout=parallel. Must match kParallelLayoutSymbol in
+// instrument.cc.
+static const char __parallel_layout_symbol[] = "__shadow_guard_parallel_layout";
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+// pthread.h is left out since its pthread_create prototype clashes with the
+// wrapper below.
+int pthread_getattr_np(pthread_t thread, pthread_attr_t *attr);
+int pthread_attr_getstack(const pthread_attr_t *attr, void **stack,
+                          size_t *size);
+int pthread_attr_destroy(pthread_attr_t *attr);
+pthread_t pthread_self(void);
+
+// Shared slow paths of the shadow stack checks. The pops inserted by the
+// rewriter only compare against the top of the shadow stack and call one of
+// these through the thread's stub slots on a mismatch. They unwind the shadow
+// stack until the return address is found, or raise SIGILL when hitting the
+// guard word. The return address, or its address when validating frames, is
+// passed on the stack and popped on return. All registers but the flags are
+// preserved.
+//
+//   __shadow_guard_unwind          : The mismatched entry has been popped.
+//   __shadow_guard_unwind_frame    : Same, with return address and frame
+//                                    entries.
+//   __shadow_guard_unwind_register : Nothing has been popped (register frame
+//                                    pops).
+//
+// Each comes in a variant for 8 byte entries and one, suffixed with 32, for
+// the 32 bit entries of --compact_entries. Those only hold the low halves of
+// the addresses.
+void __shadow_guard_unwind(void) __attribute__((visibility("hidden")));
+void __shadow_guard_unwind_frame(void) __attribute__((visibility("hidden")));
+void __shadow_guard_unwind_register(void)
+    __attribute__((visibility("hidden")));
+void __shadow_guard_unwind32(void) __attribute__((visibility("hidden")));
+void __shadow_guard_unwind_frame32(void) __attribute__((visibility("hidden")));
+void __shadow_guard_unwind_register32(void)
+    __attribute__((visibility("hidden")));
+
+#define STUB_BEGIN(name)                                                     \
+  ".globl " name "\n"                                                        \
+  ".hidden " name "\n"                                                       \
+  ".type " name ", @function\n" name ":\n"
+
+#define STUB_END(name) ".size " name ", .-" name "\n"
+
+// Stubs for entries of the given size. ra and frame are the matching widths of
+// %rcx and %rdx.
+#define UNWIND_STUBS(suffix, size, frame_size, ra, frame)                    \
+  STUB_BEGIN("__shadow_guard_unwind" suffix)                                 \
+  "  push %rax\n"                                                            \
+  "  push %rcx\n"                                                            \
+  "  mov 0x18(%rsp), %rcx\n"                                                 \
+  "  mov %gs:0x0, %rax\n"                                                    \
+  ".Lunwind_check" suffix ":\n"                                              \
+  "  cmpl $0x0, (%rax)\n"                                                    \
+  "  je .Lunwind_error" suffix "\n"                                          \
+  ".Lunwind_pop" suffix ":\n"                                                \
+  "  lea -" size "(%rax), %rax\n"                                            \
+  "  mov %rax, %gs:0x0\n"                                                    \
+  "  cmp (%rax), " ra "\n"                                                   \
+  "  jne .Lunwind_check" suffix "\n"                                         \
+  "  pop %rcx\n"                                                             \
+  "  pop %rax\n"                                                             \
+  "  ret $0x8\n"                                                             \
+  ".Lunwind_error" suffix ":\n"                                              \
+  /* Cause a SIGILL instead of SIGTRAP to ease debuggability with GDB. */   \
+  "  .byte 0x62\n"                                                           \
+  STUB_END("__shadow_guard_unwind" suffix)                                   \
+                                                                             \
+  STUB_BEGIN("__shadow_guard_unwind_register" suffix)                        \
+  "  push %rax\n"                                                            \
+  "  push %rcx\n"                                                            \
+  "  mov 0x18(%rsp), %rcx\n"                                                 \
+  "  mov %gs:0x0, %rax\n"                                                    \
+  "  jmp .Lunwind_pop" suffix "\n"                                           \
+  STUB_END("__shadow_guard_unwind_register" suffix)                          \
+                                                                             \
+  STUB_BEGIN("__shadow_guard_unwind_frame" suffix)                           \
+  "  push %rax\n"                                                            \
+  "  push %rcx\n"                                                            \
+  "  push %rdx\n"                                                            \
+  "  mov 0x20(%rsp), %rdx\n"                                                 \
+  "  mov (%rdx), " ra "\n"                                                   \
+  "  mov %gs:0x0, %rax\n"                                                    \
+  ".Lunwind_frame_check" suffix ":\n"                                        \
+  "  cmpl $0x0, (%rax)\n"                                                    \
+  "  je .Lunwind_frame_error" suffix "\n"                                    \
+  "  lea -" frame_size "(%rax), %rax\n"                                      \
+  "  mov %rax, %gs:0x0\n"                                                    \
+  "  cmp (%rax), " ra "\n"                                                   \
+  "  jne .Lunwind_frame_check" suffix "\n"                                   \
+  "  cmp " size "(%rax), " frame "\n"                                        \
+  "  jne .Lunwind_frame_check" suffix "\n"                                   \
+  "  pop %rdx\n"                                                             \
+  "  pop %rcx\n"                                                             \
+  "  pop %rax\n"                                                             \
+  "  ret $0x8\n"                                                             \
+  ".Lunwind_frame_error" suffix ":\n"                                        \
+  "  .byte 0x62\n"                                                           \
+  STUB_END("__shadow_guard_unwind_frame" suffix)
+
+asm(".pushsection .text.unlikely,\"ax\",@progbits\n"
+    UNWIND_STUBS("", "0x8", "0x10", "%rcx", "%rdx")
+    UNWIND_STUBS("32", "0x4", "0x8", "%ecx", "%edx")
+    ".popsection\n");
+
+// Stack ranges whose parallel shadow stack has been mapped. Exited threads
+// hand their stacks on to new threads, which then reuse the mirror as well.
+typedef struct __mirror_range {
+  char *start;
+  char *end;
+} mirror_range;
+
+static mirror_range *__mirrors = NULL;
+static int __num_mirrors = 0;
+static int __max_mirrors = 0;
+static volatile int __mirrors_lock = 0;
+
+// Whether objects rewritten for the parallel layout have been loaded. Only
+// objects loaded at start up are taken into account.
+static int __parallel_layout = 0;
+
+// Returns the end of the mirror containing addr, or NULL if there is none.
+static char *__mirror_containing(char *addr) {
+  for (int i = 0; i < __num_mirrors; i++) {
+    if (__mirrors[i].start <= addr && addr < __mirrors[i].end)
+      return __mirrors[i].end;
+  }
+  return NULL;
+}
+
+// Returns the start of the first mirror in (addr, end), or end if there is
+// none.
+static char *__next_mirror(char *addr, char *end) {
+  char *next = end;
+  for (int i = 0; i < __num_mirrors; i++) {
+    if (addr < __mirrors[i].start && __mirrors[i].start < next)
+      next = __mirrors[i].start;
+  }
+  return next;
+}
+
+static void __record_mirror(char *start, char *end) {
+  if (__num_mirrors == __max_mirrors) {
+    __max_mirrors = __max_mirrors ? 2 * __max_mirrors : 64;
+    __mirrors = (mirror_range *)realloc(__mirrors,
+                                        __max_mirrors * sizeof(mirror_range));
+    if (__mirrors == NULL)
+      abort();
+  }
+  __mirrors[__num_mirrors].start = start;
+  __mirrors[__num_mirrors].end = end;
+  __num_mirrors++;
+}
+
+// Maps [start, end) of the parallel shadow stack of stack. Rewritten code
+// would otherwise fault on, or worse overwrite, whatever lives at the mirror,
+// hence failing to map it is fatal.
+static void __map_mirror_range(void *stack, char *start, char *end) {
+  void *addr = mmap(start, end - start, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE |
+                        MAP_FIXED_NOREPLACE,
+                    -1, 0);
+  if (addr == start)
+    return;
+  int err = errno;
+
+  // Kernels without MAP_FIXED_NOREPLACE take the address as a hint and map
+  // elsewhere if it is taken.
+  int taken = err == EEXIST || addr != MAP_FAILED;
+  if (addr != MAP_FAILED)
+    munmap(addr, end - start);
+  if (taken) {
+    fprintf(stderr,
+            "[shadow guard] The parallel shadow stack of stack %p collides "
+            "with another mapping in [%p, %p). Mirrors lie 1 GiB below their "
+            "stacks, so the stacks of all threads must fit into 1 GiB\n",
+            stack, start, end);
+  } else {
+    fprintf(stderr,
+            "[shadow guard] Could not map the parallel shadow stack of "
+            "stack %p at %p (errno %d)\n",
+            stack, start, err);
+  }
+  abort();
+}
+
+// Maps the parallel shadow stack of the stack [stack, stack + size). Return
+// addresses are mirrored at __parallel_offset from their stack slot, so the
+// mirror spans the whole stack. Its pages are only backed once written to.
+//
+// Stacks may partially overlap ones mapped before, e.g. when a stack handed
+// on by an exited thread is reused with a different size, so only the parts
+// not mirrored yet are mapped.
+static void __shadow_guard_map_mirror(void *stack, size_t size) {
+  long page = sysconf(_SC_PAGESIZE);
+  char *start = (char *)((uintptr_t)stack & ~(page - 1)) + __parallel_offset;
+  char *end = (char *)(((uintptr_t)stack + size + page - 1) & ~(page - 1)) +
+              __parallel_offset;
+
+  while (__sync_lock_test_and_set(&__mirrors_lock, 1))
+    ;
+  char *addr = start;
+  while (addr < end) {
+    char *covered = __mirror_containing(addr);
+    if (covered != NULL) {
+      addr = covered;
+      continue;
+    }
+
+    char *next = __next_mirror(addr, end);
+    __map_mirror_range(stack, addr, next);
+    __record_mirror(addr, next);
+    addr = next;
+  }
+  __sync_lock_release(&__mirrors_lock);
+}
+
+// Maps the parallel shadow stack of a stack allocated by the program itself,
+// e.g. for makecontext. Rewritten code running on such stacks needs one, while
+// thread stacks and alternate signal stacks are taken care of here. Does
+// nothing unless the parallel layout is in use.
+void __shadow_guard_map_parallel_stack(void *stack, size_t size) {
+  if (__parallel_layout)
+    __shadow_guard_map_mirror(stack, size);
+}
+
+// Maps the parallel shadow stack of the calling thread's stack.
+static void __shadow_guard_init_parallel_stack() {
+  if (!__parallel_layout)
+    return;
+
+  pthread_attr_t attr;
+  void *stack = NULL;
+  size_t size = 0;
+  if (pthread_getattr_np(pthread_self(), &attr) != 0)
+    abort();
+  pthread_attr_getstack(&attr, &stack, &size);
+  pthread_attr_destroy(&attr);
+  __shadow_guard_map_mirror(stack, size);
+}
+
 // Sets up the thread shadow stack.
 //
 // Format of the stack is
 //
-//           |   .   |
-//           |   .   |
-//           ---------
-//           |  RA1  | First stack entry
-//           ---------
-//           |  0x0  | Guard Word [16 bytes](To catch underflows)
-//           ---------
-//           |  0x0  | Sratch space for register frame
-//           ---------
-// gs:0x0 -> |  SP   | Stack Pointer
-//           ---------
+//            |   .   |
+//            |   .   |
+//            ---------
+//            |  RA1  | First stack entry
+//            ---------
+//            |  0x0  | Guard Word [16 bytes](To catch underflows)
+//            ---------
+// gs:0x38 -> | Stub  | __shadow_guard_unwind_register32
+//            ---------
+// gs:0x30 -> | Stub  | __shadow_guard_unwind_frame32
+//            ---------
+// gs:0x28 -> | Stub  | __shadow_guard_unwind32
+//            ---------
+// gs:0x20 -> | Stub  | __shadow_guard_unwind_register
+//            ---------
+// gs:0x18 -> | Stub  | __shadow_guard_unwind_frame
+//            ---------
+// gs:0x10 -> | Stub  | __shadow_guard_unwind
+//            ---------
+//            |  0x0  | Sratch space for register frame
+//            ---------
+// gs:0x0 ->  |  SP   | Stack Pointer
+//            ---------
+//
+// Entries are 8 bytes, or 4 bytes with --compact_entries, and twice that with
+// --validate_frame. The guard word is zero in either case.
 CONSTRUCTOR(0) static void __shadow_guard_init_stack() {
+  static int layout_checked = 0;
+  if (!layout_checked) {
+    __parallel_layout = dlsym(RTLD_DEFAULT, __parallel_layout_symbol) != NULL;
+    layout_checked = 1;
+  }
+
   unsigned long addr = (unsigned long)malloc(__stack_sz);
   if (syscall(SYS_arch_prctl, ARCH_SET_GS, addr) < 0)
     abort();
   addr += 8;
   *((unsigned long *)addr) = 0;
   addr += 8;
+  *((unsigned long *)addr) = (unsigned long)__shadow_guard_unwind;
+  addr += 8;
+  *((unsigned long *)addr) = (unsigned long)__shadow_guard_unwind_frame;
+  addr += 8;
+  *((unsigned long *)addr) = (unsigned long)__shadow_guard_unwind_register;
+  addr += 8;
+  *((unsigned long *)addr) = (unsigned long)__shadow_guard_unwind32;
+  addr += 8;
+  *((unsigned long *)addr) = (unsigned long)__shadow_guard_unwind_frame32;
+  addr += 8;
+  *((unsigned long *)addr) = (unsigned long)__shadow_guard_unwind_register32;
+  addr += 8;
   *((unsigned long *)addr) = 0;
   addr += 8;
   *((unsigned long *)addr) = 0;
   addr += 8;
 
   asm volatile("mov %0, %%gs:0\n\t" : : "a"(addr) :);
+
+  __shadow_guard_init_parallel_stack();
 }
 
 typedef void *(*pthread_fn_type)(void *);
@@ -80,6 +369,20 @@ int pthread_create(pthread_t *thread, pthread_attr_t *attr, pthread_fn_type fn,
   return real_create(thread, attr, __pthread_fn_wrapper, info);
 }
 
+// Signal handlers may run on an alternate stack, which needs a mirror as
+// well.
+int sigaltstack(const stack_t *ss, stack_t *old_ss) {
+  typedef int (*sigaltstack_type)(const stack_t *, stack_t *);
+  static sigaltstack_type real_sigaltstack = NULL;
+  if (!real_sigaltstack)
+    real_sigaltstack = (sigaltstack_type)dlsym(RTLD_NEXT, "sigaltstack");
+
+  int ret = real_sigaltstack(ss, old_ss);
+  if (ret == 0 && ss != NULL && !(ss->ss_flags & SS_DISABLE))
+    __shadow_guard_map_parallel_stack(ss->ss_sp, ss->ss_size);
+  return ret;
+}
+
 #ifdef __cplusplus
 }  // extern "C"
 #endif
@@ -0,0 +1,96 @@
+#ifndef LITECFI_SCC_H_
+#define LITECFI_SCC_H_
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <vector>
+
+// Computes the strongly connected components of a directed graph using an
+// iterative formulation of Tarjan's algorithm, so that native stack usage does
+// not grow with the depth of the graph.
+//
+// successors(n) should return an iterable collection of the successors of n.
+// Successors not contained in nodes are ignored.
+//
+// Components are returned in reverse topological order. That is a component is
+// emitted only after all the components reachable from it have been emitted.
+// For a call graph this means callees come before their callers.
+template <typename Node, typename Successors>
+std::vector<std::vector<Node>> ComputeSCCs(const std::vector<Node>& nodes,
+                                           Successors successors) {
+  std::set<Node> graph(nodes.begin(), nodes.end());
+  std::map<Node, int> index;
+  std::map<Node, int> lowlink;
+  std::set<Node> on_stack;
+  std::vector<Node> stack;
+  std::vector<std::vector<Node>> sccs;
+  int counter = 0;
+
+  struct Frame {
+    Node node;
+    std::vector<Node> succs;
+    size_t next;
+  };
+  std::vector<Frame> call_stack;
+
+  auto visit = [&](Node n) {
+    index[n] = counter;
+    lowlink[n] = counter;
+    counter++;
+    stack.push_back(n);
+    on_stack.insert(n);
+
+    Frame frame;
+    frame.node = n;
+    frame.next = 0;
+    for (auto succ : successors(n)) {
+      if (graph.find(succ) != graph.end())
+        frame.succs.push_back(succ);
+    }
+    call_stack.push_back(frame);
+  };
+
+  for (auto root : nodes) {
+    if (index.find(root) != index.end())
+      continue;
+
+    visit(root);
+    while (!call_stack.empty()) {
+      Frame& frame = call_stack.back();
+      if (frame.next < frame.succs.size()) {
+        Node w = frame.succs[frame.next++];
+        if (index.find(w) == index.end()) {
+          visit(w);
+        } else if (on_stack.find(w) != on_stack.end()) {
+          lowlink[frame.node] = std::min(lowlink[frame.node], index[w]);
+        }
+        continue;
+      }
+
+      Node v = frame.node;
+      call_stack.pop_back();
+
+      if (lowlink[v] == index[v]) {
+        std::vector<Node> scc;
+        Node w;
+        do {
+          w = stack.back();
+          stack.pop_back();
+          on_stack.erase(w);
+          scc.push_back(w);
+        } while (w != v);
+        sccs.push_back(scc);
+      }
+
+      if (!call_stack.empty()) {
+        Node u = call_stack.back().node;
+        lowlink[u] = std::min(lowlink[u], lowlink[v]);
+      }
+    }
+  }
+
+  return sccs;
+}
+
+#endif  // LITECFI_SCC_H_
@@ -0,0 +1,729 @@
+#include "summary_cache.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include "CFG.h"
+#include "CodeSource.h"
+#include "utils.h"
+
+using Dyninst::Address;
+using Dyninst::ParseAPI::Block;
+
+namespace {
+
+// 64-bit FNV-1a.
+constexpr uint64_t kFnvOffset = 0xcbf29ce484222325ULL;
+constexpr uint64_t kFnvPrime = 0x100000001b3ULL;
+
+uint64_t Hash(uint64_t h, const void* data, size_t size) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; i++) {
+    h ^= bytes[i];
+    h *= kFnvPrime;
+  }
+  return h;
+}
+
+uint64_t Hash(uint64_t h, uint64_t value) {
+  return Hash(h, &value, sizeof(value));
+}
+
+std::vector<Block*> SortedBlocks(Function* f) {
+  std::vector<Block*> blocks;
+  for (auto b : f->blocks()) {
+    blocks.push_back(b);
+  }
+  std::sort(blocks.begin(), blocks.end(),
+            [](Block* a, Block* b) { return a->start() < b->start(); });
+  return blocks;
+}
+
+// Hashes the code of the function along with the names of the PLT functions it
+// calls and how these resolved against the library summaries. Returns 0 if the
+// function code is not accessible.
+uint64_t ContentHash(CodeObject* co, FuncSummary* s) {
+  Function* f = s->func;
+  uint64_t h = kFnvOffset;
+  for (auto b : SortedBlocks(f)) {
+    const void* code = co->cs()->getPtrToInstruction(b->start());
+    if (code == nullptr)
+      return 0;
+    h = Hash(h, b->start() - f->addr());
+    h = Hash(h, b->size());
+    h = Hash(h, code, b->size());
+  }
+
+  for (auto& it : s->plt_calls) {
+    h = Hash(h, it.first - f->addr());
+    h = Hash(h, it.second.data(), it.second.size());
+  }
+  h = Hash(h, (s->unsafe_plt_calls ? 1 : 0) | (s->plt_may_throw ? 2 : 0));
+  return h;
+}
+
+class Writer {
+ public:
+  template <typename T>
+  void Write(T value) {
+    buf_.append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  void WriteAddr(Address addr, Address base) {
+    Write<int64_t>(static_cast<int64_t>(addr - base));
+  }
+
+  void WriteRegisters(RegisterSet regs) { Write<uint16_t>(regs.mask()); }
+
+  void WriteAddrs(const std::set<Address>& addrs, Address base) {
+    Write<uint32_t>(addrs.size());
+    for (auto addr : addrs) {
+      WriteAddr(addr, base);
+    }
+  }
+
+  void WriteMoveInstData(const std::map<Address, MoveInstData*>& data,
+                         Address base) {
+    Write<uint32_t>(data.size());
+    for (auto& it : data) {
+      MoveInstData* mid = it.second;
+      WriteAddr(it.first, base);
+      WriteAddr(mid->newInstAddress, base);
+      Write<int32_t>(mid->raOffset);
+      Write<int32_t>(mid->saveCount);
+      Write<int8_t>(mid->reg1);
+      Write<int8_t>(mid->reg2);
+    }
+  }
+
+  void WriteHeights(const std::map<Address, int>& heights, Address base) {
+    Write<uint32_t>(heights.size());
+    for (auto& it : heights) {
+      WriteAddr(it.first, base);
+      Write<int32_t>(it.second);
+    }
+  }
+
+  void WriteBlockAddrs(const std::map<Address, std::set<Address>>& writes,
+                       Address base) {
+    Write<uint32_t>(writes.size());
+    for (auto& it : writes) {
+      WriteAddr(it.first, base);
+      WriteAddrs(it.second, base);
+    }
+  }
+
+  const std::string& buffer() const { return buf_; }
+
+ private:
+  std::string buf_;
+};
+
+class Reader {
+ public:
+  Reader(const char* data, size_t size, Arena* arena)
+      : cur_(data), end_(data + size), arena_(arena) {}
+
+  template <typename T>
+  bool Read(T* value) {
+    if (end_ - cur_ < static_cast<ptrdiff_t>(sizeof(T)))
+      return false;
+    memcpy(value, cur_, sizeof(T));
+    cur_ += sizeof(T);
+    return true;
+  }
+
+  bool ReadAddr(Address base, Address* addr) {
+    int64_t offset;
+    if (!Read(&offset))
+      return false;
+    *addr = base + offset;
+    return true;
+  }
+
+  bool ReadRegisters(RegisterSet* regs) {
+    uint16_t mask;
+    if (!Read(&mask))
+      return false;
+    *regs = RegisterSet(mask);
+    return true;
+  }
+
+  bool ReadRegister(Gpr* reg) {
+    int8_t r;
+    if (!Read(&r) || r < 0 || r >= kNumGprs)
+      return false;
+    *reg = static_cast<Gpr>(r);
+    return true;
+  }
+
+  bool ReadAddrs(Address base, std::set<Address>* addrs) {
+    uint32_t n;
+    if (!Read(&n))
+      return false;
+    for (uint32_t i = 0; i < n; i++) {
+      Address addr;
+      if (!ReadAddr(base, &addr))
+        return false;
+      addrs->insert(addr);
+    }
+    return true;
+  }
+
+  bool ReadMoveInstData(Address base, std::map<Address, MoveInstData*>* data) {
+    uint32_t n;
+    if (!Read(&n))
+      return false;
+    for (uint32_t i = 0; i < n; i++) {
+      Address addr;
+      MoveInstData* mid = arena_->New<MoveInstData>();
+      int32_t ra_offset, save_count;
+      if (!ReadAddr(base, &addr) || !ReadAddr(base, &mid->newInstAddress) ||
+          !Read(&ra_offset) || !Read(&save_count) ||
+          !ReadRegister(&mid->reg1) || !ReadRegister(&mid->reg2)) {
+        return false;
+      }
+      mid->raOffset = ra_offset;
+      mid->saveCount = save_count;
+      (*data)[addr] = mid;
+    }
+    return true;
+  }
+
+  bool ReadHeights(Address base, std::map<Address, int>* heights) {
+    uint32_t n;
+    if (!Read(&n))
+      return false;
+    for (uint32_t i = 0; i < n; i++) {
+      Address addr;
+      int32_t height;
+      if (!ReadAddr(base, &addr) || !Read(&height))
+        return false;
+      (*heights)[addr] = height;
+    }
+    return true;
+  }
+
+  bool ReadBlockAddrs(Address base,
+                      std::map<Address, std::set<Address>>* writes) {
+    uint32_t n;
+    if (!Read(&n))
+      return false;
+    for (uint32_t i = 0; i < n; i++) {
+      Address block;
+      if (!ReadAddr(base, &block) || !ReadAddrs(base, &(*writes)[block]))
+        return false;
+    }
+    return true;
+  }
+
+ private:
+  const char* cur_;
+  const char* end_;
+  Arena* arena_;
+};
+
+enum SummaryFlags : uint8_t {
+  kAssumeUnsafe = 1 << 0,
+  kSelfUnsafeWrites = 1 << 1,
+  kChildWrites = 1 << 2,
+  kWrites = 1 << 3,
+  kMoveDownSP = 1 << 4,
+  kFuncExceptionSafe = 1 << 5,
+  kUnsafeArgPassing = 1 << 6,
+  kFlagsAnalyzed = 1 << 7,
+};
+
+enum WriteFlags : uint8_t {
+  kStack = 1 << 0,
+  kResolved = 1 << 1,
+  kGlobal = 1 << 2,
+  kHeap = 1 << 3,
+  kArg = 1 << 4,
+  kHeapOrArg = 1 << 5,
+  kIndexed = 1 << 6,
+};
+
+// Serializes the parts of the summary computed by the analysis passes after
+// call graph generation. The call graph related fields are recomputed on
+// every run and are not cached. Neither is the CFG, which is only consumed by
+// local analyses.
+std::string Serialize(FuncSummary* s) {
+  Address base = s->func->addr();
+  Writer w;
+
+  uint8_t flags = 0;
+  flags |= s->assume_unsafe ? kAssumeUnsafe : 0;
+  flags |= s->self_unsafe_writes ? kSelfUnsafeWrites : 0;
+  flags |= s->child_writes ? kChildWrites : 0;
+  flags |= s->writes ? kWrites : 0;
+  flags |= s->moveDownSP ? kMoveDownSP : 0;
+  flags |= s->func_exception_safe ? kFuncExceptionSafe : 0;
+  flags |= s->unsafe_arg_passing ? kUnsafeArgPassing : 0;
+  flags |= s->flags_analyzed ? kFlagsAnalyzed : 0;
+  w.Write<uint8_t>(flags);
+  w.Write<int32_t>(s->safe_paths);
+
+  w.Write<uint32_t>(s->all_writes.size());
+  for (auto& it : s->all_writes) {
+    MemoryWrite* write = it.second;
+    uint8_t write_flags = 0;
+    write_flags |= write->stack ? kStack : 0;
+    write_flags |= write->resolved ? kResolved : 0;
+    write_flags |= write->global ? kGlobal : 0;
+    write_flags |= write->heap ? kHeap : 0;
+    write_flags |= write->arg ? kArg : 0;
+    write_flags |= write->heap_or_arg ? kHeapOrArg : 0;
+    write_flags |= write->indexed ? kIndexed : 0;
+    w.WriteAddr(write->addr, base);
+    w.WriteAddr(write->block->start(), base);
+    w.Write<uint8_t>(write_flags);
+  }
+
+  w.Write<uint32_t>(s->stack_writes.size());
+  for (auto& it : s->stack_writes) {
+    w.Write<int32_t>(it.first);
+    w.WriteAddr(it.second->addr, base);
+  }
+
+  w.Write<uint32_t>(s->unsafe_blocks.size());
+  for (auto b : s->unsafe_blocks) {
+    w.WriteAddr(b->start(), base);
+  }
+
+  w.Write<uint32_t>(s->redZoneAccess.size());
+  for (auto disp : s->redZoneAccess) {
+    w.Write<int32_t>(disp);
+  }
+
+  w.WriteRegisters(s->dead_at_entry);
+  w.Write<uint32_t>(s->dead_at_exit.size());
+  for (auto& it : s->dead_at_exit) {
+    w.WriteAddr(it.first, base);
+    w.WriteRegisters(it.second);
+  }
+  w.WriteAddrs(s->flags_live_at_end, base);
+  w.WriteRegisters(s->unused_regs);
+  w.WriteRegisters(s->written_args);
+  for (auto r : s->written_args) {
+    w.Write<int32_t>(s->arg_extents[r]);
+  }
+
+  w.WriteMoveInstData(s->entryData, base);
+  w.WriteMoveInstData(s->exitData, base);
+  w.WriteMoveInstData(s->entryFixedData, base);
+
+  w.WriteHeights(s->blockEndSPHeight, base);
+  w.WriteHeights(s->blockEntrySPHeight, base);
+
+  w.Write<uint32_t>(s->stack_heights.size());
+  for (auto& it : s->stack_heights) {
+    w.WriteAddr(it.first, base);
+    w.Write<int32_t>(it.second.src);
+    w.Write<int32_t>(it.second.dest);
+  }
+
+  w.Write<uint32_t>(s->unknown_writes.size());
+  for (auto& it : s->unknown_writes) {
+    w.WriteAddr(it.first->start(), base);
+    w.WriteAddrs(it.second, base);
+  }
+
+  w.WriteBlockAddrs(s->heap_writes, base);
+  w.WriteBlockAddrs(s->arg_writes, base);
+  w.WriteBlockAddrs(s->heap_or_arg_writes, base);
+
+  return w.buffer();
+}
+
+bool Deserialize(const char* data, size_t size, Arena* arena,
+                 FuncSummary* s) {
+  Function* f = s->func;
+  Address base = f->addr();
+
+  std::map<Address, Block*> blocks;
+  for (auto b : f->blocks()) {
+    blocks[b->start()] = b;
+  }
+  auto find_block = [&blocks](Address start) -> Block* {
+    auto it = blocks.find(start);
+    return it == blocks.end() ? nullptr : it->second;
+  };
+
+  Reader r(data, size, arena);
+  uint8_t flags;
+  int32_t safe_paths;
+  if (!r.Read(&flags) || !r.Read(&safe_paths))
+    return false;
+  s->assume_unsafe = flags & kAssumeUnsafe;
+  s->self_unsafe_writes = flags & kSelfUnsafeWrites;
+  s->child_writes = flags & kChildWrites;
+  s->writes = flags & kWrites;
+  s->moveDownSP = flags & kMoveDownSP;
+  s->func_exception_safe = flags & kFuncExceptionSafe;
+  s->unsafe_arg_passing = flags & kUnsafeArgPassing;
+  s->flags_analyzed = flags & kFlagsAnalyzed;
+  s->safe_paths = safe_paths;
+
+  uint32_t n;
+  if (!r.Read(&n))
+    return false;
+  for (uint32_t i = 0; i < n; i++) {
+    Address addr, block_start;
+    uint8_t write_flags;
+    if (!r.ReadAddr(base, &addr) || !r.ReadAddr(base, &block_start) ||
+        !r.Read(&write_flags))
+      return false;
+    Block* b = find_block(block_start);
+    if (b == nullptr)
+      return false;
+
+    MemoryWrite* write = arena->New<MemoryWrite>();
+    write->function = f;
+    write->block = b;
+    write->ins = b->getInsn(addr);
+    write->addr = addr;
+    write->stack = write_flags & kStack;
+    write->resolved = write_flags & kResolved;
+    write->global = write_flags & kGlobal;
+    write->heap = write_flags & kHeap;
+    write->arg = write_flags & kArg;
+    write->heap_or_arg = write_flags & kHeapOrArg;
+    write->indexed = write_flags & kIndexed;
+    s->all_writes[addr] = write;
+  }
+
+  if (!r.Read(&n))
+    return false;
+  for (uint32_t i = 0; i < n; i++) {
+    int32_t offset;
+    Address addr;
+    if (!r.Read(&offset) || !r.ReadAddr(base, &addr))
+      return false;
+    auto it = s->all_writes.find(addr);
+    if (it == s->all_writes.end())
+      return false;
+    s->stack_writes[offset] = it->second;
+  }
+
+  if (!r.Read(&n))
+    return false;
+  for (uint32_t i = 0; i < n; i++) {
+    Address start;
+    if (!r.ReadAddr(base, &start))
+      return false;
+    Block* b = find_block(start);
+    if (b == nullptr)
+      return false;
+    s->unsafe_blocks.insert(b);
+  }
+
+  if (!r.Read(&n))
+    return false;
+  for (uint32_t i = 0; i < n; i++) {
+    int32_t disp;
+    if (!r.Read(&disp))
+      return false;
+    s->redZoneAccess.insert(disp);
+  }
+
+  if (!r.ReadRegisters(&s->dead_at_entry) || !r.Read(&n))
+    return false;
+  for (uint32_t i = 0; i < n; i++) {
+    Address addr;
+    if (!r.ReadAddr(base, &addr) || !r.ReadRegisters(&s->dead_at_exit[addr]))
+      return false;
+  }
+  if (!r.ReadAddrs(base, &s->flags_live_at_end) ||
+      !r.ReadRegisters(&s->unused_regs) ||
+      !r.ReadRegisters(&s->written_args))
+    return false;
+  for (auto reg : s->written_args) {
+    int32_t extent;
+    if (!r.Read(&extent))
+      return false;
+    s->arg_extents[reg] = extent;
+  }
+
+  if (!r.ReadMoveInstData(base, &s->entryData) ||
+      !r.ReadMoveInstData(base, &s->exitData) ||
+      !r.ReadMoveInstData(base, &s->entryFixedData))
+    return false;
+
+  if (!r.ReadHeights(base, &s->blockEndSPHeight) ||
+      !r.ReadHeights(base, &s->blockEntrySPHeight))
+    return false;
+
+  if (!r.Read(&n))
+    return false;
+  for (uint32_t i = 0; i < n; i++) {
+    Address addr;
+    int32_t src, dest;
+    if (!r.ReadAddr(base, &addr) || !r.Read(&src) || !r.Read(&dest))
+      return false;
+    s->stack_heights[addr].src = src;
+    s->stack_heights[addr].dest = dest;
+  }
+
+  if (!r.Read(&n))
+    return false;
+  for (uint32_t i = 0; i < n; i++) {
+    Address start;
+    if (!r.ReadAddr(base, &start))
+      return false;
+    Block* b = find_block(start);
+    if (b == nullptr || !r.ReadAddrs(base, &s->unknown_writes[b]))
+      return false;
+  }
+
+  return r.ReadBlockAddrs(base, &s->heap_writes) &&
+         r.ReadBlockAddrs(base, &s->arg_writes) &&
+         r.ReadBlockAddrs(base, &s->heap_or_arg_writes);
+}
+
+}  // namespace
+
+SummaryCache::SummaryCache(const std::string& dir,
+                           const std::string& object_path)
+    : path_(dir + "/" + GetFileNameFromPath(object_path) + ".summaries"),
+      map_(nullptr), map_size_(0), index_(nullptr), n_entries_(0), hits_(0),
+      misses_(0) {
+  mkdir(dir.c_str(), 0755);
+}
+
+SummaryCache::~SummaryCache() {
+  if (map_ != nullptr) {
+    munmap(map_, map_size_);
+  }
+}
+
+void SummaryCache::Load() {
+  int fd = open(path_.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size < 16) {
+    close(fd);
+    return;
+  }
+
+  void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return;
+
+  const char* data = static_cast<const char*>(map);
+  uint32_t magic, version;
+  uint64_t n_entries;
+  memcpy(&magic, data, sizeof(magic));
+  memcpy(&version, data + 4, sizeof(version));
+  memcpy(&n_entries, data + 8, sizeof(n_entries));
+
+  size_t size = st.st_size;
+  if (magic != kMagic || version != kVersion ||
+      n_entries > (size - 16) / sizeof(IndexEntry)) {
+    StdOut(Color::RED, FLAGS_vv)
+        << "    Ignoring invalid summary cache " << path_ << Endl;
+    munmap(map, size);
+    return;
+  }
+
+  map_ = map;
+  map_size_ = size;
+  index_ = reinterpret_cast<const IndexEntry*>(data + 16);
+  n_entries_ = n_entries;
+}
+
+void SummaryCache::ComputeKeys(CodeObject* co,
+                               std::map<Function*, FuncSummary*>& summaries,
+                               const CallGraph& cg) {
+  std::vector<uint64_t> content(cg.Size());
+  std::map<int, std::vector<int>> sccs;
+  for (int id = 0; id < cg.Size(); id++) {
+    content[id] = ContentHash(co, summaries[cg.GetFunction(id)]);
+    sccs[cg.SCCId(id)].push_back(id);
+  }
+
+  scc_members_.assign(sccs.size(), {});
+  scc_callees_.assign(sccs.size(), {});
+  for (auto& it : sccs) {
+    for (auto id : it.second) {
+      scc_members_[it.first].push_back(cg.GetFunction(id));
+      for (auto& e : cg.Edges(id)) {
+        if (e.callee >= 0 && cg.SCCId(e.callee) != it.first)
+          scc_callees_[it.first].push_back(cg.SCCId(e.callee));
+      }
+    }
+  }
+
+  // Component ids follow reverse topological order so the keys of all the
+  // callees outside of a component are known by the time we get to it.
+  for (auto& it : sccs) {
+    int scc_id = it.first;
+    std::vector<int>& scc = it.second;
+
+    std::vector<uint64_t> hashes;
+    bool cacheable = true;
+    for (auto id : scc) {
+      cacheable &= content[id] != 0;
+      hashes.push_back(content[id]);
+      for (auto& e : cg.Edges(id)) {
+        if (e.callee < 0 || cg.SCCId(e.callee) == scc_id)
+          continue;
+        auto it = keys_.find(cg.GetFunction(e.callee));
+        if (it == keys_.end()) {
+          cacheable = false;
+          continue;
+        }
+        hashes.push_back(it->second);
+      }
+    }
+
+    if (!cacheable)
+      continue;
+
+    std::sort(hashes.begin(), hashes.end());
+    uint64_t scc_hash = kFnvOffset;
+    for (auto h : hashes) {
+      scc_hash = Hash(scc_hash, h);
+    }
+
+    for (auto id : scc) {
+      keys_[cg.GetFunction(id)] = Hash(scc_hash, content[id]);
+    }
+  }
+}
+
+bool SummaryCache::Lookup(FuncSummary* s, Arena* arena) {
+  auto kit = keys_.find(s->func);
+  if (index_ == nullptr || kit == keys_.end()) {
+    misses_++;
+    return false;
+  }
+
+  uint64_t key = kit->second;
+  const IndexEntry* end = index_ + n_entries_;
+  const IndexEntry* it = std::lower_bound(
+      index_, end, key,
+      [](const IndexEntry& e, uint64_t key) { return e.key < key; });
+  if (it == end || it->key != key || it->offset > map_size_ ||
+      it->size > map_size_ - it->offset) {
+    misses_++;
+    return false;
+  }
+
+  // Restore into a scratch summary so that a corrupted record does not leave
+  // a partially restored summary behind.
+  FuncSummary restored = FuncSummary();
+  restored.func = s->func;
+  const char* data = static_cast<const char*>(map_) + it->offset;
+  if (!Deserialize(data, it->size, arena, &restored)) {
+    misses_++;
+    return false;
+  }
+
+  restored.has_callees = s->has_callees;
+  restored.plt_calls = s->plt_calls;
+  restored.unsafe_plt_calls = s->unsafe_plt_calls;
+  restored.plt_may_throw = s->plt_may_throw;
+  restored.has_unknown_cf = s->has_unknown_cf;
+  restored.has_indirect_cf = s->has_indirect_cf;
+  restored.context = s->context;
+  restored.cached = true;
+  *s = restored;
+
+  hits_++;
+  return true;
+}
+
+void SummaryCache::Save(const std::set<FuncSummary*>& summaries) {
+  // Running out of budget or time depends on the machine and its load, so
+  // such summaries are recomputed the next time around. So are the summaries
+  // of their callers, which the inter-procedural passes derived from them.
+  // Component ids follow reverse topological order, hence callee components
+  // are decided first.
+  std::set<Function*> skipped;
+  for (auto s : summaries) {
+    if (s->over_budget || s->uncacheable)
+      skipped.insert(s->func);
+  }
+  std::vector<char> skipped_scc(scc_members_.size(), 0);
+  for (size_t c = 0; c < scc_members_.size(); c++) {
+    for (auto callee : scc_callees_[c]) {
+      skipped_scc[c] |= skipped_scc[callee];
+    }
+    for (auto f : scc_members_[c]) {
+      skipped_scc[c] |= skipped.count(f) > 0;
+    }
+    if (skipped_scc[c])
+      skipped.insert(scc_members_[c].begin(), scc_members_[c].end());
+  }
+
+  std::vector<IndexEntry> index;
+  std::vector<std::string> records;
+  std::set<uint64_t> seen;
+  for (auto s : summaries) {
+    auto kit = keys_.find(s->func);
+    if (kit == keys_.end())
+      continue;
+    if (skipped.count(s->func) > 0)
+      continue;
+    // Identical functions share the key and the summary.
+    if (!seen.insert(kit->second).second)
+      continue;
+
+    IndexEntry entry;
+    entry.key = kit->second;
+    entry.offset = records.size();
+    index.push_back(entry);
+    records.push_back(Serialize(s));
+  }
+
+  std::sort(index.begin(), index.end(),
+            [](const IndexEntry& a, const IndexEntry& b) {
+              return a.key < b.key;
+            });
+
+  // Resolve the record offsets now that the index layout is final.
+  uint64_t offset = 16 + index.size() * sizeof(IndexEntry);
+  std::vector<std::string*> ordered;
+  for (auto& entry : index) {
+    std::string* record = &records[entry.offset];
+    entry.offset = offset;
+    entry.size = record->size();
+    offset += record->size();
+    ordered.push_back(record);
+  }
+
+  // Write to a temporary file first and rename it over the old cache, since
+  // the old cache file may still be mapped.
+  std::string tmp_path = path_ + ".tmp";
+  std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+  uint32_t magic = kMagic;
+  uint32_t version = kVersion;
+  uint64_t n_entries = index.size();
+  out.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+  out.write(reinterpret_cast<const char*>(&version), sizeof(version));
+  out.write(reinterpret_cast<const char*>(&n_entries), sizeof(n_entries));
+  for (auto& entry : index) {
+    out.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+  }
+  for (auto record : ordered) {
+    out.write(record->data(), record->size());
+  }
+  out.close();
+
+  if (!out || rename(tmp_path.c_str(), path_.c_str()) != 0) {
+    StdOut(Color::RED) << "Failed to write summary cache " << path_ << Endl;
+    unlink(tmp_path.c_str());
+  }
+}
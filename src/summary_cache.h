@@ -0,0 +1,124 @@
+#ifndef LITECFI_SUMMARY_CACHE_H_
+#define LITECFI_SUMMARY_CACHE_H_
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "CodeObject.h"
+#include "pass_manager.h"
+
+// Persistent on-disk cache of function summaries.
+//
+// Summaries are keyed by a hash of the function's code bytes combined with the
+// keys of all the functions it (transitively) calls. Callees within the same
+// call graph cycle are hashed together. A key therefore changes whenever any
+// code that may influence the function's summary changes, which lets us reuse
+// the final summary of an unchanged function, including the results of the
+// inter-procedural passes, across runs.
+//
+// Addresses within a cached summary are stored relative to the function entry
+// so that summaries stay valid when a function merely moves.
+//
+// Cache file format (host byte order):
+//
+//   | magic | version | n_entries |                          header
+//   | key_1 | offset_1 | size_1 | .. | key_n | offset_n | size_n |   index
+//   | record_1 | .. | record_n |                                 records
+//
+// Index entries are sorted by key so that lookups can binary search the
+// memory mapped file without deserializing anything up front.
+class SummaryCache {
+ public:
+  SummaryCache(const std::string& dir, const std::string& object_path);
+
+  ~SummaryCache();
+
+  // Memory maps the cache file of the object, if there is one.
+  void Load();
+
+  // Computes the cache keys of all the functions from their code and the keys
+  // of their callees in the call graph.
+  void ComputeKeys(CodeObject* co,
+                   std::map<Function*, FuncSummary*>& summaries,
+                   const CallGraph& cg);
+
+  // Restores the summary of s->func from the cache, allocating the restored
+  // analysis objects from the arena. Returns true on a cache hit in which case
+  // s is marked as cached.
+  bool Lookup(FuncSummary* s, Arena* arena);
+
+  // Writes the given summaries out to the cache file, replacing the existing
+  // one. Summaries that are over budget or uncacheable are left out, along
+  // with those of all their transitive callers, which were derived from them.
+  void Save(const std::set<FuncSummary*>& summaries);
+
+  long hits() const { return hits_; }
+
+  long misses() const { return misses_; }
+
+ private:
+  struct IndexEntry {
+    uint64_t key;
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  static constexpr uint32_t kMagic = 0x43534753;  // "SGSC"
+  static constexpr uint32_t kVersion = 7;
+
+  std::string path_;
+
+  // Memory mapped cache file.
+  void* map_;
+  size_t map_size_;
+  const IndexEntry* index_;
+  uint64_t n_entries_;
+
+  std::map<Function*, uint64_t> keys_;
+  // Members and callee components of each call graph component, indexed by
+  // component id. Callee components have lower ids.
+  std::vector<std::vector<Function*>> scc_members_;
+  std::vector<std::vector<int>> scc_callees_;
+
+  long hits_;
+  long misses_;
+};
+
+class SummaryCacheLookup : public Pass {
+ public:
+  explicit SummaryCacheLookup(SummaryCache* cache)
+      : Pass("Summary Cache Lookup",
+             "Restores summaries of unchanged functions from the summary "
+             "cache."),
+        cache_(cache) {
+    Reads(kCallGraph);
+    // Restores whole summaries.
+    Writes(kAllFields);
+  }
+
+  void RunGlobalAnalysis(CodeObject* co,
+                         std::map<Function*, FuncSummary*>& summaries,
+                         PassResult* result) override {
+    cache_->ComputeKeys(co, summaries, *call_graph_);
+
+    for (auto f : co->funcs()) {
+      if (cache_->Lookup(summaries[f], arena_)) {
+        result->counters["Cache Hits"]++;
+      } else {
+        result->counters["Cache Misses"]++;
+      }
+    }
+
+    StdOut(Color::YELLOW, FLAGS_vv)
+        << "  Summary cache hits : " << result->counters["Cache Hits"]
+        << ", misses : " << result->counters["Cache Misses"] << Endl;
+  }
+
+ private:
+  SummaryCache* cache_;
+};
+
+#endif  // LITECFI_SUMMARY_CACHE_H_
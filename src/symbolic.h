@@ -0,0 +1,280 @@
+#ifndef LITECFI_SYMBOLIC_H_
+#define LITECFI_SYMBOLIC_H_
+
+#include <chrono>
+#include <climits>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "Absloc.h"
+#include "AbslocInterface.h"
+#include "CFG.h"
+#include "DynAST.h"
+#include "Instruction.h"
+#include "SymEval.h"
+#include "gflags/gflags.h"
+#include "pass_manager.h"
+#include "slicing.h"
+#include "value_set.h"
+
+DECLARE_int32(symbolic_deadline_ms);
+
+namespace symbolic {
+
+using Dyninst::AbsRegion;
+using Dyninst::Absloc;
+using Dyninst::Address;
+using Dyninst::Assignment;
+using Dyninst::AssignmentConverter;
+using Dyninst::AST;
+using Dyninst::DataflowAPI::ConstantAST;
+using Dyninst::DataflowAPI::GraphPtr;
+using Dyninst::DataflowAPI::Result_t;
+using Dyninst::DataflowAPI::RoseAST;
+using Dyninst::DataflowAPI::ROSEOperation;
+using Dyninst::DataflowAPI::Slicer;
+using Dyninst::DataflowAPI::SymEval;
+using Dyninst::DataflowAPI::VariableAST;
+using Dyninst::ParseAPI::Block;
+using Dyninst::ParseAPI::Function;
+
+// Where a resolved memory write goes to.
+enum class Target { kUnknown, kGlobal, kFrame };
+
+// Expanded symbolic expressions of slice criteria, shared across the functions
+// of a code object.
+//
+// Every assignment of an expanded backward slice is recorded along with the
+// criterion, so that later writes of the same function whose slices overlap
+// already expanded ones do not get sliced again. Slices depend on the function
+// they are taken in, hence blocks shared between functions are sliced once per
+// function. Failed expansions are recorded as well so they are not retried.
+class SliceCache {
+ public:
+  // Returns true and sets ast if the assignment out at addr in f has been
+  // expanded before. ast is null for failed expansions.
+  bool Lookup(Function* f, Address addr, const AbsRegion& out, AST::Ptr* ast) {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = asts_.find(Key(f, addr, out));
+    if (it == asts_.end())
+      return false;
+    *ast = it->second;
+    return true;
+  }
+
+  void Insert(Function* f, Address addr, const AbsRegion& out,
+              const AST::Ptr& ast) {
+    std::lock_guard<std::mutex> lock(mu_);
+    asts_.emplace(Key(f, addr, out), ast);
+  }
+
+  long hits() const { return hits_; }
+
+  void RecordHit() {
+    std::lock_guard<std::mutex> lock(mu_);
+    hits_++;
+  }
+
+ private:
+  using KeyType = std::tuple<Function*, Address, std::string>;
+
+  static KeyType Key(Function* f, Address addr, const AbsRegion& out) {
+    return std::make_tuple(f, addr, out.format());
+  }
+
+  std::mutex mu_;
+  std::map<KeyType, AST::Ptr> asts_;
+  long hits_ = 0;
+};
+
+// Resolves the targets of the unknown memory writes of a function by
+// backward slicing each write with the Dyninst slicer and expanding the slice
+// into a symbolic expression in terms of the values at function entry.
+//
+// The expression of a write is the write operation itself, with the target
+// address as its first operand and the written value as its second. Target
+// addresses which reduce to a constant are global writes. Those which reduce
+// to the stack pointer at function entry plus a constant are writes into the
+// function's own frame, as long as they stay below the return address. Any
+// other target is left unknown.
+//
+// Slicing is cut short once the function runs over --symbolic_deadline_ms or
+// its analysis budget, in which case the remaining writes stay unknown.
+class WriteResolver {
+ public:
+  WriteResolver(FuncSummary* s, SliceCache* cache)
+      : s_(s), cache_(cache), start_(std::chrono::steady_clock::now()) {}
+
+  // Resolves the write, filling in its defines with the target address and
+  // its uses with the written value. Sets height to the stack height of the
+  // target relative to the canonical frame address for kFrame writes.
+  Target Resolve(MemoryWrite* w, int* height) {
+    if (Expired())
+      return Target::kUnknown;
+
+    // String instructions write a run of elements starting at the address,
+    // which the size of a single access does not bound.
+    if (!value_set::IsPlainStore(w->ins.getOperation().getID()))
+      return Target::kUnknown;
+
+    AssignmentConverter converter(true /* cache results*/,
+                                  true /* use stack analysis*/);
+    std::vector<Assignment::Ptr> assigns;
+    converter.convert(w->ins, w->addr, w->function, w->block, assigns);
+
+    for (auto& a : assigns) {
+      if (a->out().absloc().type() == Absloc::Register)
+        continue;
+
+      AST::Ptr expr = Expand(a, w->block);
+      RoseAST* write = dynamic_cast<RoseAST*>(expr.get());
+      if (write == nullptr || write->val().op != ROSEOperation::writeOp ||
+          write->numChildren() < 2)
+        return Target::kUnknown;
+
+      w->defines.push_back(write->child(0));
+      w->uses.push_back(write->child(1));
+      w->resolved = true;
+      return Classify(write->child(0), AccessSize(w->ins), height);
+    }
+    return Target::kUnknown;
+  }
+
+  bool Expired() const {
+    if (s_->context->budget()->Exhausted())
+      return true;
+    if (FLAGS_symbolic_deadline_ms <= 0)
+      return false;
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start_;
+    return elapsed.count() > FLAGS_symbolic_deadline_ms;
+  }
+
+ private:
+  // Stops slicing once the time is up. Each slice node is charged to the
+  // analysis budget of the function.
+  class BoundedPredicates : public Slicer::Predicates {
+   public:
+    explicit BoundedPredicates(WriteResolver* resolver)
+        : resolver_(resolver), expired_(false) {}
+
+    bool endAtPoint(Assignment::Ptr a) override {
+      if (!resolver_->s_->context->budget()->ChargeIterations(1) ||
+          resolver_->Expired())
+        expired_ = true;
+      return expired_;
+    }
+
+    bool expired() const { return expired_; }
+
+   private:
+    WriteResolver* resolver_;
+    bool expired_;
+  };
+
+  // Returns the symbolic expression of the assignment, or null if the slice
+  // could not be expanded within the time limit.
+  AST::Ptr Expand(const Assignment::Ptr& a, Block* b) {
+    Function* f = s_->func;
+    AST::Ptr ast;
+    if (cache_->Lookup(f, a->addr(), a->out(), &ast)) {
+      cache_->RecordHit();
+      return ast;
+    }
+
+    BoundedPredicates pred(this);
+    Slicer slicer(a, b, f);
+    GraphPtr slice = slicer.backwardSlice(pred);
+
+    // A slice cut short leaves free variables in the middle of the function,
+    // so it is neither used nor cached.
+    if (pred.expired())
+      return nullptr;
+
+    Result_t result;
+    if (SymEval::expand(slice, result) != SymEval::SUCCESS) {
+      cache_->Insert(f, a->addr(), a->out(), nullptr);
+      return nullptr;
+    }
+
+    for (auto& it : result) {
+      if (it.first != nullptr)
+        cache_->Insert(f, it.first->addr(), it.first->out(), it.second);
+    }
+
+    auto it = result.find(a);
+    if (it == result.end())
+      return nullptr;
+    return it->second;
+  }
+
+  // Reduces an address expression to a base register at function entry plus a
+  // constant offset. base is invalid if the address is a plain constant.
+  bool Linearize(const AST::Ptr& ast, Dyninst::MachRegister* base,
+                 int64_t* offset) {
+    if (auto c = dynamic_cast<ConstantAST*>(ast.get())) {
+      *offset += static_cast<int64_t>(c->val().val);
+      return true;
+    }
+
+    if (auto v = dynamic_cast<VariableAST*>(ast.get())) {
+      Absloc loc = v->val().reg.absloc();
+      if (loc.type() != Absloc::Register || base->isValid() ||
+          v->val().addr != s_->func->addr())
+        return false;
+      *base = loc.reg();
+      return true;
+    }
+
+    auto op = dynamic_cast<RoseAST*>(ast.get());
+    if (op == nullptr || op->val().op != ROSEOperation::addOp)
+      return false;
+    for (unsigned i = 0; i < op->numChildren(); i++) {
+      if (!Linearize(op->child(i), base, offset))
+        return false;
+    }
+    return true;
+  }
+
+  Target Classify(const AST::Ptr& address, unsigned size, int* height) {
+    Dyninst::MachRegister base;
+    int64_t offset = 0;
+    if (!Linearize(address, &base, &offset))
+      return Target::kUnknown;
+
+    if (!base.isValid())
+      return Target::kGlobal;
+
+    // The stack pointer at function entry points to the return address.
+    if (base.getBaseRegister() == Dyninst::x86_64::rsp &&
+        offset + static_cast<int64_t>(size) <= 0 && offset > INT_MIN / 2) {
+      *height = static_cast<int>(offset) - 8;
+      return Target::kFrame;
+    }
+    return Target::kUnknown;
+  }
+
+  // Size of the memory access of the instruction in bytes. Errs on the large
+  // side if it cannot be determined.
+  static unsigned AccessSize(const Dyninst::InstructionAPI::Instruction& ins) {
+    std::vector<Dyninst::InstructionAPI::Operand> operands;
+    ins.getOperands(operands);
+    unsigned size = 0;
+    for (auto& op : operands) {
+      if (op.writesMemory() && op.getValue() != nullptr)
+        size = std::max(size, op.getValue()->size());
+    }
+    return size == 0 ? 64 : size;
+  }
+
+  FuncSummary* s_;
+  SliceCache* cache_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace symbolic
+
+#endif  // LITECFI_SYMBOLIC_H_
@@ -3,9 +3,11 @@
 
 #include <limits.h>
 #include <pwd.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <cstdio>
 #include <fstream>
 #include <iostream>
 #include <iterator>
@@ -143,3 +145,44 @@ std::string GetHomeDir() {
   struct passwd* pw = getpwuid(getuid());
   return std::string(pw->pw_dir);
 }
+
+ResourceUsage GetResourceUsage() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  ResourceUsage r;
+  r.cpu_ms = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 +
+             (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+  // ru_maxrss is reported in kilobytes on Linux.
+  r.peak_rss_kb = usage.ru_maxrss;
+  return r;
+}
+
+std::string JsonEscape(const std::string& s) {
+  std::string escaped;
+  for (char c : s) {
+    switch (c) {
+    case '"':
+      escaped += "\\\"";
+      break;
+    case '\\':
+      escaped += "\\\\";
+      break;
+    case '\n':
+      escaped += "\\n";
+      break;
+    case '\t':
+      escaped += "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "\\u%04x", c);
+        escaped += buf;
+      } else {
+        escaped += c;
+      }
+    }
+  }
+  return escaped;
+}
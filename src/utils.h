@@ -64,6 +64,19 @@ inline void PrintSequence(const T& collection, int left_pad = 0,
 
 std::string GetCurrentDir();
 
+// Process wide resource usage snapshot.
+struct ResourceUsage {
+  // User plus system CPU time across all threads in milliseconds.
+  double cpu_ms;
+  // Peak resident set size in kilobytes.
+  long peak_rss_kb;
+};
+
+ResourceUsage GetResourceUsage();
+
+// Escapes a string for embedding within a JSON string literal.
+std::string JsonEscape(const std::string& s);
+
 std::string GetHomeDir();
 
 #endif  // LITECFI_UTILS_H_
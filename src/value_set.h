@@ -0,0 +1,925 @@
+#ifndef LITECFI_VALUE_SET_H_
+#define LITECFI_VALUE_SET_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "CFG.h"
+#include "Instruction.h"
+#include "Register.h"
+#include "dyn_regs.h"
+#include "pass_manager.h"
+#include "register_utils.h"
+
+namespace value_set {
+
+using Dyninst::Offset;
+using Dyninst::InstructionAPI::BinaryFunction;
+using Dyninst::InstructionAPI::Dereference;
+using Dyninst::InstructionAPI::Expression;
+using Dyninst::InstructionAPI::Immediate;
+using Dyninst::InstructionAPI::Instruction;
+using Dyninst::InstructionAPI::RegisterAST;
+using Dyninst::InstructionAPI::Visitor;
+using Dyninst::ParseAPI::Block;
+using Dyninst::ParseAPI::Function;
+
+constexpr int64_t kMinusInf = std::numeric_limits<int64_t>::min();
+constexpr int64_t kPlusInf = std::numeric_limits<int64_t>::max();
+
+// Interval bound arithmetic saturating at the infinities.
+inline int64_t SatAdd(int64_t a, int64_t b) {
+  if (a == kMinusInf || b == kMinusInf)
+    return kMinusInf;
+  if (a == kPlusInf || b == kPlusInf)
+    return kPlusInf;
+  int64_t r;
+  if (__builtin_add_overflow(a, b, &r))
+    return b > 0 ? kPlusInf : kMinusInf;
+  return r;
+}
+
+inline int64_t SatMul(int64_t a, int64_t b) {
+  if (a == 0 || b == 0)
+    return 0;
+  bool negative = (a < 0) != (b < 0);
+  if (a == kMinusInf || a == kPlusInf || b == kMinusInf || b == kPlusInf)
+    return negative ? kMinusInf : kPlusInf;
+  int64_t r;
+  if (__builtin_mul_overflow(a, b, &r))
+    return negative ? kMinusInf : kPlusInf;
+  return r;
+}
+
+inline int64_t SatNeg(int64_t a) {
+  if (a == kMinusInf)
+    return kPlusInf;
+  if (a == kPlusInf)
+    return kMinusInf;
+  return -a;
+}
+
+// Denotes whether the instruction writes to memory at most once, at the
+// address given by its memory operand. Rules out string instructions which
+// may be repeated.
+inline bool IsPlainStore(entryID id) {
+  switch (id) {
+  case e_mov:
+  case e_add:
+  case e_sub:
+  case e_and:
+  case e_or:
+  case e_xor:
+  case e_inc:
+  case e_dec:
+  case e_movaps:
+  case e_movups:
+  case e_movdqa:
+  case e_movdqu:
+  case e_movd:
+  case e_movq:
+  case e_movss:
+  case e_movsd_sse:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Abstract value held by a register: a range of integers, a range of stack
+// addresses or anything.
+//
+// Stack addresses are relative to the canonical frame address, i.e. the
+// return address is at -8, like the heights of the stack analysis. Bounds may
+// be infinite but an interval is never empty.
+struct Value {
+  enum class Kind : uint8_t { BOTTOM, CONST, STACK, TOP };
+
+  Kind kind;
+  int64_t lo;
+  int64_t hi;
+
+  static Value Bottom() { return {Kind::BOTTOM, 0, 0}; }
+
+  static Value Top() { return {Kind::TOP, kMinusInf, kPlusInf}; }
+
+  static Value Const(int64_t lo, int64_t hi) { return {Kind::CONST, lo, hi}; }
+
+  static Value Stack(int64_t lo, int64_t hi) { return {Kind::STACK, lo, hi}; }
+
+  bool IsInterval() const { return kind == Kind::CONST || kind == Kind::STACK; }
+
+  bool IsSingleton() const { return IsInterval() && lo == hi; }
+
+  // Denotes whether the value lies within [min, max].
+  bool Within(int64_t min, int64_t max) const {
+    return kind == Kind::CONST && lo >= min && hi <= max;
+  }
+
+  bool operator==(const Value& v) const {
+    return kind == v.kind && lo == v.lo && hi == v.hi;
+  }
+
+  bool operator!=(const Value& v) const { return !(*this == v); }
+
+  void Join(const Value& other) {
+    if (other.kind == Kind::BOTTOM || *this == other)
+      return;
+    if (kind == Kind::BOTTOM) {
+      *this = other;
+      return;
+    }
+    if (kind != other.kind || kind == Kind::TOP) {
+      *this = Top();
+      return;
+    }
+    lo = std::min(lo, other.lo);
+    hi = std::max(hi, other.hi);
+  }
+};
+
+inline Value Add(const Value& a, const Value& b) {
+  if (a.kind == Value::Kind::STACK && b.kind == Value::Kind::STACK)
+    return Value::Top();
+  if (!a.IsInterval() || !b.IsInterval())
+    return Value::Top();
+  Value::Kind kind =
+      a.kind == Value::Kind::STACK ? Value::Kind::STACK : b.kind;
+  return {kind, SatAdd(a.lo, b.lo), SatAdd(a.hi, b.hi)};
+}
+
+inline Value Neg(const Value& a) {
+  if (a.kind != Value::Kind::CONST)
+    return Value::Top();
+  return Value::Const(SatNeg(a.hi), SatNeg(a.lo));
+}
+
+inline Value Mul(const Value& a, const Value& b) {
+  if (a.kind != Value::Kind::CONST || b.kind != Value::Kind::CONST)
+    return Value::Top();
+  int64_t p[] = {SatMul(a.lo, b.lo), SatMul(a.lo, b.hi), SatMul(a.hi, b.lo),
+                 SatMul(a.hi, b.hi)};
+  return Value::Const(*std::min_element(p, p + 4),
+                      *std::max_element(p, p + 4));
+}
+
+// Values of the general purpose registers at a basic block boundary. The
+// stack pointer is not tracked here but taken from the stack analysis.
+struct State {
+  State() : reached(false) {
+    for (int r = 0; r < kNumGprs; r++) {
+      regs[r] = Value::Bottom();
+    }
+  }
+
+  Value regs[kNumGprs];
+  // Denotes whether any path from the function entry has reached this state.
+  bool reached;
+
+  void Join(const State& other) {
+    if (!other.reached)
+      return;
+    if (!reached) {
+      *this = other;
+      return;
+    }
+    for (int r = 0; r < kNumGprs; r++) {
+      regs[r].Join(other.regs[r]);
+    }
+  }
+
+  bool operator==(const State& s) const {
+    if (reached != s.reached)
+      return false;
+    for (int r = 0; r < kNumGprs; r++) {
+      if (regs[r] != s.regs[r])
+        return false;
+    }
+    return true;
+  }
+
+  bool operator!=(const State& s) const { return !(*this == s); }
+};
+
+// Bounds the target addresses of the unknown memory writes of a function and
+// resolves those which provably stay within the function's own frame.
+//
+// The stack analysis only resolves writes at a fixed offset from the stack
+// pointer. Indexed writes such as buf[i] into a local array end up as unknown
+// writes, rendering their blocks unsafe. This runs an interval analysis over
+// the registers, where a register either holds a range of integers or a range
+// of stack addresses, to bound such writes. Ranges are narrowed along the
+// edges of conditional branches on a compare against a constant (or a register
+// holding a single value), so that bounds checks and loop conditions bound the
+// indices. Growing ranges are widened to the compared constants first and to
+// infinity after that, which keeps loops from iterating once per index.
+//
+// A write covering [lo, hi + width) of stack addresses with hi + width <= -8
+// stays below the return address and is resolved as a stack write. Each block
+// visit is charged to the function's analysis budget. If the budget runs out
+// before the ranges stabilize no writes are resolved.
+class StackIntervalAnalysis {
+ public:
+  explicit StackIntervalAnalysis(FuncSummary* s) : s_(s) {
+    InitBlocks();
+    if (Analyse())
+      ResolveWrites();
+  }
+
+  int resolved() const { return resolved_; }
+
+ private:
+  enum class EdgeKind : uint8_t { kOther, kTaken, kNotTaken };
+
+  enum class Cond : uint8_t { kNone, kEq, kNe, kLt, kLe, kGt, kGe };
+
+  // Conditional branch at the end of a block on a preceding compare of a
+  // register against a constant or another register.
+  struct Branch {
+    Cond cond = Cond::kNone;
+    bool is_unsigned = false;
+    Gpr reg = kNoGpr;
+    // Compared register width in bytes.
+    unsigned width = 0;
+    // Address of the compare instruction.
+    Address cmp_addr = 0;
+    // Compared constant, if the compare has an immediate operand.
+    bool has_imm = false;
+    int64_t imm = 0;
+    // Otherwise the register compared against.
+    Gpr other = kNoGpr;
+  };
+
+  // Evaluates an operand expression bottom up. Memory operands evaluate to
+  // TOP while the address of the outermost dereference is kept in address_.
+  class ExpressionEvaluator : public Visitor {
+   public:
+    ExpressionEvaluator(const State& state, const Value& sp)
+        : state_(state), sp_(sp), address_(Value::Top()) {}
+
+    void visit(BinaryFunction* f) override {
+      Value b = Pop();
+      Value a = Pop();
+      if (f->isAdd()) {
+        stack_.push_back(Add(a, b));
+      } else if (f->isMultiply()) {
+        stack_.push_back(Mul(a, b));
+      } else {
+        stack_.push_back(Value::Top());
+      }
+    }
+
+    void visit(Immediate* i) override {
+      int64_t v = i->eval().convert<int64_t>();
+      stack_.push_back(Value::Const(v, v));
+    }
+
+    void visit(RegisterAST* r) override {
+      Gpr reg = ToGpr(r->getID());
+      if (reg == kRsp) {
+        stack_.push_back(sp_);
+      } else if (reg == kNoGpr) {
+        stack_.push_back(Value::Top());
+      } else {
+        stack_.push_back(SubRegister(state_.regs[reg], r->getID().size()));
+      }
+    }
+
+    void visit(Dereference* d) override {
+      address_ = Pop();
+      stack_.push_back(Value::Top());
+    }
+
+    Value result() const {
+      return stack_.size() == 1 ? stack_.back() : Value::Top();
+    }
+
+    const Value& address() const { return address_; }
+
+   private:
+    // Value read from the low width bytes of a register holding v.
+    static Value SubRegister(const Value& v, unsigned width) {
+      if (width == 8)
+        return v;
+      if (width == 4 && v.Within(0, 0xffffffffLL))
+        return v;
+      return Value::Top();
+    }
+
+    Value Pop() {
+      if (stack_.empty())
+        return Value::Top();
+      Value v = stack_.back();
+      stack_.pop_back();
+      return v;
+    }
+
+    const State& state_;
+    Value sp_;
+    Value address_;
+    std::vector<Value> stack_;
+  };
+
+  static constexpr int kWidenDelay = 3;
+  static constexpr size_t kMaxThresholds = 256;
+
+  // Orders the blocks reachable from the function entry in reverse post order
+  // and records their intra-procedural edges.
+  void InitBlocks() {
+    Function* f = s_->func;
+    for (auto b : f->blocks()) {
+      index_[b] = -1;
+    }
+
+    std::vector<Block*> post_order;
+    std::vector<std::pair<Block*, std::vector<Block*>>> stack;
+    std::set<Block*> visited;
+    visited.insert(f->entry());
+    stack.push_back(std::make_pair(f->entry(), Successors(f->entry())));
+    while (!stack.empty()) {
+      auto& top = stack.back();
+      if (top.second.empty()) {
+        post_order.push_back(top.first);
+        stack.pop_back();
+        continue;
+      }
+
+      Block* next = top.second.back();
+      top.second.pop_back();
+      if (visited.insert(next).second)
+        stack.push_back(std::make_pair(next, Successors(next)));
+    }
+
+    blocks_.assign(post_order.rbegin(), post_order.rend());
+    for (size_t i = 0; i < blocks_.size(); i++) {
+      index_[blocks_[i]] = i;
+    }
+
+    succs_.resize(blocks_.size());
+    preds_.resize(blocks_.size());
+    branches_.resize(blocks_.size());
+    for (size_t i = 0; i < blocks_.size(); i++) {
+      branches_[i] = ParseBranch(blocks_[i]);
+      for (auto e : blocks_[i]->targets()) {
+        if (!IsIntraProcedural(e))
+          continue;
+        EdgeKind kind = EdgeKind::kOther;
+        if (e->type() == Dyninst::ParseAPI::COND_TAKEN)
+          kind = EdgeKind::kTaken;
+        if (e->type() == Dyninst::ParseAPI::COND_NOT_TAKEN)
+          kind = EdgeKind::kNotTaken;
+        int j = index_[e->trg()];
+        succs_[i].push_back(j);
+        preds_[j].push_back(std::make_pair(i, kind));
+      }
+    }
+  }
+
+  bool IsIntraProcedural(Dyninst::ParseAPI::Edge* e) {
+    if (e->sinkEdge() || e->interproc() ||
+        e->type() == Dyninst::ParseAPI::CATCH)
+      return false;
+    // A block can be shared by multiple functions, hence only follow edges
+    // into blocks of this function.
+    return index_.find(e->trg()) != index_.end();
+  }
+
+  std::vector<Block*> Successors(Block* b) {
+    std::vector<Block*> succs;
+    for (auto e : b->targets()) {
+      if (IsIntraProcedural(e))
+        succs.push_back(e->trg());
+    }
+    return succs;
+  }
+
+  Branch ParseBranch(Block* b) {
+    Branch br;
+    const InsnVec& insns = s_->context->Instructions(b);
+    if (insns.size() < 2)
+      return br;
+
+    const Instruction& jcc = insns[insns.size() - 1].second;
+    const Instruction& cmp = insns[insns.size() - 2].second;
+    if (cmp.getOperation().getID() != e_cmp)
+      return br;
+
+    switch (jcc.getOperation().getID()) {
+    case e_jz:
+      br.cond = Cond::kEq;
+      break;
+    case e_jnz:
+      br.cond = Cond::kNe;
+      break;
+    case e_jb:
+      br.cond = Cond::kLt;
+      br.is_unsigned = true;
+      break;
+    case e_jnb:
+      br.cond = Cond::kGe;
+      br.is_unsigned = true;
+      break;
+    case e_jbe:
+      br.cond = Cond::kLe;
+      br.is_unsigned = true;
+      break;
+    case e_jnbe:
+      br.cond = Cond::kGt;
+      br.is_unsigned = true;
+      break;
+    case e_jl:
+      br.cond = Cond::kLt;
+      break;
+    case e_jnl:
+      br.cond = Cond::kGe;
+      break;
+    case e_jle:
+      br.cond = Cond::kLe;
+      break;
+    case e_jnle:
+      br.cond = Cond::kGt;
+      break;
+    default:
+      return br;
+    }
+
+    RegisterAST* lhs = AsRegister(cmp.getOperand(0).getValue());
+    if (lhs == nullptr || ToGpr(lhs->getID()) == kNoGpr) {
+      br.cond = Cond::kNone;
+      return br;
+    }
+    br.reg = ToGpr(lhs->getID());
+    br.width = lhs->getID().size();
+    br.cmp_addr = insns[insns.size() - 2].first;
+
+    Expression::Ptr rhs = cmp.getOperand(1).getValue();
+    if (auto imm = dynamic_cast<Immediate*>(rhs.get())) {
+      br.has_imm = true;
+      br.imm = imm->eval().convert<int64_t>();
+      return br;
+    }
+
+    RegisterAST* other = AsRegister(rhs);
+    if (other == nullptr || other->getID().size() != br.width ||
+        ToGpr(other->getID()) == kNoGpr) {
+      br.cond = Cond::kNone;
+      return br;
+    }
+    br.other = ToGpr(other->getID());
+    return br;
+  }
+
+  static RegisterAST* AsRegister(const Expression::Ptr& expr) {
+    return dynamic_cast<RegisterAST*>(expr.get());
+  }
+
+  // Value of the stack pointer before the instruction at addr.
+  Value SPValue(Block* b, Address addr) {
+    StackAnalysis::Height h = s_->context->SPHeight(b, addr);
+    if (h.isTop() || h.isBottom())
+      return Value::Top();
+    return Value::Stack(h.height(), h.height());
+  }
+
+  Value RegValue(const State& state, Block* b, Address addr, Gpr r) {
+    if (r == kRsp)
+      return SPValue(b, addr);
+    return state.regs[r];
+  }
+
+  // Returns false if the analysis ran out of budget.
+  bool Analyse() {
+    AnalysisBudget* budget = s_->context->budget();
+    int n = blocks_.size();
+    in_.assign(n, State());
+    out_.assign(n, State());
+    visits_.assign(n, 0);
+
+    // Nothing is known about the registers at function entry.
+    State entry;
+    entry.reached = true;
+    for (int r = 0; r < kNumGprs; r++) {
+      entry.regs[r] = Value::Top();
+    }
+
+    // Lower indices come first in reverse post order.
+    std::set<int> worklist;
+    worklist.insert(0);
+    while (!worklist.empty()) {
+      int i = *worklist.begin();
+      worklist.erase(worklist.begin());
+
+      State in = i == 0 ? entry : State();
+      for (auto& p : preds_[i]) {
+        in.Join(EdgeState(p.first, p.second));
+      }
+      if (!in.reached)
+        continue;
+
+      if (!budget->ChargeIterations(1) ||
+          !budget->ChargeInstructions(
+              s_->context->Instructions(blocks_[i]).size()))
+        return false;
+
+      if (++visits_[i] > kWidenDelay && in_[i].reached)
+        in = Widen(in_[i], in);
+
+      State out = in;
+      TransferBlock(&out, blocks_[i], false);
+      in_[i] = std::move(in);
+
+      if (out != out_[i]) {
+        out_[i] = std::move(out);
+        worklist.insert(succs_[i].begin(), succs_[i].end());
+      }
+    }
+    return true;
+  }
+
+  // State flowing along the edge out of block p, narrowed by the branch
+  // condition which holds along the edge.
+  State EdgeState(int p, EdgeKind kind) {
+    State state = out_[p];
+    const Branch& br = branches_[p];
+    if (!state.reached || kind == EdgeKind::kOther || br.cond == Cond::kNone)
+      return state;
+
+    // The compare leaves the registers alone, so the exit state holds the
+    // compared values.
+    Value x = state.regs[br.reg];
+    Value c = br.has_imm ? Value::Const(br.imm, br.imm)
+                         : RegValue(state, blocks_[p], br.cmp_addr, br.other);
+    if (br.reg == kRsp || !x.IsInterval() || !c.IsSingleton() ||
+        x.kind != c.kind)
+      return state;
+
+    // Compares of sub registers only see the low bits.
+    if (br.width == 4 &&
+        (!x.Within(0, INT32_MAX) || !c.Within(0, INT32_MAX)))
+      return state;
+    if (br.width != 4 && br.width != 8)
+      return state;
+
+    AddThreshold(c);
+
+    Cond cond = kind == EdgeKind::kTaken ? br.cond : Negate(br.cond);
+    // Stack addresses do not wrap, so unsigned and signed compares of two of
+    // them agree.
+    bool is_unsigned = br.is_unsigned && x.kind == Value::Kind::CONST;
+    if (!Narrow(&x, cond, c.lo, is_unsigned)) {
+      // The edge is never taken.
+      return State();
+    }
+    state.regs[br.reg] = x;
+    return state;
+  }
+
+  static Cond Negate(Cond cond) {
+    switch (cond) {
+    case Cond::kEq:
+      return Cond::kNe;
+    case Cond::kNe:
+      return Cond::kEq;
+    case Cond::kLt:
+      return Cond::kGe;
+    case Cond::kLe:
+      return Cond::kGt;
+    case Cond::kGt:
+      return Cond::kLe;
+    case Cond::kGe:
+      return Cond::kLt;
+    default:
+      return Cond::kNone;
+    }
+  }
+
+  // Narrows x to the values satisfying x <cond> c. Returns false if there are
+  // none.
+  static bool Narrow(Value* x, Cond cond, int64_t c, bool is_unsigned) {
+    int64_t lo = kMinusInf;
+    int64_t hi = kPlusInf;
+    switch (cond) {
+    case Cond::kEq:
+      lo = hi = c;
+      break;
+    case Cond::kNe:
+      if (x->lo == c && x->hi == c)
+        return false;
+      if (x->lo == c)
+        x->lo++;
+      if (x->hi == c)
+        x->hi--;
+      return true;
+    case Cond::kLt:
+      if (c == kMinusInf)
+        return false;
+      hi = c - 1;
+      break;
+    case Cond::kLe:
+      hi = c;
+      break;
+    case Cond::kGt:
+      if (c == kPlusInf)
+        return false;
+      lo = c + 1;
+      break;
+    case Cond::kGe:
+      lo = c;
+      break;
+    default:
+      return true;
+    }
+
+    if (is_unsigned && cond != Cond::kEq) {
+      // Negative constants are huge unsigned values.
+      if (c < 0)
+        return true;
+      if (cond == Cond::kLt || cond == Cond::kLe) {
+        // Only the values in [0, c] are unsigned below c.
+        lo = 0;
+      } else if (x->lo < 0) {
+        // Negative values are unsigned above c, so nothing can be cut off.
+        return true;
+      }
+    }
+
+    x->lo = std::max(x->lo, lo);
+    x->hi = std::min(x->hi, hi);
+    return x->lo <= x->hi;
+  }
+
+  void AddThreshold(const Value& c) {
+    std::set<int64_t>& thresholds =
+        c.kind == Value::Kind::STACK ? stack_thresholds_ : const_thresholds_;
+    if (thresholds.size() >= kMaxThresholds)
+      return;
+    thresholds.insert(SatAdd(c.lo, -1));
+    thresholds.insert(c.lo);
+    thresholds.insert(SatAdd(c.lo, 1));
+  }
+
+  // Joins next into prev, widening the bounds of the registers growing from
+  // prev to the nearest compared constant, or to infinity if there is none.
+  // Thresholds are finite in number, so the states at a block only grow a
+  // bounded number of times.
+  State Widen(const State& prev, const State& next) {
+    State state = prev;
+    state.Join(next);
+    for (int r = 0; r < kNumGprs; r++) {
+      const Value& p = prev.regs[r];
+      Value& v = state.regs[r];
+      if (!p.IsInterval() || v.kind != p.kind)
+        continue;
+      const std::set<int64_t>& thresholds =
+          v.kind == Value::Kind::STACK ? stack_thresholds_ : const_thresholds_;
+      if (v.lo < p.lo) {
+        auto it = thresholds.upper_bound(v.lo);
+        v.lo = it == thresholds.begin() ? kMinusInf : *--it;
+      }
+      if (v.hi > p.hi) {
+        auto it = thresholds.lower_bound(v.hi);
+        v.hi = it == thresholds.end() ? kPlusInf : *it;
+      }
+    }
+    return state;
+  }
+
+  // Applies the transfer functions of the block's instructions. With replay
+  // set, the unknown writes of the block are resolved using the state right
+  // before the respective instruction.
+  void TransferBlock(State* state, Block* b, bool replay) {
+    std::set<Address>* writes = nullptr;
+    if (replay) {
+      auto it = s_->unknown_writes.find(b);
+      if (it != s_->unknown_writes.end())
+        writes = &it->second;
+    }
+
+    for (auto const& ins : s_->context->Instructions(b)) {
+      if (writes != nullptr && writes->count(ins.first) > 0)
+        ResolveWrite(*state, b, ins.first, ins.second, writes);
+      TransferFunction(state, b, ins.first, ins.second);
+    }
+  }
+
+  Value Evaluate(const State& state, Block* b, Address addr,
+                 const Expression::Ptr& expr, Value* address = nullptr) {
+    if (expr == nullptr)
+      return Value::Top();
+    ExpressionEvaluator eval(state, SPValue(b, addr));
+    expr->apply(&eval);
+    if (address != nullptr)
+      *address = eval.address();
+    return eval.result();
+  }
+
+  void TransferFunction(State* state, Block* b, Address addr,
+                        const Instruction& ins) {
+    RegisterAST* dest = AsRegister(ins.getOperand(0).getValue());
+    Gpr reg = dest == nullptr ? kNoGpr : ToGpr(dest->getID());
+
+    Value value = Value::Top();
+    bool handled = reg != kNoGpr && reg != kRsp;
+    if (handled) {
+      Value d = state->regs[reg];
+      Expression::Ptr src = ins.getOperand(1).getValue();
+      bool src_memory = ins.getOperand(1).readsMemory();
+      switch (ins.getOperation().getID()) {
+      case e_mov:
+        if (!src_memory)
+          value = Evaluate(*state, b, addr, src);
+        break;
+      case e_lea:
+        value = Evaluate(*state, b, addr, src);
+        break;
+      case e_movzx: {
+        unsigned width = src == nullptr ? 8 : src->size();
+        if (width < 8) {
+          int64_t max = (int64_t(1) << (8 * width)) - 1;
+          value = src_memory ? Value::Top() : Evaluate(*state, b, addr, src);
+          if (!value.Within(0, max))
+            value = Value::Const(0, max);
+        }
+        break;
+      }
+      case e_movsxd:
+        // Sign extension keeps non negative 32 bit values as they are.
+        if (!src_memory) {
+          value = Evaluate(*state, b, addr, src);
+          if (!value.Within(0, INT32_MAX))
+            value = Value::Top();
+        }
+        break;
+      case e_add:
+        if (!src_memory)
+          value = Add(d, Evaluate(*state, b, addr, src));
+        break;
+      case e_sub:
+        if (!src_memory)
+          value = Add(d, Neg(Evaluate(*state, b, addr, src)));
+        break;
+      case e_inc:
+        value = Add(d, Value::Const(1, 1));
+        break;
+      case e_dec:
+        value = Add(d, Value::Const(-1, -1));
+        break;
+      case e_and: {
+        Value mask = src_memory ? Value::Top() : Evaluate(*state, b, addr, src);
+        if (mask.IsSingleton() && mask.Within(0, kPlusInf)) {
+          int64_t max = mask.lo;
+          if (d.Within(0, kPlusInf))
+            max = std::min(max, d.hi);
+          value = Value::Const(0, max);
+        }
+        break;
+      }
+      case e_xor: {
+        RegisterAST* src_reg = AsRegister(src);
+        if (src_reg != nullptr && src_reg->getID() == dest->getID())
+          value = Value::Const(0, 0);
+        break;
+      }
+      case e_shl_sal: {
+        Value shift = Evaluate(*state, b, addr, src);
+        if (shift.IsSingleton() && shift.Within(0, 62))
+          value = Mul(d, Value::Const(int64_t(1) << shift.lo,
+                                      int64_t(1) << shift.lo));
+        break;
+      }
+      default:
+        handled = false;
+        break;
+      }
+    }
+
+    if (handled) {
+      state->regs[reg] = Truncate(value, dest->getID().size());
+      return;
+    }
+
+    if (ins.getCategory() == Dyninst::InstructionAPI::c_CallInsn) {
+      // Callee saved registers survive calls.
+      for (auto r : {kRax, kRcx, kRdx, kRsi, kRdi, kR8, kR9, kR10, kR11}) {
+        state->regs[r] = Value::Top();
+      }
+    }
+
+    std::set<RegisterAST::Ptr> written;
+    ins.getWriteSet(written);
+    for (auto const& w : written) {
+      Gpr r = ToGpr(w->getID());
+      if (r != kNoGpr && r != kRsp) {
+        state->regs[r] = Value::Top();
+      }
+    }
+  }
+
+  // Value of the full register after writing value to its sub register of
+  // the given width.
+  static Value Truncate(const Value& value, unsigned width) {
+    if (width == 8)
+      return value;
+    // 32 bit writes zero the upper half. Narrower writes keep it.
+    if (width == 4) {
+      const int64_t max = 0xffffffffLL;
+      return value.Within(0, max) ? value : Value::Const(0, max);
+    }
+    return Value::Top();
+  }
+
+  // Resolves the write at addr as a stack write if all the addresses it may
+  // write to are below the return address.
+  void ResolveWrite(const State& state, Block* b, Address addr,
+                    const Instruction& ins, std::set<Address>* writes) {
+    if (!IsPlainStore(ins.getOperation().getID()))
+      return;
+
+    std::vector<Dyninst::InstructionAPI::Operand> operands;
+    ins.getOperands(operands);
+
+    bool found = false;
+    for (auto& op : operands) {
+      if (!op.writesMemory())
+        continue;
+
+      Expression::Ptr expr = op.getValue();
+      if (expr == nullptr)
+        return;
+
+      Value address = Value::Top();
+      Evaluate(state, b, addr, expr, &address);
+      int64_t end = SatAdd(address.hi, expr->size());
+      if (address.kind != Value::Kind::STACK || end > -8)
+        return;
+      found = true;
+    }
+
+    if (!found)
+      return;
+
+    auto wit = s_->all_writes.find(addr);
+    if (wit != s_->all_writes.end()) {
+      wit->second->stack = true;
+      wit->second->indexed = true;
+    }
+    writes->erase(addr);
+    resolved_++;
+  }
+
+  void ResolveWrites() {
+    std::vector<Block*> resolved;
+    for (size_t i = 0; i < blocks_.size(); i++) {
+      Block* b = blocks_[i];
+      if (!in_[i].reached)
+        continue;
+
+      auto it = s_->unknown_writes.find(b);
+      if (it == s_->unknown_writes.end())
+        continue;
+
+      State state = in_[i];
+      TransferBlock(&state, b, true);
+
+      if (it->second.empty())
+        resolved.push_back(b);
+    }
+
+    for (auto b : resolved) {
+      s_->unknown_writes.erase(b);
+      if (!s_->HasUnsafeStackWrite(b))
+        s_->unsafe_blocks.erase(b);
+    }
+  }
+
+  FuncSummary* s_;
+  int resolved_ = 0;
+
+  // Blocks reachable from the function entry in reverse post order.
+  std::vector<Block*> blocks_;
+  // Index of each block of the function within blocks_. -1 for unreachable
+  // blocks.
+  std::unordered_map<Block*, int> index_;
+  std::vector<std::vector<int>> succs_;
+  // Predecessors of each block along with the kind of the connecting edge.
+  std::vector<std::vector<std::pair<int, EdgeKind>>> preds_;
+  std::vector<Branch> branches_;
+
+  // States at the entry and the exit of each block, indexed like blocks_.
+  std::vector<State> in_;
+  std::vector<State> out_;
+  std::vector<int> visits_;
+
+  // Widening thresholds collected from the compared values.
+  std::set<int64_t> const_thresholds_;
+  std::set<int64_t> stack_thresholds_;
+};
+
+}  // namespace value_set
+
+#endif  // LITECFI_VALUE_SET_H_
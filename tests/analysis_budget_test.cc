@@ -0,0 +1,120 @@
+#include <chrono>
+#include <thread>
+
+#include "src/analysis_budget.h"
+#include "tests/test_utils.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+// Overrides the budget limits for the duration of a test.
+class ScopedLimits {
+ public:
+  ScopedLimits(int32_t instructions, int32_t iterations, int32_t deadline_ms)
+      : instructions_(FLAGS_analysis_max_instructions),
+        iterations_(FLAGS_analysis_max_iterations),
+        deadline_ms_(FLAGS_analysis_deadline_ms) {
+    FLAGS_analysis_max_instructions = instructions;
+    FLAGS_analysis_max_iterations = iterations;
+    FLAGS_analysis_deadline_ms = deadline_ms;
+  }
+
+  ~ScopedLimits() {
+    FLAGS_analysis_max_instructions = instructions_;
+    FLAGS_analysis_max_iterations = iterations_;
+    FLAGS_analysis_deadline_ms = deadline_ms_;
+  }
+
+ private:
+  int32_t instructions_;
+  int32_t iterations_;
+  int32_t deadline_ms_;
+};
+
+}  // namespace
+
+TEST(AnalysisBudgetTest, TestsInstructionLimit) {
+  ScopedLimits limits(10, 0, 0);
+  AnalysisBudget budget;
+
+  EXPECT_TRUE(budget.ChargeInstructions(10));
+  EXPECT_FALSE(budget.Exhausted());
+  EXPECT_FALSE(budget.ChargeInstructions(1));
+  EXPECT_TRUE(budget.Exhausted());
+  EXPECT_EQ(budget.exceeded(), AnalysisBudget::kInstructions);
+
+  // The first exceeded limit sticks.
+  EXPECT_FALSE(budget.ChargeIterations(1000));
+  EXPECT_EQ(budget.exceeded(), AnalysisBudget::kInstructions);
+}
+
+TEST(AnalysisBudgetTest, TestsIterationLimit) {
+  ScopedLimits limits(0, 2, 0);
+  AnalysisBudget budget;
+
+  EXPECT_TRUE(budget.ChargeInstructions(1000000));
+  EXPECT_TRUE(budget.ChargeIterations(2));
+  EXPECT_FALSE(budget.ChargeIterations(1));
+  EXPECT_EQ(budget.exceeded(), AnalysisBudget::kIterations);
+  EXPECT_EQ(budget.iterations(), 3);
+}
+
+TEST(AnalysisBudgetTest, TestsDeadline) {
+  ScopedLimits limits(0, 0, 1);
+  AnalysisBudget budget;
+  {
+    AnalysisBudget::Timer timer(&budget, "First");
+    EXPECT_TRUE(budget.ChargeIterations(1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  {
+    // The deadline is shared with the earlier pass but the pass running out
+    // of it gets the blame.
+    AnalysisBudget::Timer timer(&budget, "Second");
+    EXPECT_FALSE(budget.ChargeIterations(1));
+  }
+  EXPECT_EQ(budget.exceeded(), AnalysisBudget::kDeadline);
+  EXPECT_STREQ(budget.exhausted_by(), "Second");
+  EXPECT_GE(budget.elapsed_ms(), 1.0);
+}
+
+TEST(AnalysisBudgetTest, TestsUntimedCharge) {
+  ScopedLimits limits(1, 0, 0);
+  AnalysisBudget budget;
+
+  EXPECT_FALSE(budget.ChargeInstructions(2));
+  EXPECT_EQ(budget.exceeded(), AnalysisBudget::kInstructions);
+  EXPECT_EQ(budget.exhausted_by(), nullptr);
+}
+
+TEST(AnalysisBudgetTest, TestsNoLimits) {
+  ScopedLimits limits(0, 0, 0);
+  AnalysisBudget budget;
+
+  EXPECT_TRUE(budget.ChargeInstructions(1L << 40));
+  EXPECT_TRUE(budget.ChargeIterations(1L << 40));
+  EXPECT_FALSE(budget.Exhausted());
+  EXPECT_EQ(budget.exceeded(), AnalysisBudget::kNoLimit);
+}
+
+TEST(AnalysisBudgetTest, TestsOverBudgetFunction) {
+  ScopedLimits limits(1, 0, 0);
+  auto summaries = Analyse(FixturePath("safe_leaf"));
+  FuncSummary* s = GetSummary(summaries, "safe_leaf_fn");
+  ASSERT_NE(s, nullptr);
+
+  // Functions the analyses gave up on are assumed unsafe.
+  EXPECT_TRUE(s->over_budget);
+  EXPECT_TRUE(s->assume_unsafe);
+  EXPECT_TRUE(s->writes);
+}
+
+TEST(AnalysisBudgetTest, TestsWithinBudgetFunction) {
+  auto summaries = Analyse(FixturePath("safe_leaf"));
+  FuncSummary* s = GetSummary(summaries, "safe_leaf_fn");
+  ASSERT_NE(s, nullptr);
+
+  EXPECT_FALSE(s->over_budget);
+  EXPECT_FALSE(s->assume_unsafe);
+  EXPECT_FALSE(s->writes);
+}
@@ -19,9 +19,6 @@ using Dyninst::ParseAPI::CodeObject;
 using Dyninst::ParseAPI::SymtabCodeSource;
 using std::string;
 
-DEFINE_bool(vv, false, "Log verbose output.");
-DEFINE_string(stats, "", "File to log statistics related to static anlaysis.");
-
 CodeObject *GetCodeObject(const char *binary) {
   SymtabCodeSource *sts = new SymtabCodeSource(const_cast<char *>(binary));
   CodeObject *co = new CodeObject(sts);
@@ -36,7 +33,6 @@ bool MatchName(string in_str, string matched) {
 PassManager *GetPassManager() {
   PassManager *pm = new PassManager;
   pm->AddPass(new CallGraphAnalysis())
-      ->AddPass(new LargeFunctionFilter())
       ->AddPass(new StackHeightAnalysis())
       ->AddPass(new InterProceduralMemoryAnalysis())
       ->AddPass(new CFGAnalysis())
@@ -0,0 +1,152 @@
+#include <cstdint>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "src/arena.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+// Records the order in which instances are destroyed.
+struct Tracked {
+  Tracked(std::vector<int>* log, int id) : log(log), id(id) {}
+  ~Tracked() { log->push_back(id); }
+
+  std::vector<int>* log;
+  int id;
+};
+
+struct alignas(64) Aligned {
+  char data[8];
+};
+
+struct Large {
+  char data[4096];
+};
+
+struct Counters {
+  int a;
+  long b;
+};
+
+}  // namespace
+
+TEST(ArenaTest, TestsConstructorArguments) {
+  Arena arena;
+  std::string* s = arena.New<std::string>(3, 'x');
+  EXPECT_EQ(*s, "xxx");
+
+  // Objects without constructor arguments are value initialized.
+  Counters* c = arena.New<Counters>();
+  EXPECT_EQ(c->a, 0);
+  EXPECT_EQ(c->b, 0);
+}
+
+TEST(ArenaTest, TestsAlignment) {
+  Arena arena(256);
+  for (int i = 0; i < 100; i++) {
+    arena.New<char>();
+    Aligned* a = arena.New<Aligned>();
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(a) % alignof(Aligned), 0u);
+    long* l = arena.New<long>();
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(l) % alignof(long), 0u);
+  }
+}
+
+TEST(ArenaTest, TestsDistinctObjects) {
+  Arena arena(128);
+  std::vector<long*> allocated;
+  std::set<long*> seen;
+  for (int i = 0; i < 1000; i++) {
+    long* l = arena.New<long>(i);
+    EXPECT_TRUE(seen.insert(l).second);
+    allocated.push_back(l);
+  }
+
+  // Earlier objects are left untouched by later allocations.
+  for (int i = 0; i < 1000; i++) {
+    EXPECT_EQ(*allocated[i], i);
+  }
+}
+
+TEST(ArenaTest, TestsReleaseRunsDestructorsInReverse) {
+  std::vector<int> log;
+  Arena arena;
+  for (int i = 0; i < 3; i++) {
+    arena.New<Tracked>(&log, i);
+  }
+  EXPECT_TRUE(log.empty());
+
+  arena.Release();
+  EXPECT_EQ(log, std::vector<int>({2, 1, 0}));
+  EXPECT_EQ(arena.BytesAllocated(), 0u);
+
+  // The arena is usable again after a release.
+  arena.New<Tracked>(&log, 3);
+  EXPECT_GT(arena.BytesAllocated(), 0u);
+}
+
+TEST(ArenaTest, TestsDestructorRunsOnArenaDestruction) {
+  std::vector<int> log;
+  {
+    Arena arena;
+    arena.New<Tracked>(&log, 42);
+  }
+  EXPECT_EQ(log, std::vector<int>({42}));
+}
+
+TEST(ArenaTest, TestsBytesAllocated) {
+  Arena arena(1024);
+  EXPECT_EQ(arena.BytesAllocated(), 0u);
+
+  arena.New<long>();
+  EXPECT_EQ(arena.BytesAllocated(), 1024u);
+
+  // Small objects are carved out of the current chunk.
+  for (int i = 0; i < 10; i++) {
+    arena.New<long>();
+  }
+  EXPECT_EQ(arena.BytesAllocated(), 1024u);
+}
+
+TEST(ArenaTest, TestsOversizedObjects) {
+  Arena arena(1024);
+  Large* large = arena.New<Large>();
+  ASSERT_NE(large, nullptr);
+  EXPECT_GE(arena.BytesAllocated(), sizeof(Large));
+
+  large->data[sizeof(Large) - 1] = 'x';
+  long* l = arena.New<long>(7);
+  EXPECT_EQ(*l, 7);
+  EXPECT_EQ(large->data[sizeof(Large) - 1], 'x');
+}
+
+TEST(ArenaTest, TestsConcurrentAllocation) {
+  const int n_threads = 4;
+  const int n_objects = 10000;
+  std::vector<std::vector<long*>> allocated(n_threads);
+
+  Arena arena(4096);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < n_threads; t++) {
+    threads.emplace_back([&arena, &allocated, t]() {
+      for (int i = 0; i < n_objects; i++) {
+        allocated[t].push_back(arena.New<long>(t * n_objects + i));
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  std::set<long*> seen;
+  for (int t = 0; t < n_threads; t++) {
+    for (int i = 0; i < n_objects; i++) {
+      long* l = allocated[t][i];
+      EXPECT_EQ(*l, t * n_objects + i);
+      EXPECT_TRUE(seen.insert(l).second);
+    }
+  }
+}
@@ -0,0 +1,16 @@
+
+#include <iostream>
+
+int unchanged_fn(int a, int b) {
+  return a * b + 42;
+}
+
+int changed_fn(int* x) {
+  return *x + 42;
+}
+
+int main() {
+  int x = 53;
+  std::cout << unchanged_fn(x, 2) << changed_fn(&x);
+  return 0;
+}
@@ -0,0 +1,142 @@
+#include <vector>
+
+#include "src/call_graph.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+// Functions are only used as keys and never dereferenced.
+Function* FakeFunction(int i) {
+  return reinterpret_cast<Function*>(0x1000 * (i + 1));
+}
+
+std::vector<int> ToVector(const CallGraph::Range<int>& r) {
+  return std::vector<int>(r.begin(), r.end());
+}
+
+// 0 calls 1 twice and tail calls 2. 1 and 2 call each other. 2 makes a PLT
+// call and 3 an indirect call. 4 is isolated.
+CallGraph MakeCallGraph() {
+  std::vector<Function*> funcs;
+  for (int i = 0; i < 5; i++) {
+    funcs.push_back(FakeFunction(i));
+  }
+
+  std::vector<std::vector<CallGraph::Edge>> edges(5);
+  edges[0] = {{0x10, 1, CallGraph::kCall},
+              {0x14, 1, CallGraph::kCall},
+              {0x18, 2, CallGraph::kTailCall}};
+  edges[1] = {{0x20, 2, CallGraph::kCall}};
+  edges[2] = {{0x30, 1, CallGraph::kCall}, {0x34, -1, CallGraph::kPltCall}};
+  edges[3] = {{0x40, -1, CallGraph::kIndirect}, {0x44, 0, CallGraph::kCall}};
+
+  CallGraph cg;
+  cg.Build(funcs, edges);
+  return cg;
+}
+
+}  // namespace
+
+TEST(CallGraphTest, TestsIds) {
+  CallGraph cg = MakeCallGraph();
+  ASSERT_EQ(cg.Size(), 5);
+  for (int i = 0; i < 5; i++) {
+    EXPECT_EQ(cg.GetFunction(i), FakeFunction(i));
+    EXPECT_EQ(cg.GetId(FakeFunction(i)), i);
+  }
+  EXPECT_EQ(cg.GetId(FakeFunction(5)), -1);
+}
+
+TEST(CallGraphTest, TestsEdges) {
+  CallGraph cg = MakeCallGraph();
+
+  auto edges = cg.Edges(0);
+  ASSERT_EQ(edges.size(), 3u);
+  EXPECT_EQ(edges.begin()[0].site, 0x10u);
+  EXPECT_EQ(edges.begin()[0].callee, 1);
+  EXPECT_EQ(edges.begin()[0].kind, CallGraph::kCall);
+  EXPECT_EQ(edges.begin()[2].site, 0x18u);
+  EXPECT_EQ(edges.begin()[2].callee, 2);
+  EXPECT_EQ(edges.begin()[2].kind, CallGraph::kTailCall);
+
+  edges = cg.Edges(2);
+  ASSERT_EQ(edges.size(), 2u);
+  EXPECT_EQ(edges.begin()[1].callee, -1);
+  EXPECT_EQ(edges.begin()[1].kind, CallGraph::kPltCall);
+
+  edges = cg.Edges(3);
+  ASSERT_EQ(edges.size(), 2u);
+  EXPECT_EQ(edges.begin()[0].kind, CallGraph::kIndirect);
+
+  EXPECT_TRUE(cg.Edges(4).empty());
+}
+
+TEST(CallGraphTest, TestsCallers) {
+  CallGraph cg = MakeCallGraph();
+
+  // Callers are sorted and unique, and external edges have no callee.
+  EXPECT_EQ(ToVector(cg.Callers(0)), std::vector<int>({3}));
+  EXPECT_EQ(ToVector(cg.Callers(1)), std::vector<int>({0, 2}));
+  EXPECT_EQ(ToVector(cg.Callers(2)), std::vector<int>({0, 1}));
+  EXPECT_TRUE(cg.Callers(3).empty());
+  EXPECT_TRUE(cg.Callers(4).empty());
+}
+
+TEST(CallGraphTest, TestsComponents) {
+  CallGraph cg = MakeCallGraph();
+
+  EXPECT_EQ(cg.SCCId(1), cg.SCCId(2));
+  EXPECT_NE(cg.SCCId(0), cg.SCCId(1));
+  EXPECT_NE(cg.SCCId(3), cg.SCCId(0));
+
+  // Called components have smaller ids.
+  EXPECT_LT(cg.SCCId(1), cg.SCCId(0));
+  EXPECT_LT(cg.SCCId(0), cg.SCCId(3));
+
+  EXPECT_EQ(cg.SCCLevel(1), 0);
+  EXPECT_EQ(cg.SCCLevel(2), 0);
+  EXPECT_EQ(cg.SCCLevel(4), 0);
+  EXPECT_EQ(cg.SCCLevel(0), 1);
+  EXPECT_EQ(cg.SCCLevel(3), 2);
+}
+
+TEST(CallGraphTest, TestsWaves) {
+  CallGraph cg = MakeCallGraph();
+  auto waves = cg.Waves();
+
+  ASSERT_EQ(waves.size(), 3u);
+  ASSERT_EQ(waves[0].size(), 2u);
+  // Components are ordered by component id and members by function id.
+  EXPECT_LT(cg.SCCId(waves[0][0][0]), cg.SCCId(waves[0][1][0]));
+  for (auto& scc : waves[0]) {
+    if (scc.size() == 2) {
+      EXPECT_EQ(scc, std::vector<int>({1, 2}));
+    } else {
+      EXPECT_EQ(scc, std::vector<int>({4}));
+    }
+  }
+  EXPECT_EQ(waves[1], std::vector<std::vector<int>>({{0}}));
+  EXPECT_EQ(waves[2], std::vector<std::vector<int>>({{3}}));
+}
+
+TEST(CallGraphTest, TestsRebuild) {
+  CallGraph cg = MakeCallGraph();
+
+  std::vector<std::vector<CallGraph::Edge>> edges(2);
+  edges[1] = {{0x50, 0, CallGraph::kCall}};
+  cg.Build({FakeFunction(7), FakeFunction(8)}, edges);
+
+  ASSERT_EQ(cg.Size(), 2);
+  EXPECT_EQ(cg.GetId(FakeFunction(0)), -1);
+  EXPECT_EQ(cg.GetId(FakeFunction(8)), 1);
+  EXPECT_TRUE(cg.Edges(0).empty());
+  EXPECT_EQ(ToVector(cg.Callers(0)), std::vector<int>({1}));
+  EXPECT_EQ(cg.SCCLevel(1), 1);
+}
+
+TEST(CallGraphTest, TestsEmpty) {
+  CallGraph cg;
+  cg.Build({}, {});
+  EXPECT_EQ(cg.Size(), 0);
+  EXPECT_TRUE(cg.Waves().empty());
+}
@@ -0,0 +1,24 @@
+#include <iostream>
+
+int global_int;
+
+__attribute__((noinline)) void callee_fn(int x) { global_int = x; }
+
+// Tail calls callee_fn only if x is non zero. The pop before the conditional
+// jump must preserve the flags it reads.
+extern "C" void cond_tail_call_fn(int x);
+
+asm(".text\n"
+    ".globl cond_tail_call_fn\n"
+    ".type cond_tail_call_fn, @function\n"
+    "cond_tail_call_fn:\n"
+    "  test %edi, %edi\n"
+    "  jne _Z9callee_fni\n"
+    "  ret\n"
+    ".size cond_tail_call_fn, .-cond_tail_call_fn\n");
+
+int main(int argc, char** argv) {
+  cond_tail_call_fn(argc);
+  std::cout << global_int;
+  return 0;
+}
@@ -0,0 +1,48 @@
+#include "tests/test_utils.h"
+#include "gtest/gtest.h"
+
+using Dyninst::ParseAPI::Block;
+
+namespace {
+
+bool FlagsLiveAtEnd(FuncSummary* s, Block* b) {
+  return s->flags_live_at_end.find(b->end()) != s->flags_live_at_end.end();
+}
+
+bool IsCondTailCall(Block* b) {
+  for (auto e : b->targets()) {
+    if (e->interproc() && e->type() == Dyninst::ParseAPI::COND_TAKEN)
+      return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+TEST(DeadRegisterTest, TestsConditionalTailCall) {
+  auto summaries = Analyse(FixturePath("cond_tail_call"));
+  FuncSummary* s = GetSummary(summaries, "cond_tail_call_fn");
+  ASSERT_NE(s, nullptr);
+  ASSERT_TRUE(s->flags_analyzed);
+
+  // The flags are dead after the jump, but the jump itself reads them.
+  int cond_tail_calls = 0;
+  for (auto b : s->func->blocks()) {
+    if (IsCondTailCall(b)) {
+      EXPECT_TRUE(FlagsLiveAtEnd(s, b));
+      cond_tail_calls++;
+    } else {
+      EXPECT_FALSE(FlagsLiveAtEnd(s, b));
+    }
+  }
+  EXPECT_EQ(cond_tail_calls, 1);
+}
+
+TEST(DeadRegisterTest, TestsFlagsDeadAtReturns) {
+  auto summaries = Analyse(FixturePath("cond_tail_call"));
+  FuncSummary* s = GetSummary(summaries, "callee_fn");
+  ASSERT_NE(s, nullptr);
+
+  EXPECT_TRUE(s->flags_analyzed);
+  EXPECT_TRUE(s->flags_live_at_end.empty());
+}
@@ -0,0 +1,31 @@
+#include "src/jit.h"
+#include "gtest/gtest.h"
+
+TEST(FlagsLiveAtPopTest, TestsNoSummary) {
+  EXPECT_TRUE(FlagsLiveAtPop(0x1000, nullptr));
+}
+
+TEST(FlagsLiveAtPopTest, TestsNotAnalyzed) {
+  // Functions skipped by the dead register analysis, e.g. those assumed
+  // unsafe, have no flag liveness.
+  FuncSummary s;
+  s.flags_analyzed = false;
+
+  EXPECT_TRUE(FlagsLiveAtPop(0x1000, &s));
+}
+
+TEST(FlagsLiveAtPopTest, TestsLiveAtBlockEnd) {
+  FuncSummary s;
+  s.flags_analyzed = true;
+  s.flags_live_at_end.insert(0x1000);
+
+  EXPECT_TRUE(FlagsLiveAtPop(0x1000, &s));
+  EXPECT_FALSE(FlagsLiveAtPop(0x2000, &s));
+}
+
+TEST(FlagsLiveAtPopTest, TestsDeadEverywhere) {
+  FuncSummary s;
+  s.flags_analyzed = true;
+
+  EXPECT_FALSE(FlagsLiveAtPop(0x1000, &s));
+}
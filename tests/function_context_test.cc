@@ -0,0 +1,86 @@
+#include <string>
+
+#include "CFG.h"
+#include "CodeObject.h"
+#include "stackanalysis.h"
+#include "src/function_context.h"
+#include "tests/test_utils.h"
+#include "gtest/gtest.h"
+
+using Dyninst::ParseAPI::CodeObject;
+
+namespace {
+
+Function* FindFunction(CodeObject* co, const std::string& name) {
+  std::string mangled = "_Z" + std::to_string(name.size()) + name;
+  for (auto f : co->funcs()) {
+    if (f->name() == name || f->name().compare(0, mangled.size(), mangled) == 0)
+      return f;
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+TEST(FunctionContextTest, TestsInstructionsMatchDecoder) {
+  CodeObject* co = GetCodeObject(FixturePath("safe_leaf"));
+  Function* f = FindFunction(co, "safe_leaf_fn");
+  ASSERT_NE(f, nullptr);
+
+  FunctionContext context(f);
+  for (auto b : f->blocks()) {
+    Block::Insns decoded;
+    b->getInsns(decoded);
+
+    const InsnVec& insns = context.Instructions(b);
+    ASSERT_EQ(insns.size(), decoded.size());
+
+    // Address ordered, covering the whole block.
+    auto it = decoded.begin();
+    for (auto& ins : insns) {
+      EXPECT_EQ(ins.first, it->first);
+      EXPECT_EQ(ins.second.size(), it->second.size());
+      it++;
+    }
+    EXPECT_EQ(insns.front().first, b->start());
+
+    // Decoded only once.
+    EXPECT_EQ(&context.Instructions(b), &insns);
+  }
+}
+
+TEST(FunctionContextTest, TestsStackAnalysisIsShared) {
+  CodeObject* co = GetCodeObject(FixturePath("safe_leaf"));
+  Function* f = FindFunction(co, "safe_leaf_fn");
+  ASSERT_NE(f, nullptr);
+
+  FunctionContext context(f);
+  StackAnalysis* sa = context.GetStackAnalysis();
+  ASSERT_NE(sa, nullptr);
+  EXPECT_EQ(context.GetStackAnalysis(), sa);
+}
+
+TEST(FunctionContextTest, TestsSPHeightMatchesStackAnalysis) {
+  CodeObject* co = GetCodeObject(FixturePath("safe_leaf"));
+  Function* f = FindFunction(co, "safe_leaf_fn");
+  ASSERT_NE(f, nullptr);
+
+  FunctionContext context(f);
+  StackAnalysis sa(f);
+  for (auto b : f->blocks()) {
+    for (auto& ins : context.Instructions(b)) {
+      EXPECT_EQ(context.SPHeight(b, ins.first), sa.findSP(b, ins.first));
+      // Memoized heights stay the same.
+      EXPECT_EQ(context.SPHeight(b, ins.first), sa.findSP(b, ins.first));
+    }
+    EXPECT_EQ(context.SPHeight(b, b->end()), sa.findSP(b, b->end()));
+  }
+}
+
+TEST(FunctionContextTest, TestsContextsAreFreedAfterAnalysis) {
+  auto summaries = Analyse(FixturePath("safe_leaf"));
+  ASSERT_FALSE(summaries.empty());
+  for (auto s : summaries) {
+    EXPECT_EQ(s->context, nullptr);
+  }
+}
@@ -0,0 +1,31 @@
+
+#include <cstdlib>
+#include <iostream>
+
+// Allocations are leaked on purpose, free would be an unsafe PLT call.
+int heap_write_fn(int n) {
+  int* p = (int*)malloc(sizeof(int));
+  *p = n;
+  return *p + 42;
+}
+
+int new_write_fn(int n) {
+  int* p = new int[4];
+  p[0] = n;
+  return p[0] + 42;
+}
+
+int heap_or_arg_write_fn(int* x, int n) {
+  int* p = x;
+  if (n > 0)
+    p = (int*)malloc(sizeof(int));
+  *p = n;
+  return *p + 42;
+}
+
+int main() {
+  int x = 53;
+  std::cout << heap_write_fn(x) << new_write_fn(x)
+            << heap_or_arg_write_fn(&x, x);
+  return 0;
+}
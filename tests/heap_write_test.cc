@@ -0,0 +1,75 @@
+#include <string>
+
+#include "tests/test_utils.h"
+#include "gtest/gtest.h"
+
+using std::string;
+
+namespace {
+
+size_t CountWrites(const std::map<Address, std::set<Address>>& writes) {
+  size_t n = 0;
+  for (auto& it : writes) {
+    n += it.second.size();
+  }
+  return n;
+}
+
+}  // namespace
+
+TEST(HeapWriteTest, TestsMallocWrite) {
+  auto summaries = Analyse(FixturePath("heap_write"));
+  FuncSummary* s = GetSummary(summaries, "heap_write_fn");
+  ASSERT_NE(s, nullptr);
+
+  EXPECT_EQ(CountWrites(s->heap_writes), 1u);
+  EXPECT_TRUE(s->arg_writes.empty());
+  EXPECT_TRUE(s->heap_or_arg_writes.empty());
+  EXPECT_TRUE(s->unknown_writes.empty());
+  EXPECT_TRUE(s->unsafe_blocks.empty());
+  EXPECT_TRUE(s->written_args.Empty());
+  EXPECT_FALSE(s->self_unsafe_writes);
+  EXPECT_FALSE(s->writes);
+}
+
+TEST(HeapWriteTest, TestsArrayNewWrite) {
+  auto summaries = Analyse(FixturePath("heap_write"));
+  FuncSummary* s = GetSummary(summaries, "new_write_fn");
+  ASSERT_NE(s, nullptr);
+
+  EXPECT_EQ(CountWrites(s->heap_writes), 1u);
+  EXPECT_TRUE(s->unknown_writes.empty());
+  EXPECT_TRUE(s->written_args.Empty());
+  EXPECT_FALSE(s->writes);
+}
+
+TEST(HeapWriteTest, TestsHeapOrArgWrite) {
+  auto summaries = Analyse(FixturePath("heap_write"));
+  FuncSummary* s = GetSummary(summaries, "heap_or_arg_write_fn");
+  ASSERT_NE(s, nullptr);
+
+  // The write may go through either the allocation or the first argument.
+  EXPECT_TRUE(s->heap_writes.empty());
+  EXPECT_EQ(CountWrites(s->heap_or_arg_writes), 1u);
+  EXPECT_TRUE(s->unknown_writes.empty());
+  EXPECT_EQ(s->written_args.mask(), RegisterSet({kRdi}).mask());
+  EXPECT_FALSE(s->self_unsafe_writes);
+  EXPECT_FALSE(s->writes);
+
+  // The caller passes a pointer into its own frame, which is fine.
+  s = GetSummary(summaries, "main");
+  ASSERT_NE(s, nullptr);
+  EXPECT_FALSE(s->unsafe_arg_passing);
+}
+
+TEST(HeapWriteTest, TestsArgWrite) {
+  auto summaries = Analyse(FixturePath("unsafe_leaf"));
+  FuncSummary* s = GetSummary(summaries, "unsafe_leaf_fn");
+  ASSERT_NE(s, nullptr);
+
+  EXPECT_TRUE(s->heap_writes.empty());
+  EXPECT_EQ(CountWrites(s->arg_writes), 1u);
+  EXPECT_TRUE(s->unknown_writes.empty());
+  EXPECT_EQ(s->written_args.mask(), RegisterSet({kRdi}).mask());
+  EXPECT_FALSE(s->writes);
+}
@@ -0,0 +1,27 @@
+
+#include <iostream>
+
+// Keeps the arrays alive.
+__attribute__((noinline)) int sum(const int* a, int n) {
+  int s = 0;
+  for (int i = 0; i < n; i++)
+    s += a[i];
+  return s;
+}
+
+__attribute__((noinline)) int indexed_write_fn(int i, int v) {
+  int a[16] = {0};
+  a[i & 15] = v;
+  return sum(a, 16);
+}
+
+__attribute__((noinline)) int unbounded_write_fn(int i, int v) {
+  int a[16] = {0};
+  a[i] = v;
+  return sum(a, 16);
+}
+
+int main(int argc, char** argv) {
+  std::cout << indexed_write_fn(argc, 42) << unbounded_write_fn(argc, 42);
+  return 0;
+}
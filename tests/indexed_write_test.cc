@@ -0,0 +1,84 @@
+#include "src/value_set.h"
+#include "tests/test_utils.h"
+#include "gtest/gtest.h"
+
+using value_set::kMinusInf;
+using value_set::kPlusInf;
+using value_set::Value;
+
+TEST(IndexedWriteTest, TestsValueJoin) {
+  Value v = Value::Bottom();
+  v.Join(Value::Const(1, 2));
+  EXPECT_EQ(v, Value::Const(1, 2));
+
+  v.Join(Value::Const(-3, 0));
+  EXPECT_EQ(v, Value::Const(-3, 2));
+
+  v.Join(Value::Bottom());
+  EXPECT_EQ(v, Value::Const(-3, 2));
+
+  // Integers and stack addresses do not mix.
+  v.Join(Value::Stack(-16, -16));
+  EXPECT_EQ(v, Value::Top());
+}
+
+TEST(IndexedWriteTest, TestsValueArithmetic) {
+  EXPECT_EQ(value_set::Add(Value::Stack(-80, -80), Value::Const(0, 60)),
+            Value::Stack(-80, -20));
+  EXPECT_EQ(value_set::Add(Value::Stack(-80, -80), Value::Stack(0, 0)),
+            Value::Top());
+  EXPECT_EQ(value_set::Add(Value::Const(1, kPlusInf), Value::Const(1, 1)),
+            Value::Const(2, kPlusInf));
+
+  EXPECT_EQ(value_set::Neg(Value::Const(-1, 5)), Value::Const(-5, 1));
+  EXPECT_EQ(value_set::Neg(Value::Stack(-8, -8)), Value::Top());
+
+  EXPECT_EQ(value_set::Mul(Value::Const(0, 15), Value::Const(4, 4)),
+            Value::Const(0, 60));
+  EXPECT_EQ(value_set::Mul(Value::Const(-2, 3), Value::Const(-4, 4)),
+            Value::Const(-12, 12));
+  EXPECT_EQ(value_set::Mul(Value::Const(kMinusInf, 1), Value::Const(2, 2)),
+            Value::Const(kMinusInf, 2));
+}
+
+TEST(IndexedWriteTest, TestsSaturation) {
+  EXPECT_EQ(value_set::SatAdd(kPlusInf - 1, 2), kPlusInf);
+  EXPECT_EQ(value_set::SatAdd(kMinusInf + 1, -2), kMinusInf);
+  EXPECT_EQ(value_set::SatMul(kPlusInf / 2 + 1, 2), kPlusInf);
+  EXPECT_EQ(value_set::SatMul(kPlusInf / 2 + 1, -2), kMinusInf);
+  EXPECT_EQ(value_set::SatNeg(kMinusInf), kPlusInf);
+}
+
+TEST(IndexedWriteTest, TestsMaskedIndex) {
+  auto summaries = Analyse(FixturePath("indexed_write"));
+  FuncSummary* s = GetSummary(summaries, "indexed_write_fn");
+  ASSERT_NE(s, nullptr);
+
+  // a[i & 15] stays within the array, below the return address.
+  int indexed = 0;
+  for (auto& it : s->all_writes) {
+    if (it.second->indexed) {
+      EXPECT_TRUE(it.second->stack);
+      indexed++;
+    }
+  }
+  EXPECT_EQ(indexed, 1);
+  EXPECT_TRUE(s->unknown_writes.empty());
+  EXPECT_TRUE(s->unsafe_blocks.empty());
+  EXPECT_FALSE(s->self_unsafe_writes);
+  EXPECT_FALSE(s->writes);
+}
+
+TEST(IndexedWriteTest, TestsUnboundedIndex) {
+  auto summaries = Analyse(FixturePath("indexed_write"));
+  FuncSummary* s = GetSummary(summaries, "unbounded_write_fn");
+  ASSERT_NE(s, nullptr);
+
+  // a[i] may reach the return address.
+  for (auto& it : s->all_writes) {
+    EXPECT_FALSE(it.second->indexed);
+  }
+  EXPECT_FALSE(s->unknown_writes.empty());
+  EXPECT_FALSE(s->unsafe_blocks.empty());
+  EXPECT_TRUE(s->writes);
+}
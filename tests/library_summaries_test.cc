@@ -0,0 +1,186 @@
+#include <stdlib.h>
+
+#include <fstream>
+#include <map>
+#include <string>
+
+#include "src/library_summaries.h"
+#include "tests/test_utils.h"
+#include "gtest/gtest.h"
+
+using std::string;
+
+namespace {
+
+string MakeTempDir() {
+  char dir[] = "/tmp/library_summaries_test.XXXXXX";
+  return string(mkdtemp(dir));
+}
+
+string WriteFile(const string& path, const string& contents) {
+  std::ofstream out(path, std::ios::trunc);
+  out << contents;
+  return path;
+}
+
+}  // namespace
+
+TEST(LibrarySummariesTest, TestsLoad) {
+  string path = WriteFile(MakeTempDir() + "/libfoo.summaries",
+                          "# <symbol> <writes> <exception_safe> "
+                          "<invokes_callbacks>\n"
+                          "\n"
+                          "foo 0 1 0\n"
+                          "bar 1 0 1\n"
+                          "malformed 1\n");
+
+  LibrarySummaries libraries;
+  ASSERT_TRUE(libraries.Load(path));
+  EXPECT_EQ(libraries.size(), 2u);
+
+  LibrarySummaries::Symbol foo = libraries.Lookup("foo");
+  EXPECT_FALSE(foo.writes);
+  EXPECT_TRUE(foo.exception_safe);
+  EXPECT_FALSE(foo.invokes_callbacks);
+  EXPECT_TRUE(libraries.IsSafeCall("foo"));
+
+  LibrarySummaries::Symbol bar = libraries.Lookup("bar");
+  EXPECT_TRUE(bar.writes);
+  EXPECT_FALSE(bar.exception_safe);
+  EXPECT_TRUE(bar.invokes_callbacks);
+  EXPECT_FALSE(libraries.IsSafeCall("bar"));
+
+  // Malformed lines are skipped.
+  EXPECT_FALSE(libraries.IsSafeCall("malformed"));
+}
+
+TEST(LibrarySummariesTest, TestsLoadOverwrites) {
+  string dir = MakeTempDir();
+  LibrarySummaries libraries;
+  libraries.LoadAll(WriteFile(dir + "/a.summaries", "foo 1 0 1\n") + "," +
+                    WriteFile(dir + "/b.summaries", "foo 0 1 0\n"));
+  EXPECT_EQ(libraries.size(), 1u);
+  EXPECT_TRUE(libraries.IsSafeCall("foo"));
+}
+
+TEST(LibrarySummariesTest, TestsLoadMissingFile) {
+  LibrarySummaries libraries;
+  EXPECT_FALSE(libraries.Load(MakeTempDir() + "/missing.summaries"));
+  EXPECT_EQ(libraries.size(), 0u);
+}
+
+TEST(LibrarySummariesTest, TestsLookupFallback) {
+  LibrarySummaries libraries;
+
+  // Known safe libc functions.
+  EXPECT_TRUE(libraries.IsSafeCall("malloc"));
+  EXPECT_TRUE(libraries.IsSafeCall("strlen"));
+  EXPECT_TRUE(libraries.IsSafeCall("malloc@GLIBC_2.2.5"));
+
+  // Anything else is assumed to write, throw and invoke callbacks.
+  LibrarySummaries::Symbol sym = libraries.Lookup("qsort");
+  EXPECT_TRUE(sym.writes);
+  EXPECT_FALSE(sym.exception_safe);
+  EXPECT_TRUE(sym.invokes_callbacks);
+}
+
+TEST(LibrarySummariesTest, TestsLookupStripsVersion) {
+  LibrarySummaries libraries;
+  ASSERT_TRUE(libraries.Load(
+      WriteFile(MakeTempDir() + "/libc.summaries", "memcpy 0 1 0\n")));
+
+  EXPECT_TRUE(libraries.IsSafeCall("memcpy"));
+  EXPECT_TRUE(libraries.IsSafeCall("memcpy@GLIBC_2.14"));
+  EXPECT_TRUE(libraries.Lookup("memcpy@@GLIBC_2.14").exception_safe);
+}
+
+TEST(LibrarySummariesTest, TestsSaveRoundTrip) {
+  std::map<string, LibrarySummaries::Symbol> symbols;
+  symbols["foo"] = {false, true, false};
+  symbols["bar"] = {true, false, true};
+  symbols["baz"] = {false, false, true};
+
+  string path = MakeTempDir() + "/libfoo.summaries";
+  ASSERT_TRUE(LibrarySummaries::Save(path, symbols));
+
+  LibrarySummaries libraries;
+  ASSERT_TRUE(libraries.Load(path));
+  ASSERT_EQ(libraries.size(), symbols.size());
+  for (auto& it : symbols) {
+    SCOPED_TRACE(it.first);
+    LibrarySummaries::Symbol sym = libraries.Lookup(it.first);
+    EXPECT_EQ(sym.writes, it.second.writes);
+    EXPECT_EQ(sym.exception_safe, it.second.exception_safe);
+    EXPECT_EQ(sym.invokes_callbacks, it.second.invokes_callbacks);
+  }
+}
+
+TEST(LibrarySummariesTest, TestsPltCallWithoutSummary) {
+  auto summaries = Analyse(FixturePath("plt_call_tree"));
+
+  FuncSummary* s = GetSummary(summaries, "plt_call");
+  ASSERT_NE(s, nullptr);
+  EXPECT_FALSE(s->plt_calls.empty());
+  EXPECT_TRUE(s->unsafe_plt_calls);
+  EXPECT_TRUE(s->plt_may_throw);
+  EXPECT_TRUE(s->writes);
+  EXPECT_FALSE(s->func_exception_safe);
+
+  s = GetSummary(summaries, "plt_call_tree");
+  ASSERT_NE(s, nullptr);
+  EXPECT_TRUE(s->plt_calls.empty());
+  EXPECT_TRUE(s->child_writes);
+  EXPECT_TRUE(s->writes);
+}
+
+TEST(LibrarySummariesTest, TestsPltCallWithSummary) {
+  // printf of a constant string is usually emitted as puts.
+  LibrarySummaries libraries;
+  ASSERT_TRUE(libraries.Load(WriteFile(MakeTempDir() + "/libc.summaries",
+                                       "printf 0 1 0\nputs 0 1 0\n")));
+
+  auto summaries = Analyse(FixturePath("plt_call_tree"), &libraries);
+
+  FuncSummary* s = GetSummary(summaries, "plt_call");
+  ASSERT_NE(s, nullptr);
+  EXPECT_FALSE(s->plt_calls.empty());
+  EXPECT_FALSE(s->unsafe_plt_calls);
+  EXPECT_FALSE(s->plt_may_throw);
+  EXPECT_FALSE(s->writes);
+  EXPECT_TRUE(s->func_exception_safe);
+
+  s = GetSummary(summaries, "plt_call_tree");
+  ASSERT_NE(s, nullptr);
+  EXPECT_FALSE(s->child_writes);
+  EXPECT_FALSE(s->writes);
+}
+
+TEST(LibrarySummariesTest, TestsExport) {
+  string dir = MakeTempDir();
+
+  string safe_path = dir + "/safe_leaf.summaries";
+  auto summaries = Analyse(FixturePath("safe_leaf"), nullptr, nullptr,
+                           new LibrarySummaryExport(safe_path));
+  FuncSummary* safe = GetSummary(summaries, "safe_leaf_fn");
+  ASSERT_NE(safe, nullptr);
+
+  string unsafe_path = dir + "/unsafe_leaf.summaries";
+  summaries = Analyse(FixturePath("unsafe_leaf"), nullptr, nullptr,
+                      new LibrarySummaryExport(unsafe_path));
+  FuncSummary* unsafe = GetSummary(summaries, "unsafe_leaf_fn");
+  ASSERT_NE(unsafe, nullptr);
+
+  LibrarySummaries libraries;
+  ASSERT_TRUE(libraries.Load(safe_path));
+  ASSERT_TRUE(libraries.Load(unsafe_path));
+
+  LibrarySummaries::Symbol sym = libraries.Lookup(safe->func->name());
+  EXPECT_FALSE(sym.writes);
+  EXPECT_FALSE(sym.invokes_callbacks);
+
+  // Importers do not check the pointers they pass, so writes through
+  // arguments are exported as writes.
+  sym = libraries.Lookup(unsafe->func->name());
+  EXPECT_TRUE(sym.writes);
+  EXPECT_FALSE(sym.invokes_callbacks);
+}
@@ -0,0 +1,60 @@
+#include <sys/mman.h>
+
+#include <cstdint>
+#include <cstring>
+
+#include "gtest/gtest.h"
+
+// Exported so that the runtime picks the parallel layout at start up.
+extern "C" {
+__attribute__((visibility("default"))) int __shadow_guard_parallel_layout = 1;
+
+void __shadow_guard_map_parallel_stack(void* stack, size_t size);
+}
+
+namespace {
+
+// Must match __parallel_offset in runtime.c.
+constexpr intptr_t kParallelOffset = -0x40000000L;
+
+constexpr size_t kPage = 4096;
+
+char* Mirror(char* addr) { return addr + kParallelOffset; }
+
+// Reserves an address range for made up stacks whose mirrors are unmapped.
+char* ReserveStacks(size_t size) {
+  void* addr = mmap(nullptr, size, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (addr == MAP_FAILED)
+    return nullptr;
+  return static_cast<char*>(addr);
+}
+
+}  // namespace
+
+TEST(ParallelStackTest, TestsPartiallyOverlappingStacks) {
+  char* stacks = ReserveStacks(8 * kPage);
+  ASSERT_NE(stacks, nullptr);
+
+  __shadow_guard_map_parallel_stack(stacks + 2 * kPage, 2 * kPage);
+  // Overlaps the first stack on both ends.
+  __shadow_guard_map_parallel_stack(stacks + kPage, 4 * kPage);
+  // Contained in the stacks mapped before.
+  __shadow_guard_map_parallel_stack(stacks + kPage, kPage);
+
+  for (size_t i = 1; i < 5; i++) {
+    char* mirror = Mirror(stacks + i * kPage);
+    memset(mirror, 0xab, kPage);
+    EXPECT_EQ(static_cast<unsigned char>(mirror[kPage - 1]), 0xab);
+  }
+}
+
+TEST(ParallelStackDeathTest, TestsCollision) {
+  char* taken = ReserveStacks(kPage);
+  ASSERT_NE(taken, nullptr);
+
+  // The mirror of the made up stack lands on the reserved page.
+  char* stack = taken - kParallelOffset;
+  EXPECT_DEATH(__shadow_guard_map_parallel_stack(stack, kPage),
+               "collides with another mapping");
+}
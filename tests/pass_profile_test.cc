@@ -0,0 +1,102 @@
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "src/pass_manager.h"
+#include "src/utils.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+FunctionCost Cost(Address addr, double wall_ms) {
+  FunctionCost cost;
+  cost.addr = addr;
+  cost.name = "f" + std::to_string(addr);
+  cost.wall_ms = wall_ms;
+  return cost;
+}
+
+std::vector<Address> SlowestAddresses(const PassResult& pr) {
+  std::vector<Address> addrs;
+  for (auto& cost : pr.slowest) {
+    addrs.push_back(cost.addr);
+  }
+  return addrs;
+}
+
+}  // namespace
+
+TEST(PassProfileTest, TestsSlowestKeepsCostliestFirst) {
+  FLAGS_slowest_functions = 2;
+
+  PassResult worker;
+  worker.slowest = {Cost(0x10, 1.0), Cost(0x20, 3.0), Cost(0x30, 2.0)};
+
+  PassResult pr;
+  pr.Merge(worker);
+  EXPECT_EQ(SlowestAddresses(pr), (std::vector<Address>{0x20, 0x30}));
+
+  FLAGS_slowest_functions = 10;
+}
+
+TEST(PassProfileTest, TestsTiesAreBrokenByAddress) {
+  // Merging in either order reports the same functions.
+  PassResult a;
+  a.slowest = {Cost(0x30, 1.0)};
+  PassResult b;
+  b.slowest = {Cost(0x10, 1.0)};
+
+  PassResult ab;
+  ab.Merge(a);
+  ab.Merge(b);
+  PassResult ba;
+  ba.Merge(b);
+  ba.Merge(a);
+
+  EXPECT_EQ(SlowestAddresses(ab), (std::vector<Address>{0x10, 0x30}));
+  EXPECT_EQ(SlowestAddresses(ab), SlowestAddresses(ba));
+}
+
+TEST(PassProfileTest, TestsMergeSumsCounts) {
+  PassResult a;
+  a.functions = 3;
+  a.counters["Unsafe Writes"] = 2;
+  PassResult b;
+  b.functions = 4;
+  b.counters["Unsafe Writes"] = 5;
+  b.counters["Safe Functions"] = 1;
+
+  PassResult pr;
+  pr.Merge(a);
+  pr.Merge(b);
+  EXPECT_EQ(pr.functions, 7);
+  EXPECT_EQ(pr.counters["Unsafe Writes"], 7);
+  EXPECT_EQ(pr.counters["Safe Functions"], 1);
+}
+
+TEST(PassProfileTest, TestsJsonEscape) {
+  EXPECT_EQ(JsonEscape("plain"), "plain");
+  EXPECT_EQ(JsonEscape("a\"b\\c"), "a\\\"b\\\\c");
+  EXPECT_EQ(JsonEscape("a\nb\tc"), "a\\nb\\tc");
+  EXPECT_EQ(JsonEscape(std::string("\x01", 1)), "\\u0001");
+}
+
+TEST(PassProfileTest, TestsLogJson) {
+  PassResult pr;
+  pr.name = "Heap \"Write\"";
+  pr.functions = 2;
+  pr.counters["Safe Functions"] = 1;
+  pr.slowest = {Cost(0x10, 1.5)};
+
+  std::ostringstream out;
+  pr.LogJson(out);
+  std::string json = out.str();
+
+  EXPECT_NE(json.find("\"name\": \"Heap \\\"Write\\\"\""), std::string::npos);
+  EXPECT_NE(json.find("\"functions\": 2"), std::string::npos);
+  EXPECT_NE(json.find("\"Safe Functions\": 1"), std::string::npos);
+  EXPECT_NE(json.find("\"data\": {}"), std::string::npos);
+  EXPECT_NE(json.find("{\"name\": \"f16\", \"addr\": 16, \"wall_ms\": 1.5}"),
+            std::string::npos);
+}
@@ -0,0 +1,92 @@
+#include <cstdint>
+#include <vector>
+
+#include "src/pass_manager.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+typedef std::vector<std::vector<size_t>> Waves;
+
+class FakePass : public Pass {
+ public:
+  FakePass(uint32_t reads, uint32_t writes) : Pass("Fake", "Fake pass.") {
+    Reads(reads);
+    Writes(writes);
+  }
+};
+
+// A pass which does not declare the summary fields it accesses.
+class UndeclaredPass : public Pass {
+ public:
+  UndeclaredPass() : Pass("Undeclared", "Undeclared pass.") {}
+};
+
+}  // namespace
+
+TEST(PassScheduleTest, TestsIndependentPassesShareWaves) {
+  PassManager pm;
+  pm.AddPass(new FakePass(kNoFields, kCFG))
+      ->AddPass(new FakePass(kCFG, kStackAccesses))
+      ->AddPass(new FakePass(kCFG, kDeadRegisters))
+      ->AddPass(new FakePass(kNoFields, kUnusedRegisters))
+      ->AddPass(new FakePass(kStackAccesses | kDeadRegisters, kSafePaths));
+
+  EXPECT_EQ(pm.SchedulePasses(), (Waves{{0, 3}, {1, 2}, {4}}));
+}
+
+TEST(PassScheduleTest, TestsReadersShareWaves) {
+  PassManager pm;
+  pm.AddPass(new FakePass(kCFG, kNoFields))
+      ->AddPass(new FakePass(kCFG, kNoFields));
+
+  EXPECT_EQ(pm.SchedulePasses(), (Waves{{0, 1}}));
+}
+
+TEST(PassScheduleTest, TestsWritersAreOrdered) {
+  PassManager pm;
+  pm.AddPass(new FakePass(kNoFields, kSafePaths))
+      ->AddPass(new FakePass(kNoFields, kSafePaths));
+
+  EXPECT_EQ(pm.SchedulePasses(), (Waves{{0}, {1}}));
+}
+
+TEST(PassScheduleTest, TestsReadersAfterWriters) {
+  // A later writer must not overtake an earlier reader.
+  PassManager pm;
+  pm.AddPass(new FakePass(kCFG, kNoFields))
+      ->AddPass(new FakePass(kNoFields, kCFG));
+
+  EXPECT_EQ(pm.SchedulePasses(), (Waves{{0}, {1}}));
+}
+
+TEST(PassScheduleTest, TestsSafeFunctionCountReadsWrites) {
+  // The safe function count taken after every pass reads writes, so a pass
+  // writing it runs on its own.
+  PassManager pm;
+  pm.AddPass(new FakePass(kNoFields, kCFG))
+      ->AddPass(new FakePass(kNoFields, kWrites))
+      ->AddPass(new FakePass(kNoFields, kUnusedRegisters));
+
+  EXPECT_EQ(pm.SchedulePasses(), (Waves{{0}, {1}, {2}}));
+}
+
+TEST(PassScheduleTest, TestsUndeclaredPassesAreSerialised) {
+  PassManager pm;
+  pm.AddPass(new FakePass(kNoFields, kCFG))
+      ->AddPass(new UndeclaredPass())
+      ->AddPass(new FakePass(kNoFields, kUnusedRegisters));
+
+  EXPECT_EQ(pm.SchedulePasses(), (Waves{{0}, {1}, {2}}));
+}
+
+TEST(PassScheduleTest, TestsDependsOn) {
+  FakePass cfg(kNoFields, kCFG);
+  FakePass stack(kCFG, kStackAccesses);
+  FakePass unused(kNoFields, kUnusedRegisters);
+
+  EXPECT_TRUE(PassManager::DependsOn(&stack, &cfg));
+  EXPECT_TRUE(PassManager::DependsOn(&cfg, &stack));
+  EXPECT_FALSE(PassManager::DependsOn(&unused, &cfg));
+  EXPECT_FALSE(PassManager::DependsOn(&unused, &stack));
+}
@@ -0,0 +1,51 @@
+
+#include <iostream>
+
+int global_int;
+int* global_ptr = &global_int;
+
+// The writes through global_ptr are unknown writes, hence unsafe.
+int both_unsafe_fn(int* p, int c) {
+  if (p == 0)
+    return 0;
+  if (c > 0)
+    *global_ptr = 1;
+  else
+    *global_ptr = 2;
+  return 1;
+}
+
+int one_unsafe_fn(int* p, int c) {
+  if (p == 0)
+    return 0;
+  if (c > 0)
+    *global_ptr = 1;
+  return 1;
+}
+
+// Never returns, so calls to it end the path without reaching a pop.
+__attribute__((noreturn, noinline)) void fail_fn() {
+  for (;;) {
+  }
+}
+
+int failing_path_fn(int* p, int c) {
+  if (p == 0)
+    return 0;
+  *global_ptr = 1;
+  if (c < 0)
+    fail_fn();
+  return 1;
+}
+
+int safe_fn(int a, int b) {
+  if (a > b)
+    return a;
+  return b;
+}
+
+int main(int argc, char** argv) {
+  std::cout << both_unsafe_fn(&argc, argc) << one_unsafe_fn(&argc, argc)
+            << failing_path_fn(&argc, argc) << safe_fn(argc, 42);
+  return 0;
+}
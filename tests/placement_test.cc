@@ -0,0 +1,233 @@
+#include <set>
+#include <string>
+#include <vector>
+
+#include "PatchCFG.h"
+#include "PatchObject.h"
+#include "src/placement.h"
+#include "tests/test_utils.h"
+#include "gtest/gtest.h"
+
+using Dyninst::PatchAPI::PatchBlock;
+using Dyninst::PatchAPI::PatchEdge;
+using Dyninst::PatchAPI::PatchFunction;
+using Dyninst::PatchAPI::PatchObject;
+
+namespace {
+
+typedef std::vector<std::vector<int>> Graph;
+
+std::vector<int> Idoms(const Graph& succs, int root) {
+  Graph preds(succs.size());
+  for (size_t v = 0; v < succs.size(); v++) {
+    for (auto w : succs[v]) {
+      preds[w].push_back(v);
+    }
+  }
+  return placement::ComputeIdoms(
+      succs.size(), root, [&succs](int v) { return succs[v]; },
+      [&preds](int v) { return preds[v]; });
+}
+
+// Analyses the placement fixture and returns the patch function of the named
+// function along with its summary.
+PatchFunction* GetPatchFunction(const std::string& function,
+                                FuncSummary** summary) {
+  static std::set<FuncSummary*>* summaries = nullptr;
+  static PatchObject* object = nullptr;
+  if (summaries == nullptr) {
+    summaries = new std::set<FuncSummary*>(Analyse(FixturePath("placement")));
+    object = PatchObject::create((*summaries->begin())->func->obj(), 0);
+  }
+
+  *summary = GetSummary(*summaries, function);
+  if (*summary == nullptr)
+    return nullptr;
+  return object->getFunc((*summary)->func);
+}
+
+bool IsUnsafe(FuncSummary* s, PatchBlock* b) {
+  return s->unsafe_blocks.find(b->block()) != s->unsafe_blocks.end();
+}
+
+}  // namespace
+
+TEST(PlacementTest, TestsIdomsDiamond) {
+  // 0 -> {1, 2} -> 3
+  Graph g = {{1, 2}, {3}, {3}, {}};
+  EXPECT_EQ(Idoms(g, 0), std::vector<int>({0, 0, 0, 0}));
+}
+
+TEST(PlacementTest, TestsIdomsLoop) {
+  // 0 -> 1 -> 2 -> 1, 2 -> 3, 4 unreachable
+  Graph g = {{1}, {2}, {1, 3}, {}, {3}};
+  EXPECT_EQ(Idoms(g, 0), std::vector<int>({0, 0, 1, 2, -1}));
+}
+
+TEST(PlacementTest, TestsPostDominators) {
+  // Post-dominators are the dominators of the reversed graph, rooted at the
+  // exit. 0 -> {1, 2}, 1 -> 3, 2 -> 3
+  Graph reversed = {{}, {0}, {0}, {1, 2}};
+  EXPECT_EQ(Idoms(reversed, 3), std::vector<int>({3, 3, 3, 3}));
+}
+
+TEST(PlacementTest, TestsHoistedPush) {
+  FuncSummary* s;
+  PatchFunction* f = GetPatchFunction("both_unsafe_fn", &s);
+  ASSERT_NE(f, nullptr);
+  ASSERT_FALSE(s->unsafe_blocks.empty());
+
+  placement::PushPlacement placement(f, s);
+  ASSERT_TRUE(placement.Compute([](PatchEdge*) { return true; }));
+
+  // Both branches write unsafely, so the push moves up to the branching block
+  // and the two push sites become one.
+  EXPECT_EQ(placement.hoisted(), 1);
+  ASSERT_EQ(placement.push_edges().size(), 1u);
+  PatchBlock* d = (*placement.push_edges().begin())->trg();
+  EXPECT_FALSE(IsUnsafe(s, d));
+  EXPECT_NE(d, f->entry());
+
+  EXPECT_TRUE(placement.region().count(d));
+  for (auto b : f->blocks()) {
+    if (IsUnsafe(s, b)) {
+      EXPECT_TRUE(placement.region().count(b));
+    }
+  }
+  // The early return does not need a push.
+  EXPECT_FALSE(placement.region().count(f->entry()));
+}
+
+TEST(PlacementTest, TestsPushNotHoistedOnPartialPaths) {
+  FuncSummary* s;
+  PatchFunction* f = GetPatchFunction("one_unsafe_fn", &s);
+  ASSERT_NE(f, nullptr);
+
+  placement::PushPlacement placement(f, s);
+  ASSERT_TRUE(placement.Compute([](PatchEdge*) { return true; }));
+
+  // Hoisting would add a push to the path skipping the write.
+  EXPECT_EQ(placement.hoisted(), 0);
+  ASSERT_EQ(placement.push_edges().size(), 1u);
+  EXPECT_TRUE(IsUnsafe(s, (*placement.push_edges().begin())->trg()));
+}
+
+TEST(PlacementTest, TestsPushNotHoistedToUnpushableEdges) {
+  FuncSummary* s;
+  PatchFunction* f = GetPatchFunction("both_unsafe_fn", &s);
+  ASSERT_NE(f, nullptr);
+
+  // Edges into safe blocks cannot carry a push.
+  placement::PushPlacement placement(f, s);
+  ASSERT_TRUE(placement.Compute(
+      [s](PatchEdge* e) { return IsUnsafe(s, e->trg()); }));
+
+  EXPECT_EQ(placement.hoisted(), 0);
+  EXPECT_EQ(placement.push_edges().size(), 2u);
+  for (auto e : placement.push_edges()) {
+    EXPECT_TRUE(IsUnsafe(s, e->trg()));
+  }
+}
+
+TEST(PlacementTest, TestsUnpushableEdge) {
+  FuncSummary* s;
+  PatchFunction* f = GetPatchFunction("one_unsafe_fn", &s);
+  ASSERT_NE(f, nullptr);
+
+  placement::PushPlacement placement(f, s);
+  EXPECT_FALSE(placement.Compute([](PatchEdge*) { return false; }));
+}
+
+TEST(PlacementTest, TestsRegionExcludesNonReturningPaths) {
+  FuncSummary* s;
+  PatchFunction* f = GetPatchFunction("failing_path_fn", &s);
+  ASSERT_NE(f, nullptr);
+
+  placement::PushPlacement placement(f, s);
+  ASSERT_TRUE(placement.Compute([](PatchEdge*) { return true; }));
+
+  // The call to fail_fn never returns, so its block does not need cloning.
+  PatchBlock* failing = nullptr;
+  for (auto b : f->blocks()) {
+    bool call = false;
+    bool call_ft = false;
+    for (auto e : b->targets()) {
+      call |= e->type() == Dyninst::ParseAPI::CALL;
+      call_ft |= e->type() == Dyninst::ParseAPI::CALL_FT;
+    }
+    if (call && !call_ft)
+      failing = b;
+  }
+  ASSERT_NE(failing, nullptr);
+  EXPECT_FALSE(placement.region().count(failing));
+
+  // The unsafe block and the path on to the return are cloned.
+  for (auto b : f->blocks()) {
+    if (IsUnsafe(s, b)) {
+      EXPECT_TRUE(placement.region().count(b));
+    }
+  }
+  for (auto b : f->exitBlocks()) {
+    if (b != failing) {
+      EXPECT_TRUE(placement.region().count(b));
+    }
+  }
+}
+
+TEST(PlacementTest, TestsFastPaths) {
+  FuncSummary* s;
+  PatchFunction* f = GetPatchFunction("both_unsafe_fn", &s);
+  ASSERT_NE(f, nullptr);
+
+  placement::FastPaths fp;
+  ASSERT_TRUE(placement::FindFastPaths(f, s, &fp));
+
+  // The early return is the fast path. Each unsafe branch pushes at its entry
+  // and the block joining them pops before falling into the shared epilogue.
+  ASSERT_EQ(fp.pushes.size(), 2u);
+  for (auto& push : fp.pushes) {
+    EXPECT_TRUE(IsUnsafe(s, push.first));
+    EXPECT_EQ(push.second, s->blockEntrySPHeight[push.first->start()]);
+  }
+
+  ASSERT_EQ(fp.pops.size(), 1u);
+  PatchBlock* pop = fp.pops[0].first;
+  EXPECT_FALSE(IsUnsafe(s, pop));
+  EXPECT_EQ(fp.pops[0].second, s->blockEndSPHeight[pop->start()]);
+}
+
+TEST(PlacementTest, TestsFastPathsIntoEpilogue) {
+  FuncSummary* s;
+  PatchFunction* f = GetPatchFunction("one_unsafe_fn", &s);
+  ASSERT_NE(f, nullptr);
+
+  placement::FastPaths fp;
+  ASSERT_TRUE(placement::FindFastPaths(f, s, &fp));
+
+  // The unsafe block is the whole slow path. It pops right before falling
+  // into the rest of the function, which the fast paths share.
+  ASSERT_EQ(fp.pushes.size(), 1u);
+  ASSERT_EQ(fp.pops.size(), 1u);
+  EXPECT_TRUE(IsUnsafe(s, fp.pushes[0].first));
+  EXPECT_EQ(fp.pushes[0].first, fp.pops[0].first);
+}
+
+TEST(PlacementTest, TestsNoSlowPaths) {
+  FuncSummary* s;
+  PatchFunction* f = GetPatchFunction("safe_fn", &s);
+  ASSERT_NE(f, nullptr);
+
+  placement::FastPaths fp;
+  EXPECT_FALSE(placement::FindFastPaths(f, s, &fp));
+}
+
+TEST(PlacementTest, TestsCallingEntry) {
+  FuncSummary* s;
+  PatchFunction* f = GetPatchFunction("main", &s);
+  ASSERT_NE(f, nullptr);
+
+  // The entry block calls, so there are no fast paths.
+  placement::FastPaths fp;
+  EXPECT_FALSE(placement::FindFastPaths(f, s, &fp));
+  EXPECT_TRUE(fp.pushes.empty());
+}
@@ -0,0 +1,87 @@
+#include <vector>
+
+#include "src/register_utils.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+std::vector<Gpr> Elements(RegisterSet regs) {
+  std::vector<Gpr> elements;
+  for (auto r : regs) {
+    elements.push_back(r);
+  }
+  return elements;
+}
+
+}  // namespace
+
+TEST(RegisterSetTest, TestsInsertAndErase) {
+  RegisterSet regs;
+  EXPECT_TRUE(regs.Empty());
+
+  regs.Insert(kRdi);
+  regs.Insert(kR15);
+  regs.Insert(kRdi);
+  EXPECT_EQ(regs.Size(), 2);
+  EXPECT_TRUE(regs.Contains(kRdi));
+  EXPECT_TRUE(regs.Contains(kR15));
+  EXPECT_FALSE(regs.Contains(kRax));
+
+  regs.Erase(kRdi);
+  EXPECT_FALSE(regs.Contains(kRdi));
+  EXPECT_EQ(regs.mask(), 1 << kR15);
+}
+
+TEST(RegisterSetTest, TestsNoGprIsIgnored) {
+  RegisterSet regs;
+  regs.Insert(kNoGpr);
+  EXPECT_TRUE(regs.Empty());
+  EXPECT_FALSE(regs.Contains(kNoGpr));
+}
+
+TEST(RegisterSetTest, TestsIterationOrder) {
+  RegisterSet regs = {kR12, kRax, kRsi, kR8};
+  EXPECT_EQ(Elements(regs), (std::vector<Gpr>{kRax, kRsi, kR8, kR12}));
+  EXPECT_EQ(regs.First(), kRax);
+  EXPECT_TRUE(Elements(RegisterSet()).empty());
+}
+
+TEST(RegisterSetTest, TestsSetOperations) {
+  RegisterSet a = {kRax, kRcx, kRdx};
+  RegisterSet b = {kRdx, kRbx};
+
+  EXPECT_EQ(a | b, RegisterSet({kRax, kRcx, kRdx, kRbx}));
+  EXPECT_EQ(a & b, RegisterSet({kRdx}));
+  EXPECT_EQ(a - b, RegisterSet({kRax, kRcx}));
+  EXPECT_NE(a, b);
+}
+
+TEST(RegisterSetTest, TestsAllButSp) {
+  RegisterSet regs = RegisterSet::AllButSp();
+  EXPECT_EQ(regs.Size(), kNumGprs - 1);
+  EXPECT_FALSE(regs.Contains(kRsp));
+  EXPECT_TRUE(regs.Contains(kRbp));
+  EXPECT_TRUE(regs.Contains(kR15));
+}
+
+TEST(RegisterSetTest, TestsToGprRoundTrip) {
+  for (int i = 0; i < kNumGprs; i++) {
+    Gpr r = static_cast<Gpr>(i);
+    EXPECT_EQ(ToGpr(ToMachRegister(r)), r);
+  }
+}
+
+TEST(RegisterSetTest, TestsSubRegisters) {
+  EXPECT_EQ(ToGpr(Dyninst::x86_64::eax), kRax);
+  EXPECT_EQ(ToGpr(Dyninst::x86_64::ax), kRax);
+  EXPECT_EQ(ToGpr(Dyninst::x86_64::ah), kRax);
+  EXPECT_EQ(ToGpr(Dyninst::x86_64::sil), kRsi);
+  EXPECT_EQ(ToGpr(Dyninst::x86_64::r8d), kR8);
+  EXPECT_EQ(ToGpr(Dyninst::x86_64::r15b), kR15);
+}
+
+TEST(RegisterSetTest, TestsNonGprs) {
+  EXPECT_EQ(ToGpr(Dyninst::x86_64::rip), kNoGpr);
+  EXPECT_EQ(ToGpr(Dyninst::x86_64::flags), kNoGpr);
+  EXPECT_EQ(ToGpr(Dyninst::x86_64::xmm0), kNoGpr);
+}
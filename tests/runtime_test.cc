@@ -0,0 +1,226 @@
+#include <csetjmp>
+#include <csignal>
+#include <cstdint>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+void __shadow_guard_unwind(void);
+void __shadow_guard_unwind_frame(void);
+void __shadow_guard_unwind_register(void);
+void __shadow_guard_unwind32(void);
+void __shadow_guard_unwind_frame32(void);
+void __shadow_guard_unwind_register32(void);
+}
+
+namespace {
+
+// Return addresses of made up frames. The setjmp caller is kRa1. kRa4 has
+// the same low 32 bits as kRa1.
+constexpr uint64_t kRa1 = 0x401000;
+constexpr uint64_t kRa2 = 0x402000;
+constexpr uint64_t kRa3 = 0x403000;
+constexpr uint64_t kRa4 = 0x100401000;
+
+// Stub slots for 8 byte and for 32 bit entries.
+struct Stubs {
+  int unwind;
+  int frame;
+  int reg;
+};
+
+constexpr Stubs kStubs = {0x10, 0x18, 0x20};
+constexpr Stubs kStubs32 = {0x28, 0x30, 0x38};
+
+uint64_t Slot(int offset) {
+  uint64_t value;
+  asm volatile("mov %%gs:(%1), %0" : "=r"(value) : "r"((uint64_t)offset));
+  return value;
+}
+
+char* ShadowTop() {
+  return reinterpret_cast<char*>(Slot(0));
+}
+
+void SetShadowTop(char* top) {
+  asm volatile("mov %0, %%gs:0x0" : : "r"(top) : "memory");
+}
+
+template <typename Entry>
+void ShadowPush(uint64_t value) {
+  char* top = ShadowTop();
+  *reinterpret_cast<Entry*>(top) = static_cast<Entry>(value);
+  SetShadowTop(top + sizeof(Entry));
+}
+
+// Calls the stub in slot the way the inserted pops do. Steps over the red
+// zone, since the call pushes onto the stack of this function. Checks that
+// the stub preserves the registers.
+void CallStub(int slot, uint64_t arg) {
+  uint64_t rax = 0x1111, rcx = 0x2222, rdx = 0x3333;
+  asm volatile(
+      "sub $0x80, %%rsp\n\t"
+      "push %3\n\t"
+      "call *%%gs:(%4)\n\t"
+      "add $0x80, %%rsp\n\t"
+      : "+a"(rax), "+c"(rcx), "+d"(rdx)
+      : "r"(arg), "r"((uint64_t)slot)
+      : "memory", "cc");
+  EXPECT_EQ(rax, 0x1111);
+  EXPECT_EQ(rcx, 0x2222);
+  EXPECT_EQ(rdx, 0x3333);
+}
+
+// Inline part of a stack pop: pops the top entry and only calls the unwind
+// stub on a mismatch.
+template <typename Entry>
+void Pop(uint64_t ra, const Stubs& stubs) {
+  char* top = ShadowTop() - sizeof(Entry);
+  SetShadowTop(top);
+  if (*reinterpret_cast<Entry*>(top) != static_cast<Entry>(ra))
+    CallStub(stubs.unwind, ra);
+}
+
+std::jmp_buf env;
+
+template <typename Entry>
+void Throw() {
+  // Frames of kRa2 and kRa3 get skipped by the longjmp.
+  ShadowPush<Entry>(kRa2);
+  ShadowPush<Entry>(kRa3);
+  std::longjmp(env, 1);
+}
+
+template <typename Entry>
+void UnwindThroughLongjmp(const Stubs& stubs) {
+  char* base = ShadowTop();
+  ShadowPush<Entry>(kRa1);
+  if (setjmp(env) == 0) {
+    Throw<Entry>();
+  }
+
+  // Returning to kRa1 unwinds the entries of the skipped frames.
+  Pop<Entry>(kRa1, stubs);
+  EXPECT_EQ(ShadowTop(), base);
+}
+
+template <typename Entry>
+void UnwindFrame(const Stubs& stubs) {
+  char* base = ShadowTop();
+  uint64_t ra = kRa1;
+  uint64_t ra_addr = reinterpret_cast<uint64_t>(&ra);
+  ShadowPush<Entry>(kRa1);
+  ShadowPush<Entry>(ra_addr);
+  // A later frame with the same return address but another frame.
+  ShadowPush<Entry>(kRa1);
+  ShadowPush<Entry>(ra_addr + 0x100);
+  ShadowPush<Entry>(kRa2);
+  ShadowPush<Entry>(ra_addr + 0x200);
+
+  SetShadowTop(ShadowTop() - 2 * sizeof(Entry));
+  CallStub(stubs.frame, ra_addr);
+  EXPECT_EQ(ShadowTop(), base);
+}
+
+template <typename Entry>
+void UnwindRegister(const Stubs& stubs) {
+  char* base = ShadowTop();
+  ShadowPush<Entry>(kRa1);
+  ShadowPush<Entry>(kRa2);
+
+  // Register frames keep the top entry in a register, so nothing has been
+  // popped from the shadow stack yet.
+  CallStub(stubs.reg, kRa1);
+  EXPECT_EQ(ShadowTop(), base);
+}
+
+template <typename Entry>
+void Mismatch(const Stubs& stubs) {
+  ShadowPush<Entry>(kRa1);
+  ShadowPush<Entry>(kRa2);
+  Pop<Entry>(kRa3, stubs);
+}
+
+template <typename Entry>
+void FrameMismatch(const Stubs& stubs) {
+  uint64_t ra = kRa1;
+  ShadowPush<Entry>(kRa1);
+  ShadowPush<Entry>(reinterpret_cast<uint64_t>(&ra) + 0x100);
+  SetShadowTop(ShadowTop() - 2 * sizeof(Entry));
+  CallStub(stubs.frame, reinterpret_cast<uint64_t>(&ra));
+}
+
+}  // namespace
+
+TEST(RuntimeTest, TestsStubSlots) {
+  EXPECT_EQ(Slot(0x10), reinterpret_cast<uint64_t>(__shadow_guard_unwind));
+  EXPECT_EQ(Slot(0x18),
+            reinterpret_cast<uint64_t>(__shadow_guard_unwind_frame));
+  EXPECT_EQ(Slot(0x20),
+            reinterpret_cast<uint64_t>(__shadow_guard_unwind_register));
+  EXPECT_EQ(Slot(0x28), reinterpret_cast<uint64_t>(__shadow_guard_unwind32));
+  EXPECT_EQ(Slot(0x30),
+            reinterpret_cast<uint64_t>(__shadow_guard_unwind_frame32));
+  EXPECT_EQ(Slot(0x38),
+            reinterpret_cast<uint64_t>(__shadow_guard_unwind_register32));
+}
+
+TEST(RuntimeTest, TestsMatchingPop) {
+  char* base = ShadowTop();
+  ShadowPush<uint64_t>(kRa1);
+  Pop<uint64_t>(kRa1, kStubs);
+  EXPECT_EQ(ShadowTop(), base);
+}
+
+TEST(RuntimeTest, TestsUnwindThroughLongjmp) {
+  UnwindThroughLongjmp<uint64_t>(kStubs);
+}
+
+TEST(RuntimeTest, TestsUnwindThroughLongjmp32) {
+  UnwindThroughLongjmp<uint32_t>(kStubs32);
+}
+
+TEST(RuntimeTest, TestsUnwindFrame) {
+  UnwindFrame<uint64_t>(kStubs);
+}
+
+TEST(RuntimeTest, TestsUnwindFrame32) {
+  UnwindFrame<uint32_t>(kStubs32);
+}
+
+TEST(RuntimeTest, TestsUnwindRegister) {
+  UnwindRegister<uint64_t>(kStubs);
+}
+
+TEST(RuntimeTest, TestsUnwindRegister32) {
+  UnwindRegister<uint32_t>(kStubs32);
+}
+
+TEST(RuntimeTest, TestsCompactEntriesCompareLowHalves) {
+  // 32 bit entries only hold the low halves of the addresses.
+  char* base = ShadowTop();
+  ShadowPush<uint32_t>(kRa4);
+  ShadowPush<uint32_t>(kRa2);
+  Pop<uint32_t>(kRa1, kStubs32);
+  EXPECT_EQ(ShadowTop(), base);
+}
+
+TEST(RuntimeDeathTest, TestsMismatch) {
+  EXPECT_EXIT(Mismatch<uint64_t>(kStubs), ::testing::KilledBySignal(SIGILL),
+              "");
+}
+
+TEST(RuntimeDeathTest, TestsMismatch32) {
+  EXPECT_EXIT(Mismatch<uint32_t>(kStubs32),
+              ::testing::KilledBySignal(SIGILL), "");
+}
+
+TEST(RuntimeDeathTest, TestsFrameMismatch) {
+  EXPECT_EXIT(FrameMismatch<uint64_t>(kStubs),
+              ::testing::KilledBySignal(SIGILL), "");
+}
+
+TEST(RuntimeDeathTest, TestsFrameMismatch32) {
+  EXPECT_EXIT(FrameMismatch<uint32_t>(kStubs32),
+              ::testing::KilledBySignal(SIGILL), "");
+}
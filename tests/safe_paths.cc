@@ -0,0 +1,87 @@
+#include <iostream>
+
+int global_int;
+int* global_ptr = &global_int;
+
+// The write through global_ptr is an unknown write, hence unsafe.
+void unsafe_fn() { *global_ptr = 1; }
+
+int safe_callee_fn(int a) { return a + 1; }
+
+int diamond_fn(int a) {
+  int r;
+  if (a > 0)
+    r = safe_callee_fn(a);
+  else
+    r = 2;
+  return r;
+}
+
+int one_unsafe_fn(int a) {
+  if (a > 0)
+    unsafe_fn();
+  return a;
+}
+
+int all_unsafe_fn(int a) {
+  unsafe_fn();
+  return a;
+}
+
+int loop_fn(int n) {
+  int s = 0;
+  for (int i = 0; i < n; i++)
+    s += i;
+  return s;
+}
+
+// 2^33 paths.
+int many_paths_fn(long a) {
+  int x = 0;
+#define BRANCH(k) \
+  if (a & (1L << k)) \
+    x++;
+  BRANCH(0) BRANCH(1) BRANCH(2) BRANCH(3) BRANCH(4) BRANCH(5) BRANCH(6)
+  BRANCH(7) BRANCH(8) BRANCH(9) BRANCH(10) BRANCH(11) BRANCH(12) BRANCH(13)
+  BRANCH(14) BRANCH(15) BRANCH(16) BRANCH(17) BRANCH(18) BRANCH(19) BRANCH(20)
+  BRANCH(21) BRANCH(22) BRANCH(23) BRANCH(24) BRANCH(25) BRANCH(26) BRANCH(27)
+  BRANCH(28) BRANCH(29) BRANCH(30) BRANCH(31) BRANCH(32)
+#undef BRANCH
+  return x;
+}
+
+// Dense enough to be compiled into a jump table.
+int switch_fn(int a) {
+  int r;
+  switch (a) {
+  case 0: r = 3; break;
+  case 1: r = 5; break;
+  case 2: r = 7; break;
+  case 3: r = 11; break;
+  case 4: r = 13; break;
+  case 5: r = 17; break;
+  default: r = 1; break;
+  }
+  return r;
+}
+
+int unsafe_switch_fn(int a) {
+  int r;
+  switch (a) {
+  case 0: r = 3; break;
+  case 1: r = 5; break;
+  case 2: unsafe_fn(); r = 7; break;
+  case 3: r = 11; break;
+  case 4: r = 13; break;
+  case 5: r = 17; break;
+  default: r = 1; break;
+  }
+  return r;
+}
+
+int main(int argc, char** argv) {
+  std::cout << diamond_fn(argc) << one_unsafe_fn(argc) << all_unsafe_fn(argc)
+            << loop_fn(argc) << many_paths_fn(argc) << switch_fn(argc)
+            << unsafe_switch_fn(argc);
+  return 0;
+}
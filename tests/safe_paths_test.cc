@@ -0,0 +1,48 @@
+#include <limits>
+#include <set>
+#include <string>
+
+#include "tests/test_utils.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+int SafePaths(const std::string& function) {
+  static std::set<FuncSummary*>* summaries = nullptr;
+  if (summaries == nullptr) {
+    summaries = new std::set<FuncSummary*>(Analyse(FixturePath("safe_paths")));
+  }
+
+  FuncSummary* s = GetSummary(*summaries, function);
+  EXPECT_NE(s, nullptr) << function;
+  return s == nullptr ? -1 : s->safe_paths;
+}
+
+}  // namespace
+
+TEST(SafePathsTest, TestsDiamond) { EXPECT_EQ(SafePaths("diamond_fn"), 2); }
+
+TEST(SafePathsTest, TestsUnsafeBranchIsSkipped) {
+  EXPECT_EQ(SafePaths("one_unsafe_fn"), 1);
+}
+
+TEST(SafePathsTest, TestsNoSafePaths) {
+  EXPECT_EQ(SafePaths("all_unsafe_fn"), 0);
+}
+
+TEST(SafePathsTest, TestsLoopIsASingleNode) {
+  EXPECT_EQ(SafePaths("loop_fn"), 1);
+}
+
+TEST(SafePathsTest, TestsCountSaturates) {
+  EXPECT_EQ(SafePaths("many_paths_fn"), std::numeric_limits<int>::max());
+}
+
+TEST(SafePathsTest, TestsJumpTable) {
+  // Six cases and the default.
+  EXPECT_EQ(SafePaths("switch_fn"), 7);
+}
+
+TEST(SafePathsTest, TestsUnsafeJumpTableCase) {
+  EXPECT_EQ(SafePaths("unsafe_switch_fn"), 6);
+}
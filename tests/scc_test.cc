@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "src/call_graph.h"
+#include "src/scc.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+typedef std::map<int, std::vector<int>> Graph;
+
+std::vector<std::vector<int>> SCCs(const Graph& g) {
+  std::vector<int> nodes;
+  for (auto& it : g) {
+    nodes.push_back(it.first);
+  }
+  auto sccs = ComputeSCCs(nodes, [&g](int n) { return g.at(n); });
+  for (auto& scc : sccs) {
+    std::sort(scc.begin(), scc.end());
+  }
+  return sccs;
+}
+
+// Returns the position of the component holding n.
+int Position(const std::vector<std::vector<int>>& sccs, int n) {
+  for (size_t i = 0; i < sccs.size(); i++) {
+    if (std::find(sccs[i].begin(), sccs[i].end(), n) != sccs[i].end())
+      return i;
+  }
+  return -1;
+}
+
+// Builds a call graph over fake functions. The functions are never
+// dereferenced.
+CallGraph MakeCallGraph(const Graph& g) {
+  std::vector<Function*> funcs;
+  std::vector<std::vector<CallGraph::Edge>> edges;
+  for (auto& it : g) {
+    funcs.push_back(reinterpret_cast<Function*>(0x1000 * (it.first + 1)));
+    std::vector<CallGraph::Edge> out;
+    for (auto callee : it.second) {
+      out.push_back({0, callee, CallGraph::kCall});
+    }
+    edges.push_back(out);
+  }
+
+  CallGraph cg;
+  cg.Build(funcs, edges);
+  return cg;
+}
+
+}  // namespace
+
+TEST(SCCTest, TestsAcyclic) {
+  // 0 -> 1 -> 2, 0 -> 2
+  Graph g = {{0, {1, 2}}, {1, {2}}, {2, {}}};
+  auto sccs = SCCs(g);
+  ASSERT_EQ(sccs.size(), 3u);
+  EXPECT_EQ(sccs[0], std::vector<int>({2}));
+  EXPECT_EQ(sccs[1], std::vector<int>({1}));
+  EXPECT_EQ(sccs[2], std::vector<int>({0}));
+}
+
+TEST(SCCTest, TestsCycles) {
+  // 0 -> {1 <-> 2} -> {3 -> 4 -> 5 -> 3}, 0 -> 6, 6 -> 6
+  Graph g = {{0, {1, 6}}, {1, {2}}, {2, {1, 3}}, {3, {4}},
+             {4, {5}},    {5, {3}}, {6, {6}}};
+  auto sccs = SCCs(g);
+  ASSERT_EQ(sccs.size(), 4u);
+
+  EXPECT_EQ(sccs[Position(sccs, 1)], std::vector<int>({1, 2}));
+  EXPECT_EQ(sccs[Position(sccs, 3)], std::vector<int>({3, 4, 5}));
+  EXPECT_EQ(sccs[Position(sccs, 6)], std::vector<int>({6}));
+
+  // Callees come before their callers.
+  EXPECT_LT(Position(sccs, 3), Position(sccs, 1));
+  EXPECT_LT(Position(sccs, 1), Position(sccs, 0));
+  EXPECT_LT(Position(sccs, 6), Position(sccs, 0));
+  EXPECT_EQ(Position(sccs, 0), 3);
+}
+
+TEST(SCCTest, TestsUnknownSuccessorsIgnored) {
+  std::vector<int> nodes = {0, 1};
+  auto sccs = ComputeSCCs(nodes, [](int n) {
+    return n == 0 ? std::vector<int>({1, 42}) : std::vector<int>({0, 43});
+  });
+  ASSERT_EQ(sccs.size(), 1u);
+  std::sort(sccs[0].begin(), sccs[0].end());
+  EXPECT_EQ(sccs[0], std::vector<int>({0, 1}));
+}
+
+TEST(SCCTest, TestsDeepChain) {
+  // Deep enough to overflow the native stack with a recursive formulation.
+  const int n = 200000;
+  std::vector<int> nodes(n);
+  for (int i = 0; i < n; i++) {
+    nodes[i] = i;
+  }
+  auto sccs = ComputeSCCs(nodes, [n](int i) {
+    return i + 1 < n ? std::vector<int>({i + 1}) : std::vector<int>();
+  });
+
+  ASSERT_EQ(sccs.size(), static_cast<size_t>(n));
+  for (int i = 0; i < n; i++) {
+    ASSERT_EQ(sccs[i], std::vector<int>({n - 1 - i}));
+  }
+}
+
+TEST(SCCTest, TestsSolveBottomUp) {
+  Graph g = {{0, {1, 3}}, {1, {2}}, {2, {1, 4}}, {3, {4}}, {4, {}}, {5, {0}}};
+  CallGraph cg = MakeCallGraph(g);
+
+  for (int threads : {1, 4}) {
+    SCOPED_TRACE(threads);
+    int32_t analysis_threads = FLAGS_analysis_threads;
+    FLAGS_analysis_threads = threads;
+
+    std::mutex mu;
+    std::vector<int> order;
+    std::map<int, int> solved_at;
+    SolveBottomUp(cg, [&](const std::vector<int>& scc) {
+      std::lock_guard<std::mutex> lock(mu);
+      for (auto id : scc) {
+        EXPECT_EQ(solved_at.count(id), 0u);
+        solved_at[id] = order.size();
+      }
+      order.push_back(scc[0]);
+    });
+    FLAGS_analysis_threads = analysis_threads;
+
+    ASSERT_EQ(solved_at.size(), g.size());
+    // Members of a cycle are solved together.
+    EXPECT_EQ(solved_at[1], solved_at[2]);
+    // Callees outside of the component are solved first.
+    for (auto& it : g) {
+      for (auto callee : it.second) {
+        if (cg.SCCId(callee) != cg.SCCId(it.first)) {
+          EXPECT_LT(solved_at[callee], solved_at[it.first]);
+        }
+      }
+    }
+  }
+}
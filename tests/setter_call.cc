@@ -0,0 +1,72 @@
+
+#include <cstdlib>
+#include <iostream>
+
+int global_int;
+int* global_ptr = &global_int;
+
+void set_fn(int* p, int v) { *p = v; }
+
+// Optimized so that the writes address the argument directly.
+__attribute__((noinline, optimize("O1"))) void set_at_fn(int* p, int i,
+                                                         int v) {
+  p[i] = v;
+}
+
+__attribute__((noinline, optimize("O1"))) void set_far_fn(int* p, int v) {
+  p[8] = v;
+}
+
+int stack_arg_fn() {
+  int x;
+  set_fn(&x, 42);
+  return x;
+}
+
+int heap_arg_fn() {
+  int* p = (int*)malloc(sizeof(int));
+  set_fn(p, 42);
+  return *p;
+}
+
+int forwarded_arg_fn(int* p) {
+  set_fn(p, 42);
+  return *p;
+}
+
+// The loaded pointer may point anywhere, including to the return address.
+int escaping_arg_fn() {
+  int* p = global_ptr;
+  set_fn(p, 42);
+  return *p;
+}
+
+// The index may reach past the buffer, up to the return address.
+int indexed_arg_fn(int i) {
+  int x[2];
+  set_at_fn(x, i, 42);
+  return x[0];
+}
+
+// The write lands past the buffer, above the return address.
+int far_arg_fn() {
+  int x[2];
+  set_far_fn(x, 42);
+  return x[0];
+}
+
+// The pointer passed on is computed with arithmetic, so it may point
+// anywhere.
+int offset_arg_fn(int* p) {
+  set_far_fn(p + 2, 42);
+  return *p;
+}
+
+int main() {
+  int x = 53;
+  int buf[16] = {};
+  std::cout << stack_arg_fn() << heap_arg_fn() << forwarded_arg_fn(&x)
+            << escaping_arg_fn() << indexed_arg_fn(x) << far_arg_fn()
+            << offset_arg_fn(buf);
+  return 0;
+}
@@ -0,0 +1,127 @@
+#include "tests/test_utils.h"
+#include "gtest/gtest.h"
+
+TEST(SetterCallTest, TestsSetter) {
+  auto summaries = Analyse(FixturePath("setter_call"));
+  FuncSummary* s = GetSummary(summaries, "set_fn");
+  ASSERT_NE(s, nullptr);
+
+  // Writes through the argument are left to the callers.
+  EXPECT_EQ(s->written_args.mask(), RegisterSet({kRdi}).mask());
+  EXPECT_TRUE(s->unknown_writes.empty());
+  EXPECT_FALSE(s->self_unsafe_writes);
+  EXPECT_FALSE(s->writes);
+}
+
+TEST(SetterCallTest, TestsStackPointer) {
+  auto summaries = Analyse(FixturePath("setter_call"));
+  FuncSummary* s = GetSummary(summaries, "stack_arg_fn");
+  ASSERT_NE(s, nullptr);
+
+  EXPECT_TRUE(s->written_args.Empty());
+  EXPECT_FALSE(s->unsafe_arg_passing);
+  EXPECT_TRUE(s->unsafe_blocks.empty());
+  EXPECT_FALSE(s->child_writes);
+  EXPECT_FALSE(s->writes);
+}
+
+TEST(SetterCallTest, TestsHeapPointer) {
+  auto summaries = Analyse(FixturePath("setter_call"));
+  FuncSummary* s = GetSummary(summaries, "heap_arg_fn");
+  ASSERT_NE(s, nullptr);
+
+  EXPECT_TRUE(s->written_args.Empty());
+  EXPECT_FALSE(s->unsafe_arg_passing);
+  EXPECT_TRUE(s->unsafe_blocks.empty());
+  EXPECT_FALSE(s->writes);
+}
+
+TEST(SetterCallTest, TestsForwardedPointer) {
+  auto summaries = Analyse(FixturePath("setter_call"));
+  FuncSummary* s = GetSummary(summaries, "forwarded_arg_fn");
+  ASSERT_NE(s, nullptr);
+
+  // The argument is passed on, so checking it is left to the callers.
+  EXPECT_EQ(s->written_args.mask(), RegisterSet({kRdi}).mask());
+  EXPECT_FALSE(s->unsafe_arg_passing);
+  EXPECT_FALSE(s->writes);
+}
+
+TEST(SetterCallTest, TestsEscapingPointer) {
+  auto summaries = Analyse(FixturePath("setter_call"));
+  FuncSummary* s = GetSummary(summaries, "escaping_arg_fn");
+  ASSERT_NE(s, nullptr);
+
+  EXPECT_TRUE(s->written_args.Empty());
+  EXPECT_TRUE(s->unsafe_arg_passing);
+  EXPECT_FALSE(s->unsafe_blocks.empty());
+  EXPECT_TRUE(s->writes);
+
+  // Callers of an unsafe function are unsafe.
+  s = GetSummary(summaries, "main");
+  ASSERT_NE(s, nullptr);
+  EXPECT_FALSE(s->unsafe_arg_passing);
+  EXPECT_TRUE(s->child_writes);
+}
+
+TEST(SetterCallTest, TestsExtents) {
+  auto summaries = Analyse(FixturePath("setter_call"));
+  FuncSummary* s = GetSummary(summaries, "set_fn");
+  ASSERT_NE(s, nullptr);
+  EXPECT_EQ(s->arg_extents[kRdi], 4);
+
+  s = GetSummary(summaries, "set_far_fn");
+  ASSERT_NE(s, nullptr);
+  EXPECT_EQ(s->written_args.mask(), RegisterSet({kRdi}).mask());
+  EXPECT_EQ(s->arg_extents[kRdi], 36);
+  EXPECT_FALSE(s->writes);
+
+  // Forwarding at no offset keeps the extent.
+  s = GetSummary(summaries, "forwarded_arg_fn");
+  ASSERT_NE(s, nullptr);
+  EXPECT_EQ(s->arg_extents[kRdi], 4);
+}
+
+TEST(SetterCallTest, TestsIndexedWrite) {
+  auto summaries = Analyse(FixturePath("setter_call"));
+  FuncSummary* s = GetSummary(summaries, "set_at_fn");
+  ASSERT_NE(s, nullptr);
+
+  // Indexed writes may go anywhere past the argument.
+  EXPECT_TRUE(s->written_args.Empty());
+  EXPECT_TRUE(s->arg_writes.empty());
+  EXPECT_FALSE(s->unknown_writes.empty());
+  EXPECT_TRUE(s->writes);
+
+  s = GetSummary(summaries, "indexed_arg_fn");
+  ASSERT_NE(s, nullptr);
+  EXPECT_TRUE(s->child_writes);
+  EXPECT_TRUE(s->writes);
+}
+
+TEST(SetterCallTest, TestsWriteAboveReturnAddress) {
+  auto summaries = Analyse(FixturePath("setter_call"));
+  FuncSummary* s = GetSummary(summaries, "far_arg_fn");
+  ASSERT_NE(s, nullptr);
+
+  // The callee's extent reaches past the return address of the caller.
+  EXPECT_TRUE(s->written_args.Empty());
+  EXPECT_TRUE(s->unsafe_arg_passing);
+  EXPECT_FALSE(s->unsafe_blocks.empty());
+  EXPECT_TRUE(s->writes);
+
+  // A write within the passed local is fine.
+  s = GetSummary(summaries, "stack_arg_fn");
+  ASSERT_NE(s, nullptr);
+  EXPECT_FALSE(s->unsafe_arg_passing);
+}
+
+TEST(SetterCallTest, TestsArithmeticPointer) {
+  auto summaries = Analyse(FixturePath("setter_call"));
+  FuncSummary* s = GetSummary(summaries, "offset_arg_fn");
+  ASSERT_NE(s, nullptr);
+
+  EXPECT_TRUE(s->written_args.Empty());
+  EXPECT_TRUE(s->unsafe_arg_passing);
+  EXPECT_TRUE(s->writes);
+}
@@ -0,0 +1,108 @@
+#include <map>
+#include <string>
+
+#include "src/jit.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+SnippetKey Key(SnippetOp op) {
+  SnippetKey key;
+  key.op = op;
+  key.tmp1 = 1;
+  key.tmp2 = 2;
+  key.tmp1_saved = false;
+  key.tmp2_saved = true;
+  key.sp_offset = 8;
+  key.save_flags = false;
+  key.validate_frame = false;
+  key.compact_entries = false;
+  key.parallel = false;
+  key.dry_run = "";
+  return key;
+}
+
+void ExpectOrdered(const SnippetKey& a, const SnippetKey& b) {
+  EXPECT_FALSE(a == b);
+  EXPECT_NE(a < b, b < a);
+}
+
+}  // namespace
+
+TEST(SnippetKeyTest, TestsEqualKeys) {
+  SnippetKey a = Key(SnippetOp::kStackPush);
+  SnippetKey b = Key(SnippetOp::kStackPush);
+  EXPECT_TRUE(a == b);
+  EXPECT_FALSE(a < b);
+  EXPECT_FALSE(b < a);
+}
+
+TEST(SnippetKeyTest, TestsEveryFieldDistinguishesKeys) {
+  SnippetKey base = Key(SnippetOp::kStackPush);
+
+  SnippetKey k = base;
+  k.op = SnippetOp::kStackPop;
+  ExpectOrdered(base, k);
+
+  k = base;
+  k.tmp1 = 3;
+  ExpectOrdered(base, k);
+
+  k = base;
+  k.tmp2 = 3;
+  ExpectOrdered(base, k);
+
+  k = base;
+  k.tmp1_saved = true;
+  ExpectOrdered(base, k);
+
+  k = base;
+  k.tmp2_saved = false;
+  ExpectOrdered(base, k);
+
+  k = base;
+  k.sp_offset = 16;
+  ExpectOrdered(base, k);
+
+  k = base;
+  k.save_flags = true;
+  ExpectOrdered(base, k);
+
+  k = base;
+  k.validate_frame = true;
+  ExpectOrdered(base, k);
+
+  k = base;
+  k.compact_entries = true;
+  ExpectOrdered(base, k);
+
+  k = base;
+  k.parallel = true;
+  ExpectOrdered(base, k);
+
+  k = base;
+  k.dry_run = "empty";
+  ExpectOrdered(base, k);
+}
+
+TEST(SnippetKeyTest, TestsOrderingIsTransitive) {
+  SnippetKey a = Key(SnippetOp::kStackPush);
+  SnippetKey b = a;
+  b.tmp1 = 2;
+  SnippetKey c = a;
+  c.op = SnippetOp::kRegisterPush;
+
+  EXPECT_TRUE(a < b);
+  EXPECT_TRUE(b < c);
+  EXPECT_TRUE(a < c);
+}
+
+TEST(SnippetKeyTest, TestsEqualKeysShareMapEntry) {
+  std::map<SnippetKey, int> snippets;
+  snippets[Key(SnippetOp::kStackPush)]++;
+  snippets[Key(SnippetOp::kStackPush)]++;
+  snippets[Key(SnippetOp::kStackPop)]++;
+
+  EXPECT_EQ(snippets.size(), 2);
+  EXPECT_EQ(snippets[Key(SnippetOp::kStackPush)], 2);
+}
@@ -0,0 +1,209 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <set>
+#include <string>
+
+#include "src/summary_cache.h"
+#include "tests/test_utils.h"
+#include "gtest/gtest.h"
+
+using std::string;
+
+namespace {
+
+// Creates a fresh temporary directory for the cache files of a test.
+string MakeTempDir() {
+  char dir[] = "/tmp/summary_cache_test.XXXXXX";
+  return string(mkdtemp(dir));
+}
+
+// Copies the binary to path, so that different fixtures can be analysed under
+// the same object name.
+void CopyFile(const string& from, const string& to) {
+  std::ifstream in(from, std::ios::binary);
+  std::ofstream out(to, std::ios::binary | std::ios::trunc);
+  out << in.rdbuf();
+}
+
+// Marks the summary of the named function as uncacheable, as a time limit
+// would.
+class MarkUncacheable : public Pass {
+ public:
+  explicit MarkUncacheable(const string& function)
+      : Pass("Mark Uncacheable", "Marks a summary as uncacheable."),
+        function_(function) {}
+
+  void RunGlobalAnalysis(CodeObject* co,
+                         std::map<Function*, FuncSummary*>& summaries,
+                         PassResult* result) override {
+    for (auto& it : summaries) {
+      if (it.first->name() == function_)
+        it.second->uncacheable = true;
+    }
+  }
+
+ private:
+  string function_;
+};
+
+std::set<FuncSummary*> AnalyseCached(const string& dir, const string& binary,
+                                     long* hits, long* misses,
+                                     Pass* last_pass = nullptr) {
+  SummaryCache cache(dir, binary);
+  cache.Load();
+  std::set<FuncSummary*> summaries =
+      Analyse(binary, nullptr, &cache, last_pass);
+  *hits = cache.hits();
+  *misses = cache.misses();
+  return summaries;
+}
+
+void ExpectSameSummary(FuncSummary* a, FuncSummary* b) {
+  ASSERT_NE(a, nullptr);
+  ASSERT_NE(b, nullptr);
+  EXPECT_EQ(a->assume_unsafe, b->assume_unsafe);
+  EXPECT_EQ(a->self_unsafe_writes, b->self_unsafe_writes);
+  EXPECT_EQ(a->child_writes, b->child_writes);
+  EXPECT_EQ(a->writes, b->writes);
+  EXPECT_EQ(a->func_exception_safe, b->func_exception_safe);
+  EXPECT_EQ(a->safe_paths, b->safe_paths);
+  EXPECT_EQ(a->all_writes.size(), b->all_writes.size());
+  EXPECT_EQ(a->stack_writes.size(), b->stack_writes.size());
+  EXPECT_EQ(a->unsafe_blocks.size(), b->unsafe_blocks.size());
+  EXPECT_EQ(a->dead_at_entry.mask(), b->dead_at_entry.mask());
+  EXPECT_EQ(a->flags_analyzed, b->flags_analyzed);
+  EXPECT_EQ(a->flags_live_at_end, b->flags_live_at_end);
+  EXPECT_EQ(a->unused_regs.mask(), b->unused_regs.mask());
+  EXPECT_EQ(a->written_args.mask(), b->written_args.mask());
+  for (auto r : a->written_args) {
+    EXPECT_EQ(a->arg_extents[r], b->arg_extents[r]);
+  }
+}
+
+}  // namespace
+
+TEST(SummaryCacheTest, TestsRoundTrip) {
+  string dir = MakeTempDir();
+  string binary = FixturePath("unsafe_non_leaf");
+
+  long hits, misses;
+  auto fresh = AnalyseCached(dir, binary, &hits, &misses);
+  EXPECT_EQ(hits, 0);
+  EXPECT_GT(misses, 0);
+
+  auto cached = AnalyseCached(dir, binary, &hits, &misses);
+  EXPECT_GT(hits, 0);
+  EXPECT_EQ(misses, 0);
+
+  for (string function : {"unsafe_non_leaf_fn", "non_leaf_fn", "ns_leaf_fn"}) {
+    SCOPED_TRACE(function);
+    FuncSummary* s = GetSummary(cached, function);
+    ASSERT_NE(s, nullptr);
+    EXPECT_TRUE(s->cached);
+    ExpectSameSummary(GetSummary(fresh, function), s);
+  }
+}
+
+TEST(SummaryCacheTest, TestsInvalidation) {
+  string dir = MakeTempDir();
+  string binary = dir + "/cache_test";
+
+  long hits, misses;
+  CopyFile(FixturePath("cache_v1"), binary);
+  auto v1 = AnalyseCached(dir, binary, &hits, &misses);
+  FuncSummary* s = GetSummary(v1, "changed_fn");
+  ASSERT_NE(s, nullptr);
+  EXPECT_TRUE(s->written_args.Empty());
+
+  // Same object name, different code for changed_fn.
+  CopyFile(FixturePath("cache_v2"), binary);
+  auto v2 = AnalyseCached(dir, binary, &hits, &misses);
+  EXPECT_GT(hits, 0);
+  EXPECT_GT(misses, 0);
+
+  s = GetSummary(v2, "unchanged_fn");
+  ASSERT_NE(s, nullptr);
+  EXPECT_TRUE(s->cached);
+
+  s = GetSummary(v2, "changed_fn");
+  ASSERT_NE(s, nullptr);
+  EXPECT_FALSE(s->cached);
+  EXPECT_TRUE(s->written_args.Contains(kRdi));
+}
+
+TEST(SummaryCacheTest, TestsCorruptCacheFile) {
+  string dir = MakeTempDir();
+  string binary = FixturePath("safe_leaf");
+
+  {
+    std::ofstream out(dir + "/safe_leaf.summaries", std::ios::trunc);
+    out << "not a summary cache";
+  }
+
+  long hits, misses;
+  auto summaries = AnalyseCached(dir, binary, &hits, &misses);
+  EXPECT_EQ(hits, 0);
+  EXPECT_GT(misses, 0);
+
+  FuncSummary* s = GetSummary(summaries, "safe_leaf_fn");
+  ASSERT_NE(s, nullptr);
+  EXPECT_FALSE(s->cached);
+  EXPECT_FALSE(s->writes);
+
+  // The corrupt file is replaced by a valid one.
+  AnalyseCached(dir, binary, &hits, &misses);
+  EXPECT_GT(hits, 0);
+  EXPECT_EQ(misses, 0);
+}
+
+TEST(SummaryCacheTest, TestsOverBudgetNotCached) {
+  string dir = MakeTempDir();
+  string binary = FixturePath("safe_non_leaf");
+
+  int32_t max_instructions = FLAGS_analysis_max_instructions;
+  FLAGS_analysis_max_instructions = 1;
+
+  long hits, misses;
+  auto summaries = AnalyseCached(dir, binary, &hits, &misses);
+  FuncSummary* s = GetSummary(summaries, "leaf_fn");
+  ASSERT_NE(s, nullptr);
+  EXPECT_TRUE(s->over_budget);
+
+  FLAGS_analysis_max_instructions = max_instructions;
+
+  // Summaries computed under the tiny budget must not be reused.
+  summaries = AnalyseCached(dir, binary, &hits, &misses);
+  s = GetSummary(summaries, "leaf_fn");
+  ASSERT_NE(s, nullptr);
+  EXPECT_FALSE(s->cached);
+  EXPECT_FALSE(s->over_budget);
+  EXPECT_FALSE(s->writes);
+}
+
+TEST(SummaryCacheTest, TestsUncacheableCallersNotCached) {
+  string dir = MakeTempDir();
+  string binary = FixturePath("safe_non_leaf");
+
+  long hits, misses;
+  AnalyseCached(dir, binary, &hits, &misses, new MarkUncacheable("leaf_fn"));
+
+  // The summaries of the callers were derived from the uncacheable one.
+  auto summaries = AnalyseCached(dir, binary, &hits, &misses);
+  EXPECT_GT(hits, 0);
+  for (auto name : {"leaf_fn", "non_leaf_fn", "safe_non_leaf_fn", "main"}) {
+    FuncSummary* s = GetSummary(summaries, name);
+    ASSERT_NE(s, nullptr);
+    EXPECT_FALSE(s->cached) << name;
+  }
+
+  // Now that nothing timed out, all of them are cached.
+  summaries = AnalyseCached(dir, binary, &hits, &misses);
+  EXPECT_EQ(misses, 0);
+  for (auto name : {"leaf_fn", "non_leaf_fn", "safe_non_leaf_fn", "main"}) {
+    FuncSummary* s = GetSummary(summaries, name);
+    ASSERT_NE(s, nullptr);
+    EXPECT_TRUE(s->cached) << name;
+  }
+}
@@ -0,0 +1,35 @@
+#include <iostream>
+
+int global_array[4];
+int global_int;
+int* global_ptr = &global_int;
+
+// The pointer arithmetic loses the heap write analysis, but the target still
+// reduces to a constant address.
+int global_write_fn(int v) {
+  int* p = global_array;
+  p += 2;
+  *p = v;
+  return global_array[2];
+}
+
+// Reduces to a slot within the frame of the function.
+int frame_write_fn(int v) {
+  int a[4] = {0, 0, 0, 0};
+  int* p = a;
+  p += 1;
+  *p = v;
+  return a[1];
+}
+
+// The pointer is loaded from memory, so the target stays unknown.
+int unresolved_write_fn(int v) {
+  *global_ptr = v;
+  return v;
+}
+
+int main(int argc, char** argv) {
+  std::cout << global_write_fn(argc) << frame_write_fn(argc)
+            << unresolved_write_fn(argc);
+  return 0;
+}
@@ -0,0 +1,70 @@
+#include <set>
+#include <string>
+
+#include "tests/test_utils.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+FuncSummary* Summary(const std::string& function) {
+  static std::set<FuncSummary*>* summaries = nullptr;
+  if (summaries == nullptr) {
+    summaries =
+        new std::set<FuncSummary*>(Analyse(FixturePath("symbolic_write")));
+  }
+  return GetSummary(*summaries, function);
+}
+
+// Returns the write resolved by symbolic evaluation, i.e. the write through
+// the pointer.
+MemoryWrite* ResolvedWrite(FuncSummary* s) {
+  for (auto& it : s->all_writes) {
+    if (it.second->resolved)
+      return it.second;
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+TEST(SymbolicWriteTest, TestsGlobalTarget) {
+  FuncSummary* s = Summary("global_write_fn");
+  ASSERT_NE(s, nullptr);
+
+  EXPECT_TRUE(s->unknown_writes.empty());
+  EXPECT_TRUE(s->unsafe_blocks.empty());
+  EXPECT_FALSE(s->writes);
+
+  MemoryWrite* w = ResolvedWrite(s);
+  ASSERT_NE(w, nullptr);
+  EXPECT_EQ(w->defines.size(), 1u);
+  EXPECT_TRUE(w->global);
+  EXPECT_FALSE(w->stack);
+}
+
+TEST(SymbolicWriteTest, TestsFrameTarget) {
+  FuncSummary* s = Summary("frame_write_fn");
+  ASSERT_NE(s, nullptr);
+
+  EXPECT_TRUE(s->unknown_writes.empty());
+  EXPECT_TRUE(s->unsafe_blocks.empty());
+  EXPECT_FALSE(s->writes);
+
+  MemoryWrite* w = ResolvedWrite(s);
+  ASSERT_NE(w, nullptr);
+  EXPECT_FALSE(w->global);
+  EXPECT_TRUE(w->stack);
+
+  // The write got a height below the return address.
+  auto it = s->stack_heights.find(w->addr);
+  ASSERT_NE(it, s->stack_heights.end());
+  EXPECT_LT(it->second.dest, -8);
+}
+
+TEST(SymbolicWriteTest, TestsUnresolvedTarget) {
+  FuncSummary* s = Summary("unresolved_write_fn");
+  ASSERT_NE(s, nullptr);
+
+  EXPECT_FALSE(s->unknown_writes.empty());
+  EXPECT_TRUE(s->writes);
+}
@@ -0,0 +1,17 @@
+#include "gflags/gflags.h"
+
+// Flags declared by the analysis library. These are defined by the cfi
+// binary in the tool proper.
+DEFINE_bool(vv, false, "Log verbose output.");
+DEFINE_int32(analysis_threads, 1, "Number of local analysis threads.");
+DEFINE_bool(parallel_passes, false,
+            "Run independent analysis passes concurrently.");
+DEFINE_int32(slowest_functions, 10, "Number of costliest functions to report.");
+DEFINE_int32(analysis_max_instructions, 5000000,
+             "Per function analysis instruction budget.");
+DEFINE_int32(analysis_max_iterations, 1000000,
+             "Per function analysis iteration budget.");
+DEFINE_int32(analysis_deadline_ms, 0, "Per function analysis deadline.");
+DEFINE_int32(symbolic_deadline_ms, 0,
+             "Per function symbolic write resolution deadline.");
+DEFINE_string(stats, "", "File to log statistics related to static anlaysis.");
@@ -0,0 +1,82 @@
+#ifndef LITECFI_TEST_UTILS_H_
+#define LITECFI_TEST_UTILS_H_
+
+#include <set>
+#include <string>
+
+#include "CodeObject.h"
+#include "CodeSource.h"
+#include "src/library_summaries.h"
+#include "src/pass_manager.h"
+#include "src/passes.h"
+#include "src/summary_cache.h"
+
+// Test fixture binaries are built next to the tests.
+inline std::string FixturePath(const std::string& name) {
+  return "bazel-bin/tests/" + name;
+}
+
+inline Dyninst::ParseAPI::CodeObject* GetCodeObject(const std::string& binary) {
+  Dyninst::ParseAPI::SymtabCodeSource* sts =
+      new Dyninst::ParseAPI::SymtabCodeSource(
+          const_cast<char*>(binary.c_str()));
+  Dyninst::ParseAPI::CodeObject* co = new Dyninst::ParseAPI::CodeObject(sts);
+  co->parse();
+  co->adjustJumpTableRange();
+  return co;
+}
+
+// Returns the summary of the named function. Fixtures are C++, so mangled
+// names of free functions match as well.
+inline FuncSummary* GetSummary(const std::set<FuncSummary*>& summaries,
+                               const std::string& function) {
+  std::string mangled = "_Z" + std::to_string(function.size()) + function;
+  for (auto s : summaries) {
+    const std::string& name = s->func->name();
+    if (name == function || name.compare(0, mangled.size(), mangled) == 0) {
+      return s;
+    }
+  }
+  return nullptr;
+}
+
+// Runs the analysis pipeline of the instrumenter over the binary. PLT calls are
+// resolved against the given library summaries and summaries are restored from
+// and saved to the given cache, if any. last_pass, if given, runs after the
+// rest of the pipeline.
+//
+// The code object and the analysis arena are leaked so that the summaries stay
+// valid for the rest of the test.
+inline std::set<FuncSummary*> Analyse(
+    const std::string& binary, const LibrarySummaries* libraries = nullptr,
+    SummaryCache* cache = nullptr, Pass* last_pass = nullptr) {
+  PassManager* pm = new PassManager(new Arena);
+  pm->AddPass(new CallGraphAnalysis(libraries));
+  if (cache != nullptr) {
+    pm->AddPass(new SummaryCacheLookup(cache));
+  }
+  pm->AddPass(new StackHeightAnalysis())
+      ->AddPass(new CFGAnalysis())
+      ->AddPass(new IndexedStackWriteAnalysis())
+      ->AddPass(new HeapWriteAnalysis())
+      ->AddPass(new SymbolicWriteResolution())
+      ->AddPass(new ArgumentWriteAnalysis())
+      ->AddPass(new InterProceduralMemoryAnalysis())
+      ->AddPass(new FunctionExceptionAnalysis())
+      ->AddPass(new UnsafeCallBlockAnalysis())
+      ->AddPass(new SafePathsCounting())
+      ->AddPass(new DeadRegisterAnalysis())
+      ->AddPass(new UnusedRegisterAnalysis())
+      ->AddPass(new BlockDeadRegisterAnalysis());
+  if (last_pass != nullptr) {
+    pm->AddPass(last_pass);
+  }
+  std::set<FuncSummary*> summaries = pm->Run(GetCodeObject(binary));
+
+  if (cache != nullptr) {
+    cache->Save(summaries);
+  }
+  return summaries;
+}
+
+#endif  // LITECFI_TEST_UTILS_H_
@@ -0,0 +1,102 @@
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "src/thread_pool.h"
+#include "gtest/gtest.h"
+
+TEST(ThreadPoolTest, TestsEveryTaskRunsOnce) {
+  WorkStealingPool pool(4);
+  const size_t n_tasks = 1000;
+
+  std::vector<std::atomic<int>> runs(n_tasks);
+  for (auto& r : runs) {
+    r = 0;
+  }
+
+  pool.ParallelFor(n_tasks, [&](int worker, size_t task) { runs[task]++; });
+
+  for (size_t i = 0; i < n_tasks; i++) {
+    EXPECT_EQ(runs[i], 1) << "task " << i;
+  }
+}
+
+TEST(ThreadPoolTest, TestsWorkerIds) {
+  WorkStealingPool pool(3);
+  ASSERT_EQ(pool.Size(), 3);
+
+  std::mutex mu;
+  std::set<int> workers;
+  pool.ParallelFor(100, [&](int worker, size_t task) {
+    std::lock_guard<std::mutex> lock(mu);
+    workers.insert(worker);
+  });
+
+  ASSERT_FALSE(workers.empty());
+  EXPECT_GE(*workers.begin(), 0);
+  EXPECT_LT(*workers.rbegin(), pool.Size());
+}
+
+TEST(ThreadPoolTest, TestsCallerIsWorkerZero) {
+  WorkStealingPool pool(1);
+  std::thread::id caller = std::this_thread::get_id();
+
+  pool.ParallelFor(10, [&](int worker, size_t task) {
+    EXPECT_EQ(worker, 0);
+    EXPECT_EQ(std::this_thread::get_id(), caller);
+  });
+}
+
+TEST(ThreadPoolTest, TestsNoTasks) {
+  WorkStealingPool pool(4);
+  std::atomic<int> runs(0);
+
+  pool.ParallelFor(0, [&](int worker, size_t task) { runs++; });
+  EXPECT_EQ(runs, 0);
+}
+
+TEST(ThreadPoolTest, TestsMoreWorkersThanTasks) {
+  WorkStealingPool pool(8);
+  std::vector<std::atomic<int>> runs(3);
+  for (auto& r : runs) {
+    r = 0;
+  }
+
+  pool.ParallelFor(runs.size(), [&](int worker, size_t task) { runs[task]++; });
+
+  for (auto& r : runs) {
+    EXPECT_EQ(r, 1);
+  }
+}
+
+TEST(ThreadPoolTest, TestsSkewedTasksAreStolen) {
+  // Worker 0 starts out with the only expensive task in its chunk. The rest of
+  // its chunk should be picked up by the other workers in the meantime.
+  WorkStealingPool pool(2);
+  std::atomic<bool> slow_done(false);
+  std::atomic<int> ran_while_slow(0);
+
+  pool.ParallelFor(64, [&](int worker, size_t task) {
+    if (task == 31) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      slow_done = true;
+      return;
+    }
+    if (task < 31 && !slow_done)
+      ran_while_slow++;
+  });
+
+  EXPECT_GT(ran_while_slow, 0);
+}
+
+TEST(ThreadPoolTest, TestsNonPositiveSize) {
+  WorkStealingPool pool(0);
+  EXPECT_EQ(pool.Size(), 1);
+
+  std::atomic<int> runs(0);
+  pool.ParallelFor(5, [&](int worker, size_t task) { runs++; });
+  EXPECT_EQ(runs, 5);
+}